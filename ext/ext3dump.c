@@ -13,341 +13,482 @@
  * If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <getopt.h>
 #include <fcntl.h>
 #include <stdint.h>
-#include <math.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 
-// Standard ext3 constants
-#define SUPER_BLOCK_SIZE	1024
-#define MAX_BLOCK_SIZE		8192
-#define MAX_INODE_SIZE		1024
-#define GDT_ENTRY_SIZE		32
-
-// File system specific variables
-int INODE_SIZE;			// Inode size
-int BLOCK_SIZE;			// Block size
-int INODE_PER_GROUP;		// Number of inodes per block group
-int BLOCKS_PER_GROUP;		// Number of blocks per block group
-int TOTAL_BLOCKS;		// Total number of blocks in file system
-int GDT_SIZE;			// Gblobal Descriptor Table size
-int RESERVE_GDT;		// Number of blocks reserved for GDT
-int SUPERBLOCK_SIZE;		// Superblock size in bytes
-int FIRST_BLOCK;		// Block number of the first block
-
-int fs;				// The /dev entry for the file system
+#include "extimg.h"
+#include "extfile.h"
+#include "extindex.h"
+#include "extdir.h"
+#include "exttree.h"
+#include "extfree.h"
+#include "extstore.h"
+#include "extcsum.h"
+#include "extcarve.h"
+#include "extjournal.h"
+
+static void usage(void)
+{
+	printf("\nUsage : ext3dump [-o <output>] [-x <index>] [filename] [/dev/sda1]\n"
+			"        ext3dump [-o <output>] [-x <index>] [/dev/sda1] [/path/in/fs]\n"
+			"        ext3dump [-o <output>] [-x <index>] -i <inode> [/dev/sda1]\n"
+			"        ext3dump -s <index> [-t <threads>] [/dev/sda1]\n"
+			"        ext3dump -F [-G] [-N] [-t <threads>] [/dev/sda1]\n"
+			"        ext3dump -V [-t <threads>] [/dev/sda1]\n"
+			"        ext3dump -c <dir> [-m <file>] [-N] [-t <threads>] [/dev/sda1]\n"
+			"        ext3dump -S <store> -C <snapshot> [/dev/sda1]\n"
+			"        ext3dump -S <store> [options] [snapshot] [/path/in/fs]\n\n"
+			"  -o, --output <file>  Write the whole file data to file,\n"
+			"                       - for stdout\n"
+			"  -i, --inode <inode>  Dump an inode by number, the file\n"
+			"                       system does not need to be mounted\n"
+			"  -r, --recursive <dir> Extract the directory and all below\n"
+			"                       it into dir\n"
+			"  -R, --readers <n>    Parallel readers for -r (default 4)\n"
+			"  -W, --writers <n>    Parallel writers for -r (default 4)\n"
+			"  -U, --unsorted       Read in tree order instead of block\n"
+			"                       order with -r\n"
+			"  -s, --scan <index>   Scan all inode tables and write an\n"
+			"                       index of every inode to file\n"
+			"  -F, --free           Report free space and fragmentation\n"
+			"  -G, --groups         Print the counts of every group\n"
+			"                       with -F\n"
+			"  -N, --no-files       Only read bitmaps with -F, skip the\n"
+			"                       inode tables and file fragmentation,\n"
+			"                       with -c skip deleted inodes\n"
+			"  -V, --verify-metadata Check the checksums of all group\n"
+			"                       descriptors, bitmaps and inodes\n"
+			"  -c, --carve <dir>    Recover deleted files from the free\n"
+			"                       space and inode tables into dir\n"
+			"  -m, --magic <file>   Headers and footers of the file types\n"
+			"                       to carve, see ext3dump_README.txt\n"
+			"  -t, --threads <n>    Threads for --scan, --free,\n"
+			"                       --verify-metadata and --carve\n"
+			"                       (default: cpus)\n"
+			"  -x, --index <index>  Take the file size and block map from\n"
+			"                       an index written by --scan\n"
+			"  -M, --no-mmap        Read the file system with pread()\n"
+			"                       instead of mapping it\n"
+			"  -J, --no-journal     Read the file system as it is on\n"
+			"                       disk, without the committed\n"
+			"                       transactions in its journal\n"
+			"  -S, --store <dir>    Block store, the file system is read\n"
+			"                       from a snapshot in it\n"
+			"  -C, --capture <name> Capture the device into the store\n"
+			"                       given by -S as snapshot name\n\n");
+}
 
-int inode_table_addr;
+// Checksum errors, device reads and the hit rate of the block cache
+static void print_stats(struct ext_fs *fs)
+{
+	struct ext_cache_stats cs;
+	struct blkio_stats io;
+
+	ext_csum_print(fs);
+	blkio_stats_get(&fs->io, &io);
+	if (io.reads > 0) {
+		printf("Device reads : %llu requests, %.1f MB, latency p50/p99 "
+				"%.2f/%.2f ms", (unsigned long long)io.reads,
+				io.bytes / 1e6,
+				blkio_lat_percentile(&io.lat, 0.50) / 1e6,
+				blkio_lat_percentile(&io.lat, 0.99) / 1e6);
+		if (io.short_reads || io.errors)
+			printf(", %llu short, %llu failed",
+					(unsigned long long)io.short_reads,
+					(unsigned long long)io.errors);
+		printf("\n");
+	}
+	ext_cache_stats(fs, &cs);
+	if (cs.hits + cs.misses == 0)
+		return;
+	printf("Block cache : %llu hits, %llu misses (%.1f%% hits), "
+			"%llu blocks read ahead\n", (unsigned long long)cs.hits,
+			(unsigned long long)cs.misses,
+			100.0 * cs.hits / (cs.hits + cs.misses),
+			(unsigned long long)cs.readahead);
+}
 
-// Function prototypes
-int init_fs(void);
-int read_gdt(int);
-int check_superblock(int);
+/*
+ * A device or image, or a snapshot with a store. A journal that needs
+ * recovery is replayed in memory, a broken one is left out.
+ */
+static int open_fs(struct ext_fs *fs, const char *store, const char *device,
+		int use_mmap, int journal)
+{
+	if (store) {
+		if (ext_open_snap(fs, store, device) < 0)
+			return -1;
+	} else if (ext_open(fs, device, use_mmap) < 0) {
+		return -1;
+	}
+	if (journal && ext_journal_load(fs) < 0)
+		printf("Reading the file system without its journal\n");
+	return 0;
+}
 
 int main(int argc, char *argv[])
 {
-	int fd;
-	int i = 0, c = 0;
+	int fd, out = -1;
 	struct stat filestat;
-	int inode_number, blk_grp_number;
-	int inode_grp_offset;
-	int superblock_present;
-	int offset;
-	int filesize;
-
-	uint32_t data32;
-	uint16_t data16;
-
-	// Setting up buffers
-	unsigned char blk[MAX_BLOCK_SIZE];
-	unsigned char blk_bitmap[MAX_BLOCK_SIZE];
-	unsigned char inode_bitmap[MAX_BLOCK_SIZE];
-	unsigned char inode[MAX_INODE_SIZE];
-
-	if (argc < 3) {
-		printf("\nUsage : fileblock [filename] [/dev/sda1]\n\n");
-		return 1;
+	struct ext_fs fs;
+	const struct ext_inode_disk *inode = NULL;
+	const struct ext_group *gd;
+	const unsigned char *blk;
+	uint32_t inode_number, blk_grp_number, flags, block0;
+	uint64_t filesize, inode_grp_offset;
+	struct block_map map = { NULL, 0, 0 };
+	struct ext_idx idx = { 0 };
+	const struct ext_idx_entry *entry = NULL;
+	const char *output = NULL, *scan = NULL, *index = NULL, *device;
+	const char *path = NULL, *recursive = NULL, *store = NULL, *capture = NULL;
+	struct ext_tree_opts topts = { 4, 4, 0 };
+	struct ext_dir_stats dstats = { 0, 0, 0 };
+	struct ext_free_opts fopts = { 1, 0, 1 };
+	struct ext_carve_opts copts = { NULL, NULL, 1, 1 };
+	int use_mmap = 1, journal = 1, nthreads, n, report = 0, verify = 0;
+	int opt, ret = 1;
+	char *end;
+
+	static const struct option long_opts[] = {
+		{ "output", required_argument, NULL, 'o' },
+		{ "inode", required_argument, NULL, 'i' },
+		{ "recursive", required_argument, NULL, 'r' },
+		{ "readers", required_argument, NULL, 'R' },
+		{ "writers", required_argument, NULL, 'W' },
+		{ "unsorted", no_argument, NULL, 'U' },
+		{ "scan", required_argument, NULL, 's' },
+		{ "free", no_argument, NULL, 'F' },
+		{ "groups", no_argument, NULL, 'G' },
+		{ "no-files", no_argument, NULL, 'N' },
+		{ "verify-metadata", no_argument, NULL, 'V' },
+		{ "carve", required_argument, NULL, 'c' },
+		{ "magic", required_argument, NULL, 'm' },
+		{ "threads", required_argument, NULL, 't' },
+		{ "index", required_argument, NULL, 'x' },
+		{ "no-mmap", no_argument, NULL, 'M' },
+		{ "no-journal", no_argument, NULL, 'J' },
+		{ "store", required_argument, NULL, 'S' },
+		{ "capture", required_argument, NULL, 'C' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+
+	// Showing upto max first 1024 bytes plus a \0
+	char data[1025];
+
+	inode_number = 0;
+	nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	while ((opt = getopt_long(argc, argv, "o:i:r:R:W:Us:FGNVc:m:t:x:MJS:C:h", long_opts, NULL)) != -1) {
+		switch (opt) {
+		case 'o':
+			output = optarg;
+			break;
+		case 'i':
+			inode_number = strtoul(optarg, &end, 10);
+			if (*end != '\0' || inode_number == 0) {
+				printf("Invalid inode number %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'r':
+			recursive = optarg;
+			break;
+		case 'R':
+		case 'W':
+			n = atoi(optarg);
+			if (n < 1 || n > 1024) {
+				printf("Invalid number of threads %s\n", optarg);
+				return 1;
+			}
+			if (opt == 'R')
+				topts.readers = n;
+			else
+				topts.writers = n;
+			break;
+		case 'U':
+			topts.unsorted = 1;
+			break;
+		case 's':
+			scan = optarg;
+			break;
+		case 'F':
+			report = 1;
+			break;
+		case 'G':
+			fopts.groups = 1;
+			break;
+		case 'N':
+			fopts.files = 0;
+			break;
+		case 'V':
+			verify = 1;
+			break;
+		case 'c':
+			copts.outdir = optarg;
+			break;
+		case 'm':
+			copts.sigfile = optarg;
+			break;
+		case 't':
+			nthreads = atoi(optarg);
+			if (nthreads < 1 || nthreads > 1024) {
+				printf("Invalid number of threads %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'x':
+			index = optarg;
+			break;
+		case 'M':
+			use_mmap = 0;
+			break;
+		case 'J':
+			journal = 0;
+			break;
+		case 'S':
+			store = optarg;
+			break;
+		case 'C':
+			capture = optarg;
+			break;
+		default:
+			usage();
+			return 1;
+		}
 	}
-
-	// Open data file
-	fd = open(argv[1], O_RDONLY);
-	if (fd < 0) {
-		printf("Error opening file\n");
+	// Without a file name only the device is given
+	if (argc - optind != ((scan || report || verify || capture ||
+					copts.outdir || inode_number) ? 1 : 2) ||
+			(capture && !store) || (copts.sigfile && !copts.outdir)) {
+		usage();
 		return 1;
 	}
-	// Open file system
-	fs = open(argv[2], O_RDONLY);
-	if (fs < 0) {
-		printf("Error opening file system\n");
-		close(fd);
-		return 1;
-	}
-	// Initialize all the file system specific structures
-	if (init_fs() != 0) {
-		printf("Error reading extfs information from super block\n");
-		close(fs); close(fd);
-		return 1;
+	device = argv[argc - 1];
+
+	if (capture) {
+		if (ext_open(&fs, device, 0) < 0)
+			return 1;
+		ret = ext_store_capture(&fs, store, capture) < 0 ? 1 : 0;
+		ext_close(&fs);
+		return ret;
 	}
 
-	// Read inode number of file
-	if (fstat(fd, &filestat) < 0) {
-		printf("Error reading inode number for a file\n");
-		close(fs); close(fd);
-		return 1;
+	/*
+	 * A device or image first and a path that is not one is a path
+	 * inside the file system, resolved without mounting it. With a
+	 * store it is always a snapshot and a path.
+	 */
+	if (!scan && !report && !verify && !copts.outdir && !inode_number &&
+			(store || (ext_probe(argv[optind]) &&
+				!ext_probe(argv[optind + 1])))) {
+		device = argv[optind];
+		path = argv[optind + 1];
 	}
 
-	inode_number = filestat.st_ino;
-	blk_grp_number = (inode_number / INODE_PER_GROUP);
-	inode_grp_offset = ((inode_number - 1) % INODE_PER_GROUP) * INODE_SIZE;
-
-	// Super block copy present in block number 0, 1 and power of 3, 5, 7
-	superblock_present = check_superblock(blk_grp_number);
-
-	printf("Inode number: %d (offset = %d)\n",
-			inode_number, inode_grp_offset);
-	printf("Block number: %d (super block = %d)\n",
-			blk_grp_number, superblock_present);
-
-	close(fd);
-
-	if (read_gdt(blk_grp_number) < 0) {
-		close(fs);
-		return 1;
+	if (nthreads < 1)
+		nthreads = 1;
+	if (scan) {
+		if (open_fs(&fs, store, device, use_mmap, journal) < 0)
+			return 1;
+		ret = ext_idx_scan(&fs, scan, nthreads) < 0 ? 1 : 0;
+		print_stats(&fs);
+		ext_close(&fs);
+		return ret;
 	}
-
-	offset = (inode_table_addr * BLOCK_SIZE) + inode_grp_offset;
-	printf("Inode table entry at : %d\n", offset);
-	if (lseek(fs, offset, 0) < 0) {
-		printf("Failed to seek to inode table entry\n");
-		close(fs);
-		return 1;
+	if (verify) {
+		if (open_fs(&fs, store, device, use_mmap, journal) < 0)
+			return 1;
+		ret = ext_csum_verify(&fs, nthreads) == 0 ? 0 : 1;
+		print_stats(&fs);
+		ext_close(&fs);
+		return ret;
 	}
-
-	// Read inode table
-	read(fs, inode, INODE_SIZE);
-
-	// Decoding inode data which in is LE format
-	// http://wiki.osdev.org/Ext2
-
-	// User id
-	data16 = inode[3];
-	data16 = (data16 << 8) | inode[2];
-	printf("User ID : %d\n", data16);
-
-	// File size
-	data32 = inode[7];
-	data32 = (data32 << 8) | inode[6];
-	data32 = (data32 << 8) | inode[5];
-	data32 = (data32 << 8) | inode[4];
-	filesize = data32;
-	printf("Size : %d\n", filesize);
-
-	// Address of direct block 0
-	data32 = inode[43];
-	data32 = (data32 << 8) | inode[42];
-	data32 = (data32 << 8) | inode[41];
-	data32 = (data32 << 8) | inode[40];
-	printf("Direct Block 0 : %d\n", data32);
-
-	// Reading inode data
-	if (lseek(fs, data32 * BLOCK_SIZE, 0) < 0) {
-		printf("Failed to seek to inode data block 0\n");
-		close(fs);
-		return 1;
+	if (copts.outdir) {
+		if (open_fs(&fs, store, device, use_mmap, journal) < 0)
+			return 1;
+		copts.threads = nthreads;
+		copts.inodes = fopts.files;
+		ret = ext_carve(&fs, &copts) < 0 ? 1 : 0;
+		print_stats(&fs);
+		ext_close(&fs);
+		return ret;
 	}
-
-	read(fs, blk, BLOCK_SIZE);
-
-	// Showing upto max first 1024 bytes by adding \0 in the data buffer
-	if (filesize < 1024) {
-		blk[filesize] = '\0';
-	} else {
-		blk[1024] = '\0';
+	if (report) {
+		if (open_fs(&fs, store, device, use_mmap, journal) < 0)
+			return 1;
+		fopts.threads = nthreads;
+		ret = ext_free_report(&fs, &fopts) < 0 ? 1 : 0;
+		print_stats(&fs);
+		ext_close(&fs);
+		return ret;
 	}
-	printf("Data 0 (max 1024 bytes) :\n%s\n", blk);
 
-	close(fs);
-	return 0;
-}
-
-/**
- * init_fs() - Initialize the filesystem variables from super block
- *
- * This function reads the super block from the filesystem
- * and initialize all file system specific variables
- * http://wiki.osdev.org/Ext2
- */
-int init_fs(void)
-{
-	uint32_t data32;
-	uint16_t data16;
-
-	// Buffers
-	unsigned char superblk[SUPER_BLOCK_SIZE];
-
-	// Reading file system super block
-	if (lseek(fs, 1024, 0) < 0) {
-		printf("Failed to seek to superblock\n");
-		return 1;
+	// Open output, file data on stdout moves the information to stderr
+	if (output && strcmp(output, "-") == 0) {
+		out = dup(STDOUT_FILENO);
+		if (out < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+			printf("Error redirecting stdout\n");
+			return 1;
+		}
+	} else if (output) {
+		out = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (out < 0) {
+			printf("Error creating output file\n");
+			return 1;
+		}
 	}
-	read(fs, superblk, SUPER_BLOCK_SIZE);
-
-	// Calculating various file system parameters from super block
-	data32 = superblk[7];
-	data32 = (data32 << 8) | superblk[6];
-	data32 = (data32 << 8) | superblk[5];
-	data32 = (data32 << 8) | superblk[4];
-	TOTAL_BLOCKS = data32;
-	printf("Total Blocks : %d\n", TOTAL_BLOCKS);
-
-	data32 = superblk[35];
-	data32 = (data32 << 8) | superblk[34];
-	data32 = (data32 << 8) | superblk[33];
-	data32 = (data32 << 8) | superblk[32];
-	BLOCKS_PER_GROUP = data32;
-	printf("Blocks per group : %d\n", BLOCKS_PER_GROUP);
 
-	data32 = superblk[43];
-	data32 = (data32 << 8) | superblk[42];
-	data32 = (data32 << 8) | superblk[41];
-	data32 = (data32 << 8) | superblk[40];
-	INODE_PER_GROUP = data32;
-	printf("Inodes group : %d\n", INODE_PER_GROUP);
-
-	data16 = superblk[89];
-	data16 = (data16 << 8) | superblk[88];
-	INODE_SIZE = data16;
-	printf("Inode size : %d\n", INODE_SIZE);
-
-	data32 = superblk[27];
-	data32 = (data32 << 8) | superblk[26];
-	data32 = (data32 << 8) | superblk[25];
-	data32 = (data32 << 8) | superblk[24];
-	BLOCK_SIZE = 1024 << data32;    // Shift 1024 by data32 bits
-	printf("Blocks size : %d\n", BLOCK_SIZE);
-
-	data16 = superblk[207];
-	data16 = (data16 << 8) | superblk[206];
-	RESERVE_GDT = data16;
-	printf("Reserve GDT size : %d\n", RESERVE_GDT);
-
-	// Super block size is always 1024 bytes = max 1 block
-	SUPERBLOCK_SIZE = 1;
-	printf("Super Block size : %d\n", SUPERBLOCK_SIZE);
-
-	if (BLOCK_SIZE == 1024) {
-		FIRST_BLOCK = 1;
-	} else {
-		FIRST_BLOCK = 0;
+	// Open data file and read its inode number
+	if (!inode_number && !path) {
+		fd = open(argv[optind], O_RDONLY);
+		if (fd < 0) {
+			printf("Error opening file\n");
+			return 1;
+		}
+		if (fstat(fd, &filestat) < 0) {
+			printf("Error reading inode number for a file\n");
+			close(fd);
+			return 1;
+		}
+		close(fd);
+		inode_number = filestat.st_ino;
 	}
-	printf("First Block : %d\n", FIRST_BLOCK);
-
-	// Calculating number of blocks required for GDT
-	data32 = ceil((float)TOTAL_BLOCKS / BLOCKS_PER_GROUP) * GDT_ENTRY_SIZE;
-	GDT_SIZE = ceil((float)data32 / BLOCK_SIZE);
-	printf("GDT size : %d\n", GDT_SIZE);
-
-	return 0;
-}
 
-/**
- * read_gdt() - Read GDT table and get the block group descriptor entry
- *
- * This function reads block group descriptor entry from the
- * the GDT table located right after the super block. This entry
- * is 32 bytes in size and stores all the meta data related to the
- * block group including the inode table offset
- *
- * @block_group_number : Block group number of the inode
- */
-int read_gdt(int block_group_number)
-{
-	unsigned char gdt_entry[GDT_ENTRY_SIZE];
-	uint32_t data32;
-	int offset;
-
-	// Reading GDT table entry for the block group number
-	// Offset = boot block + super block (FIRST_BLOCK) + GDT table block
-	offset = ((FIRST_BLOCK + 1) * BLOCK_SIZE)
-			+ (block_group_number * GDT_ENTRY_SIZE);
-	printf("Block group offset in GDT table : %d\n", offset);
-	if (lseek(fs, offset, 0) < 0) {
-		printf("Failed to seek to GDT entry for the block group\n");
+	// Open file system, this parses the super block and the whole GDT
+	if (open_fs(&fs, store, device, use_mmap, journal) < 0) {
+		printf("Error reading extfs information from super block\n");
 		return 1;
 	}
-	read(fs, gdt_entry, GDT_ENTRY_SIZE);
-
-	data32 = gdt_entry[3];
-	data32 = (data32 << 8) | gdt_entry[2];
-	data32 = (data32 << 8) | gdt_entry[1];
-	data32 = (data32 << 8) | gdt_entry[0];
-	printf("Block usage bitmap : %d\n", data32);
-
-	data32 = gdt_entry[7];
-	data32 = (data32 << 8) | gdt_entry[6];
-	data32 = (data32 << 8) | gdt_entry[5];
-	data32 = (data32 << 8) | gdt_entry[4];
-	printf("Inode usage bitmap : %d\n", data32);
-
-	data32 = gdt_entry[11];
-	data32 = (data32 << 8) | gdt_entry[10];
-	data32 = (data32 << 8) | gdt_entry[9];
-	data32 = (data32 << 8) | gdt_entry[8];
-	inode_table_addr = data32;
-	printf("Inode table : %d\n", data32);
-
-	return 0;
-}
-
-/**
- * check_superblock() - Check whether block group contains copy of superblock
- *
- * This function checks if the block group contains copy of superblock
- * or not. Only block group number that are 0, 1 or power of 3, 5, 7
- * contain copy of super bock
- *
- * @block_group_number 	: Block group number of the inode
- * @ret			: return 1 if true
- */
-int check_superblock(int block_group_number)
-{
-	int n;
-
-	// Check if 0 or 1
-	n = block_group_number;
-	if (n == 0 || n == 1) {
-		return 1;
+	printf("Total Blocks : %llu\n", (unsigned long long)fs.blocks_count);
+	printf("Blocks per group : %u\n", fs.blocks_per_group);
+	printf("Inodes group : %u\n", fs.inodes_per_group);
+	printf("Inode size : %u\n", fs.inode_size);
+	printf("Blocks size : %u\n", fs.block_size);
+	printf("Reserve GDT size : %u\n", le16toh(fs.sb.s_reserved_gdt_blocks));
+	printf("First Block : %u\n", fs.first_data_block);
+	printf("GDT size : %u (%u byte descriptors)\n", fs.gdt_blocks,
+			fs.desc_size);
+	printf("Groups per flex group : %u\n", fs.groups_per_flex);
+	printf("Image access : %s\n", fs.store ? "store" :
+			fs.map ? "mmap" : "pread");
+
+	if (path) {
+		if (ext_namei(&fs, path, &inode_number, &dstats) < 0)
+			goto out;
+		printf("Path : %s (%lu directory blocks read, %lu htree and "
+				"%lu linear lookups)\n", path, dstats.blocks,
+				dstats.htree, dstats.linear);
 	}
 
-	// Check if power of 3
-	n = block_group_number;
-	while ((n % 3) == 0) {
-		n /= 3;
+	if (recursive) {
+		ret = ext_extract_tree(&fs, inode_number, recursive, &topts) < 0 ?
+			1 : 0;
+		goto out;
 	}
-	if (n == 1) {
-		return 1;
+
+	blk_grp_number = ext_inode_group(&fs, inode_number);
+
+	inode_grp_offset = (uint64_t)((inode_number - 1) % fs.inodes_per_group) *
+		fs.inode_size;
+
+	printf("Inode number: %u (offset = %llu)\n", inode_number,
+			(unsigned long long)inode_grp_offset);
+	printf("Block number: %u (super block = %d, flex group = %u)\n",
+			blk_grp_number, ext_group_has_super(&fs, blk_grp_number),
+			blk_grp_number / fs.groups_per_flex);
+
+	if (blk_grp_number < fs.groups) {
+		gd = &fs.gd[blk_grp_number];
+		printf("Block usage bitmap : %llu\n",
+				(unsigned long long)gd->block_bitmap);
+		printf("Inode usage bitmap : %llu\n",
+				(unsigned long long)gd->inode_bitmap);
+		printf("Inode table : %llu\n", (unsigned long long)gd->inode_table);
+		printf("Inode table entry at : %llu\n", (unsigned long long)
+				(gd->inode_table * fs.block_size + inode_grp_offset));
 	}
 
-	// Check if power of 5
-	n = block_group_number;
-	while ((n % 5) == 0) {
-		n /= 5;
+	// The index has the size and block map, the inode is not read
+	if (index) {
+		if (ext_idx_open(&idx, index, &fs) < 0)
+			goto out;
+		entry = ext_idx_find(&idx, inode_number);
+		if (!entry) {
+			printf("Inode %u is not in the index\n", inode_number);
+			goto out;
+		}
+		filesize = le64toh(entry->size);
+		printf("Mode : 0%o\n", le16toh(entry->mode));
+		printf("Size : %llu\n", (unsigned long long)filesize);
+		printf("Index runs : %u%s\n", le32toh(entry->nruns),
+				(le16toh(entry->flags) & EXT_IDX_BAD) ?
+				" (block map unreadable)" : "");
+		if (ext_idx_map(&idx, entry, &map) < 0)
+			goto out;
+	} else {
+		inode = ext_inode(&fs, inode_number);
+		if (!inode) {
+			printf("Failed to read inode table entry\n");
+			goto out;
+		}
+
+		filesize = ext_inode_size(inode);
+		flags = ext_inode_flags(inode);
+		block0 = le32toh(inode->i_block[0]);
+		printf("User ID : %u\n", le16toh(inode->i_uid));
+		printf("Size : %llu\n", (unsigned long long)filesize);
+		printf("Direct Block 0 : %u\n", block0);
+		printf("Flags : 0x%x%s\n", flags,
+				(flags & EXT_EXTENTS_FL) ? " (extents)" : "");
+
+		if (ext_map_file(&fs, inode_number, inode, &map) < 0)
+			goto out_inode;
 	}
-	if (n == 1) {
-		return 1;
+
+	// Dump the whole file
+	if (out >= 0) {
+		if (ext_dump_file(&fs, &map, filesize, out) < 0)
+			goto out_inode;
+		printf("Wrote %llu bytes in %lu runs\n",
+				(unsigned long long)filesize, (unsigned long)map.n);
+		ret = 0;
+		goto out_inode;
 	}
 
-	// Check if power of 7
-	n = block_group_number;
-	while ((n % 7) == 0) {
-		n /= 7;
+	// Reading the first data block, a hole reads as zeros
+	filesize = filesize < 1024 ? filesize : 1024;
+	memset(data, 0x00, sizeof(data));
+	if (map.n > 0 && map.r[0].logical == 0) {
+		blk = ext_block(&fs, map.r[0].physical);
+		if (!blk) {
+			printf("Failed to read inode data block 0\n");
+			goto out_inode;
+		}
+		memcpy(data, blk, filesize);
+		ext_put(&fs, blk);
 	}
-	if (n == 1) {
-		return 1;
+	printf("Data 0 (max 1024 bytes) :\n%s\n", data);
+	ret = 0;
+
+out_inode:
+	ext_put(&fs, inode);
+out:
+	print_stats(&fs);
+	free(map.r);
+	ext_idx_close(&idx);
+	ext_close(&fs);
+	if (out >= 0 && close(out) < 0) {
+		printf("Error writing output file\n");
+		ret = 1;
 	}
-
-	return 0;
+	return ret;
 }
-
@@ -0,0 +1,685 @@
+/*
+ * extbench - Performance regression suite for ext3dump on synthetic images
+ *
+ * Written in 2026 by the ext3dump contributors
+ *
+ * To the extent possible under law, the author(s) have dedicated
+ * all copyright and related and neighboring rights to this software
+ * to the public domain worldwide. This software is distributed
+ * without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication
+ * along with this software.
+ * If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <time.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "extimg.h"
+#include "extindex.h"
+#include "extdir.h"
+#include "exttree.h"
+#include "extsynth.h"
+#include "../fileops/blockio.h"
+
+#define MAX_METRICS		16
+#define CHUNK			(1024 * 1024)	// Verify files this much at a time
+
+struct metric {
+	char image[8];
+	char name[32];
+	double value;
+};
+
+struct bench {
+	const char *dir;
+	int use_mmap;
+	int nthreads;
+	struct ext_tree_opts topts;
+	uint32_t lookups;
+	int keep;
+	int verbose;
+	int stdout_fd;			// Saved while the library is quiet
+	struct metric *m;
+	size_t nm;
+	size_t alloc;
+	unsigned char *want;		// CHUNK bytes each
+	unsigned char *got;
+};
+
+static void usage(void)
+{
+	printf("\nUsage : extbench [options]\n"
+			"        extbench -w <image> [options]\n\n"
+			"  -d, --dir <dir>      Directory for the images and the\n"
+			"                       extracted trees (default .)\n"
+			"  -y, --types <234>    File system types to run (default 234)\n"
+			"  -s, --size <MB>      Image size (default 512)\n"
+			"  -B, --block-size <n> 1024, 2048 or 4096 (default 4096)\n"
+			"  -I, --inode-size <n> 128 or 256 (default 256)\n"
+			"  -P, --plain          ext4 without 64bit, flex_bg and\n"
+			"                       metadata_csum\n"
+			"  -f, --files <n>      Files below /files (default 2000)\n"
+			"  -m, --max-file <KB>  Largest of them (default 1024)\n"
+			"  -g, --frag <n>       Fragmented files (default 8)\n"
+			"  -G, --frag-size <KB> Size of each (default 4096)\n"
+			"  -e, --entries <n>    Entries of the directory /huge\n"
+			"                       (default 50000)\n"
+			"  -S, --seed <n>       Seed of names, sizes and content\n"
+			"  -n, --lookups <n>    Random path lookups (default 10000)\n"
+			"  -t, --threads <n>    Scan threads (default all cpus)\n"
+			"  -R, --readers <n>    Parallel readers of the extraction\n"
+			"  -W, --writers <n>    Parallel writers of the extraction\n"
+			"  -M, --no-mmap        Read the images with pread\n"
+			"  -k, --keep           Keep the images and extracted trees\n"
+			"  -o, --output <file>  Write the results to file\n"
+			"  -b, --baseline <file> Compare with earlier results\n"
+			"  -T, --tolerance <%%>  Allowed regression (default 20)\n"
+			"  -w, --write <image>  Only write the image of the first type\n"
+			"  -v, --verbose        Show the output of ext3dump code\n"
+			"  -h, --help           Show this help\n\n");
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * The scan and the extraction report their progress on stdout, which
+ * would bury the results. Unless -v it goes to /dev/null meanwhile.
+ */
+static void quiet(struct bench *b)
+{
+	int fd;
+
+	if (b->verbose)
+		return;
+	fflush(stdout);
+	b->stdout_fd = dup(1);
+	fd = open("/dev/null", O_WRONLY);
+	if (b->stdout_fd < 0 || fd < 0) {
+		if (fd >= 0)
+			close(fd);
+		return;
+	}
+	dup2(fd, 1);
+	close(fd);
+}
+
+static void loud(struct bench *b)
+{
+	if (b->verbose || b->stdout_fd < 0)
+		return;
+	fflush(stdout);
+	dup2(b->stdout_fd, 1);
+	close(b->stdout_fd);
+	b->stdout_fd = -1;
+}
+
+static int add_metric(struct bench *b, const char *image, const char *name,
+		double value)
+{
+	struct metric *m;
+
+	if (b->nm == b->alloc) {
+		b->alloc = b->alloc ? b->alloc * 2 : MAX_METRICS;
+		m = realloc(b->m, b->alloc * sizeof(*m));
+		if (!m) {
+			printf("Failed to allocate memory\n");
+			return -1;
+		}
+		b->m = m;
+	}
+	m = &b->m[b->nm++];
+	snprintf(m->image, sizeof(m->image), "%s", image);
+	snprintf(m->name, sizeof(m->name), "%s", name);
+	m->value = value;
+	printf("%-6s %-20s %12.3f\n", image, name, value);
+	return 0;
+}
+
+// Drop the cached pages of the image, so every phase reads the disk
+static void drop_cache(const char *path)
+{
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0)
+		return;
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	close(fd);
+}
+
+static int rm_entry(const char *path, const struct stat *st, int flag,
+		struct FTW *ftw)
+{
+	(void)st;
+	(void)flag;
+	(void)ftw;
+	return remove(path) < 0 && errno != ENOENT ? -1 : 0;
+}
+
+static void rm_tree(const char *path)
+{
+	nftw(path, rm_entry, 64, FTW_DEPTH | FTW_PHYS);
+}
+
+/**
+ * bench_scan() - Time an index scan and check the sizes it found
+ *
+ * Every node of the plan must be in the index with its size and type.
+ */
+static int bench_scan(struct bench *b, struct ext_fs *fs,
+		const struct ext_synth *s, const char *image, const char *idxpath)
+{
+	struct ext_idx idx = { 0 };
+	const struct ext_idx_entry *e;
+	const struct ext_synth_node *n;
+	uint16_t type;
+	uint32_t i, bad = 0;
+	double t;
+	int ret;
+
+	quiet(b);
+	t = now();
+	ret = ext_idx_scan(fs, idxpath, b->nthreads);
+	t = now() - t;
+	if (ret == 0)
+		ret = ext_idx_open(&idx, idxpath, fs);
+	loud(b);
+	if (ret < 0) {
+		printf("%s : scan failed\n", image);
+		return -1;
+	}
+
+	for (i = 0; i < s->count; i++) {
+		n = &s->n[i];
+		type = n->kind == EXT_SYNTH_DIR ? EXT_S_IFDIR :
+			n->kind == EXT_SYNTH_SYMLINK ? EXT_S_IFLNK : EXT_S_IFREG;
+		e = ext_idx_find(&idx, n->ino);
+		if (!e || (le16toh(e->mode) & EXT_S_IFMT) != type ||
+				(type != EXT_S_IFDIR && le64toh(e->size) != n->size)) {
+			if (bad++ < 10)
+				printf("%s : /%s wrong in the index\n", image, n->path);
+		}
+	}
+	ext_idx_close(&idx);
+	if (!b->keep)
+		unlink(idxpath);
+	add_metric(b, image, "scan_s", t);
+	add_metric(b, image, "scan_inodes_per_s", t > 0 ? s->count / t : 0);
+	return bad ? -1 : 0;
+}
+
+/**
+ * bench_lookup() - Time path lookups of random nodes
+ *
+ * The nodes are picked with a fixed seed, so runs look up the same
+ * paths. Lookups into /huge go through its htree on ext3 and ext4.
+ */
+static int bench_lookup(struct bench *b, struct ext_fs *fs,
+		const struct ext_synth *s, const char *image)
+{
+	struct blkio_lat lat;
+	struct ext_dir_stats dstats = { 0, 0, 0 };
+	const struct ext_synth_node *n;
+	char path[4096];
+	uint64_t r = 0x12345678;
+	uint32_t i, ino, bad = 0;
+	double t, total = 0;
+
+	memset(&lat, 0x00, sizeof(lat));
+	for (i = 0; i < b->lookups; i++) {
+		r = r * 6364136223846793005ULL + 1442695040888963407ULL;
+		n = &s->n[1 + (r >> 33) % (s->count - 1)];
+		snprintf(path, sizeof(path), "/%s", n->path);
+		t = now();
+		if (ext_namei(fs, path, &ino, &dstats) < 0)
+			ino = 0;
+		t = now() - t;
+		total += t;
+		blkio_lat_add(&lat, t * 1e9);
+		if (ino != n->ino && bad++ < 10)
+			printf("%s : %s found as inode %u, not %u\n", image, path,
+					ino, n->ino);
+	}
+	add_metric(b, image, "lookup_p50_us",
+			blkio_lat_percentile(&lat, 0.50) / 1e3);
+	add_metric(b, image, "lookup_p99_us",
+			blkio_lat_percentile(&lat, 0.99) / 1e3);
+	add_metric(b, image, "lookup_per_s", total > 0 ? b->lookups / total : 0);
+	return bad ? -1 : 0;
+}
+
+// Compare an extracted file with the content it should have
+static int verify_file(struct bench *b, const struct ext_synth *s,
+		const struct ext_synth_node *n, const char *path)
+{
+	uint64_t off;
+	size_t len;
+	ssize_t got;
+	struct stat st;
+	int fd, ret = 0;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0 || (uint64_t)st.st_size != n->size) {
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+	for (off = 0; off < n->size && ret == 0; off += len) {
+		len = n->size - off < CHUNK ? n->size - off : CHUNK;
+		got = blkio_pread_full(fd, b->got, len, off);
+		ext_synth_data(s, n, off, b->want, len);
+		if (got != (ssize_t)len || memcmp(b->got, b->want, len) != 0)
+			ret = -1;
+	}
+	close(fd);
+	return ret;
+}
+
+/**
+ * bench_extract() - Time the extraction of the whole tree and check it
+ *
+ * The throughput counts file data only, holes included.
+ */
+static int bench_extract(struct bench *b, struct ext_fs *fs,
+		const struct ext_synth *s, const char *image, const char *outdir)
+{
+	const struct ext_synth_node *n;
+	char path[8192], target[4096];
+	struct stat st;
+	uint32_t i, bad = 0;
+	ssize_t len;
+	double t;
+	int ret;
+
+	rm_tree(outdir);
+	quiet(b);
+	t = now();
+	ret = ext_extract_tree(fs, 2, outdir, &b->topts);
+	t = now() - t;
+	loud(b);
+	if (ret < 0)
+		printf("%s : extraction failed\n", image);
+
+	for (i = 1; i < s->count; i++) {
+		n = &s->n[i];
+		snprintf(path, sizeof(path), "%s/%s", outdir, n->path);
+		if (n->kind == EXT_SYNTH_DIR) {
+			ret = stat(path, &st) < 0 || !S_ISDIR(st.st_mode) ? -1 : 0;
+		} else if (n->kind == EXT_SYNTH_SYMLINK) {
+			len = readlink(path, target, sizeof(target) - 1);
+			ret = len < 0 || (size_t)len != n->size ||
+				memcmp(target, n->target, len) != 0 ? -1 : 0;
+		} else {
+			ret = verify_file(b, s, n, path);
+		}
+		if (ret < 0 && bad++ < 10)
+			printf("%s : /%s extracted wrong\n", image, n->path);
+	}
+	if (!b->keep)
+		rm_tree(outdir);
+	add_metric(b, image, "extract_s", t);
+	add_metric(b, image, "extract_mb_per_s",
+			t > 0 ? s->data_bytes / t / (1024 * 1024) : 0);
+	return bad ? -1 : 0;
+}
+
+/**
+ * run_image() - Write one image and run every benchmark on it
+ *
+ * Return: 0 if all content checked out, -1 otherwise
+ */
+static int run_image(struct bench *b, const struct ext_synth_opts *opts)
+{
+	struct ext_synth s;
+	struct ext_fs fs;
+	char image[8], img[4096], idx[4096], out[4096];
+	double t;
+	int ret = 0;
+
+	snprintf(image, sizeof(image), "ext%d", opts->type);
+	snprintf(img, sizeof(img), "%s/synth-%s.img", b->dir, image);
+	snprintf(idx, sizeof(idx), "%s/synth-%s.idx", b->dir, image);
+	snprintf(out, sizeof(out), "%s/synth-%s.out", b->dir, image);
+
+	if (ext_synth_plan(&s, opts) < 0)
+		return -1;
+	t = now();
+	if (ext_synth_write(&s, img) < 0) {
+		ext_synth_free(&s);
+		return -1;
+	}
+	t = now() - t;
+	printf("%s : %u inodes, %.1f MB of file data in %s\n", image, s.count,
+			s.data_bytes / (1024.0 * 1024.0), img);
+	add_metric(b, image, "write_s", t);
+
+	drop_cache(img);
+	quiet(b);
+	ret = ext_open(&fs, img, b->use_mmap);
+	loud(b);
+	if (ret < 0) {
+		printf("%s : cannot open %s\n", image, img);
+		ext_synth_free(&s);
+		return -1;
+	}
+	ret |= bench_scan(b, &fs, &s, image, idx);
+	ret |= bench_lookup(b, &fs, &s, image);
+	ext_close(&fs);
+
+	// The extraction starts with a cold cache of its own
+	drop_cache(img);
+	quiet(b);
+	if (ext_open(&fs, img, b->use_mmap) < 0) {
+		loud(b);
+		printf("%s : cannot open %s\n", image, img);
+		ext_synth_free(&s);
+		return -1;
+	}
+	loud(b);
+	ret |= bench_extract(b, &fs, &s, image, out);
+	ext_close(&fs);
+
+	if (!b->keep)
+		unlink(img);
+	ext_synth_free(&s);
+	return ret;
+}
+
+static int save_results(const struct bench *b, const char *path)
+{
+	FILE *f = fopen(path, "w");
+	size_t i;
+
+	if (!f) {
+		printf("Error creating %s : %s\n", path, strerror(errno));
+		return -1;
+	}
+	for (i = 0; i < b->nm; i++)
+		fprintf(f, "%s %s %.6f\n", b->m[i].image, b->m[i].name,
+				b->m[i].value);
+	if (fclose(f) != 0) {
+		printf("Error writing %s : %s\n", path, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * compare_baseline() - Report metrics that got worse than the baseline
+ *
+ * Rates, names with _per_s, should not drop and times should not rise
+ * by more than tolerance percent. Metrics missing on either side are
+ * skipped.
+ *
+ * Return: Number of regressions, -1 if the baseline cannot be read
+ */
+static int compare_baseline(const struct bench *b, const char *path,
+		double tolerance)
+{
+	FILE *f = fopen(path, "r");
+	char image[8], name[32];
+	double base, cur, change;
+	int regressions = 0, higher;
+	size_t i;
+
+	if (!f) {
+		printf("Error opening %s : %s\n", path, strerror(errno));
+		return -1;
+	}
+	printf("\nCompared with %s :\n", path);
+	while (fscanf(f, "%7s %31s %lf", image, name, &base) == 3) {
+		for (i = 0; i < b->nm; i++)
+			if (strcmp(b->m[i].image, image) == 0 &&
+					strcmp(b->m[i].name, name) == 0)
+				break;
+		if (i == b->nm || base <= 0)
+			continue;
+		cur = b->m[i].value;
+		higher = strstr(name, "_per_s") != NULL;
+		change = 100.0 * (cur - base) / base;
+		if ((higher && change < -tolerance) || (!higher && change > tolerance)) {
+			regressions++;
+			printf("%-6s %-20s %12.3f -> %12.3f (%+.1f%%) REGRESSION\n",
+					image, name, base, cur, change);
+		} else {
+			printf("%-6s %-20s %12.3f -> %12.3f (%+.1f%%)\n",
+					image, name, base, cur, change);
+		}
+	}
+	fclose(f);
+	return regressions;
+}
+
+int main(int argc, char *argv[])
+{
+	struct ext_synth_opts opts = {
+		.type = 4, .size = 512ULL << 20, .block_size = 4096,
+		.inode_size = 256, .bit64 = 1, .flex_bg = 1, .csum = 1,
+		.seed = 1, .files = 2000, .max_file = 1024 << 10,
+		.frag_files = 8, .frag_size = 4096 << 10, .entries = 50000,
+	};
+	struct bench b = {
+		.dir = ".", .use_mmap = 1, .topts = { 4, 4, 0 },
+		.lookups = 10000, .stdout_fd = -1,
+	};
+	struct ext_synth s;
+	const char *types = "234", *output = NULL, *baseline = NULL;
+	const char *write_only = NULL, *p;
+	double tolerance = 20.0;
+	uint64_t val;
+	int plain = 0, opt, n, ret = 0;
+	char *end;
+
+	static const struct option long_opts[] = {
+		{ "dir", required_argument, NULL, 'd' },
+		{ "types", required_argument, NULL, 'y' },
+		{ "size", required_argument, NULL, 's' },
+		{ "block-size", required_argument, NULL, 'B' },
+		{ "inode-size", required_argument, NULL, 'I' },
+		{ "plain", no_argument, NULL, 'P' },
+		{ "files", required_argument, NULL, 'f' },
+		{ "max-file", required_argument, NULL, 'm' },
+		{ "frag", required_argument, NULL, 'g' },
+		{ "frag-size", required_argument, NULL, 'G' },
+		{ "entries", required_argument, NULL, 'e' },
+		{ "seed", required_argument, NULL, 'S' },
+		{ "lookups", required_argument, NULL, 'n' },
+		{ "threads", required_argument, NULL, 't' },
+		{ "readers", required_argument, NULL, 'R' },
+		{ "writers", required_argument, NULL, 'W' },
+		{ "no-mmap", no_argument, NULL, 'M' },
+		{ "keep", no_argument, NULL, 'k' },
+		{ "output", required_argument, NULL, 'o' },
+		{ "baseline", required_argument, NULL, 'b' },
+		{ "tolerance", required_argument, NULL, 'T' },
+		{ "write", required_argument, NULL, 'w' },
+		{ "verbose", no_argument, NULL, 'v' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+
+	b.nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	while ((opt = getopt_long(argc, argv, "d:y:s:B:I:Pf:m:g:G:e:S:n:t:R:W:Mko:b:T:w:vh",
+					long_opts, NULL)) != -1) {
+		switch (opt) {
+		case 'd':
+			b.dir = optarg;
+			break;
+		case 'y':
+			for (p = optarg; *p; p++) {
+				if (*p < '2' || *p > '4') {
+					printf("Invalid types %s\n", optarg);
+					return 1;
+				}
+			}
+			types = optarg;
+			break;
+		case 's':
+		case 'm':
+		case 'G':
+			val = strtoull(optarg, &end, 10);
+			if (*end != '\0' || val == 0) {
+				printf("Invalid size %s\n", optarg);
+				return 1;
+			}
+			if (opt == 's')
+				opts.size = val << 20;
+			else if (opt == 'm')
+				opts.max_file = val << 10;
+			else
+				opts.frag_size = val << 10;
+			break;
+		case 'B':
+			opts.block_size = atoi(optarg);
+			break;
+		case 'I':
+			opts.inode_size = atoi(optarg);
+			break;
+		case 'P':
+			plain = 1;
+			break;
+		case 'f':
+		case 'g':
+		case 'e':
+		case 'n':
+			n = atoi(optarg);
+			if (n < 0 || (n == 0 && opt == 'n')) {
+				printf("Invalid number %s\n", optarg);
+				return 1;
+			}
+			if (opt == 'f')
+				opts.files = n;
+			else if (opt == 'g')
+				opts.frag_files = n;
+			else if (opt == 'e')
+				opts.entries = n;
+			else
+				b.lookups = n;
+			break;
+		case 'S':
+			opts.seed = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+		case 'R':
+		case 'W':
+			n = atoi(optarg);
+			if (n < 1 || n > 1024) {
+				printf("Invalid number of threads %s\n", optarg);
+				return 1;
+			}
+			if (opt == 't')
+				b.nthreads = n;
+			else if (opt == 'R')
+				b.topts.readers = n;
+			else
+				b.topts.writers = n;
+			break;
+		case 'M':
+			b.use_mmap = 0;
+			break;
+		case 'k':
+			b.keep = 1;
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		case 'b':
+			baseline = optarg;
+			break;
+		case 'T':
+			tolerance = atof(optarg);
+			break;
+		case 'w':
+			write_only = optarg;
+			break;
+		case 'v':
+			b.verbose = 1;
+			break;
+		case 'h':
+		default:
+			usage();
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (optind != argc) {
+		usage();
+		return 1;
+	}
+	if (plain) {
+		opts.bit64 = 0;
+		opts.flex_bg = 0;
+		opts.csum = 0;
+	}
+
+	b.want = malloc(CHUNK);
+	b.got = malloc(CHUNK);
+	if (!b.want || !b.got) {
+		printf("Failed to allocate memory\n");
+		return 1;
+	}
+
+	for (p = types; *p && ret == 0; p++) {
+		opts.type = *p - '0';
+		if (ext_synth_plan(&s, &opts) < 0)
+			return 1;
+		if (s.data_bytes > opts.size / 4 * 3) {
+			printf("ext%d : %.1f MB of files do not fit, use a larger -s\n",
+					opts.type, s.data_bytes / (1024.0 * 1024.0));
+			ret = 1;
+		} else if (write_only) {
+			if (ext_synth_write(&s, write_only) < 0)
+				ret = 1;
+			else
+				printf("Wrote ext%d image %s, %u inodes, %.1f MB of file data\n",
+						opts.type, write_only, s.count,
+						s.data_bytes / (1024.0 * 1024.0));
+			ext_synth_free(&s);
+			break;
+		}
+		ext_synth_free(&s);
+	}
+	if (ret || write_only)
+		goto out;
+
+	printf("%-6s %-20s %12s\n", "image", "metric", "value");
+	for (p = types; *p; p++) {
+		opts.type = *p - '0';
+		if (run_image(&b, &opts) < 0)
+			ret = 1;
+	}
+	if (ret)
+		printf("Content mismatch, the results are not valid\n");
+	if (output && save_results(&b, output) < 0)
+		ret = 1;
+	if (baseline) {
+		n = compare_baseline(&b, baseline, tolerance);
+		if (n != 0) {
+			if (n > 0)
+				printf("%d regressions over %.0f%%\n", n, tolerance);
+			ret = 1;
+		}
+	}
+out:
+	free(b.want);
+	free(b.got);
+	free(b.m);
+	return ret;
+}
@@ -0,0 +1,929 @@
+/*
+ * extcarve - Recover deleted files from the free space of ext2/3/4 images
+ *
+ * Written in 2026 by the ext3dump contributors
+ *
+ * To the extent possible under law, the author(s) have dedicated
+ * all copyright and related and neighboring rights to this software
+ * to the public domain worldwide. This software is distributed
+ * without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication
+ * along with this software.
+ * If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "extcarve.h"
+#include "extfile.h"
+#include "extfree.h"
+#include "extcsum.h"
+
+/*
+ * Signatures used without a file, in the format of one. Types without
+ * a footer end at max_size or at the end of the free space.
+ */
+static const char *const default_sigs[] = {
+	"jpg	20M	\\xff\\xd8\\xff		\\xff\\xd9",
+	"png	20M	\\x89PNG\\x0d\\x0a\\x1a\\x0a	IEND\\xae\\x42\\x60\\x82",
+	"gif	20M	GIF8			\\x00\\x3b",
+	"pdf	100M	%PDF-			%%EOF",
+	"zip	100M	PK\\x03\\x04		PK\\x05\\x06	18",
+	"gz	20M	\\x1f\\x8b\\x08",
+	"xz	20M	\\xfd7zXZ\\x00",
+	"sqlite	20M	SQLite\\x20format\\x203\\x00",
+	"elf	10M	\\x7fELF",
+};
+
+// Free blocks scanned for headers by one thread
+struct carve_job {
+	uint64_t start;			// First block
+	uint64_t count;			// Blocks scanned
+	uint64_t end;			// End of the free run, files may reach it
+};
+
+// Blocks free in the block bitmaps, in block order
+struct free_run {
+	uint64_t start;
+	uint64_t count;
+};
+
+// First 16 header bytes of a signature, compared at once
+struct sig_match {
+	unsigned char pat[16];
+	unsigned char mask[16];
+};
+
+struct carve {
+	struct ext_fs *fs;
+	const struct ext_carve_opts *opts;
+	int dirfd;			// Output directory
+
+	struct ext_carve_sig sigs[EXT_CARVE_SIGS];
+	struct sig_match match[EXT_CARVE_SIGS];
+	int nsigs;
+
+	struct free_run *runs;
+	size_t nruns;
+	size_t runs_alloc;
+	uint64_t free_blocks;
+
+	struct carve_job *jobs;
+	size_t njobs;
+	size_t next_job;		// Next job to scan, taken atomically
+	uint32_t next_group;		// Next inode table to scan, the same
+
+	// Counters, added to atomically
+	uint64_t files[EXT_CARVE_SIGS];
+	uint64_t bytes[EXT_CARVE_SIGS];
+	uint64_t unterminated[EXT_CARVE_SIGS];	// Footer not found
+	uint64_t scanned;		// Bytes of free space read
+	uint64_t orphans;
+	uint64_t deleted;
+	uint64_t failed;		// Jobs and groups that could not be read
+};
+
+// Buffers of one thread
+struct carve_worker {
+	struct carve *c;
+	unsigned char *chunk;		// Free space of the job
+	unsigned char *data;		// File data past the chunk
+	unsigned char *itable;
+};
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * parse_bytes() - Decode a header or footer
+ *
+ * Bytes are given as they are, or as \xNN for any byte and \\ for a
+ * backslash, spaces as \x20.
+ *
+ * Return: Number of bytes or -1 if invalid
+ */
+static int parse_bytes(const char *s, unsigned char *out)
+{
+	char hex[3] = { 0 };
+	int n = 0;
+
+	while (*s) {
+		if (n == EXT_CARVE_MAGIC_MAX)
+			return -1;
+		if (s[0] != '\\') {
+			out[n++] = *s++;
+		} else if (s[1] == '\\') {
+			out[n++] = '\\';
+			s += 2;
+		} else if (s[1] == 'x' && isxdigit((unsigned char)s[2]) &&
+				isxdigit((unsigned char)s[3])) {
+			memcpy(hex, s + 2, 2);
+			out[n++] = strtoul(hex, NULL, 16);
+			s += 4;
+		} else {
+			return -1;
+		}
+	}
+	return n;
+}
+
+// Parse a size in bytes with an optional K, M or G suffix
+static int parse_size(const char *s, uint64_t *size)
+{
+	char *end;
+	uint64_t v;
+
+	v = strtoull(s, &end, 10);
+	if (end == s)
+		return -1;
+	switch (*end) {
+	case 'K':
+		v <<= 10;
+		end++;
+		break;
+	case 'M':
+		v <<= 20;
+		end++;
+		break;
+	case 'G':
+		v <<= 30;
+		end++;
+		break;
+	}
+	if (*end != '\0' || v == 0)
+		return -1;
+	*size = v;
+	return 0;
+}
+
+/**
+ * parse_sig() - Parse a signature line
+ *
+ * A line is "ext max_size header [footer [extra]]" separated by spaces
+ * or tabs, extra being the bytes of the file that follow the footer.
+ * Blank lines and lines starting with # are skipped.
+ *
+ * Return: 1 for a signature, 0 for nothing, -1 if invalid
+ */
+static int parse_sig(const char *line, struct ext_carve_sig *sig)
+{
+	char buf[512], *tok[6], *save, *p, *end;
+	unsigned long extra;
+	int n = 0, len;
+
+	if (strlen(line) >= sizeof(buf))
+		return -1;
+	strcpy(buf, line);
+	for (p = strtok_r(buf, " \t\r\n", &save); p && n < 6;
+			p = strtok_r(NULL, " \t\r\n", &save))
+		tok[n++] = p;
+	if (n == 0 || tok[0][0] == '#')
+		return 0;
+	if (n < 3 || n > 5 || strlen(tok[0]) >= EXT_CARVE_EXT_MAX ||
+			strchr(tok[0], '/'))
+		return -1;
+
+	memset(sig, 0x00, sizeof(*sig));
+	strcpy(sig->ext, tok[0]);
+	if (parse_size(tok[1], &sig->max_size) < 0)
+		return -1;
+	len = parse_bytes(tok[2], sig->header);
+	if (len < 2)
+		return -1;
+	sig->header_len = len;
+	if (n >= 4) {
+		len = parse_bytes(tok[3], sig->footer);
+		if (len < 1)
+			return -1;
+		sig->footer_len = len;
+	}
+	if (n == 5) {
+		extra = strtoul(tok[4], &end, 10);
+		if (*end != '\0' || extra > 65536)
+			return -1;
+		sig->footer_extra = extra;
+	}
+	return 1;
+}
+
+// Add a signature and its SIMD pattern
+static int add_sig(struct carve *c, const char *line)
+{
+	struct ext_carve_sig sig;
+	struct sig_match *m = &c->match[c->nsigs];
+	unsigned int i;
+	int ret;
+
+	ret = parse_sig(line, &sig);
+	if (ret <= 0)
+		return ret;
+	if (c->nsigs == EXT_CARVE_SIGS) {
+		printf("More than %d signatures\n", EXT_CARVE_SIGS);
+		return -1;
+	}
+	c->sigs[c->nsigs] = sig;
+	memset(m, 0x00, sizeof(*m));
+	for (i = 0; i < sig.header_len && i < 16; i++) {
+		m->pat[i] = sig.header[i];
+		m->mask[i] = 0xff;
+	}
+	c->nsigs++;
+	return 1;
+}
+
+// Read the signature file, or take the built in signatures without one
+static int load_sigs(struct carve *c, const char *path)
+{
+	char line[512];
+	FILE *fp;
+	size_t i;
+	int n = 0;
+
+	if (!path) {
+		for (i = 0; i < sizeof(default_sigs) / sizeof(default_sigs[0]); i++)
+			if (add_sig(c, default_sigs[i]) < 0)
+				return -1;
+		return 0;
+	}
+	fp = fopen(path, "r");
+	if (!fp) {
+		printf("Error opening signature file %s : %s\n", path,
+				strerror(errno));
+		return -1;
+	}
+	while (fgets(line, sizeof(line), fp)) {
+		n++;
+		if (add_sig(c, line) < 0) {
+			printf("Invalid signature on line %d of %s\n", n, path);
+			fclose(fp);
+			return -1;
+		}
+	}
+	fclose(fp);
+	if (c->nsigs == 0) {
+		printf("No signatures in %s\n", path);
+		return -1;
+	}
+	return 0;
+}
+
+static inline uint64_t load_word(const unsigned char *p)
+{
+	uint64_t w;
+
+	memcpy(&w, p, sizeof(w));
+	return le64toh(w);
+}
+
+// Add free blocks, joined with the last run if they follow it
+static int add_run(struct carve *c, uint64_t start, uint64_t count)
+{
+	struct free_run *r;
+
+	c->free_blocks += count;
+	if (c->nruns > 0) {
+		r = &c->runs[c->nruns - 1];
+		if (r->start + r->count == start) {
+			r->count += count;
+			return 0;
+		}
+	}
+	if (c->nruns == c->runs_alloc) {
+		c->runs_alloc = c->runs_alloc ? c->runs_alloc * 2 : 1024;
+		r = realloc(c->runs, c->runs_alloc * sizeof(*r));
+		if (!r) {
+			printf("Failed to allocate memory\n");
+			return -1;
+		}
+		c->runs = r;
+	}
+	c->runs[c->nruns].start = start;
+	c->runs[c->nruns].count = count;
+	c->nruns++;
+	return 0;
+}
+
+/**
+ * find_free() - Collect the free blocks of all groups
+ *
+ * Runs of clear bits are found a 64 bit word at a time. Runs that
+ * continue into the next word or group are joined, so one run is all
+ * the free space between two used blocks. Groups whose bitmap cannot be
+ * read are taken as used.
+ */
+static int find_free(struct carve *c)
+{
+	struct ext_fs *fs = c->fs;
+	const unsigned char *bitmap;
+	unsigned char *buf;
+	uint64_t first, w, f;
+	uint32_t group, bits, words, i;
+	unsigned int pos, len;
+	int ret = 0;
+
+	buf = malloc(fs->block_size);
+	if (!buf) {
+		printf("Failed to allocate memory\n");
+		return -1;
+	}
+	for (group = 0; group < fs->groups && ret == 0; group++) {
+		first = fs->first_data_block + (uint64_t)group * fs->blocks_per_group;
+		bits = fs->blocks_count - first < fs->blocks_per_group ?
+			fs->blocks_count - first : fs->blocks_per_group;
+		bitmap = ext_block_bitmap(fs, group, buf);
+		if (!bitmap) {
+			c->failed++;
+			continue;
+		}
+		words = (bits + 63) / 64;
+		for (i = 0; i < words && ret == 0; i++) {
+			if (i == words - 1 && bits % 64) {
+				w = 0;
+				memcpy(&w, bitmap + (size_t)i * 8, (bits % 64 + 7) / 8);
+				w = le64toh(w) | (~0ULL << (bits % 64));
+			} else {
+				w = load_word(bitmap + (size_t)i * 8);
+			}
+			for (pos = 0; pos < 64 && ret == 0; pos += len) {
+				f = ~w >> pos;
+				if (f == 0)
+					break;
+				pos += __builtin_ctzll(f);
+				len = (w >> pos) ?
+					(unsigned int)__builtin_ctzll(w >> pos) : 64 - pos;
+				ret = add_run(c, first + (uint64_t)i * 64 + pos, len);
+			}
+		}
+		if (bitmap != buf)
+			ext_put(fs, bitmap);
+	}
+	free(buf);
+	return ret;
+}
+
+// Split the free runs into jobs of at most EXT_CARVE_CHUNK bytes
+static int make_jobs(struct carve *c)
+{
+	uint64_t per_job = EXT_CARVE_CHUNK / c->fs->block_size, blk, end;
+	size_t i, n = 0;
+
+	for (i = 0; i < c->nruns; i++)
+		n += (c->runs[i].count + per_job - 1) / per_job;
+	c->jobs = calloc(n ? n : 1, sizeof(*c->jobs));
+	if (!c->jobs) {
+		printf("Failed to allocate memory\n");
+		return -1;
+	}
+	for (i = 0; i < c->nruns; i++) {
+		end = c->runs[i].start + c->runs[i].count;
+		for (blk = c->runs[i].start; blk < end; blk += per_job) {
+			c->jobs[c->njobs].start = blk;
+			c->jobs[c->njobs].count = end - blk < per_job ?
+				end - blk : per_job;
+			c->jobs[c->njobs].end = end;
+			c->njobs++;
+		}
+	}
+	return 0;
+}
+
+// Check that blocks are all in one free run
+static int blocks_free(const struct carve *c, uint64_t start, uint64_t count)
+{
+	size_t lo = 0, hi = c->nruns, mid;
+
+	// Last run starting at or before start
+	while (hi - lo > 1) {
+		mid = (lo + hi) / 2;
+		if (c->runs[mid].start <= start)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return c->nruns > 0 && c->runs[lo].start <= start &&
+		start + count <= c->runs[lo].start + c->runs[lo].count;
+}
+
+static int read_bytes(struct ext_fs *fs, unsigned char *buf, size_t len,
+		uint64_t off)
+{
+	size_t done;
+	ssize_t r;
+
+	for (done = 0; done < len; done += r) {
+		r = ext_pread(fs, buf + done, len - done, off + done);
+		if (r <= 0) {
+			printf("Failed to read %zu bytes at %llu\n", len,
+					(unsigned long long)off);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int write_bytes(int fd, const unsigned char *buf, size_t len,
+		uint64_t off)
+{
+	size_t done;
+	ssize_t r;
+
+	for (done = 0; done < len; done += r) {
+		r = pwrite(fd, buf + done, len - done, off + done);
+		if (r < 0) {
+			printf("Error writing file data : %s\n", strerror(errno));
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * match_header() - Find the signature whose header starts a block
+ *
+ * The first 16 bytes of the block are compared with the masked pattern
+ * of every signature in one SSE2 compare, only longer headers need a
+ * memcmp() of the rest.
+ *
+ * Return: Index of the signature or -1
+ */
+static int match_header(const struct carve *c, const unsigned char *p)
+{
+	int i;
+#ifdef __SSE2__
+	__m128i v = _mm_loadu_si128((const __m128i *)p), m;
+#endif
+
+	for (i = 0; i < c->nsigs; i++) {
+#ifdef __SSE2__
+		m = _mm_and_si128(v, _mm_loadu_si128((const __m128i *)c->match[i].mask));
+		m = _mm_cmpeq_epi8(m, _mm_loadu_si128((const __m128i *)c->match[i].pat));
+		if (_mm_movemask_epi8(m) != 0xffff)
+			continue;
+		if (c->sigs[i].header_len <= 16)
+			return i;
+#endif
+		if (memcmp(p, c->sigs[i].header, c->sigs[i].header_len) == 0)
+			return i;
+	}
+	return -1;
+}
+
+/**
+ * find_footer() - Find the first footer in a buffer
+ *
+ * The first and the last byte of the footer are compared at 16 offsets
+ * at once with SSE2, only offsets where both match are compared fully.
+ *
+ * Return: Offset of the footer or -1
+ */
+static long find_footer(const unsigned char *p, size_t len,
+		const unsigned char *f, size_t flen)
+{
+	size_t i = 0;
+#ifdef __SSE2__
+	const __m128i first = _mm_set1_epi8(f[0]), last = _mm_set1_epi8(f[flen - 1]);
+	__m128i a, b;
+	unsigned int m;
+
+	for (; i + 16 + flen - 1 <= len; i += 16) {
+		a = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + i)), first);
+		b = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)
+					(p + i + flen - 1)), last);
+		for (m = _mm_movemask_epi8(_mm_and_si128(a, b)); m; m &= m - 1)
+			if (memcmp(p + i + __builtin_ctz(m), f, flen) == 0)
+				return i + __builtin_ctz(m);
+	}
+#endif
+	for (; i + flen <= len; i++)
+		if (p[i] == f[0] && memcmp(p + i, f, flen) == 0)
+			return i;
+	return -1;
+}
+
+/**
+ * carve_file() - Write out a file whose header starts a free block
+ *
+ * The part of the file in the chunk is taken from it, the rest is read
+ * in pieces of EXT_CARVE_CHUNK, but never past the end of the free run
+ * or max_size. The last footer_len - 1 bytes of a piece are kept to
+ * find a footer across two pieces.
+ *
+ * @i		: Block of w->chunk the header is in
+ *
+ * Return: Blocks to skip, the whole file if its footer was found and
+ *	   else 1, -1 on error
+ */
+static long carve_file(struct carve_worker *w, int s,
+		const struct carve_job *job, uint64_t i)
+{
+	struct carve *c = w->c;
+	struct ext_fs *fs = c->fs;
+	const struct ext_carve_sig *sig = &c->sigs[s];
+	unsigned char tail[2 * EXT_CARVE_MAGIC_MAX];
+	uint64_t blk = job->start + i, pos = 0, end, limit;
+	const unsigned char *p = w->chunk + i * fs->block_size;
+	size_t len = (job->count - i) * fs->block_size, keep = 0, n;
+	char name[64];
+	long off;
+	int fd, found = 0;
+
+	limit = (job->end - blk) * fs->block_size;
+	if (limit > sig->max_size)
+		limit = sig->max_size;
+	end = limit;
+	snprintf(name, sizeof(name), "block_%llu.%s", (unsigned long long)blk,
+			sig->ext);
+	fd = openat(c->dirfd, name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		printf("Error creating %s : %s\n", name, strerror(errno));
+		return -1;
+	}
+
+	while (pos < end) {
+		if (pos > 0) {
+			len = end - pos < EXT_CARVE_CHUNK ? end - pos : EXT_CARVE_CHUNK;
+			if (read_bytes(fs, w->data, len,
+					blk * fs->block_size + pos) < 0)
+				goto err;
+			p = w->data;
+		}
+		if (len > end - pos)
+			len = end - pos;
+
+		if (sig->footer_len && !found) {
+			n = len < sig->footer_len - 1 ? len : sig->footer_len - 1;
+			memcpy(tail + keep, p, n);
+			off = keep ? find_footer(tail, keep + n, sig->footer,
+					sig->footer_len) : -1;
+			if (off >= 0) {
+				end = pos - keep + off;
+			} else {
+				off = find_footer(p, len, sig->footer, sig->footer_len);
+				if (off >= 0)
+					end = pos + off;
+			}
+			if (off >= 0) {
+				found = 1;
+				end += sig->footer_len + sig->footer_extra;
+				if (end > limit)
+					end = limit;
+				if (len > end - pos)
+					len = end - pos;
+			} else if (len >= sig->footer_len - 1) {
+				keep = sig->footer_len - 1;
+				memcpy(tail, p + len - keep, keep);
+			} else if (keep + n > sig->footer_len - 1) {
+				memmove(tail, tail + keep + n - (sig->footer_len - 1),
+						sig->footer_len - 1);
+				keep = sig->footer_len - 1;
+			} else {
+				keep += n;
+			}
+		}
+		if (write_bytes(fd, p, len, pos) < 0)
+			goto err;
+		pos += len;
+	}
+	close(fd);
+
+	__atomic_fetch_add(&c->files[s], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&c->bytes[s], pos, __ATOMIC_RELAXED);
+	if (sig->footer_len && !found) {
+		__atomic_fetch_add(&c->unterminated[s], 1, __ATOMIC_RELAXED);
+		return 1;
+	}
+	// Without a footer the end is a guess, go on at the next block
+	if (!found)
+		return 1;
+	return (pos + fs->block_size - 1) / fs->block_size;
+
+err:
+	close(fd);
+	return -1;
+}
+
+// Read the free space of a job and carve every file found in it
+static int scan_job(struct carve_worker *w, const struct carve_job *job)
+{
+	struct carve *c = w->c;
+	struct ext_fs *fs = c->fs;
+	uint64_t i;
+	long n;
+	int s;
+
+	if (read_bytes(fs, w->chunk, job->count * fs->block_size,
+			job->start * fs->block_size) < 0)
+		return -1;
+	__atomic_fetch_add(&c->scanned, job->count * fs->block_size,
+			__ATOMIC_RELAXED);
+	for (i = 0; i < job->count; i += n) {
+		n = 1;
+		s = match_header(c, w->chunk + i * fs->block_size);
+		if (s < 0)
+			continue;
+		n = carve_file(w, s, job, i);
+		if (n < 0)
+			return -1;
+	}
+	return 0;
+}
+
+/**
+ * trim_extents() - Keep the extents of a deleted inode that look valid
+ *
+ * Only extents in the inode itself are used, the blocks of a deeper
+ * tree are free and may have been reused. Entries are taken up to the
+ * first one with no blocks or outside the file system.
+ *
+ * Return: Number of extents kept
+ */
+static int trim_extents(const struct ext_fs *fs, struct ext_inode_disk *inode)
+{
+	struct ext_extent_header *eh = (struct ext_extent_header *)inode->i_block;
+	const struct ext_extent *ex = (const struct ext_extent *)(eh + 1);
+	uint64_t start;
+	unsigned int len;
+	int n, max;
+
+	if (le16toh(eh->eh_magic) != EXT_EXT_MAGIC || eh->eh_depth != 0)
+		return 0;
+	max = le16toh(eh->eh_max) < 4 ? le16toh(eh->eh_max) : 4;
+	for (n = 0; n < max; n++) {
+		len = le16toh(ex[n].ee_len);
+		if (len > EXT_INIT_MAX_LEN)
+			len -= EXT_INIT_MAX_LEN;
+		start = ((uint64_t)le16toh(ex[n].ee_start_hi) << 32) |
+			le32toh(ex[n].ee_start_lo);
+		if (len == 0 || start == 0 || start + len > fs->blocks_count)
+			break;
+	}
+	eh->eh_entries = htole16(n);
+	return n;
+}
+
+/**
+ * recover_inode() - Write out the data of an orphaned or deleted inode
+ *
+ * An orphan is still allocated and read like any file. The blocks of a
+ * deleted inode must all still be free, else they may belong to another
+ * file by now. Its size is usually cleared, the mapped blocks are
+ * written then.
+ *
+ * @inode	: Copy that may be changed
+ */
+static int recover_inode(struct carve *c, uint32_t ino,
+		struct ext_inode_disk *inode, int deleted)
+{
+	struct ext_fs *fs = c->fs;
+	struct block_map map = { NULL, 0, 0 };
+	const struct block_run *last;
+	uint64_t size = ext_inode_size(inode);
+	char name[64];
+	size_t i;
+	int fd, ret = 0;
+
+	if (!ext_inode_has_blocks(inode))
+		return 0;
+	if (deleted && (ext_inode_flags(inode) & EXT_EXTENTS_FL) &&
+			trim_extents(fs, inode) == 0)
+		return 0;
+	if (ext_map_file(fs, ino, inode, &map) < 0 || map.n == 0)
+		goto out;
+	for (i = 0; deleted && i < map.n; i++)
+		if (!blocks_free(c, map.r[i].physical, map.r[i].count))
+			goto out;
+	if (size == 0) {
+		last = &map.r[map.n - 1];
+		size = (last->logical + last->count) * fs->block_size;
+	}
+
+	snprintf(name, sizeof(name), "inode_%u.%s", ino,
+			deleted ? "deleted" : "orphan");
+	fd = openat(c->dirfd, name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		printf("Error creating %s : %s\n", name, strerror(errno));
+		ret = -1;
+		goto out;
+	}
+	ret = ext_dump_file(fs, &map, size, fd);
+	close(fd);
+	if (ret == 0)
+		__atomic_fetch_add(deleted ? &c->deleted : &c->orphans, 1,
+				__ATOMIC_RELAXED);
+out:
+	free(map.r);
+	return ret;
+}
+
+/**
+ * scan_inodes() - Recover the orphaned and deleted files of a group
+ *
+ * Orphans are allocated regular files without links, left behind when
+ * a file still open was deleted. Deleted files have a clear bit in the
+ * inode bitmap and a deletion time.
+ */
+static int scan_inodes(struct carve_worker *w, uint32_t group)
+{
+	struct carve *c = w->c;
+	struct ext_fs *fs = c->fs;
+	struct ext_inode_disk *inode;
+	const unsigned char *bitmap;
+	uint32_t ino, first_ino = le32toh(fs->sb.s_first_ino);
+	long n, i;
+	int used, ret = 0;
+
+	n = ext_read_itable(fs, group, w->itable);
+	if (n <= 0)
+		return n;
+	bitmap = ext_block(fs, fs->gd[group].inode_bitmap);
+	if (!bitmap) {
+		printf("Failed to read inode bitmap of group %u\n", group);
+		return -1;
+	}
+	ext_csum_inode_bitmap(fs, group, bitmap);
+
+	for (i = 0; i < n && ret == 0; i++) {
+		inode = (struct ext_inode_disk *)(w->itable +
+				(size_t)i * fs->inode_size);
+		ino = group * fs->inodes_per_group + i + 1;
+		if ((le16toh(inode->i_mode) & EXT_S_IFMT) != EXT_S_IFREG ||
+				ino < first_ino)
+			continue;
+		used = bitmap[i / 8] & (1 << (i % 8));
+		if (used && inode->i_links_count == 0)
+			ret = recover_inode(c, ino, inode, 0);
+		else if (!used && inode->i_dtime != 0)
+			ret = recover_inode(c, ino, inode, 1);
+	}
+	ext_put(fs, bitmap);
+	return ret;
+}
+
+// Take jobs until there are none left, then inode tables
+static void *carve_thread(void *arg)
+{
+	struct carve_worker *w = arg;
+	struct carve *c = w->c;
+	size_t job;
+	uint32_t group;
+
+	while (1) {
+		job = __atomic_fetch_add(&c->next_job, 1, __ATOMIC_RELAXED);
+		if (job >= c->njobs)
+			break;
+		if (scan_job(w, &c->jobs[job]) < 0)
+			__atomic_fetch_add(&c->failed, 1, __ATOMIC_RELAXED);
+	}
+	while (c->opts->inodes) {
+		group = __atomic_fetch_add(&c->next_group, 1, __ATOMIC_RELAXED);
+		if (group >= c->fs->groups)
+			break;
+		if (scan_inodes(w, group) < 0)
+			__atomic_fetch_add(&c->failed, 1, __ATOMIC_RELAXED);
+	}
+	return NULL;
+}
+
+/**
+ * ext_carve() - Recover deleted files from the free space
+ *
+ * The block bitmaps give the free space, which is split into chunks of
+ * EXT_CARVE_CHUNK bytes. Threads read the chunks with large sequential
+ * reads and look for a known header at the start of every block, as
+ * files start at block boundaries. A file found is written to the
+ * output directory as block_<block>.<ext>. Then the inode tables are
+ * scanned for orphaned and deleted inodes whose blocks are still there.
+ *
+ * Return: 0 on success, -1 if something could not be read or written
+ */
+int ext_carve(struct ext_fs *fs, const struct ext_carve_opts *opts)
+{
+	struct carve *c;
+	struct carve_worker *w = NULL;
+	struct blkio_pool bufs = { .mem = NULL };
+	pthread_t *tids = NULL;
+	size_t itable;
+	double start, elapsed;
+	uint64_t files = 0;
+	int i, n, started, nthreads = opts->threads, ret = -1;
+
+	c = calloc(1, sizeof(*c));
+	if (!c) {
+		printf("Failed to allocate memory\n");
+		return -1;
+	}
+	c->fs = fs;
+	c->opts = opts;
+	c->dirfd = -1;
+	if (load_sigs(c, opts->sigfile) < 0)
+		goto out;
+	if (mkdir(opts->outdir, 0755) < 0 && errno != EEXIST) {
+		printf("Error creating directory %s : %s\n", opts->outdir,
+				strerror(errno));
+		goto out;
+	}
+	c->dirfd = open(opts->outdir, O_RDONLY | O_DIRECTORY);
+	if (c->dirfd < 0) {
+		printf("Error opening directory %s : %s\n", opts->outdir,
+				strerror(errno));
+		goto out;
+	}
+
+	start = now();
+	if (find_free(c) < 0 || make_jobs(c) < 0)
+		goto out;
+	printf("Free space : %.1f MB in %zu runs, %zu jobs\n",
+			c->free_blocks * (double)fs->block_size / 1e6, c->nruns,
+			c->njobs);
+
+	if (nthreads < 1)
+		nthreads = 1;
+	tids = calloc(nthreads, sizeof(*tids));
+	w = calloc(nthreads, sizeof(*w));
+	if (!tids || !w || blkio_pool_init(&bufs, EXT_CARVE_CHUNK,
+				2 * nthreads, BLKIO_ALIGN) < 0) {
+		printf("Failed to allocate memory\n");
+		goto out_threads;
+	}
+	itable = (size_t)fs->inodes_per_group * fs->inode_size;
+	for (n = 0; n < nthreads; n++) {
+		w[n].c = c;
+		w[n].chunk = blkio_pool_get(&bufs);
+		w[n].data = blkio_pool_get(&bufs);
+		w[n].itable = malloc(itable);
+		if (!w[n].itable) {
+			printf("Failed to allocate memory\n");
+			break;
+		}
+	}
+	if (n == 0)
+		goto out_threads;
+	for (started = 0; started < n; started++)
+		if (pthread_create(&tids[started], NULL, carve_thread, &w[started]))
+			break;
+	if (started == 0)
+		carve_thread(&w[0]);
+	for (i = 0; i < started; i++)
+		pthread_join(tids[i], NULL);
+	elapsed = now() - start;
+
+	printf("Scanned %.1f MB of free space in %.2f s with %d threads "
+			"(%.1f MB/s)\n", c->scanned / 1e6, elapsed,
+			started ? started : 1,
+			c->scanned / 1e6 / (elapsed > 0 ? elapsed : 1));
+	for (i = 0; i < c->nsigs; i++) {
+		if (c->files[i] == 0)
+			continue;
+		files += c->files[i];
+		printf("  %-8s %6llu files  %10.1f MB", c->sigs[i].ext,
+				(unsigned long long)c->files[i], c->bytes[i] / 1e6);
+		if (c->unterminated[i])
+			printf("  (%llu without footer)",
+					(unsigned long long)c->unterminated[i]);
+		printf("\n");
+	}
+	printf("Carved %llu files", (unsigned long long)files);
+	if (opts->inodes)
+		printf(", recovered %llu orphaned and %llu deleted inodes",
+				(unsigned long long)c->orphans,
+				(unsigned long long)c->deleted);
+	printf(" into %s\n", opts->outdir);
+	if (c->failed)
+		printf("%llu jobs or groups failed\n",
+				(unsigned long long)c->failed);
+	ret = c->failed ? -1 : 0;
+
+out_threads:
+	for (i = 0; w && i < nthreads; i++)
+		free(w[i].itable);
+	blkio_pool_destroy(&bufs);
+	free(tids);
+	free(w);
+out:
+	if (c->dirfd >= 0)
+		close(c->dirfd);
+	free(c->runs);
+	free(c->jobs);
+	free(c);
+	return ret;
+}
@@ -0,0 +1,52 @@
+/*
+ * extcarve - Recover deleted files from the free space of ext2/3/4 images
+ *
+ * Written in 2026 by the ext3dump contributors
+ *
+ * To the extent possible under law, the author(s) have dedicated
+ * all copyright and related and neighboring rights to this software
+ * to the public domain worldwide. This software is distributed
+ * without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication
+ * along with this software.
+ * If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+#ifndef EXTCARVE_H
+#define EXTCARVE_H
+
+#include <stdint.h>
+
+#include "extimg.h"
+
+#define EXT_CARVE_CHUNK		(8 * 1024 * 1024)	// Free space read at once
+#define EXT_CARVE_MAGIC_MAX	32	// Longest header or footer
+#define EXT_CARVE_SIGS		64	// Most signatures in a file
+#define EXT_CARVE_EXT_MAX	16	// Longest extension plus a \0
+
+/*
+ * A file type found by its header at the start of a free block. It ends
+ * after its footer and footer_extra more bytes, or without a footer at
+ * max_size or at the end of the free space it starts in.
+ */
+struct ext_carve_sig {
+	char ext[EXT_CARVE_EXT_MAX];	// Extension of the files written
+	unsigned char header[EXT_CARVE_MAGIC_MAX];
+	unsigned int header_len;
+	unsigned char footer[EXT_CARVE_MAGIC_MAX];
+	unsigned int footer_len;	// 0 if the type has no footer
+	unsigned int footer_extra;	// Bytes of the file after the footer
+	uint64_t max_size;		// Largest file carved
+};
+
+struct ext_carve_opts {
+	const char *outdir;
+	const char *sigfile;		// Signatures, NULL for the built in ones
+	int threads;
+	int inodes;			// Recover orphaned and deleted inodes too
+};
+
+int ext_carve(struct ext_fs *fs, const struct ext_carve_opts *opts);
+
+#endif
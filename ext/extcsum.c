@@ -0,0 +1,595 @@
+/*
+ * extcsum - Metadata checksums of ext4 file systems
+ *
+ * Written in 2026 by the ext3dump contributors
+ *
+ * To the extent possible under law, the author(s) have dedicated
+ * all copyright and related and neighboring rights to this software
+ * to the public domain worldwide. This software is distributed
+ * without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication
+ * along with this software.
+ * If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include <pthread.h>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#define HAVE_SSE42_CRC
+#endif
+
+#include "extcsum.h"
+
+// Directory leaf blocks end in a fake entry holding the checksum
+struct dir_tail {
+	uint32_t reserved_zero1;	// Looks like an unused entry
+	uint16_t rec_len;		// 12
+	uint8_t  reserved_zero2;
+	uint8_t  reserved_ft;		// EXT_DIR_TAIL_FT
+	uint32_t checksum;
+} __attribute__((packed));
+
+#define EXT_DIR_TAIL_FT		0xDE
+
+// Htree nodes have this after the last possible entry
+struct dx_tail {
+	uint32_t reserved;
+	uint32_t checksum;
+} __attribute__((packed));
+
+static const char *const kind_names[EXT_CSUM_KINDS] = {
+	"super block", "group descriptors", "block bitmaps", "inode bitmaps",
+	"inodes", "extent blocks", "directory blocks",
+};
+
+static uint32_t crc_table[8][256];
+static uint32_t (*crc_fn)(uint32_t crc, const unsigned char *p, size_t len);
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * crc32c_sb8() - crc32c eight bytes at a time with slice-by-8 tables
+ *
+ * Table k gives the crc of a byte followed by k zero bytes, so the
+ * eight bytes of a word are folded in with eight independent lookups.
+ */
+static uint32_t crc32c_sb8(uint32_t crc, const unsigned char *p, size_t len)
+{
+	uint64_t w;
+
+	for (; len > 0 && ((uintptr_t)p & 7); len--)
+		crc = crc_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	for (; len >= 8; len -= 8, p += 8) {
+		memcpy(&w, p, sizeof(w));
+		w = le64toh(w) ^ crc;
+		crc = crc_table[7][w & 0xff] ^
+			crc_table[6][(w >> 8) & 0xff] ^
+			crc_table[5][(w >> 16) & 0xff] ^
+			crc_table[4][(w >> 24) & 0xff] ^
+			crc_table[3][(w >> 32) & 0xff] ^
+			crc_table[2][(w >> 40) & 0xff] ^
+			crc_table[1][(w >> 48) & 0xff] ^
+			crc_table[0][w >> 56];
+	}
+	for (; len > 0; len--)
+		crc = crc_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	return crc;
+}
+
+#ifdef HAVE_SSE42_CRC
+/**
+ * crc32c_sse42() - crc32c with the SSE4.2 crc32 instruction
+ *
+ * The instruction computes exactly this crc, 8 bytes per instruction.
+ */
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const unsigned char *p, size_t len)
+{
+	uint64_t c, w;
+
+	for (; len > 0 && ((uintptr_t)p & 7); len--)
+		crc = _mm_crc32_u8(crc, *p++);
+	for (c = crc; len >= 8; len -= 8, p += 8) {
+		memcpy(&w, p, sizeof(w));
+		c = _mm_crc32_u64(c, w);
+	}
+	for (crc = c; len > 0; len--)
+		crc = _mm_crc32_u8(crc, *p++);
+	return crc;
+}
+#endif
+
+static void crc_init(void)
+{
+	uint32_t c;
+	int i, j;
+
+	for (i = 0; i < 256; i++) {
+		c = i;
+		for (j = 0; j < 8; j++)
+			c = (c & 1) ? (c >> 1) ^ EXT_CRC32C_POLY : c >> 1;
+		crc_table[0][i] = c;
+	}
+	for (i = 0; i < 256; i++)
+		for (j = 1; j < 8; j++)
+			crc_table[j][i] = (crc_table[j - 1][i] >> 8) ^
+				crc_table[0][crc_table[j - 1][i] & 0xff];
+
+	crc_fn = crc32c_sb8;
+#ifdef HAVE_SSE42_CRC
+	if (__builtin_cpu_supports("sse4.2"))
+		crc_fn = crc32c_sse42;
+#endif
+}
+
+/**
+ * ext_crc32c() - Continue a crc32c over a buffer
+ *
+ * Like the kernel and e2fsprogs there is no inversion at the start or
+ * the end, ext4 seeds its checksums with ~0 and stores the raw result.
+ */
+uint32_t ext_crc32c(uint32_t crc, const void *buf, size_t len)
+{
+	pthread_once(&crc_once, crc_init);
+	return crc_fn(crc, buf, len);
+}
+
+// Name of the crc32c implementation in use
+const char *ext_crc32c_impl(void)
+{
+	pthread_once(&crc_once, crc_init);
+	return crc_fn == crc32c_sb8 ? "slice-by-8" : "sse4.2";
+}
+
+/**
+ * csum_error() - Count a checksum mismatch and report the first ones
+ */
+__attribute__((format(printf, 3, 4)))
+static int csum_error(struct ext_fs *fs, int kind, const char *fmt, ...)
+{
+	char msg[128];
+	va_list ap;
+	uint64_t n;
+
+	__atomic_fetch_add(&fs->csum_errors[kind], 1, __ATOMIC_RELAXED);
+	n = __atomic_add_fetch(&fs->csum_reported, 1, __ATOMIC_RELAXED);
+	if (n > EXT_CSUM_REPORT)
+		return -1;
+	va_start(ap, fmt);
+	vsnprintf(msg, sizeof(msg), fmt, ap);
+	va_end(ap);
+	printf("Checksum error in %s%s\n", msg, n == EXT_CSUM_REPORT ?
+			", further errors are only counted" : "");
+	return -1;
+}
+
+/**
+ * ext_csum_setup() - Find the checksum seed and check the super block
+ *
+ * Checksums are only verified with metadata_csum and crc32c. The seed is
+ * the crc of the UUID unless csum_seed stores it, so that the UUID can
+ * change without rewriting every checksum.
+ */
+void ext_csum_setup(struct ext_fs *fs)
+{
+	uint32_t crc;
+
+	fs->csum = 0;
+	if (!ext_has_ro_compat(fs, EXT_FEATURE_RO_COMPAT_METADATA_CSUM))
+		return;
+	if (fs->sb.s_checksum_type != EXT_CSUM_CRC32C) {
+		printf("Unknown checksum type %u, metadata is not verified\n",
+				fs->sb.s_checksum_type);
+		return;
+	}
+	fs->csum = 1;
+	if (ext_has_incompat(fs, EXT_FEATURE_INCOMPAT_CSUM_SEED))
+		fs->csum_seed = le32toh(fs->sb.s_checksum_seed);
+	else
+		fs->csum_seed = ext_crc32c(~0U, fs->sb.s_uuid,
+				sizeof(fs->sb.s_uuid));
+
+	crc = ext_crc32c(~0U, &fs->sb, offsetof(struct ext_super_disk,
+				s_checksum));
+	if (crc != le32toh(fs->sb.s_checksum))
+		csum_error(fs, EXT_CSUM_SUPER, "the super block");
+}
+
+/**
+ * ext_csum_desc() - Check a group descriptor
+ *
+ * The low 16 bits of the crc of the group number and the descriptor,
+ * with bg_checksum taken as zero.
+ *
+ * @desc	: Descriptor of desc_size bytes as on disk
+ */
+int ext_csum_desc(struct ext_fs *fs, uint32_t group, const void *desc)
+{
+	const struct ext_group_desc_disk *d = desc;
+	const size_t off = offsetof(struct ext_group_desc_disk, bg_checksum);
+	const uint16_t zero = 0;
+	uint32_t le = htole32(group), crc;
+
+	if (!fs->csum)
+		return 0;
+	crc = ext_crc32c(fs->csum_seed, &le, sizeof(le));
+	crc = ext_crc32c(crc, d, off);
+	crc = ext_crc32c(crc, &zero, sizeof(zero));
+	crc = ext_crc32c(crc, (const unsigned char *)d + off + 2,
+			fs->desc_size - off - 2);
+	if ((crc & 0xffff) == le16toh(d->bg_checksum))
+		return 0;
+	return csum_error(fs, EXT_CSUM_DESC, "group descriptor %u", group);
+}
+
+// Descriptors of 32 bytes only hold the low half of bitmap checksums
+static inline uint32_t bitmap_mask(const struct ext_fs *fs)
+{
+	return fs->desc_size >= EXT_GDT_ENTRY_SIZE_64 ? 0xffffffff : 0xffff;
+}
+
+/**
+ * ext_csum_block_bitmap() - Check the block bitmap of a group
+ *
+ * The checksum covers one bit per cluster of the group, a group with
+ * BLOCK_UNINIT has no bitmap on disk and nothing to check.
+ */
+int ext_csum_block_bitmap(struct ext_fs *fs, uint32_t group,
+		const unsigned char *bitmap)
+{
+	uint32_t per_group = le32toh(fs->sb.s_clusters_per_group), crc;
+
+	if (!fs->csum || (fs->gd[group].flags & EXT_BG_BLOCK_UNINIT))
+		return 0;
+	if (per_group == 0 || per_group / 8 > fs->block_size)
+		per_group = fs->blocks_per_group;
+	crc = ext_crc32c(fs->csum_seed, bitmap, per_group / 8);
+	if ((crc & bitmap_mask(fs)) == fs->gd[group].block_bitmap_csum)
+		return 0;
+	return csum_error(fs, EXT_CSUM_BLOCK_BITMAP, "block bitmap of group %u",
+			group);
+}
+
+// Check the inode bitmap of a group, one bit per inode of the group
+int ext_csum_inode_bitmap(struct ext_fs *fs, uint32_t group,
+		const unsigned char *bitmap)
+{
+	uint32_t crc;
+
+	if (!fs->csum || (fs->gd[group].flags & EXT_BG_INODE_UNINIT))
+		return 0;
+	crc = ext_crc32c(fs->csum_seed, bitmap, fs->inodes_per_group / 8);
+	if ((crc & bitmap_mask(fs)) == fs->gd[group].inode_bitmap_csum)
+		return 0;
+	return csum_error(fs, EXT_CSUM_INODE_BITMAP, "inode bitmap of group %u",
+			group);
+}
+
+/**
+ * ext_csum_inode_seed() - Seed of the checksums of an inode and its blocks
+ *
+ * The inode itself, its extent blocks and its directory blocks all start
+ * from the crc of the inode number and generation.
+ */
+uint32_t ext_csum_inode_seed(const struct ext_fs *fs, uint32_t ino,
+		const struct ext_inode_disk *inode)
+{
+	uint32_t le = htole32(ino), crc;
+
+	if (!fs->csum)
+		return 0;
+	crc = ext_crc32c(fs->csum_seed, &le, sizeof(le));
+	return ext_crc32c(crc, &inode->i_generation, sizeof(inode->i_generation));
+}
+
+/**
+ * ext_csum_inode() - Check an inode
+ *
+ * The crc covers the whole inode_size bytes with the checksum fields
+ * taken as zero. The high 16 bits are only stored if i_extra_isize
+ * covers i_checksum_hi. An inode of zeros was never used and has no
+ * checksum, as in e2fsprogs.
+ */
+int ext_csum_inode(struct ext_fs *fs, uint32_t ino,
+		const struct ext_inode_disk *inode)
+{
+	static const unsigned char zeros[128];
+	const unsigned char *p = (const unsigned char *)inode;
+	const size_t lo = offsetof(struct ext_inode_disk, i_checksum_lo);
+	const size_t hi = offsetof(struct ext_inode_disk, i_checksum_hi);
+	const uint16_t zero = 0;
+	uint32_t crc, stored = le16toh(inode->i_checksum_lo), mask = 0xffff;
+	size_t off = lo + 2;
+
+	if (!fs->csum)
+		return 0;
+	crc = ext_csum_inode_seed(fs, ino, inode);
+	crc = ext_crc32c(crc, p, lo);
+	crc = ext_crc32c(crc, &zero, sizeof(zero));
+	crc = ext_crc32c(crc, p + off, 128 - off);
+	if (fs->inode_size > 128) {
+		crc = ext_crc32c(crc, p + 128, hi - 128);
+		off = hi;
+		if (128 + (size_t)le16toh(inode->i_extra_isize) >= hi + 2) {
+			crc = ext_crc32c(crc, &zero, sizeof(zero));
+			off += 2;
+			stored |= (uint32_t)le16toh(inode->i_checksum_hi) << 16;
+			mask = 0xffffffff;
+		}
+		crc = ext_crc32c(crc, p + off, fs->inode_size - off);
+	}
+	if ((crc & mask) == stored || memcmp(p, zeros, sizeof(zeros)) == 0)
+		return 0;
+	return csum_error(fs, EXT_CSUM_INODE, "inode %u", ino);
+}
+
+/**
+ * ext_csum_extent() - Check an extent tree block
+ *
+ * The checksum follows the last possible entry, eh_max of them.
+ *
+ * @ino		: Owner of the block, for the report
+ * @seed	: From ext_csum_inode_seed()
+ * @blk		: Block number, for the report
+ */
+int ext_csum_extent(struct ext_fs *fs, uint32_t ino, uint32_t seed,
+		uint64_t blk, const void *block)
+{
+	const struct ext_extent_header *eh = block;
+	size_t off = sizeof(*eh) + le16toh(eh->eh_max) * sizeof(struct ext_extent);
+	uint32_t stored;
+
+	if (!fs->csum)
+		return 0;
+	if (off + sizeof(stored) <= fs->block_size) {
+		memcpy(&stored, (const unsigned char *)block + off, sizeof(stored));
+		if (ext_crc32c(seed, block, off) == le32toh(stored))
+			return 0;
+	}
+	return csum_error(fs, EXT_CSUM_EXTENT, "extent block %llu of inode %u",
+			(unsigned long long)blk, ino);
+}
+
+/**
+ * dx_count_offset() - Offset of the count and limit of an htree node
+ *
+ * The root has . and .. before its dx_root_info, interior nodes look
+ * like one empty entry covering the block.
+ *
+ * @ret		: Offset, 0 if the block is not an htree node
+ */
+static unsigned int dx_count_offset(const struct ext_fs *fs,
+		const unsigned char *block)
+{
+	const struct ext_dir_entry_disk *de = (const void *)block;
+	unsigned int rec_len = le16toh(de->rec_len);
+
+	if (rec_len == fs->block_size || (rec_len == 0 && fs->block_size == 65536))
+		return 8;
+	if (rec_len != 12)
+		return 0;
+	de = (const void *)(block + 12);
+	if (le16toh(de->rec_len) != fs->block_size - 12)
+		return 0;
+	// dx_root_info : reserved_zero, hash_version, info_length
+	if (memcmp(block + 24, "\0\0\0\0", 4) != 0 || block[24 + 5] != 8)
+		return 0;
+	return 32;
+}
+
+/**
+ * ext_csum_dir() - Check a directory block
+ *
+ * Leaf blocks end in a fake entry with the checksum of everything before
+ * it. Htree nodes have a tail after their limit entries instead, with
+ * the checksum of the used entries and the tail with a zero checksum.
+ *
+ * @ino		: Directory, for the report
+ * @seed	: From ext_csum_inode_seed()
+ * @blk		: Block number, for the report
+ */
+int ext_csum_dir(struct ext_fs *fs, uint32_t ino, uint32_t seed,
+		uint64_t blk, const unsigned char *block)
+{
+	const struct dir_tail *t;
+	const struct dx_tail *dt;
+	const uint32_t zero = 0;
+	unsigned int off, count, limit;
+	uint32_t crc;
+
+	if (!fs->csum)
+		return 0;
+	t = (const void *)(block + fs->block_size - sizeof(*t));
+	if (t->reserved_zero1 == 0 && le16toh(t->rec_len) == sizeof(*t) &&
+			t->reserved_zero2 == 0 && t->reserved_ft == EXT_DIR_TAIL_FT) {
+		crc = ext_crc32c(seed, block, fs->block_size - sizeof(*t));
+		if (crc == le32toh(t->checksum))
+			return 0;
+	} else if ((off = dx_count_offset(fs, block)) != 0) {
+		limit = le16toh(*(const uint16_t *)(block + off));
+		count = le16toh(*(const uint16_t *)(block + off + 2));
+		if (count <= limit && off + limit * 8 + sizeof(*dt) <= fs->block_size) {
+			dt = (const void *)(block + off + limit * 8);
+			crc = ext_crc32c(seed, block, off + count * 8);
+			crc = ext_crc32c(crc, dt, offsetof(struct dx_tail, checksum));
+			crc = ext_crc32c(crc, &zero, sizeof(zero));
+			if (crc == le32toh(dt->checksum))
+				return 0;
+		}
+	}
+	return csum_error(fs, EXT_CSUM_DIR, "directory block %llu of inode %u",
+			(unsigned long long)blk, ino);
+}
+
+// Print the number of checksum errors found so far, if there were any
+void ext_csum_print(const struct ext_fs *fs)
+{
+	uint64_t total = 0;
+	const char *sep = "";
+	int i;
+
+	for (i = 0; i < EXT_CSUM_KINDS; i++)
+		total += fs->csum_errors[i];
+	if (total == 0)
+		return;
+	printf("Metadata checksum errors : %llu (",
+			(unsigned long long)total);
+	for (i = 0; i < EXT_CSUM_KINDS; i++) {
+		if (fs->csum_errors[i] == 0)
+			continue;
+		printf("%s%s %llu", sep, kind_names[i],
+				(unsigned long long)fs->csum_errors[i]);
+		sep = ", ";
+	}
+	printf(")\n");
+}
+
+struct verify {
+	struct ext_fs *fs;
+	uint32_t next_group;		// Next group to check, taken atomically
+	uint64_t bitmaps;		// Counters, added to atomically
+	uint64_t inodes;
+	uint64_t bytes;
+	uint64_t failed;		// Groups that could not be read
+};
+
+/**
+ * verify_group() - Check the bitmaps and the inode table of a group
+ *
+ * ext_read_itable() checks every inode it reads.
+ *
+ * @itable	: Room for a whole inode table
+ */
+static int verify_group(struct verify *v, uint32_t group, unsigned char *itable)
+{
+	struct ext_fs *fs = v->fs;
+	const struct ext_group *gd = &fs->gd[group];
+	const unsigned char *bitmap;
+	long n;
+
+	if (!(gd->flags & EXT_BG_BLOCK_UNINIT)) {
+		bitmap = ext_block(fs, gd->block_bitmap);
+		if (!bitmap) {
+			printf("Failed to read block bitmap of group %u\n", group);
+			return -1;
+		}
+		ext_csum_block_bitmap(fs, group, bitmap);
+		ext_put(fs, bitmap);
+		__atomic_fetch_add(&v->bitmaps, 1, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&v->bytes, fs->block_size, __ATOMIC_RELAXED);
+	}
+	if (gd->flags & EXT_BG_INODE_UNINIT)
+		return 0;
+	bitmap = ext_block(fs, gd->inode_bitmap);
+	if (!bitmap) {
+		printf("Failed to read inode bitmap of group %u\n", group);
+		return -1;
+	}
+	ext_csum_inode_bitmap(fs, group, bitmap);
+	ext_put(fs, bitmap);
+	__atomic_fetch_add(&v->bitmaps, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&v->bytes, fs->block_size, __ATOMIC_RELAXED);
+
+	n = ext_read_itable(fs, group, itable);
+	if (n < 0)
+		return -1;
+	__atomic_fetch_add(&v->inodes, n, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&v->bytes, (uint64_t)n * fs->inode_size,
+			__ATOMIC_RELAXED);
+	return 0;
+}
+
+static void *verify_thread(void *arg)
+{
+	struct verify *v = arg;
+	unsigned char *itable;
+	uint32_t group;
+
+	itable = malloc((size_t)v->fs->inodes_per_group * v->fs->inode_size);
+	if (!itable)
+		printf("Failed to allocate memory\n");
+	while (1) {
+		group = __atomic_fetch_add(&v->next_group, 1, __ATOMIC_RELAXED);
+		if (group >= v->fs->groups)
+			break;
+		if (!itable || verify_group(v, group, itable) < 0)
+			__atomic_fetch_add(&v->failed, 1, __ATOMIC_RELAXED);
+	}
+	free(itable);
+	return NULL;
+}
+
+/**
+ * ext_csum_verify() - Check the checksums of all group metadata
+ *
+ * The super block and the group descriptors were checked when the file
+ * system was opened. Threads take the groups in turn and check their
+ * block and inode bitmaps and every inode of the used part of their
+ * inode table.
+ *
+ * @ret		: 0 if everything matches, 1 on checksum errors, -1 if
+ *		  something could not be read
+ */
+int ext_csum_verify(struct ext_fs *fs, int nthreads)
+{
+	struct verify v;
+	pthread_t *tids;
+	double start = now(), elapsed;
+	uint64_t errors = 0;
+	int i, started;
+
+	if (!fs->csum) {
+		printf("No metadata checksums (metadata_csum) to verify\n");
+		return 0;
+	}
+	memset(&v, 0x00, sizeof(v));
+	v.fs = fs;
+	if ((uint32_t)nthreads > fs->groups)
+		nthreads = fs->groups;
+	tids = calloc(nthreads, sizeof(*tids));
+	if (!tids) {
+		printf("Failed to allocate memory\n");
+		return -1;
+	}
+	for (started = 0; started < nthreads; started++)
+		if (pthread_create(&tids[started], NULL, verify_thread, &v))
+			break;
+	if (started == 0)
+		verify_thread(&v);
+	for (i = 0; i < started; i++)
+		pthread_join(tids[i], NULL);
+	free(tids);
+	elapsed = now() - start;
+
+	printf("Checked the super block, %u group descriptors, %llu bitmaps "
+			"and %llu inodes\n", fs->groups,
+			(unsigned long long)v.bitmaps, (unsigned long long)v.inodes);
+	printf("Read %.1f MB of metadata in %.2f s with %d threads (%.1f MB/s), "
+			"crc32c : %s\n", v.bytes / 1e6, elapsed, started ? started : 1,
+			v.bytes / 1e6 / (elapsed > 0 ? elapsed : 1), ext_crc32c_impl());
+	for (i = 0; i < EXT_CSUM_KINDS; i++)
+		errors += fs->csum_errors[i];
+	if (errors == 0)
+		printf("All metadata checksums match\n");
+	if (v.failed) {
+		printf("%llu groups could not be read\n",
+				(unsigned long long)v.failed);
+		return -1;
+	}
+	return errors ? 1 : 0;
+}
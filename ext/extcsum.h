@@ -0,0 +1,53 @@
+/*
+ * extcsum - Metadata checksums of ext4 file systems
+ *
+ * Written in 2026 by the ext3dump contributors
+ *
+ * To the extent possible under law, the author(s) have dedicated
+ * all copyright and related and neighboring rights to this software
+ * to the public domain worldwide. This software is distributed
+ * without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication
+ * along with this software.
+ * If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+#ifndef EXTCSUM_H
+#define EXTCSUM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "extimg.h"
+
+#define EXT_CRC32C_POLY		0x82F63B78	// Reversed Castagnoli polynomial
+#define EXT_CSUM_CRC32C		1	// s_checksum_type of crc32c
+#define EXT_CSUM_REPORT		20	// Checksum errors printed, the rest counted
+
+/*
+ * Every check returns 0 if the checksum matches or the file system has
+ * no metadata_csum, and -1 after counting and reporting a mismatch in
+ * fs->csum_errors. The caller goes on using the data either way.
+ */
+
+uint32_t ext_crc32c(uint32_t crc, const void *buf, size_t len);
+const char *ext_crc32c_impl(void);
+void ext_csum_setup(struct ext_fs *fs);
+int ext_csum_desc(struct ext_fs *fs, uint32_t group, const void *desc);
+int ext_csum_block_bitmap(struct ext_fs *fs, uint32_t group,
+		const unsigned char *bitmap);
+int ext_csum_inode_bitmap(struct ext_fs *fs, uint32_t group,
+		const unsigned char *bitmap);
+uint32_t ext_csum_inode_seed(const struct ext_fs *fs, uint32_t ino,
+		const struct ext_inode_disk *inode);
+int ext_csum_inode(struct ext_fs *fs, uint32_t ino,
+		const struct ext_inode_disk *inode);
+int ext_csum_extent(struct ext_fs *fs, uint32_t ino, uint32_t seed,
+		uint64_t blk, const void *block);
+int ext_csum_dir(struct ext_fs *fs, uint32_t ino, uint32_t seed,
+		uint64_t blk, const unsigned char *block);
+void ext_csum_print(const struct ext_fs *fs);
+int ext_csum_verify(struct ext_fs *fs, int nthreads);
+
+#endif
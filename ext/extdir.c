@@ -0,0 +1,595 @@
+/*
+ * extdir - Directory lookup and path resolution for ext2/3/4 images
+ *
+ * Written in 2026 by the ext3dump contributors
+ *
+ * To the extent possible under law, the author(s) have dedicated
+ * all copyright and related and neighboring rights to this software
+ * to the public domain worldwide. This software is distributed
+ * without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication
+ * along with this software.
+ * If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "extdir.h"
+#include "extfile.h"
+#include "extcsum.h"
+
+_Static_assert(sizeof(struct ext_dx_root_info) == 8, "dx_root layout");
+
+/*
+ * Directory hashes, as used to order the htree. The name is packed into
+ * 32 bit words padded with its length, then mixed into a seed with a
+ * reduced MD4, TEA or the original ext3 "hack" hash.
+ */
+
+#define ROL32(x, s)	(((x) << (s)) | ((x) >> (32 - (s))))
+
+static void str2hashbuf(const char *msg, size_t len, uint32_t *buf, int num,
+		int is_signed)
+{
+	uint32_t pad, val;
+	size_t i;
+	int c;
+
+	pad = (uint32_t)len | ((uint32_t)len << 8);
+	pad |= pad << 16;
+
+	val = pad;
+	if (len > (size_t)num * 4)
+		len = num * 4;
+	for (i = 0; i < len; i++) {
+		c = is_signed ? (int)(signed char)msg[i] : (int)(unsigned char)msg[i];
+		val = c + (val << 8);
+		if ((i % 4) == 3) {
+			*buf++ = val;
+			val = pad;
+			num--;
+		}
+	}
+	if (--num >= 0)
+		*buf++ = val;
+	while (--num >= 0)
+		*buf++ = pad;
+}
+
+static uint32_t dx_hack_hash(const char *name, size_t len, int is_signed)
+{
+	uint32_t hash, hash0 = 0x12a3fe2d, hash1 = 0x37abe8f9;
+	size_t i;
+	int c;
+
+	for (i = 0; i < len; i++) {
+		c = is_signed ? (int)(signed char)name[i] : (int)(unsigned char)name[i];
+		hash = hash1 + (hash0 ^ (uint32_t)(c * 7152373));
+		if (hash & 0x80000000)
+			hash -= 0x7fffffff;
+		hash1 = hash0;
+		hash0 = hash;
+	}
+	return hash0 << 1;
+}
+
+static void tea_transform(uint32_t *buf, const uint32_t *in)
+{
+	uint32_t sum = 0, b0 = buf[0], b1 = buf[1];
+	uint32_t a = in[0], b = in[1], c = in[2], d = in[3];
+	int n = 16;
+
+	do {
+		sum += 0x9E3779B9;
+		b0 += ((b1 << 4) + a) ^ (b1 + sum) ^ ((b1 >> 5) + b);
+		b1 += ((b0 << 4) + c) ^ (b0 + sum) ^ ((b0 >> 5) + d);
+	} while (--n);
+
+	buf[0] += b0;
+	buf[1] += b1;
+}
+
+#define F(x, y, z)	((z) ^ ((x) & ((y) ^ (z))))
+#define G(x, y, z)	(((x) & (y)) + (((x) ^ (y)) & (z)))
+#define H(x, y, z)	((x) ^ (y) ^ (z))
+#define ROUND(f, a, b, c, d, x, s) \
+	(a += f(b, c, d) + (x), a = ROL32(a, s))
+#define K2	0x5A827999
+#define K3	0x6ED9EBA1
+
+// MD4 with three rounds of 8 steps over 8 words
+static void half_md4_transform(uint32_t *buf, const uint32_t *in)
+{
+	uint32_t a = buf[0], b = buf[1], c = buf[2], d = buf[3];
+
+	ROUND(F, a, b, c, d, in[0], 3);
+	ROUND(F, d, a, b, c, in[1], 7);
+	ROUND(F, c, d, a, b, in[2], 11);
+	ROUND(F, b, c, d, a, in[3], 19);
+	ROUND(F, a, b, c, d, in[4], 3);
+	ROUND(F, d, a, b, c, in[5], 7);
+	ROUND(F, c, d, a, b, in[6], 11);
+	ROUND(F, b, c, d, a, in[7], 19);
+
+	ROUND(G, a, b, c, d, in[1] + K2, 3);
+	ROUND(G, d, a, b, c, in[3] + K2, 5);
+	ROUND(G, c, d, a, b, in[5] + K2, 9);
+	ROUND(G, b, c, d, a, in[7] + K2, 13);
+	ROUND(G, a, b, c, d, in[0] + K2, 3);
+	ROUND(G, d, a, b, c, in[2] + K2, 5);
+	ROUND(G, c, d, a, b, in[4] + K2, 9);
+	ROUND(G, b, c, d, a, in[6] + K2, 13);
+
+	ROUND(H, a, b, c, d, in[3] + K3, 3);
+	ROUND(H, d, a, b, c, in[7] + K3, 9);
+	ROUND(H, c, d, a, b, in[2] + K3, 11);
+	ROUND(H, b, c, d, a, in[6] + K3, 15);
+	ROUND(H, a, b, c, d, in[1] + K3, 3);
+	ROUND(H, d, a, b, c, in[5] + K3, 9);
+	ROUND(H, c, d, a, b, in[0] + K3, 11);
+	ROUND(H, b, c, d, a, in[4] + K3, 15);
+
+	buf[0] += a;
+	buf[1] += b;
+	buf[2] += c;
+	buf[3] += d;
+}
+
+/**
+ * ext_dir_hash() - Hash a name the way the htree of a directory does
+ *
+ * The lowest bit is always 0, it marks hash collisions in index entries.
+ *
+ * @version	: Hash version from dx_root, with EXT_HASH_UNSIGNED added
+ *		  for the unsigned variants
+ */
+uint32_t ext_dir_hash(const struct ext_fs *fs, int version, const char *name,
+		size_t len)
+{
+	uint32_t buf[4] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476 };
+	uint32_t in[8], hash;
+	int is_signed = version < EXT_HASH_UNSIGNED, i;
+
+	// A zero seed means the default one
+	for (i = 0; i < 4; i++) {
+		if (fs->sb.s_hash_seed[i] != 0)
+			break;
+	}
+	if (i < 4) {
+		for (i = 0; i < 4; i++)
+			buf[i] = le32toh(fs->sb.s_hash_seed[i]);
+	}
+
+	switch (version % EXT_HASH_UNSIGNED) {
+	case EXT_HASH_LEGACY:
+		hash = dx_hack_hash(name, len, is_signed);
+		break;
+	case EXT_HASH_HALF_MD4:
+		while (1) {
+			str2hashbuf(name, len, in, 8, is_signed);
+			half_md4_transform(buf, in);
+			if (len <= 32)
+				break;
+			len -= 32;
+			name += 32;
+		}
+		hash = buf[1];
+		break;
+	default:
+		while (1) {
+			str2hashbuf(name, len, in, 4, is_signed);
+			tea_transform(buf, in);
+			if (len <= 16)
+				break;
+			len -= 16;
+			name += 16;
+		}
+		hash = buf[0];
+		break;
+	}
+
+	hash &= ~1;
+	// The end of directory marker is not a valid hash
+	if (hash == (0x7fffffffU << 1))
+		hash = (0x7fffffffU - 1) << 1;
+	return hash;
+}
+
+/**
+ * find_entry() - Look for a name in one directory block
+ *
+ * @ret		: Inode of the entry, 0 if it is not in the block, -1 if the
+ *		  block is corrupt
+ */
+static int64_t find_entry(const struct ext_fs *fs, const unsigned char *blk,
+		const char *name, size_t len)
+{
+	const struct ext_dir_entry_disk *de;
+	unsigned int off = 0, rec_len, name_len;
+	int filetype = ext_has_incompat(fs, EXT_FEATURE_INCOMPAT_FILETYPE);
+
+	while (off + 8 <= fs->block_size) {
+		de = (const struct ext_dir_entry_disk *)(blk + off);
+		rec_len = le16toh(de->rec_len);
+		// Block sizes of 64k store 65536 as 0
+		if (rec_len == 0 && fs->block_size == 65536)
+			rec_len = 65536;
+		name_len = de->name_len;
+		if (!filetype)
+			name_len |= de->file_type << 8;
+		if (rec_len < 8 || rec_len % 4 || off + rec_len > fs->block_size ||
+				name_len + 8 > rec_len)
+			return -1;
+		if (de->inode != 0 && name_len == len &&
+				memcmp(de->name, name, len) == 0)
+			return le32toh(de->inode);
+		off += rec_len;
+	}
+	return 0;
+}
+
+/**
+ * find_in_block() - Read one logical block of a directory and look for
+ * the name in it
+ *
+ * @dir		: The directory and its checksum seed, for checking the block
+ */
+static int64_t find_in_block(struct ext_fs *fs, uint32_t dir, uint32_t seed,
+		const struct block_map *map, uint64_t logical, const char *name,
+		size_t len, struct ext_dir_stats *stats)
+{
+	const unsigned char *blk;
+	uint64_t physical = ext_map_lookup(map, logical);
+	int64_t res;
+
+	// A hole in a directory has no entries
+	if (physical == 0)
+		return 0;
+	blk = ext_block(fs, physical);
+	if (!blk)
+		return -1;
+	stats->blocks++;
+	ext_csum_dir(fs, dir, seed, physical, blk);
+	res = find_entry(fs, blk, name, len);
+	ext_put(fs, blk);
+	return res;
+}
+
+// Position in one level of an htree, from the root down
+struct dx_frame {
+	const unsigned char *blk;
+	const struct ext_dx_entry *entries;
+	uint32_t count;
+	uint32_t at;			// Entry followed down
+};
+
+/**
+ * dx_read() - Read an index block of the htree
+ *
+ * @ret		: 0 on success, -1 on error, -2 if the block is not mapped
+ */
+static int dx_read(struct ext_fs *fs, uint32_t dir, uint32_t seed,
+		const struct block_map *map, uint32_t block,
+		struct dx_frame *f, struct ext_dir_stats *stats)
+{
+	uint64_t physical = ext_map_lookup(map, block);
+
+	if (physical == 0)
+		return -2;
+	f->blk = ext_block(fs, physical);
+	if (!f->blk)
+		return -1;
+	stats->blocks++;
+	ext_csum_dir(fs, dir, seed, physical, f->blk);
+	return 0;
+}
+
+/**
+ * dx_entries() - Find the entries of an index block and check them
+ *
+ * @off		: Offset of the count and limit in the block
+ * @ret		: 0 if they are sane, -2 if not
+ */
+static int dx_entries(struct ext_fs *fs, struct dx_frame *f, unsigned int off)
+{
+	const struct ext_dx_countlimit *cl =
+		(const struct ext_dx_countlimit *)(f->blk + off);
+	uint32_t limit = le16toh(cl->limit);
+
+	f->entries = (const struct ext_dx_entry *)(f->blk + off);
+	f->count = le16toh(cl->count);
+	if (f->count == 0 || f->count > limit ||
+			off + limit * sizeof(*f->entries) > fs->block_size)
+		return -2;
+	return 0;
+}
+
+static inline uint32_t dx_block(const struct dx_frame *f)
+{
+	return le32toh(f->entries[f->at].block) & 0x0fffffff;
+}
+
+/**
+ * dx_lookup() - Look up a name through the htree of a directory
+ *
+ * Every index level is a sorted array of (hash, block) pairs, the search
+ * follows the last entry whose hash is not larger than the hash of the
+ * name down to a leaf, which is a normal directory block. If the name
+ * continues into the next leaf because of a hash collision (the next
+ * entry has the same hash with the low bit set), that leaf is read too.
+ * The next entry may be in the next index node, as in the kernel's
+ * ext4_htree_next_block() the levels above are then moved on as well.
+ *
+ * @ret		: Inode, 0 if not found, -1 on error, -2 if the index cannot
+ *		  be used and the directory has to be scanned linearly
+ */
+static int64_t dx_lookup(struct ext_fs *fs, uint32_t dir, uint32_t seed,
+		const struct block_map *map, const char *name, size_t len,
+		struct ext_dir_stats *stats)
+{
+	struct dx_frame frames[EXT_DX_MAX_LEVELS];
+	const struct ext_dx_root_info *info;
+	struct dx_frame *f;
+	uint32_t hash, lo, hi, mid;
+	unsigned int off = 24, levels = 1, level;
+	int version;
+	int64_t res;
+
+	memset(frames, 0x00, sizeof(frames));
+	res = dx_read(fs, dir, seed, map, 0, &frames[0], stats);
+	if (res < 0)
+		return res;
+
+	info = (const struct ext_dx_root_info *)(frames[0].blk + off);
+	version = info->hash_version;
+	if (info->reserved_zero != 0 || version > EXT_HASH_TEA ||
+			info->info_length != 8 ||
+			info->indirect_levels + 1 > EXT_DX_MAX_LEVELS) {
+		res = -2;
+		goto out;
+	}
+	levels = info->indirect_levels + 1;
+	if (le32toh(fs->sb.s_flags) & EXT_FLAGS_UNSIGNED_HASH)
+		version += EXT_HASH_UNSIGNED;
+	hash = ext_dir_hash(fs, version, name, len);
+	off += info->info_length;
+
+	for (level = 0; ; level++) {
+		f = &frames[level];
+		res = dx_entries(fs, f, off);
+		if (res < 0)
+			goto out;
+
+		// Last entry with a hash not above ours, entry 0 covers hash 0
+		lo = 1;
+		hi = f->count - 1;
+		while (lo <= hi) {
+			mid = lo + (hi - lo) / 2;
+			if (le32toh(f->entries[mid].hash) > hash)
+				hi = mid - 1;
+			else
+				lo = mid + 1;
+		}
+		f->at = lo - 1;
+		if (level + 1 == levels)
+			break;
+
+		// Interior node, a fake empty entry covering the block
+		res = dx_read(fs, dir, seed, map, dx_block(f), &frames[level + 1],
+				stats);
+		if (res < 0)
+			goto out;
+		off = 8;
+	}
+
+	while (1) {
+		res = find_in_block(fs, dir, seed, map, dx_block(&frames[levels - 1]),
+				name, len, stats);
+		if (res != 0)
+			break;
+
+		// The next entry, going up while a node has no more
+		for (level = levels - 1; ++frames[level].at >= frames[level].count;
+				level--) {
+			if (level == 0)
+				goto out;
+		}
+		// A collision continues in the next leaf, flagged by the low bit
+		f = &frames[level];
+		if (le32toh(f->entries[f->at].hash) != (hash | 1))
+			break;
+
+		// Down to the first leaf below the entry
+		for (; level + 1 < levels; level++) {
+			ext_put(fs, frames[level + 1].blk);
+			frames[level + 1].blk = NULL;
+			res = dx_read(fs, dir, seed, map, dx_block(&frames[level]),
+					&frames[level + 1], stats);
+			if (res == 0)
+				res = dx_entries(fs, &frames[level + 1], 8);
+			if (res < 0)
+				goto out;
+			frames[level + 1].at = 0;
+		}
+	}
+out:
+	for (level = 0; level < levels; level++)
+		if (frames[level].blk)
+			ext_put(fs, frames[level].blk);
+	return res;
+}
+
+/**
+ * ext_dir_lookup() - Find a name in a directory
+ *
+ * Directories with an htree (dir_index) are searched through the index,
+ * which reads one block per index level and one leaf. Otherwise, or if
+ * the index is damaged, every block is scanned.
+ *
+ * @dir		: Inode of the directory
+ * @ino		: Inode of the name, 0 if it does not exist
+ * @ret		: 0 on success, -1 on error
+ */
+int ext_dir_lookup(struct ext_fs *fs, uint32_t dir, const char *name,
+		size_t len, uint32_t *ino, struct ext_dir_stats *stats)
+{
+	const struct ext_inode_disk *inode;
+	struct block_map map = { NULL, 0, 0 };
+	uint64_t nblocks, b;
+	uint32_t seed;
+	int64_t res = -2;
+	int indexed;
+
+	*ino = 0;
+	inode = ext_inode(fs, dir);
+	if (!inode)
+		return -1;
+	if ((le16toh(inode->i_mode) & EXT_S_IFMT) != EXT_S_IFDIR) {
+		printf("Inode %u is not a directory\n", dir);
+		ext_put(fs, inode);
+		return -1;
+	}
+	indexed = (ext_inode_flags(inode) & EXT_INDEX_FL) &&
+		ext_has_compat(fs, EXT_FEATURE_COMPAT_DIR_INDEX);
+	nblocks = (ext_inode_size(inode) + fs->block_size - 1) / fs->block_size;
+	seed = ext_csum_inode_seed(fs, dir, inode);
+	if (ext_map_file(fs, dir, inode, &map) < 0) {
+		ext_put(fs, inode);
+		free(map.r);
+		return -1;
+	}
+	ext_put(fs, inode);
+
+	// . and .. are only in block 0, which the index does not point to
+	if (indexed && !(len <= 2 && memcmp(name, "..", len) == 0)) {
+		res = dx_lookup(fs, dir, seed, &map, name, len, stats);
+		if (res != -2)
+			stats->htree++;
+	}
+	if (res == -2) {
+		stats->linear++;
+		for (b = 0, res = 0; b < nblocks && res == 0; b++)
+			res = find_in_block(fs, dir, seed, &map, b, name, len,
+					stats);
+	}
+	free(map.r);
+
+	if (res < 0) {
+		printf("Corrupt directory %u\n", dir);
+		return -1;
+	}
+	*ino = res;
+	return 0;
+}
+
+/**
+ * ext_dir_iterate() - Call fn for every entry of a directory
+ *
+ * All blocks are walked in logical order, including the index blocks of
+ * an htree, which look like blocks with a single empty entry. Deleted
+ * entries are skipped, . and .. are passed on.
+ *
+ * @ret		: 0, -1 on error, or the non zero return of fn
+ */
+int ext_dir_iterate(struct ext_fs *fs, uint32_t dir, ext_dir_fn fn, void *arg)
+{
+	const struct ext_inode_disk *inode;
+	const struct ext_dir_entry_disk *de;
+	const unsigned char *blk;
+	struct block_map map = { NULL, 0, 0 };
+	unsigned int off, rec_len, name_len;
+	int filetype = ext_has_incompat(fs, EXT_FEATURE_INCOMPAT_FILETYPE);
+	uint64_t nblocks, b, physical;
+	uint32_t seed;
+	int ret = 0;
+
+	inode = ext_inode(fs, dir);
+	if (!inode)
+		return -1;
+	if ((le16toh(inode->i_mode) & EXT_S_IFMT) != EXT_S_IFDIR) {
+		printf("Inode %u is not a directory\n", dir);
+		ext_put(fs, inode);
+		return -1;
+	}
+	nblocks = (ext_inode_size(inode) + fs->block_size - 1) / fs->block_size;
+	seed = ext_csum_inode_seed(fs, dir, inode);
+	if (ext_map_file(fs, dir, inode, &map) < 0) {
+		ext_put(fs, inode);
+		free(map.r);
+		return -1;
+	}
+	ext_put(fs, inode);
+
+	for (b = 0; b < nblocks && ret == 0; b++) {
+		physical = ext_map_lookup(&map, b);
+		if (physical == 0)
+			continue;
+		blk = ext_block(fs, physical);
+		if (!blk) {
+			ret = -1;
+			break;
+		}
+		ext_csum_dir(fs, dir, seed, physical, blk);
+		for (off = 0; off + 8 <= fs->block_size && ret == 0; off += rec_len) {
+			de = (const struct ext_dir_entry_disk *)(blk + off);
+			rec_len = le16toh(de->rec_len);
+			if (rec_len == 0 && fs->block_size == 65536)
+				rec_len = 65536;
+			name_len = de->name_len;
+			if (!filetype)
+				name_len |= de->file_type << 8;
+			if (rec_len < 8 || rec_len % 4 ||
+					off + rec_len > fs->block_size ||
+					name_len + 8 > rec_len) {
+				printf("Corrupt directory %u\n", dir);
+				ret = -1;
+				break;
+			}
+			if (de->inode != 0 && name_len > 0)
+				ret = fn(le32toh(de->inode), de->name, name_len,
+						filetype ? de->file_type : 0, arg);
+		}
+		ext_put(fs, blk);
+	}
+	free(map.r);
+	return ret;
+}
+
+/**
+ * ext_namei() - Resolve an absolute path to an inode
+ *
+ * Starts at the root directory and looks up one component at a time.
+ * Symbolic links are not followed.
+ */
+int ext_namei(struct ext_fs *fs, const char *path, uint32_t *ino,
+		struct ext_dir_stats *stats)
+{
+	const char *p = path, *end;
+	uint32_t cur = EXT_ROOT_INO;
+	size_t len;
+
+	while (1) {
+		while (*p == '/')
+			p++;
+		if (*p == '\0')
+			break;
+		end = strchr(p, '/');
+		len = end ? (size_t)(end - p) : strlen(p);
+		if (len > EXT_NAME_LEN) {
+			printf("Name too long in %s\n", path);
+			return -1;
+		}
+		if (ext_dir_lookup(fs, cur, p, len, &cur, stats) < 0)
+			return -1;
+		if (cur == 0) {
+			printf("%.*s not found in %s\n", (int)len, p, path);
+			return -1;
+		}
+		p += len;
+	}
+	*ino = cur;
+	return 0;
+}
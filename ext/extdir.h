@@ -0,0 +1,76 @@
+/*
+ * extdir - Directory lookup and path resolution for ext2/3/4 images
+ *
+ * Written in 2026 by the ext3dump contributors
+ *
+ * To the extent possible under law, the author(s) have dedicated
+ * all copyright and related and neighboring rights to this software
+ * to the public domain worldwide. This software is distributed
+ * without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication
+ * along with this software.
+ * If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+#ifndef EXTDIR_H
+#define EXTDIR_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "extimg.h"
+
+#define EXT_NAME_LEN		255
+#define EXT_DX_MAX_LEVELS	3	// Index levels with largedir
+
+// Directory hash versions in dx_root
+#define EXT_HASH_LEGACY		0
+#define EXT_HASH_HALF_MD4	1
+#define EXT_HASH_TEA		2
+#define EXT_HASH_UNSIGNED	3	// Added for unsigned char variants
+
+// s_flags
+#define EXT_FLAGS_SIGNED_HASH	0x0001
+#define EXT_FLAGS_UNSIGNED_HASH	0x0002
+
+// Header of the first block of an indexed directory, after . and ..
+struct ext_dx_root_info {
+	uint32_t reserved_zero;
+	uint8_t  hash_version;
+	uint8_t  info_length;		// 8
+	uint8_t  indirect_levels;	// Index levels below the root
+	uint8_t  unused_flags;
+} __attribute__((packed));
+
+// Index entry, the first one of a node holds limit and count instead of hash
+struct ext_dx_entry {
+	uint32_t hash;
+	uint32_t block;			// Logical block of the directory
+} __attribute__((packed));
+
+struct ext_dx_countlimit {
+	uint16_t limit;
+	uint16_t count;
+} __attribute__((packed));
+
+// Work done by lookups
+struct ext_dir_stats {
+	unsigned long blocks;		// Directory blocks read
+	unsigned long htree;		// Lookups through the htree
+	unsigned long linear;		// Lookups by linear scan
+};
+
+// Called for every entry of a directory, a non zero return stops the walk
+typedef int (*ext_dir_fn)(uint32_t ino, const char *name, size_t len,
+		uint8_t file_type, void *arg);
+
+uint32_t ext_dir_hash(const struct ext_fs *fs, int version, const char *name,
+		size_t len);
+int ext_dir_lookup(struct ext_fs *fs, uint32_t dir, const char *name,
+		size_t len, uint32_t *ino, struct ext_dir_stats *stats);
+int ext_dir_iterate(struct ext_fs *fs, uint32_t dir, ext_dir_fn fn, void *arg);
+int ext_namei(struct ext_fs *fs, const char *path, uint32_t *ino,
+		struct ext_dir_stats *stats);
+
+#endif
@@ -0,0 +1,393 @@
+/*
+ * extfile - File block maps and data extraction for ext2/3/4 images
+ *
+ * Written in 2026 by the ext3dump contributors
+ *
+ * To the extent possible under law, the author(s) have dedicated
+ * all copyright and related and neighboring rights to this software
+ * to the public domain worldwide. This software is distributed
+ * without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication
+ * along with this software.
+ * If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+
+#include "extfile.h"
+#include "extcsum.h"
+#include "extjournal.h"
+
+/**
+ * map_add() - Append blocks to the block map
+ *
+ * Blocks that continue the last run both logically and physically are
+ * merged into it, so a contiguous file becomes a single run.
+ */
+int map_add(struct block_map *map, uint64_t logical, uint64_t physical,
+		uint64_t count)
+{
+	struct block_run *last, *r;
+
+	if (map->n > 0) {
+		last = &map->r[map->n - 1];
+		if (last->logical + last->count == logical &&
+				last->physical + last->count == physical) {
+			last->count += count;
+			return 0;
+		}
+	}
+	if (map->n == map->alloc) {
+		map->alloc = map->alloc ? map->alloc * 2 : 64;
+		r = realloc(map->r, map->alloc * sizeof(*r));
+		if (!r) {
+			printf("Failed to allocate memory\n");
+			return -1;
+		}
+		map->r = r;
+	}
+	map->r[map->n].logical = logical;
+	map->r[map->n].physical = physical;
+	map->r[map->n].count = count;
+	map->n++;
+	return 0;
+}
+
+/**
+ * map_indirect() - Add the blocks below an indirect block to the map
+ *
+ * @blk		: Indirect block, 0 for a hole
+ * @level	: 1 for a single, 2 for a double, 3 for a triple indirect block
+ * @logical	: First file block below blk, advanced past the blocks covered
+ * @nblocks	: Number of blocks in the file
+ */
+static int map_indirect(struct ext_fs *fs, struct block_map *map, uint32_t blk,
+		int level, uint64_t *logical, uint64_t nblocks)
+{
+	uint64_t per_ptr = 1, ptrs = fs->block_size / 4;
+	const uint32_t *ptr;
+	uint64_t i;
+	int l, res = 0;
+
+	for (l = 1; l < level; l++)
+		per_ptr *= ptrs;
+
+	// A hole covers everything below it
+	if (blk == 0) {
+		*logical += per_ptr * ptrs;
+		return 0;
+	}
+
+	ptr = ext_block(fs, blk);
+	if (!ptr) {
+		printf("Failed to read indirect block %u\n", blk);
+		return -1;
+	}
+	for (i = 0; i < ptrs && *logical < nblocks && res == 0; i++) {
+		if (level > 1) {
+			res = map_indirect(fs, map, le32toh(ptr[i]), level - 1,
+					logical, nblocks);
+			continue;
+		}
+		if (ptr[i] != 0)
+			res = map_add(map, *logical, le32toh(ptr[i]), 1);
+		(*logical)++;
+	}
+	ext_put(fs, ptr);
+	return res;
+}
+
+/**
+ * map_blocks() - Build the block map of a file from its block pointers
+ *
+ * Walks the 12 direct pointers of i_block followed by the single, double
+ * and triple indirect blocks. Pointers that are 0 are holes and are left
+ * out of the map.
+ */
+static int map_blocks(struct ext_fs *fs, const struct ext_inode_disk *inode,
+		uint64_t nblocks, struct block_map *map)
+{
+	uint64_t logical;
+	uint32_t ptr;
+	int level;
+
+	for (logical = 0; logical < EXT_NDIR_BLOCKS && logical < nblocks; logical++) {
+		ptr = le32toh(inode->i_block[logical]);
+		if (ptr != 0 && map_add(map, logical, ptr, 1) < 0)
+			return -1;
+	}
+	for (level = 1; level <= 3 && logical < nblocks; level++) {
+		ptr = le32toh(inode->i_block[EXT_NDIR_BLOCKS + level - 1]);
+		if (map_indirect(fs, map, ptr, level, &logical, nblocks) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+/**
+ * map_extent_node() - Add the extents below an extent tree node to the map
+ *
+ * A node is an extent header followed by either leaf extents (depth 0)
+ * or index entries pointing to the next level of extent blocks.
+ * Uninitialized extents read as zeros and are left out like holes.
+ *
+ * @eh		: Header and entries, in i_block or an extent block
+ * @len		: Size of the node in bytes
+ * @depth	: Expected depth of the node
+ * @ino		: Owner of the tree
+ * @seed	: Checksum seed of the owner
+ */
+static int map_extent_node(struct ext_fs *fs, struct block_map *map,
+		const struct ext_extent_header *eh, size_t len, int depth,
+		uint64_t nblocks, uint32_t ino, uint32_t seed)
+{
+	const struct ext_extent_idx *ei = (const void *)(eh + 1);
+	const struct ext_extent *ee = (const void *)(eh + 1);
+	const struct ext_extent_header *child;
+	unsigned int entries = le16toh(eh->eh_entries), i;
+	uint64_t logical, physical, count;
+	int res = 0;
+
+	if (le16toh(eh->eh_magic) != EXT_EXT_MAGIC ||
+			le16toh(eh->eh_depth) != depth ||
+			entries > (len - sizeof(*eh)) / sizeof(*ee)) {
+		printf("Invalid extent header at depth %d\n", depth);
+		return -1;
+	}
+
+	for (i = 0; i < entries && res == 0; i++) {
+		if (depth > 0) {
+			if (le32toh(ei[i].ei_block) >= nblocks)
+				break;
+			physical = ((uint64_t)le16toh(ei[i].ei_leaf_hi) << 32) |
+				le32toh(ei[i].ei_leaf_lo);
+			child = ext_block(fs, physical);
+			if (!child) {
+				printf("Failed to read extent block %llu\n",
+						(unsigned long long)physical);
+				return -1;
+			}
+			ext_csum_extent(fs, ino, seed, physical, child);
+			res = map_extent_node(fs, map, child, fs->block_size,
+					depth - 1, nblocks, ino, seed);
+			ext_put(fs, child);
+			continue;
+		}
+
+		logical = le32toh(ee[i].ee_block);
+		if (logical >= nblocks)
+			break;
+		count = le16toh(ee[i].ee_len);
+		if (count > EXT_INIT_MAX_LEN)
+			continue;
+		physical = ((uint64_t)le16toh(ee[i].ee_start_hi) << 32) |
+			le32toh(ee[i].ee_start_lo);
+		if (logical + count > nblocks)
+			count = nblocks - logical;
+		res = map_add(map, logical, physical, count);
+	}
+	return res;
+}
+
+/**
+ * ext_map_file() - Build the block map of a file
+ *
+ * Files with the extents flag are mapped through their extent tree,
+ * whose root is in i_block, all others through block pointers. Device
+ * files, fast symlinks and inline data have no blocks and an empty map.
+ *
+ * @ino		: Inode number, for checksums of extent blocks
+ * @inode	: Inode of the file
+ * @map		: Map to fill
+ */
+int ext_map_file(struct ext_fs *fs, uint32_t ino,
+		const struct ext_inode_disk *inode, struct block_map *map)
+{
+	uint64_t nblocks = (ext_inode_size(inode) + fs->block_size - 1) /
+		fs->block_size;
+	const struct ext_extent_header *eh = (const void *)inode->i_block;
+	uint32_t flags = ext_inode_flags(inode);
+	int depth;
+
+	if (!ext_inode_has_blocks(inode))
+		return 0;
+	if (!(flags & EXT_EXTENTS_FL))
+		return map_blocks(fs, inode, nblocks, map);
+
+	depth = le16toh(eh->eh_depth);
+	if (depth > EXT_MAX_DEPTH) {
+		printf("Invalid extent tree depth %d\n", depth);
+		return -1;
+	}
+	return map_extent_node(fs, map, eh, sizeof(inode->i_block), depth,
+			nblocks, ino, ext_csum_inode_seed(fs, ino, inode));
+}
+
+/**
+ * ext_map_lookup() - Find the device block of a file block
+ *
+ * Binary search in the runs, which are sorted by logical block.
+ *
+ * @ret		: Device block, 0 for a hole
+ */
+uint64_t ext_map_lookup(const struct block_map *map, uint64_t logical)
+{
+	size_t lo = 0, hi = map->n, mid;
+	const struct block_run *r;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		r = &map->r[mid];
+		if (logical < r->logical)
+			hi = mid;
+		else if (logical >= r->logical + r->count)
+			lo = mid + 1;
+		else
+			return r->physical + (logical - r->logical);
+	}
+	return 0;
+}
+
+/**
+ * write_hole() - Write len bytes of zeros for a hole in the file
+ *
+ * Regular output files just skip ahead and stay sparse, pipes and
+ * terminals get real zeros.
+ */
+static int write_hole(int out, int seekable, uint64_t len)
+{
+	static const unsigned char zeros[65536];
+	ssize_t n;
+
+	if (seekable)
+		return lseek(out, len, SEEK_CUR) < 0 ? -1 : 0;
+	while (len > 0) {
+		n = write(out, zeros, len < sizeof(zeros) ? len : sizeof(zeros));
+		if (n <= 0)
+			return -1;
+		len -= n;
+	}
+	return 0;
+}
+
+/**
+ * copy_data() - Copy len bytes at offset off of the image to out
+ *
+ * Tries copy_file_range() first, which can be a reflink or at least
+ * stays in the kernel, then sendfile(), each with the whole run in one
+ * call, and falls back to EXT_COPY_SIZE pread() and write() calls if
+ * neither works for this pair of files or the image is a snapshot.
+ * Ranges with journal copies always take the pread() path.
+ */
+static int copy_data(struct ext_fs *fs, int out, off_t off, uint64_t len)
+{
+	static int use_copy_range = 1, use_sendfile = 1;
+	static unsigned char *buf;
+	size_t chunk;
+	ssize_t n, w;
+
+	while (len > 0) {
+		chunk = len < (1ULL << 30) ? len : (1ULL << 30);
+		// Blocks replaced by the journal are only right in ext_pread()
+		chunk = ext_journal_clean(fs, off, chunk);
+
+		if (chunk > 0 && use_copy_range && fs->io.fd >= 0) {
+			n = copy_file_range(fs->io.fd, &off, out, NULL, chunk, 0);
+			if (n > 0) {
+				len -= n;
+				continue;
+			}
+			// EBADF is an output opened with O_APPEND
+			if (n < 0 && errno != EXDEV && errno != EINVAL &&
+					errno != ENOSYS && errno != EOPNOTSUPP &&
+					errno != EBADF)
+				return -1;
+			use_copy_range = 0;
+		}
+		if (chunk > 0 && use_sendfile && fs->io.fd >= 0) {
+			n = sendfile(out, fs->io.fd, &off, chunk);
+			if (n > 0) {
+				len -= n;
+				continue;
+			}
+			if (n < 0 && errno != EINVAL && errno != ENOSYS)
+				return -1;
+			use_sendfile = 0;
+		}
+
+		chunk = len < EXT_COPY_SIZE ? len : EXT_COPY_SIZE;
+		if (!buf) {
+			buf = malloc(EXT_COPY_SIZE);
+			if (!buf) {
+				printf("Failed to allocate memory\n");
+				return -1;
+			}
+		}
+		n = ext_pread(fs, buf, chunk, off);
+		if (n <= 0)
+			return -1;
+		for (w = 0; w < n; ) {
+			chunk = write(out, buf + w, n - w);
+			if ((ssize_t)chunk <= 0)
+				return -1;
+			w += chunk;
+		}
+		off += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/**
+ * ext_dump_file() - Write the file data described by the block map to out
+ *
+ * Every run is copied with as few large sequential reads as possible,
+ * the gaps between runs are holes. The last block is cut at filesize.
+ */
+int ext_dump_file(struct ext_fs *fs, const struct block_map *map,
+		uint64_t filesize, int out)
+{
+	uint64_t pos = 0, start, end;
+	struct stat st;
+	int seekable;
+	size_t i;
+
+	// Appending ignores the file offset, so holes need real zeros
+	seekable = fstat(out, &st) == 0 && S_ISREG(st.st_mode) &&
+		!(fcntl(out, F_GETFL) & O_APPEND);
+
+	for (i = 0; i < map->n && pos < filesize; i++) {
+		start = map->r[i].logical * fs->block_size;
+		end = start + map->r[i].count * fs->block_size;
+		if (end > filesize)
+			end = filesize;
+		if (start >= end)
+			break;
+		if (start > pos && write_hole(out, seekable, start - pos) < 0)
+			goto err;
+		if (copy_data(fs, out, (off_t)map->r[i].physical * fs->block_size,
+					end - start) < 0)
+			goto err;
+		pos = end;
+	}
+	if (pos < filesize && write_hole(out, seekable, filesize - pos) < 0)
+		goto err;
+
+	// A hole at the end needs the size set explicitly
+	if (seekable && ftruncate(out, filesize) < 0)
+		goto err;
+	return 0;
+
+err:
+	printf("Error writing file data : %s\n", strerror(errno));
+	return -1;
+}
@@ -0,0 +1,50 @@
+/*
+ * extfile - File block maps and data extraction for ext2/3/4 images
+ *
+ * Written in 2026 by the ext3dump contributors
+ *
+ * To the extent possible under law, the author(s) have dedicated
+ * all copyright and related and neighboring rights to this software
+ * to the public domain worldwide. This software is distributed
+ * without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication
+ * along with this software.
+ * If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+#ifndef EXTFILE_H
+#define EXTFILE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "extimg.h"
+
+#define EXT_COPY_SIZE		(4 * 1024 * 1024)	// Largest single read
+#define EXT_MAX_DEPTH		5	// Deepest valid extent tree
+#define EXT_INIT_MAX_LEN	32768	// Longer extents are uninitialized
+
+// A run of physically contiguous file blocks
+struct block_run {
+	uint64_t logical;		// First file block
+	uint64_t physical;		// First device block
+	uint64_t count;			// Number of blocks
+};
+
+// List of runs making up a file, in logical order
+struct block_map {
+	struct block_run *r;
+	size_t n;
+	size_t alloc;
+};
+
+int map_add(struct block_map *map, uint64_t logical, uint64_t physical,
+		uint64_t count);
+int ext_map_file(struct ext_fs *fs, uint32_t ino,
+		const struct ext_inode_disk *inode, struct block_map *map);
+uint64_t ext_map_lookup(const struct block_map *map, uint64_t logical);
+int ext_dump_file(struct ext_fs *fs, const struct block_map *map,
+		uint64_t filesize, int out);
+
+#endif
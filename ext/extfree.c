@@ -0,0 +1,718 @@
+/*
+ * extfree - Free space and fragmentation report of ext2/3/4 images
+ *
+ * Written in 2026 by the ext3dump contributors
+ *
+ * To the extent possible under law, the author(s) have dedicated
+ * all copyright and related and neighboring rights to this software
+ * to the public domain worldwide. This software is distributed
+ * without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication
+ * along with this software.
+ * If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_AVX2_POPCOUNT
+#endif
+
+#include "extfree.h"
+#include "extfile.h"
+#include "extcsum.h"
+
+// Counts of one block group
+struct free_group {
+	uint32_t blocks;		// Blocks in the group
+	uint32_t free_blocks;
+	uint32_t free_inodes;
+	uint32_t dirs;
+	uint32_t head;			// Free blocks at the start of the group
+	uint32_t tail;			// Free blocks at the end of the group
+	int err;
+};
+
+// A fragmented file
+struct worst_file {
+	uint32_t ino;
+	uint64_t frags;
+	uint64_t blocks;
+};
+
+// Totals of one thread, added up at the end
+struct free_stats {
+	uint64_t ext_count[EXT_FREE_BUCKETS];	// Free extents by size class
+	uint64_t ext_blocks[EXT_FREE_BUCKETS];
+	uint64_t largest;		// Largest free extent
+	uint64_t frag_count[EXT_FREE_BUCKETS];	// Files by fragment count class
+	uint64_t files;			// Regular files with data blocks
+	uint64_t frags;			// Fragments of all of them
+	uint64_t bad;			// Files whose map could not be read
+	uint64_t bitmap_bytes;
+	uint64_t itable_bytes;
+	struct worst_file worst[EXT_FREE_WORST];
+};
+
+struct free_scan {
+	struct ext_fs *fs;
+	const struct ext_free_opts *opts;
+	struct free_group *res;		// One per group
+	uint32_t next_group;		// Next group to scan, taken atomically
+	pthread_mutex_t lock;		// Protects total
+	struct free_stats total;
+};
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Bit i of a bitmap is bit i % 8 of byte i / 8, so a little endian word
+static inline uint64_t load_word(const unsigned char *p)
+{
+	uint64_t w;
+
+	memcpy(&w, p, sizeof(w));
+	return le64toh(w);
+}
+
+static uint64_t popcount_words(const unsigned char *p, size_t words)
+{
+	uint64_t n = 0;
+	size_t i;
+
+	for (i = 0; i < words; i++)
+		n += __builtin_popcountll(load_word(p + i * 8));
+	return n;
+}
+
+#ifdef HAVE_AVX2_POPCOUNT
+/**
+ * popcount_avx2() - Count set bits 256 bits at a time
+ *
+ * Every nibble is counted with a 16 entry table lookup (vpshufb) and
+ * the byte counts are summed into 64 bit lanes with vpsadbw.
+ */
+__attribute__((target("avx2")))
+static uint64_t popcount_avx2(const unsigned char *p, size_t words)
+{
+	const __m256i table = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3,
+			1, 2, 2, 3, 2, 3, 3, 4, 0, 1, 1, 2, 1, 2, 2, 3,
+			1, 2, 2, 3, 2, 3, 3, 4);
+	const __m256i low = _mm256_set1_epi8(0x0f);
+	__m256i acc = _mm256_setzero_si256(), v, lo, hi, cnt;
+	uint64_t lanes[4];
+	size_t i, n = words / 4;
+
+	for (i = 0; i < n; i++) {
+		v = _mm256_loadu_si256((const __m256i *)(p + i * 32));
+		lo = _mm256_and_si256(v, low);
+		hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low);
+		cnt = _mm256_add_epi8(_mm256_shuffle_epi8(table, lo),
+				_mm256_shuffle_epi8(table, hi));
+		acc = _mm256_add_epi64(acc, _mm256_sad_epu8(cnt,
+					_mm256_setzero_si256()));
+	}
+	_mm256_storeu_si256((__m256i *)lanes, acc);
+	return lanes[0] + lanes[1] + lanes[2] + lanes[3] +
+		popcount_words(p + n * 32, words % 4);
+}
+#endif
+
+// Number of set bits among the first bits of a bitmap
+static uint64_t popcount_bits(const unsigned char *p, uint32_t bits)
+{
+	size_t words = bits / 64;
+	uint64_t n, w;
+
+#ifdef HAVE_AVX2_POPCOUNT
+	static int avx2 = -1;
+
+	if (avx2 < 0)
+		avx2 = __builtin_cpu_supports("avx2");
+	n = avx2 ? popcount_avx2(p, words) : popcount_words(p, words);
+#else
+	n = popcount_words(p, words);
+#endif
+	if (bits % 64) {
+		memcpy(&w, p + words * 8, (bits % 64 + 7) / 8);
+		w = le64toh(w) & ((1ULL << (bits % 64)) - 1);
+		n += __builtin_popcountll(w);
+	}
+	return n;
+}
+
+// Size class of a length, class k holds lengths 2^k to 2^(k+1)-1
+static inline int size_class(uint64_t len)
+{
+	return 63 - __builtin_clzll(len);
+}
+
+static void add_extent(struct free_stats *s, uint64_t len)
+{
+	s->ext_count[size_class(len)]++;
+	s->ext_blocks[size_class(len)] += len;
+	if (len > s->largest)
+		s->largest = len;
+}
+
+/**
+ * free_runs() - Find the runs of free blocks of a block bitmap
+ *
+ * Words that are all free or all used are skipped as a whole, others
+ * are walked run by run with count trailing zeros. Runs that touch the
+ * start or end of the group may continue in the next group, they are
+ * returned in res->head and res->tail and only the ones in between are
+ * added to the histogram here.
+ */
+static void free_runs(const unsigned char *bitmap, uint32_t bits,
+		struct free_group *res, struct free_stats *s)
+{
+	uint64_t w, f, run = 0, start;
+	uint32_t i, words = (bits + 63) / 64;
+	unsigned int pos, c;
+
+	res->head = res->tail = 0;
+	for (i = 0; i < words; i++) {
+		if (i == words - 1 && bits % 64) {
+			w = 0;
+			memcpy(&w, bitmap + (size_t)i * 8, (bits % 64 + 7) / 8);
+			w = le64toh(w) | (~0ULL << (bits % 64));
+		} else {
+			w = load_word(bitmap + (size_t)i * 8);
+		}
+		if (w == 0) {
+			run += 64;
+			continue;
+		}
+		for (pos = 0; pos < 64; ) {
+			if ((w >> pos) == 0) {
+				run += 64 - pos;
+				break;
+			}
+			c = __builtin_ctzll(w >> pos);
+			run += c;
+			pos += c;
+			if (run > 0) {
+				start = (uint64_t)i * 64 + pos - run;
+				if (start == 0)
+					res->head = run;
+				else
+					add_extent(s, run);
+				run = 0;
+			}
+			f = ~w >> pos;
+			if (f == 0)
+				break;
+			pos += __builtin_ctzll(f);
+		}
+	}
+	if (run == bits)
+		res->head = res->tail = bits;
+	else
+		res->tail = run;
+}
+
+/**
+ * base_meta_blocks() - Blocks at the start of a group used by the super
+ * block backup, the GDT and the reserved GDT blocks
+ */
+static uint32_t base_meta_blocks(const struct ext_fs *fs, uint32_t group)
+{
+	uint32_t per_block = fs->block_size / fs->desc_size, first_meta_bg, n;
+	int super = ext_group_has_super(fs, group);
+
+	if (!ext_has_incompat(fs, EXT_FEATURE_INCOMPAT_META_BG))
+		return super ? 1 + fs->gdt_blocks +
+			le16toh(fs->sb.s_reserved_gdt_blocks) : 0;
+
+	first_meta_bg = le32toh(fs->sb.s_first_meta_bg);
+	if (group / per_block < first_meta_bg)
+		return super ? 1 + first_meta_bg +
+			le16toh(fs->sb.s_reserved_gdt_blocks) : 0;
+	n = group % per_block;
+	return super + (n == 0 || n == 1 || n == per_block - 1);
+}
+
+static void set_bits(unsigned char *bitmap, uint64_t first, uint64_t count,
+		uint32_t bits)
+{
+	uint64_t i;
+
+	for (i = first; i < first + count && i < bits; i++)
+		bitmap[i / 8] |= 1 << (i % 8);
+}
+
+/**
+ * uninit_bitmap() - Build the block bitmap of a group with BLOCK_UNINIT
+ *
+ * The kernel does not write the bitmap of such a group, it is derived
+ * the same way : the super block and GDT copies and the bitmaps and
+ * inode table of the group, where they lie inside the group, are used.
+ */
+static void uninit_bitmap(const struct ext_fs *fs, uint32_t group,
+		unsigned char *bitmap, uint32_t bits)
+{
+	const struct ext_group *gd = &fs->gd[group];
+	uint64_t start = fs->first_data_block +
+		(uint64_t)group * fs->blocks_per_group;
+	uint64_t itable = ((uint64_t)fs->inodes_per_group * fs->inode_size +
+			fs->block_size - 1) / fs->block_size;
+
+	memset(bitmap, 0x00, fs->block_size);
+	set_bits(bitmap, 0, base_meta_blocks(fs, group), bits);
+	if (gd->block_bitmap >= start && gd->block_bitmap < start + bits)
+		set_bits(bitmap, gd->block_bitmap - start, 1, bits);
+	if (gd->inode_bitmap >= start && gd->inode_bitmap < start + bits)
+		set_bits(bitmap, gd->inode_bitmap - start, 1, bits);
+	if (gd->inode_table >= start && gd->inode_table < start + bits)
+		set_bits(bitmap, gd->inode_table - start, itable, bits);
+}
+
+/**
+ * ext_block_bitmap() - Get the block bitmap of a group
+ *
+ * The bitmap of a group with BLOCK_UNINIT is built in buf, others are
+ * read with ext_block() and their checksum is verified. Give it back
+ * with ext_put() unless it is buf.
+ *
+ * @buf		: Room for one block
+ *
+ * Return: Bitmap or NULL if it cannot be read
+ */
+const unsigned char *ext_block_bitmap(struct ext_fs *fs, uint32_t group,
+		unsigned char *buf)
+{
+	const struct ext_group *gd = &fs->gd[group];
+	const unsigned char *bitmap;
+	uint64_t left;
+
+	if (gd->flags & EXT_BG_BLOCK_UNINIT) {
+		left = fs->blocks_count - fs->first_data_block -
+			(uint64_t)group * fs->blocks_per_group;
+		uninit_bitmap(fs, group, buf, left < fs->blocks_per_group ?
+				left : fs->blocks_per_group);
+		return buf;
+	}
+	bitmap = ext_block(fs, gd->block_bitmap);
+	if (!bitmap) {
+		printf("Failed to read block bitmap of group %u\n", group);
+		return NULL;
+	}
+	ext_csum_block_bitmap(fs, group, bitmap);
+	return bitmap;
+}
+
+static void add_worst(struct free_stats *s, uint32_t ino, uint64_t frags,
+		uint64_t blocks)
+{
+	int i = EXT_FREE_WORST - 1;
+
+	if (frags <= s->worst[i].frags)
+		return;
+	for (; i > 0 && s->worst[i - 1].frags < frags; i--)
+		s->worst[i] = s->worst[i - 1];
+	s->worst[i].ino = ino;
+	s->worst[i].frags = frags;
+	s->worst[i].blocks = blocks;
+}
+
+/**
+ * scan_files() - Count directories and the fragments of every file
+ *
+ * A fragment is a run of the block map that does not continue where
+ * the previous one ended on disk, holes alone do not fragment a file.
+ * Reserved inodes like the resize inode are not files.
+ *
+ * @itable	: Room for a whole inode table
+ */
+static int scan_files(struct ext_fs *fs, uint32_t group,
+		const unsigned char *bitmap, unsigned char *itable,
+		struct free_group *res, struct free_stats *s)
+{
+	const struct ext_inode_disk *inode;
+	struct block_map map = { NULL, 0, 0 };
+	uint64_t frags, blocks;
+	uint16_t type;
+	uint32_t i, ino, first_ino = le32toh(fs->sb.s_first_ino);
+	size_t r;
+	long n;
+
+	n = ext_read_itable(fs, group, itable);
+	if (n <= 0)
+		return n;
+	s->itable_bytes += (uint64_t)n * fs->inode_size;
+
+	for (i = 0; i < (uint32_t)n; i++) {
+		if (!(bitmap[i / 8] & (1 << (i % 8))))
+			continue;
+		inode = (const struct ext_inode_disk *)(itable +
+				(size_t)i * fs->inode_size);
+		type = le16toh(inode->i_mode) & EXT_S_IFMT;
+		if (type == EXT_S_IFDIR)
+			res->dirs++;
+		ino = group * fs->inodes_per_group + i + 1;
+		if (type != EXT_S_IFREG || ino < first_ino)
+			continue;
+
+		map.n = 0;
+		if (ext_map_file(fs, ino, inode, &map) < 0) {
+			s->bad++;
+			continue;
+		}
+		if (map.n == 0)
+			continue;
+		frags = 1;
+		blocks = map.r[0].count;
+		for (r = 1; r < map.n; r++) {
+			if (map.r[r].physical != map.r[r - 1].physical +
+					map.r[r - 1].count)
+				frags++;
+			blocks += map.r[r].count;
+		}
+		s->files++;
+		s->frags += frags;
+		s->frag_count[size_class(frags)]++;
+		add_worst(s, ino, frags, blocks);
+	}
+	free(map.r);
+	return 0;
+}
+
+/**
+ * scan_group() - Count the free blocks and inodes of a group
+ *
+ * @buf		: Room for one bitmap block
+ * @itable	: Room for a whole inode table, NULL to skip the files
+ */
+static int scan_group(struct free_scan *st, uint32_t group, unsigned char *buf,
+		unsigned char *itable, struct free_group *res,
+		struct free_stats *s)
+{
+	struct ext_fs *fs = st->fs;
+	const struct ext_group *gd = &fs->gd[group];
+	const unsigned char *bitmap;
+	uint64_t left;
+	int ret = 0;
+
+	left = fs->blocks_count - fs->first_data_block -
+		(uint64_t)group * fs->blocks_per_group;
+	res->blocks = left < fs->blocks_per_group ? left : fs->blocks_per_group;
+
+	bitmap = ext_block_bitmap(fs, group, buf);
+	if (!bitmap)
+		return -1;
+	if (bitmap != buf)
+		s->bitmap_bytes += fs->block_size;
+	res->free_blocks = res->blocks - popcount_bits(bitmap, res->blocks);
+	free_runs(bitmap, res->blocks, res, s);
+	if (bitmap != buf)
+		ext_put(fs, bitmap);
+
+	if (gd->flags & EXT_BG_INODE_UNINIT) {
+		res->free_inodes = fs->inodes_per_group;
+		return 0;
+	}
+	bitmap = ext_block(fs, gd->inode_bitmap);
+	if (!bitmap) {
+		printf("Failed to read inode bitmap of group %u\n", group);
+		return -1;
+	}
+	s->bitmap_bytes += fs->block_size;
+	ext_csum_inode_bitmap(fs, group, bitmap);
+	res->free_inodes = fs->inodes_per_group -
+		popcount_bits(bitmap, fs->inodes_per_group);
+	if (itable)
+		ret = scan_files(fs, group, bitmap, itable, res, s);
+	ext_put(fs, bitmap);
+	return ret;
+}
+
+static void *scan_thread(void *arg)
+{
+	struct free_scan *st = arg;
+	struct free_stats *s;
+	unsigned char *buf, *itable = NULL;
+	uint32_t group;
+	int i, j;
+
+	s = calloc(1, sizeof(*s));
+	buf = malloc(st->fs->block_size);
+	if (st->opts->files)
+		itable = malloc((size_t)st->fs->inodes_per_group *
+				st->fs->inode_size);
+	if (!s || !buf || (st->opts->files && !itable)) {
+		printf("Failed to allocate memory\n");
+		free(s);
+		s = NULL;
+	}
+
+	while (1) {
+		group = __atomic_fetch_add(&st->next_group, 1, __ATOMIC_RELAXED);
+		if (group >= st->fs->groups)
+			break;
+		if (!s || scan_group(st, group, buf, itable, &st->res[group], s) < 0)
+			st->res[group].err = 1;
+	}
+
+	if (s) {
+		pthread_mutex_lock(&st->lock);
+		for (i = 0; i < EXT_FREE_BUCKETS; i++) {
+			st->total.ext_count[i] += s->ext_count[i];
+			st->total.ext_blocks[i] += s->ext_blocks[i];
+			st->total.frag_count[i] += s->frag_count[i];
+		}
+		if (s->largest > st->total.largest)
+			st->total.largest = s->largest;
+		st->total.files += s->files;
+		st->total.frags += s->frags;
+		st->total.bad += s->bad;
+		st->total.bitmap_bytes += s->bitmap_bytes;
+		st->total.itable_bytes += s->itable_bytes;
+		for (j = 0; j < EXT_FREE_WORST && s->worst[j].frags; j++)
+			add_worst(&st->total, s->worst[j].ino, s->worst[j].frags,
+					s->worst[j].blocks);
+		pthread_mutex_unlock(&st->lock);
+	}
+	free(itable);
+	free(buf);
+	free(s);
+	return NULL;
+}
+
+// Byte count with a binary unit
+static const char *size_str(uint64_t bytes, char *buf, size_t len)
+{
+	static const char units[] = "BKMGTPE";
+	int u = 0;
+
+	while (bytes >= 1024 && bytes % 1024 == 0 && units[u + 1]) {
+		bytes /= 1024;
+		u++;
+	}
+	snprintf(buf, len, "%llu%c", (unsigned long long)bytes, units[u]);
+	return buf;
+}
+
+static void print_extents(const struct ext_fs *fs, const struct free_stats *t,
+		uint64_t free_blocks)
+{
+	char lo[32], hi[32];
+	int i;
+
+	printf("\nFree extents by size :\n");
+	printf("%16s - %-8s %12s %14s %7s\n", "From", "To", "Extents",
+			"Blocks", "Free");
+	for (i = 0; i < EXT_FREE_BUCKETS; i++) {
+		if (t->ext_count[i] == 0)
+			continue;
+		printf("%16s - %-8s %12llu %14llu %6.2f%%\n",
+				size_str((uint64_t)fs->block_size << i, lo, sizeof(lo)),
+				size_str((uint64_t)fs->block_size << (i + 1), hi,
+					sizeof(hi)),
+				(unsigned long long)t->ext_count[i],
+				(unsigned long long)t->ext_blocks[i],
+				free_blocks ? 100.0 * t->ext_blocks[i] / free_blocks : 0);
+	}
+}
+
+static void print_files(const struct free_stats *t)
+{
+	uint64_t fragmented = t->files - t->frag_count[0];
+	int i;
+
+	printf("\nFiles : %llu with data, %llu fragmented (%.2f%%), "
+			"%.2f fragments per file, %llu unreadable\n",
+			(unsigned long long)t->files, (unsigned long long)fragmented,
+			t->files ? 100.0 * fragmented / t->files : 0,
+			t->files ? (double)t->frags / t->files : 0,
+			(unsigned long long)t->bad);
+	printf("%12s - %-10s %12s\n", "Fragments", "", "Files");
+	for (i = 0; i < EXT_FREE_BUCKETS; i++) {
+		if (t->frag_count[i] == 0)
+			continue;
+		printf("%12llu - %-10llu %12llu\n", 1ULL << i,
+				(2ULL << i) - 1,
+				(unsigned long long)t->frag_count[i]);
+	}
+	if (t->worst[0].frags > 1) {
+		printf("Most fragmented :\n");
+		for (i = 0; i < EXT_FREE_WORST && t->worst[i].frags > 1; i++)
+			printf("  inode %u : %llu fragments, %llu blocks\n",
+					t->worst[i].ino,
+					(unsigned long long)t->worst[i].frags,
+					(unsigned long long)t->worst[i].blocks);
+	}
+}
+
+/**
+ * ext_free_report() - Report free space and fragmentation
+ *
+ * Threads take block groups in turn, read their block and inode bitmaps
+ * and count the free blocks and inodes with a vectorized popcount. The
+ * free extents inside a group go into a size histogram, the ones at the
+ * start and end of a group are joined with their neighbours afterwards
+ * since free space runs across groups. With opts->files the inode tables
+ * are read as well to count the fragments of every file.
+ *
+ * The counts are checked against the group descriptors and the super
+ * block, which the kernel updates lazily on a mounted file system.
+ */
+int ext_free_report(struct ext_fs *fs, const struct ext_free_opts *opts)
+{
+	struct free_scan st;
+	struct free_group *res;
+	const struct ext_group *gd;
+	pthread_t *tids;
+	uint64_t free_blocks = 0, free_inodes = 0, dirs = 0, d_blocks = 0;
+	uint64_t d_inodes = 0, d_dirs = 0, run = 0, extents = 0;
+	uint64_t sb_blocks, blocks = 0;
+	uint32_t g, bad = 0, mismatches = 0, uninit_b = 0, uninit_i = 0;
+	double start = now(), elapsed;
+	int t, started = 0, mismatch, i, ret = -1;
+	char buf[32];
+
+	memset(&st, 0x00, sizeof(st));
+	st.fs = fs;
+	st.opts = opts;
+	st.res = calloc(fs->groups, sizeof(*st.res));
+	tids = calloc(opts->threads, sizeof(*tids));
+	if (!st.res || !tids) {
+		printf("Failed to allocate memory\n");
+		goto out;
+	}
+	pthread_mutex_init(&st.lock, NULL);
+
+	for (t = 0; t < opts->threads; t++) {
+		if (pthread_create(&tids[t], NULL, scan_thread, &st)) {
+			printf("Failed to create scan thread\n");
+			break;
+		}
+		started++;
+	}
+	for (t = 0; t < started; t++)
+		pthread_join(tids[t], NULL);
+	pthread_mutex_destroy(&st.lock);
+	if (started == 0)
+		goto out;
+	elapsed = now() - start;
+
+	if (opts->groups)
+		printf("%8s %12s %12s %10s %10s %8s %8s\n", "Group", "Free blocks",
+				"(desc)", "Free inodes", "(desc)", "Dirs", "(desc)");
+	for (g = 0; g < fs->groups; g++) {
+		res = &st.res[g];
+		gd = &fs->gd[g];
+		if (res->err) {
+			// Nothing is known about the free space of the group
+			if (run > 0)
+				add_extent(&st.total, run);
+			run = 0;
+			bad++;
+			continue;
+		}
+		blocks += res->blocks;
+		free_blocks += res->free_blocks;
+		free_inodes += res->free_inodes;
+		dirs += res->dirs;
+		d_blocks += gd->free_blocks;
+		d_inodes += gd->free_inodes;
+		d_dirs += gd->used_dirs;
+		uninit_b += (gd->flags & EXT_BG_BLOCK_UNINIT) != 0;
+		uninit_i += (gd->flags & EXT_BG_INODE_UNINIT) != 0;
+
+		// Join free space across group boundaries
+		if (res->head == res->blocks) {
+			run += res->blocks;
+		} else {
+			run += res->head;
+			if (run > 0)
+				add_extent(&st.total, run);
+			run = res->tail;
+		}
+
+		mismatch = res->free_blocks != gd->free_blocks ||
+			res->free_inodes != gd->free_inodes ||
+			(opts->files && res->dirs != gd->used_dirs);
+		mismatches += mismatch;
+		if (opts->groups) {
+			printf("%8u %12u %12u %10u %10u ", g, res->free_blocks,
+					gd->free_blocks, res->free_inodes,
+					gd->free_inodes);
+			if (opts->files)
+				printf("%8u ", res->dirs);
+			else
+				printf("%8s ", "-");
+			printf("%8u%s\n", gd->used_dirs, mismatch ? " *" : "");
+		} else if (mismatch && mismatches <= EXT_FREE_MISMATCHES) {
+			printf("Group %u : %u free blocks, %u free inodes, "
+					"descriptor has %u, %u", g,
+					res->free_blocks, res->free_inodes,
+					gd->free_blocks, gd->free_inodes);
+			if (opts->files)
+				printf(", %u dirs, descriptor has %u", res->dirs,
+						gd->used_dirs);
+			printf("\n");
+		}
+	}
+	if (run > 0)
+		add_extent(&st.total, run);
+	for (i = 0; i < EXT_FREE_BUCKETS; i++)
+		extents += st.total.ext_count[i];
+
+	if (mismatches > EXT_FREE_MISMATCHES && !opts->groups)
+		printf("... %u more groups do not match\n",
+				mismatches - EXT_FREE_MISMATCHES);
+
+	sb_blocks = le32toh(fs->sb.s_free_blocks_count_lo);
+	if (ext_has_incompat(fs, EXT_FEATURE_INCOMPAT_64BIT))
+		sb_blocks |= (uint64_t)le32toh(fs->sb.s_free_blocks_count_hi) << 32;
+
+	printf("\nGroups : %u, %u with uninitialized block bitmap, %u with "
+			"uninitialized inode table, %u unreadable\n", fs->groups,
+			uninit_b, uninit_i, bad);
+	printf("Free blocks : %llu of %llu (%.2f%%), descriptors %llu, "
+			"super block %llu\n", (unsigned long long)free_blocks,
+			(unsigned long long)blocks,
+			blocks ? 100.0 * free_blocks / blocks : 0,
+			(unsigned long long)d_blocks, (unsigned long long)sb_blocks);
+	printf("Free inodes : %llu of %u (%.2f%%), descriptors %llu, "
+			"super block %u\n", (unsigned long long)free_inodes,
+			fs->inodes_count,
+			fs->inodes_count ? 100.0 * free_inodes / fs->inodes_count : 0,
+			(unsigned long long)d_inodes,
+			le32toh(fs->sb.s_free_inodes_count));
+	if (opts->files)
+		printf("Directories : %llu, descriptors %llu\n",
+				(unsigned long long)dirs, (unsigned long long)d_dirs);
+	printf("Groups not matching their descriptor : %u\n", mismatches);
+
+	printf("Free extents : %llu, average %.1f blocks, largest %llu blocks\n",
+			(unsigned long long)extents,
+			extents ? (double)free_blocks / extents : 0,
+			(unsigned long long)st.total.largest);
+	print_extents(fs, &st.total, free_blocks);
+	if (opts->files)
+		print_files(&st.total);
+
+	printf("\nRead %.1f MB of bitmaps and %.1f MB of inode tables in "
+			"%.2f s with %d threads (%s blocks)\n",
+			st.total.bitmap_bytes / 1e6, st.total.itable_bytes / 1e6,
+			elapsed, started, size_str(fs->block_size, buf, sizeof(buf)));
+	ret = bad ? -1 : 0;
+out:
+	free(st.res);
+	free(tids);
+	return ret;
+}
@@ -0,0 +1,37 @@
+/*
+ * extfree - Free space and fragmentation report of ext2/3/4 images
+ *
+ * Written in 2026 by the ext3dump contributors
+ *
+ * To the extent possible under law, the author(s) have dedicated
+ * all copyright and related and neighboring rights to this software
+ * to the public domain worldwide. This software is distributed
+ * without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication
+ * along with this software.
+ * If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+#ifndef EXTFREE_H
+#define EXTFREE_H
+
+#include <stdint.h>
+
+#include "extimg.h"
+
+#define EXT_FREE_BUCKETS	64	// Power of two size classes
+#define EXT_FREE_WORST		10	// Most fragmented files listed
+#define EXT_FREE_MISMATCHES	20	// Mismatching groups listed
+
+struct ext_free_opts {
+	int threads;
+	int groups;			// Print a line for every group
+	int files;			// Scan inode tables for file fragmentation
+};
+
+int ext_free_report(struct ext_fs *fs, const struct ext_free_opts *opts);
+const unsigned char *ext_block_bitmap(struct ext_fs *fs, uint32_t group,
+		unsigned char *buf);
+
+#endif
@@ -0,0 +1,773 @@
+/*
+ * extimg - Access layer for ext2/3/4 file system images
+ *
+ * Written in 2026 by the ext3dump contributors
+ *
+ * To the extent possible under law, the author(s) have dedicated
+ * all copyright and related and neighboring rights to this software
+ * to the public domain worldwide. This software is distributed
+ * without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication
+ * along with this software.
+ * If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+#include "extimg.h"
+#include "extstore.h"
+#include "extcsum.h"
+#include "extjournal.h"
+
+#define CACHE_PER_SHARD		(EXT_CACHE_BLOCKS / EXT_CACHE_SHARDS)
+
+_Static_assert(sizeof(struct ext_super_disk) == EXT_SUPER_SIZE,
+		"super block layout");
+_Static_assert(offsetof(struct ext_super_disk, s_desc_size) == 0xfe,
+		"super block layout");
+_Static_assert(offsetof(struct ext_super_disk, s_log_groups_per_flex) == 0x174,
+		"super block layout");
+_Static_assert(offsetof(struct ext_group_desc_disk, bg_block_bitmap_hi) ==
+		EXT_GDT_ENTRY_SIZE, "group descriptor layout");
+_Static_assert(sizeof(struct ext_group_desc_disk) == EXT_GDT_ENTRY_SIZE_64,
+		"group descriptor layout");
+_Static_assert(offsetof(struct ext_inode_disk, i_extra_isize) == 128,
+		"inode layout");
+
+/**
+ * ext_pread() - Read from the image or the snapshot it was opened from
+ *
+ * Works like pread(), it does not go through the map or the cache.
+ * Blocks with a copy in a replayed journal read as that copy.
+ */
+ssize_t ext_pread(struct ext_fs *fs, void *buf, size_t len, uint64_t off)
+{
+	ssize_t n;
+
+	if (fs->store)
+		n = ext_store_read(fs->store, buf, len, off);
+	else
+		n = blkio_pread(&fs->io, buf, len, off);
+	if (n > 0 && fs->journal && ext_journal_patch(fs, buf, n, off) < 0)
+		return -1;
+	return n;
+}
+
+/**
+ * ext_read() - Read from the image, retrying short reads
+ */
+static int ext_read(struct ext_fs *fs, void *buf, size_t len, uint64_t off)
+{
+	ssize_t n;
+
+	if (fs->map) {
+		if (off + len > fs->size)
+			return -1;
+		memcpy(buf, fs->map + off, len);
+		return ext_journal_patch(fs, buf, len, off);
+	}
+	while (len > 0) {
+		n = ext_pread(fs, buf, len, off);
+		if (n <= 0)
+			return -1;
+		buf = (char *)buf + n;
+		len -= n;
+		off += n;
+	}
+	return 0;
+}
+
+/**
+ * parse_super() - Derive the file system parameters from the super block
+ *
+ * With the 64bit feature the block count has a high half and group
+ * descriptors are s_desc_size bytes, otherwise they are 32 bytes.
+ */
+static int parse_super(struct ext_fs *fs)
+{
+	struct ext_super_disk *sb = &fs->sb;
+	uint32_t log, per_block;
+
+	if (le16toh(sb->s_magic) != EXT_SUPER_MAGIC) {
+		printf("No ext2/3/4 file system found\n");
+		return -1;
+	}
+	log = le32toh(sb->s_log_block_size);
+	if (log > 6) {
+		printf("Invalid block size in super block\n");
+		return -1;
+	}
+	fs->block_size = 1024 << log;
+	fs->inode_size = le32toh(sb->s_rev_level) == 0 ? 128 :
+		le16toh(sb->s_inode_size);
+	fs->inodes_per_group = le32toh(sb->s_inodes_per_group);
+	fs->blocks_per_group = le32toh(sb->s_blocks_per_group);
+	fs->inodes_count = le32toh(sb->s_inodes_count);
+	fs->blocks_count = le32toh(sb->s_blocks_count_lo);
+	fs->first_data_block = le32toh(sb->s_first_data_block);
+	fs->desc_size = EXT_GDT_ENTRY_SIZE;
+	if (ext_has_incompat(fs, EXT_FEATURE_INCOMPAT_64BIT)) {
+		fs->blocks_count |= (uint64_t)le32toh(sb->s_blocks_count_hi) << 32;
+		fs->desc_size = le16toh(sb->s_desc_size);
+		if (fs->desc_size < EXT_GDT_ENTRY_SIZE_64 ||
+				fs->desc_size > fs->block_size ||
+				(fs->desc_size & (fs->desc_size - 1))) {
+			printf("Invalid group descriptor size %u\n", fs->desc_size);
+			return -1;
+		}
+	}
+	fs->groups_per_flex = 1;
+	if (ext_has_incompat(fs, EXT_FEATURE_INCOMPAT_FLEX_BG)) {
+		if (sb->s_log_groups_per_flex > 31) {
+			printf("Invalid flex group size\n");
+			return -1;
+		}
+		fs->groups_per_flex = 1U << sb->s_log_groups_per_flex;
+	}
+
+	if (fs->inode_size < 128 || fs->inode_size > fs->block_size ||
+			fs->inodes_per_group == 0 || fs->blocks_per_group == 0 ||
+			fs->blocks_count <= fs->first_data_block) {
+		printf("Invalid super block\n");
+		return -1;
+	}
+	if ((fs->blocks_count - fs->first_data_block + fs->blocks_per_group - 1) /
+			fs->blocks_per_group > UINT32_MAX) {
+		printf("Too many block groups\n");
+		return -1;
+	}
+	fs->groups = (fs->blocks_count - fs->first_data_block +
+			fs->blocks_per_group - 1) / fs->blocks_per_group;
+	per_block = fs->block_size / fs->desc_size;
+	fs->gdt_blocks = (fs->groups + per_block - 1) / per_block;
+	return 0;
+}
+
+/**
+ * ext_gdt_block() - Location of a block of the group descriptor table
+ *
+ * The GDT normally follows the super block. With meta_bg the blocks from
+ * s_first_meta_bg on are spread out instead, block n of the GDT lives in
+ * the first group of the meta group it describes, after the super block
+ * backup if that group has one.
+ *
+ * @n		: Block of the GDT
+ */
+uint64_t ext_gdt_block(const struct ext_fs *fs, uint32_t n)
+{
+	uint64_t group;
+
+	if (!ext_has_incompat(fs, EXT_FEATURE_INCOMPAT_META_BG) ||
+			n < le32toh(fs->sb.s_first_meta_bg))
+		return (uint64_t)fs->first_data_block + 1 + n;
+
+	group = (uint64_t)n * (fs->block_size / fs->desc_size);
+	return fs->first_data_block + group * fs->blocks_per_group +
+		ext_group_has_super(fs, group);
+}
+
+/**
+ * read_gdt() - Read and parse all group descriptors
+ *
+ * Every block of the GDT is read once and all its entries are parsed into
+ * an ext_group, taking the high halves from 64 byte descriptors. Without
+ * meta_bg the GDT is contiguous and read in one go.
+ */
+static int read_gdt(struct ext_fs *fs)
+{
+	const struct ext_group_desc_disk *d;
+	struct ext_group *g;
+	unsigned char *buf;
+	uint32_t per_block = fs->block_size / fs->desc_size;
+	uint32_t i, n, len;
+	int hi = fs->desc_size >= EXT_GDT_ENTRY_SIZE_64;
+
+	buf = malloc(fs->block_size);
+	fs->gd = calloc(fs->groups, sizeof(*fs->gd));
+	if (!buf || !fs->gd) {
+		printf("Failed to allocate memory\n");
+		free(buf);
+		return -1;
+	}
+
+	for (n = 0; n < fs->gdt_blocks; n++) {
+		if (ext_read(fs, buf, fs->block_size, ext_gdt_block(fs, n) *
+					fs->block_size) < 0) {
+			printf("Failed to read GDT block %u\n", n);
+			free(buf);
+			return -1;
+		}
+		len = fs->groups - n * per_block;
+		if (len > per_block)
+			len = per_block;
+
+		for (i = 0; i < len; i++) {
+			d = (const struct ext_group_desc_disk *)(buf + i * fs->desc_size);
+			g = &fs->gd[n * per_block + i];
+			g->block_bitmap = le32toh(d->bg_block_bitmap_lo);
+			g->inode_bitmap = le32toh(d->bg_inode_bitmap_lo);
+			g->inode_table = le32toh(d->bg_inode_table_lo);
+			g->free_blocks = le16toh(d->bg_free_blocks_count_lo);
+			g->free_inodes = le16toh(d->bg_free_inodes_count_lo);
+			g->used_dirs = le16toh(d->bg_used_dirs_count_lo);
+			g->itable_unused = le16toh(d->bg_itable_unused_lo);
+			g->flags = le16toh(d->bg_flags);
+			g->block_bitmap_csum = le16toh(d->bg_block_bitmap_csum_lo);
+			g->inode_bitmap_csum = le16toh(d->bg_inode_bitmap_csum_lo);
+			ext_csum_desc(fs, n * per_block + i, d);
+			if (!hi)
+				continue;
+			g->block_bitmap |= (uint64_t)le32toh(d->bg_block_bitmap_hi) << 32;
+			g->inode_bitmap |= (uint64_t)le32toh(d->bg_inode_bitmap_hi) << 32;
+			g->inode_table |= (uint64_t)le32toh(d->bg_inode_table_hi) << 32;
+			g->free_blocks |= (uint32_t)le16toh(d->bg_free_blocks_count_hi) << 16;
+			g->free_inodes |= (uint32_t)le16toh(d->bg_free_inodes_count_hi) << 16;
+			g->used_dirs |= (uint32_t)le16toh(d->bg_used_dirs_count_hi) << 16;
+			g->itable_unused |= (uint32_t)le16toh(d->bg_itable_unused_hi) << 16;
+			g->block_bitmap_csum |=
+				(uint32_t)le16toh(d->bg_block_bitmap_csum_hi) << 16;
+			g->inode_bitmap_csum |=
+				(uint32_t)le16toh(d->bg_inode_bitmap_csum_hi) << 16;
+		}
+	}
+	free(buf);
+	return 0;
+}
+
+static int cache_init(struct ext_fs *fs)
+{
+	struct ext_cache_shard *sh;
+	int s, i;
+
+	fs->cache_data = malloc((size_t)EXT_CACHE_BLOCKS * fs->block_size);
+	fs->cache = aligned_alloc(64, EXT_CACHE_SHARDS * sizeof(*fs->cache));
+	if (!fs->cache_data || !fs->cache) {
+		free(fs->cache);
+		fs->cache = NULL;
+		return -1;
+	}
+	memset(fs->cache, 0x00, EXT_CACHE_SHARDS * sizeof(*fs->cache));
+	for (s = 0; s < EXT_CACHE_SHARDS; s++) {
+		sh = &fs->cache[s];
+		pthread_mutex_init(&sh->lock, NULL);
+		for (i = 0; i < EXT_CACHE_HASH; i++)
+			sh->hash[i] = -1;
+		for (i = 0; i < CACHE_PER_SHARD; i++)
+			sh->e[i].next = -1;
+	}
+	return 0;
+}
+
+// Read the super block and the GDT and set up the cache
+static int fs_init(struct ext_fs *fs)
+{
+	if (ext_read(fs, &fs->sb, EXT_SUPER_SIZE, EXT_SUPER_OFFSET) < 0) {
+		printf("Failed to read super block\n");
+		return -1;
+	}
+	if (parse_super(fs) < 0)
+		return -1;
+	ext_csum_setup(fs);
+
+	if (!fs->map) {
+		if (cache_init(fs) < 0) {
+			printf("Failed to allocate memory\n");
+			return -1;
+		}
+	}
+	return read_gdt(fs);
+}
+
+/**
+ * ext_open() - Open a file system image or device
+ *
+ * The whole image is mapped read only if possible, so that block access
+ * is pointer arithmetic. Otherwise blocks are read through a cache.
+ * The super block and the whole GDT are parsed once here.
+ *
+ * @use_mmap	: Try to map the image
+ */
+int ext_open(struct ext_fs *fs, const char *path, int use_mmap)
+{
+	void *map;
+
+	memset(fs, 0x00, sizeof(*fs));
+	if (blkio_open(&fs->io, path, O_RDONLY) < 0) {
+		printf("Error opening file system : %s\n", strerror(errno));
+		return -1;
+	}
+	fs->size = fs->io.size;
+
+	if (use_mmap && fs->size > 0) {
+		map = mmap(NULL, fs->size, PROT_READ, MAP_SHARED, fs->io.fd, 0);
+		if (map != MAP_FAILED) {
+			// Metadata is scattered, fault in only what is used
+			madvise(map, fs->size, MADV_RANDOM);
+			fs->map = map;
+		}
+	}
+
+	if (fs_init(fs) < 0)
+		goto err;
+	return 0;
+
+err:
+	ext_close(fs);
+	return -1;
+}
+
+/**
+ * ext_open_snap() - Open a file system from a snapshot in a block store
+ *
+ * The image is never mapped, blocks are read through the cache from the
+ * packs of the store.
+ *
+ * @dir		: Store directory
+ * @name	: Snapshot name
+ */
+int ext_open_snap(struct ext_fs *fs, const char *dir, const char *name)
+{
+	memset(fs, 0x00, sizeof(*fs));
+	fs->io.fd = -1;
+	fs->store = ext_store_open(dir, name);
+	if (!fs->store)
+		return -1;
+	fs->size = fs->store->size;
+	if (fs_init(fs) < 0) {
+		ext_close(fs);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * ext_reload() - Read the super block and the GDT again
+ *
+ * For after the journal has been replayed, which can hold newer copies
+ * of both. The block size cannot change, the cache depends on it. On
+ * error the file system is left as it was.
+ */
+int ext_reload(struct ext_fs *fs)
+{
+	struct ext_super_disk old = fs->sb;
+	struct ext_group *gd = fs->gd;
+	unsigned int block_size = fs->block_size;
+
+	fs->gd = NULL;
+	if (ext_read(fs, &fs->sb, EXT_SUPER_SIZE, EXT_SUPER_OFFSET) < 0) {
+		printf("Failed to read super block\n");
+		goto err;
+	}
+	if (parse_super(fs) < 0)
+		goto err;
+	if (fs->block_size != block_size) {
+		printf("Block size changed in the journal\n");
+		goto err;
+	}
+	ext_csum_setup(fs);
+	if (read_gdt(fs) < 0)
+		goto err;
+	free(gd);
+	return 0;
+
+err:
+	free(fs->gd);
+	fs->gd = gd;
+	fs->sb = old;
+	parse_super(fs);
+	ext_csum_setup(fs);
+	return -1;
+}
+
+/**
+ * ext_probe() - Check whether a file or device holds an ext2/3/4 file system
+ *
+ * Only the super block magic is checked, for telling images and devices
+ * apart from other files on the command line.
+ */
+int ext_probe(const char *path)
+{
+	struct ext_super_disk sb;
+	struct blkio io;
+	int ret;
+
+	if (blkio_open(&io, path, O_RDONLY) < 0)
+		return 0;
+	ret = blkio_pread(&io, &sb, sizeof(sb), EXT_SUPER_OFFSET) == sizeof(sb) &&
+		le16toh(sb.s_magic) == EXT_SUPER_MAGIC;
+	blkio_close(&io);
+	return ret;
+}
+
+void ext_close(struct ext_fs *fs)
+{
+	int i;
+
+	if (fs->map)
+		munmap((void *)fs->map, fs->size);
+	fs->map = NULL;
+	if (fs->cache) {
+		for (i = 0; i < EXT_CACHE_SHARDS; i++)
+			pthread_mutex_destroy(&fs->cache[i].lock);
+		free(fs->cache);
+		fs->cache = NULL;
+	}
+	free(fs->cache_data);
+	fs->cache_data = NULL;
+	free(fs->gd);
+	fs->gd = NULL;
+	ext_journal_free(fs->journal);
+	fs->journal = NULL;
+	blkio_close(&fs->io);
+	ext_store_close(fs->store);
+	fs->store = NULL;
+}
+
+// Shard of a block, runs of EXT_CACHE_RA blocks share one
+static inline struct ext_cache_shard *cache_shard(struct ext_fs *fs,
+		uint64_t blk)
+{
+	return &fs->cache[(blk / EXT_CACHE_RA) % EXT_CACHE_SHARDS];
+}
+
+static inline unsigned int cache_bucket(uint64_t blk)
+{
+	return (uint32_t)((blk * 0x9E3779B97F4A7C15ULL) >> 32) % EXT_CACHE_HASH;
+}
+
+static unsigned char *cache_entry_data(struct ext_fs *fs,
+		struct ext_cache_shard *sh, int i)
+{
+	return fs->cache_data + ((size_t)(sh - fs->cache) * CACHE_PER_SHARD + i) *
+		fs->block_size;
+}
+
+static int cache_find(struct ext_cache_shard *sh, uint64_t blk)
+{
+	int i;
+
+	for (i = sh->hash[cache_bucket(blk)]; i >= 0; i = sh->e[i].next)
+		if (sh->e[i].blk == blk)
+			return i;
+	return -1;
+}
+
+static void cache_insert(struct ext_cache_shard *sh, int i, uint64_t blk)
+{
+	unsigned int b = cache_bucket(blk);
+
+	sh->e[i].blk = blk;
+	sh->e[i].next = sh->hash[b];
+	sh->e[i].valid = 1;
+	sh->hash[b] = i;
+}
+
+static void cache_remove(struct ext_cache_shard *sh, int i)
+{
+	int *p = &sh->hash[cache_bucket(sh->e[i].blk)];
+
+	while (*p != i)
+		p = &sh->e[*p].next;
+	*p = sh->e[i].next;
+	sh->e[i].valid = 0;
+}
+
+/**
+ * cache_victim() - Free an entry of a shard with the clock algorithm
+ *
+ * Entries used since the hand last passed them get a second chance,
+ * pinned entries are skipped. The entry is returned pinned and no
+ * longer holds a block.
+ *
+ * @ret		: Entry index or -1 if all entries are pinned
+ */
+static int cache_victim(struct ext_cache_shard *sh)
+{
+	struct ext_cache_entry *e;
+	unsigned int n;
+	int i;
+
+	for (n = 0; n < 2 * CACHE_PER_SHARD; n++) {
+		i = sh->hand;
+		sh->hand = (sh->hand + 1) % CACHE_PER_SHARD;
+		e = &sh->e[i];
+		if (e->pins > 0)
+			continue;
+		if (e->valid && e->ref) {
+			e->ref = 0;
+			continue;
+		}
+		if (e->valid)
+			cache_remove(sh, i);
+		e->pins = 1;
+		return i;
+	}
+	return -1;
+}
+
+/**
+ * ext_block() - Get a pointer to the contents of a block
+ *
+ * The pointer stays valid until it is given back with ext_put(). With a
+ * mapped image it points into the mapping, otherwise into a cache entry
+ * that is not reused while pinned. Safe to call from several threads,
+ * every shard of the cache has its own lock and reads of one shard do
+ * not hold up the others.
+ *
+ * A miss on the block after the last one read into the shard reads the
+ * rest of the EXT_CACHE_RA run ahead with a single preadv(), directory,
+ * extent and inode table blocks are mostly walked in order. A run read
+ * to its end hands on to the shard of the next run.
+ *
+ * A block with a copy in a replayed journal is taken from the journal.
+ *
+ * @ret		: Block data or NULL if the block cannot be read
+ */
+const void *ext_block(struct ext_fs *fs, uint64_t blk)
+{
+	const struct ext_jblock *jb;
+	struct ext_cache_shard *sh;
+	struct iovec iov[EXT_CACHE_RA];
+	int idx[EXT_CACHE_RA];
+	uint64_t end = fs->size / fs->block_size, last;
+	uint64_t got;
+	const void *p = NULL;
+	ssize_t r;
+	int i, n, want = 1;
+
+	if (fs->journal && (jb = ext_journal_find(fs->journal, blk))) {
+		if (jb->copy)
+			return jb->copy;
+		blk = jb->src;
+	}
+	if (blk >= end)
+		return NULL;
+	if (fs->map)
+		return fs->map + blk * fs->block_size;
+
+	sh = cache_shard(fs, blk);
+	pthread_mutex_lock(&sh->lock);
+	i = cache_find(sh, blk);
+	if (i >= 0) {
+		sh->hits++;
+		sh->e[i].pins++;
+		sh->e[i].ref = 1;
+		p = cache_entry_data(fs, sh, i);
+		goto out;
+	}
+	sh->misses++;
+
+	last = __atomic_load_n(&sh->last, __ATOMIC_RELAXED);
+	if (blk == last + 1) {
+		want = EXT_CACHE_RA - blk % EXT_CACHE_RA;
+		if ((uint64_t)want > end - blk)
+			want = end - blk;
+	}
+	for (n = 0; n < want; n++) {
+		if (n > 0 && cache_find(sh, blk + n) >= 0)
+			break;
+		idx[n] = cache_victim(sh);
+		if (idx[n] < 0)
+			break;
+		iov[n].iov_base = cache_entry_data(fs, sh, idx[n]);
+		iov[n].iov_len = fs->block_size;
+	}
+	if (n == 0) {
+		printf("Block cache exhausted\n");
+		goto out;
+	}
+
+	if (fs->store) {
+		// The store coalesces reads within a pack itself
+		for (r = 0, i = 0; i < n && r == (ssize_t)i * fs->block_size; i++)
+			if (ext_store_read(fs->store, iov[i].iov_base, fs->block_size,
+					(blk + i) * fs->block_size) ==
+					(ssize_t)fs->block_size)
+				r += fs->block_size;
+	} else {
+		r = blkio_preadv(&fs->io, iov, n, blk * fs->block_size);
+	}
+	for (i = 0; i < n; i++) {
+		if (r >= (ssize_t)(i + 1) * fs->block_size) {
+			cache_insert(sh, idx[i], blk + i);
+			sh->e[idx[i]].ref = i == 0;
+		}
+		// Only the requested block stays pinned
+		if (i > 0 || !sh->e[idx[i]].valid)
+			sh->e[idx[i]].pins = 0;
+	}
+	if (sh->e[idx[0]].valid) {
+		p = cache_entry_data(fs, sh, idx[0]);
+		got = r / fs->block_size;
+		if (got > (uint64_t)n)
+			got = n;
+		sh->readahead += got - 1;
+		last = blk + got - 1;
+		__atomic_store_n(&sh->last, last, __ATOMIC_RELAXED);
+		if ((last + 1) % EXT_CACHE_RA == 0)
+			__atomic_store_n(&cache_shard(fs, last + 1)->last, last,
+					__ATOMIC_RELAXED);
+	}
+out:
+	pthread_mutex_unlock(&sh->lock);
+	return p;
+}
+
+/**
+ * ext_put() - Give back a pointer returned by ext_block() or ext_inode()
+ */
+void ext_put(struct ext_fs *fs, const void *p)
+{
+	struct ext_cache_shard *sh;
+	size_t i;
+
+	if (fs->map || !p)
+		return;
+	// Escaped journal copies are not in the cache
+	if ((uintptr_t)p < (uintptr_t)fs->cache_data)
+		return;
+	i = ((uintptr_t)p - (uintptr_t)fs->cache_data) / fs->block_size;
+	if (i >= EXT_CACHE_BLOCKS)
+		return;
+	sh = &fs->cache[i / CACHE_PER_SHARD];
+	pthread_mutex_lock(&sh->lock);
+	if (sh->e[i % CACHE_PER_SHARD].pins > 0)
+		sh->e[i % CACHE_PER_SHARD].pins--;
+	pthread_mutex_unlock(&sh->lock);
+}
+
+/**
+ * ext_cache_stats() - Add up the counters of all cache shards
+ *
+ * Everything is zero for a mapped image, which has no cache.
+ */
+void ext_cache_stats(struct ext_fs *fs, struct ext_cache_stats *stats)
+{
+	struct ext_cache_shard *sh;
+	int s;
+
+	memset(stats, 0x00, sizeof(*stats));
+	if (!fs->cache)
+		return;
+	for (s = 0; s < EXT_CACHE_SHARDS; s++) {
+		sh = &fs->cache[s];
+		pthread_mutex_lock(&sh->lock);
+		stats->hits += sh->hits;
+		stats->misses += sh->misses;
+		stats->readahead += sh->readahead;
+		pthread_mutex_unlock(&sh->lock);
+	}
+}
+
+// Block group holding an inode, inodes are numbered from 1
+uint32_t ext_inode_group(const struct ext_fs *fs, uint32_t ino)
+{
+	return (ino - 1) / fs->inodes_per_group;
+}
+
+/**
+ * ext_inode() - Get a pointer to an inode in its inode table
+ *
+ * Only the first inode_size bytes are valid, fields past 128 bytes exist
+ * only if i_extra_isize covers them. A checksum mismatch is reported,
+ * the inode is returned anyway. Give it back with ext_put().
+ */
+const struct ext_inode_disk *ext_inode(struct ext_fs *fs, uint32_t ino)
+{
+	uint32_t group = ext_inode_group(fs, ino);
+	uint64_t off, blk;
+	const unsigned char *p;
+
+	if (ino == 0 || ino > fs->inodes_count || group >= fs->groups) {
+		printf("Invalid inode number %u\n", ino);
+		return NULL;
+	}
+	if (fs->gd[group].flags & EXT_BG_INODE_UNINIT) {
+		printf("Inode %u is in an uninitialized group\n", ino);
+		return NULL;
+	}
+	off = (uint64_t)((ino - 1) % fs->inodes_per_group) * fs->inode_size;
+	blk = fs->gd[group].inode_table + off / fs->block_size;
+	p = ext_block(fs, blk);
+	if (!p)
+		return NULL;
+	ext_csum_inode(fs, ino, (const void *)(p + off % fs->block_size));
+	return (const struct ext_inode_disk *)(p + off % fs->block_size);
+}
+
+/**
+ * ext_read_itable() - Read the used part of the inode table of a group
+ *
+ * Inodes past bg_itable_unused were never used and are not read, nor is
+ * anything of a group with INODE_UNINIT. The rest is read with a single
+ * large pread(), also when the image is mapped, since faulting in a
+ * whole table page by page is much slower. The checksum of every inode
+ * read is verified.
+ *
+ * @buf		: Room for inodes_per_group inodes
+ *
+ * Return: Number of inodes read, -1 on error
+ */
+long ext_read_itable(struct ext_fs *fs, uint32_t group, unsigned char *buf)
+{
+	const struct ext_group *gd = &fs->gd[group];
+	uint32_t n = fs->inodes_per_group, i;
+	size_t len, done;
+	ssize_t r;
+
+	if (gd->flags & EXT_BG_INODE_UNINIT)
+		return 0;
+	if ((ext_has_ro_compat(fs, EXT_FEATURE_RO_COMPAT_GDT_CSUM) ||
+			ext_has_ro_compat(fs, EXT_FEATURE_RO_COMPAT_METADATA_CSUM)) &&
+			gd->itable_unused <= n)
+		n -= gd->itable_unused;
+	if (n == 0)
+		return 0;
+	len = (size_t)n * fs->inode_size;
+	for (done = 0; done < len; done += r) {
+		r = ext_pread(fs, buf + done, len - done,
+				gd->inode_table * fs->block_size + done);
+		if (r <= 0) {
+			printf("Failed to read inode table of group %u\n", group);
+			return -1;
+		}
+	}
+	for (i = 0; fs->csum && i < n; i++)
+		ext_csum_inode(fs, group * fs->inodes_per_group + i + 1,
+				(const void *)(buf + (size_t)i * fs->inode_size));
+	return n;
+}
+
+/**
+ * ext_group_has_super() - Check whether a group holds a super block backup
+ *
+ * With sparse_super only groups 0, 1 and powers of 3, 5 and 7 do,
+ * otherwise every group.
+ */
+int ext_group_has_super(const struct ext_fs *fs, uint64_t group)
+{
+	static const int base[] = { 3, 5, 7 };
+	uint64_t n;
+	int i;
+
+	if (group <= 1 || !ext_has_ro_compat(fs, EXT_FEATURE_RO_COMPAT_SPARSE_SUPER))
+		return 1;
+	for (i = 0; i < 3; i++) {
+		n = group;
+		while (n % base[i] == 0)
+			n /= base[i];
+		if (n == 1)
+			return 1;
+	}
+	return 0;
+}
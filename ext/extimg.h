@@ -0,0 +1,395 @@
+/*
+ * extimg - Access layer for ext2/3/4 file system images
+ *
+ * Written in 2026 by the ext3dump contributors
+ *
+ * To the extent possible under law, the author(s) have dedicated
+ * all copyright and related and neighboring rights to this software
+ * to the public domain worldwide. This software is distributed
+ * without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication
+ * along with this software.
+ * If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+#ifndef EXTIMG_H
+#define EXTIMG_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <endian.h>
+#include <pthread.h>
+
+#include "../fileops/blockio.h"
+
+#define EXT_SUPER_OFFSET	1024	// Super block offset in the image
+#define EXT_SUPER_SIZE		1024
+#define EXT_SUPER_MAGIC		0xEF53
+#define EXT_GDT_ENTRY_SIZE	32	// Group descriptor without 64bit
+#define EXT_GDT_ENTRY_SIZE_64	64	// Smallest descriptor with 64bit
+#define EXT_ROOT_INO		2
+#define EXT_N_BLOCKS		15	// Block pointers in i_block
+#define EXT_NDIR_BLOCKS		12	// Direct block pointers
+#define EXT_CACHE_BLOCKS	4096	// Blocks in the read cache
+#define EXT_CACHE_SHARDS	16	// Separately locked parts of the cache
+#define EXT_CACHE_RA		16	// Blocks read ahead on sequential misses
+#define EXT_CACHE_HASH		512	// Hash buckets of a shard
+
+// Feature flags
+#define EXT_FEATURE_COMPAT_DIR_INDEX		0x0020
+#define EXT_FEATURE_INCOMPAT_FILETYPE		0x0002
+#define EXT_FEATURE_RO_COMPAT_SPARSE_SUPER	0x0001
+#define EXT_FEATURE_INCOMPAT_META_BG		0x0010
+#define EXT_FEATURE_INCOMPAT_EXTENTS		0x0040
+#define EXT_FEATURE_INCOMPAT_64BIT		0x0080
+#define EXT_FEATURE_INCOMPAT_FLEX_BG		0x0200
+#define EXT_FEATURE_INCOMPAT_CSUM_SEED		0x2000
+
+#define EXT_FEATURE_RO_COMPAT_GDT_CSUM		0x0010
+#define EXT_FEATURE_RO_COMPAT_METADATA_CSUM	0x0400
+
+// Group descriptor flags
+#define EXT_BG_INODE_UNINIT	0x0001	// Inode table and bitmap not initialized
+#define EXT_BG_BLOCK_UNINIT	0x0002	// Block bitmap not initialized
+
+// Kinds of metadata with a checksum, see extcsum.h
+enum ext_csum_kind {
+	EXT_CSUM_SUPER,
+	EXT_CSUM_DESC,
+	EXT_CSUM_BLOCK_BITMAP,
+	EXT_CSUM_INODE_BITMAP,
+	EXT_CSUM_INODE,
+	EXT_CSUM_EXTENT,
+	EXT_CSUM_DIR,
+	EXT_CSUM_KINDS
+};
+
+// Inode flags
+#define EXT_INDEX_FL		0x1000	// Hashed directory index
+#define EXT_EXTENTS_FL		0x80000	// Inode uses an extent tree
+#define EXT_INLINE_DATA_FL	0x10000000	// Data stored in the inode
+
+// File types in i_mode
+#define EXT_S_IFMT		0xF000
+#define EXT_S_IFLNK		0xA000
+#define EXT_S_IFREG		0x8000
+#define EXT_S_IFDIR		0x4000
+
+/*
+ * On-disk structures. All fields are little endian, use le16toh() and
+ * le32toh() on them. Pointers to these point straight into the mapped
+ * image or a cached block.
+ */
+
+struct ext_super_disk {
+	uint32_t s_inodes_count;
+	uint32_t s_blocks_count_lo;
+	uint32_t s_r_blocks_count_lo;
+	uint32_t s_free_blocks_count_lo;
+	uint32_t s_free_inodes_count;
+	uint32_t s_first_data_block;
+	uint32_t s_log_block_size;
+	uint32_t s_log_cluster_size;
+	uint32_t s_blocks_per_group;
+	uint32_t s_clusters_per_group;
+	uint32_t s_inodes_per_group;
+	uint32_t s_mtime;
+	uint32_t s_wtime;
+	uint16_t s_mnt_count;
+	uint16_t s_max_mnt_count;
+	uint16_t s_magic;
+	uint16_t s_state;
+	uint16_t s_errors;
+	uint16_t s_minor_rev_level;
+	uint32_t s_lastcheck;
+	uint32_t s_checkinterval;
+	uint32_t s_creator_os;
+	uint32_t s_rev_level;
+	uint16_t s_def_resuid;
+	uint16_t s_def_resgid;
+	uint32_t s_first_ino;
+	uint16_t s_inode_size;
+	uint16_t s_block_group_nr;
+	uint32_t s_feature_compat;
+	uint32_t s_feature_incompat;
+	uint32_t s_feature_ro_compat;
+	uint8_t  s_uuid[16];
+	char     s_volume_name[16];
+	char     s_last_mounted[64];
+	uint32_t s_algorithm_usage_bitmap;
+	uint8_t  s_prealloc_blocks;
+	uint8_t  s_prealloc_dir_blocks;
+	uint16_t s_reserved_gdt_blocks;
+	uint8_t  s_journal_uuid[16];
+	uint32_t s_journal_inum;
+	uint32_t s_journal_dev;
+	uint32_t s_last_orphan;
+	uint32_t s_hash_seed[4];
+	uint8_t  s_def_hash_version;
+	uint8_t  s_jnl_backup_type;
+	uint16_t s_desc_size;
+	uint32_t s_default_mount_opts;
+	uint32_t s_first_meta_bg;
+	uint32_t s_mkfs_time;
+	uint32_t s_jnl_blocks[17];
+	uint32_t s_blocks_count_hi;
+	uint32_t s_r_blocks_count_hi;
+	uint32_t s_free_blocks_count_hi;
+	uint16_t s_min_extra_isize;
+	uint16_t s_want_extra_isize;
+	uint32_t s_flags;
+	uint16_t s_raid_stride;
+	uint16_t s_mmp_interval;
+	uint64_t s_mmp_block;
+	uint32_t s_raid_stripe_width;
+	uint8_t  s_log_groups_per_flex;
+	uint8_t  s_checksum_type;
+	uint8_t  s_encryption_level;
+	uint8_t  s_reserved_pad;
+	uint64_t s_kbytes_written;
+	uint8_t  s_reserved1[0x270 - 0x180];
+	uint32_t s_checksum_seed;
+	uint8_t  s_reserved2[0x3fc - 0x274];
+	uint32_t s_checksum;
+} __attribute__((packed));
+
+struct ext_group_desc_disk {
+	uint32_t bg_block_bitmap_lo;
+	uint32_t bg_inode_bitmap_lo;
+	uint32_t bg_inode_table_lo;
+	uint16_t bg_free_blocks_count_lo;
+	uint16_t bg_free_inodes_count_lo;
+	uint16_t bg_used_dirs_count_lo;
+	uint16_t bg_flags;
+	uint32_t bg_exclude_bitmap_lo;
+	uint16_t bg_block_bitmap_csum_lo;
+	uint16_t bg_inode_bitmap_csum_lo;
+	uint16_t bg_itable_unused_lo;
+	uint16_t bg_checksum;
+	// Only present with 64bit and s_desc_size of 64 or more
+	uint32_t bg_block_bitmap_hi;
+	uint32_t bg_inode_bitmap_hi;
+	uint32_t bg_inode_table_hi;
+	uint16_t bg_free_blocks_count_hi;
+	uint16_t bg_free_inodes_count_hi;
+	uint16_t bg_used_dirs_count_hi;
+	uint16_t bg_itable_unused_hi;
+	uint32_t bg_exclude_bitmap_hi;
+	uint16_t bg_block_bitmap_csum_hi;
+	uint16_t bg_inode_bitmap_csum_hi;
+	uint32_t bg_reserved;
+} __attribute__((packed));
+
+struct ext_inode_disk {
+	uint16_t i_mode;
+	uint16_t i_uid;
+	uint32_t i_size_lo;
+	uint32_t i_atime;
+	uint32_t i_ctime;
+	uint32_t i_mtime;
+	uint32_t i_dtime;
+	uint16_t i_gid;
+	uint16_t i_links_count;
+	uint32_t i_blocks_lo;
+	uint32_t i_flags;
+	uint32_t i_version;
+	uint32_t i_block[EXT_N_BLOCKS];
+	uint32_t i_generation;
+	uint32_t i_file_acl_lo;
+	uint32_t i_size_high;
+	uint32_t i_obso_faddr;
+	uint16_t i_blocks_high;
+	uint16_t i_file_acl_high;
+	uint16_t i_uid_high;
+	uint16_t i_gid_high;
+	uint16_t i_checksum_lo;
+	uint16_t i_reserved;
+	// Only present with inodes larger than 128 bytes
+	uint16_t i_extra_isize;
+	uint16_t i_checksum_hi;
+	uint32_t i_ctime_extra;
+	uint32_t i_mtime_extra;
+	uint32_t i_atime_extra;
+	uint32_t i_crtime;
+	uint32_t i_crtime_extra;
+	uint32_t i_version_hi;
+	uint32_t i_projid;
+} __attribute__((packed));
+
+struct ext_dir_entry_disk {
+	uint32_t inode;
+	uint16_t rec_len;
+	uint8_t  name_len;
+	uint8_t  file_type;
+	char     name[];
+} __attribute__((packed));
+
+#define EXT_EXT_MAGIC		0xF30A	// Extent header magic
+
+struct ext_extent_header {
+	uint16_t eh_magic;
+	uint16_t eh_entries;
+	uint16_t eh_max;
+	uint16_t eh_depth;		// 0 for leaf nodes
+	uint32_t eh_generation;
+} __attribute__((packed));
+
+// Leaf extent pointing to data blocks
+struct ext_extent {
+	uint32_t ee_block;		// First file block
+	uint16_t ee_len;		// Above 32768 the extent is uninitialized
+	uint16_t ee_start_hi;
+	uint32_t ee_start_lo;
+} __attribute__((packed));
+
+// Index entry pointing to the next level of the tree
+struct ext_extent_idx {
+	uint32_t ei_block;
+	uint32_t ei_leaf_lo;
+	uint16_t ei_leaf_hi;
+	uint16_t ei_unused;
+} __attribute__((packed));
+
+// Parsed block group descriptor
+struct ext_group {
+	uint64_t block_bitmap;
+	uint64_t inode_bitmap;
+	uint64_t inode_table;
+	uint32_t free_blocks;
+	uint32_t free_inodes;
+	uint32_t used_dirs;
+	uint32_t itable_unused;
+	uint32_t block_bitmap_csum;
+	uint32_t inode_bitmap_csum;
+	uint16_t flags;
+};
+
+// Cached block when the image cannot be mapped
+struct ext_cache_entry {
+	uint64_t blk;
+	unsigned int pins;		// Users holding a pointer to the data
+	int next;			// Next entry of the hash chain or -1
+	uint8_t ref;			// Used since the clock hand passed it
+	uint8_t valid;
+};
+
+/*
+ * Blocks are spread over the shards in runs of EXT_CACHE_RA, so that a
+ * read ahead run always falls into the shard of its first block.
+ */
+struct ext_cache_shard {
+	pthread_mutex_t lock;
+	struct ext_cache_entry e[EXT_CACHE_BLOCKS / EXT_CACHE_SHARDS];
+	int hash[EXT_CACHE_HASH];	// First entry of every chain or -1
+	unsigned int hand;		// Clock hand
+	uint64_t last;			// Last block read, accessed atomically
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t readahead;		// Blocks read ahead
+} __attribute__((aligned(64)));
+
+struct ext_cache_stats {
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t readahead;
+};
+
+// An open file system image
+struct ext_fs {
+	struct blkio io;		// Device or image, fd -1 with a store
+	uint64_t size;			// Image size in bytes
+	const unsigned char *map;	// Whole image mapped, or NULL
+	struct ext_super_disk sb;	// Copy of the super block
+
+	// Derived from the super block
+	unsigned int block_size;
+	unsigned int inode_size;
+	uint32_t inodes_per_group;
+	uint32_t blocks_per_group;
+	uint32_t inodes_count;
+	uint64_t blocks_count;
+	uint32_t first_data_block;
+	uint32_t groups;
+	unsigned int desc_size;		// Group descriptor size
+	uint32_t gdt_blocks;		// Blocks used by the GDT
+	uint32_t groups_per_flex;	// 1 without flex_bg
+
+	struct ext_group *gd;		// All group descriptors
+
+	// Metadata checksums, only verified with metadata_csum
+	int csum;
+	uint32_t csum_seed;
+	uint64_t csum_errors[EXT_CSUM_KINDS];	// Mismatches, counted atomically
+	uint64_t csum_reported;
+
+	// Read cache, used when the image is not mapped
+	struct ext_cache_shard *cache;
+	unsigned char *cache_data;	// Data of all entries of all shards
+
+	struct ext_store *store;	// Snapshot the image is read from, or NULL
+	struct ext_journal *journal;	// Journal copies read in place of blocks
+};
+
+struct ext_store;
+struct ext_journal;
+
+int ext_open(struct ext_fs *fs, const char *path, int use_mmap);
+int ext_open_snap(struct ext_fs *fs, const char *dir, const char *name);
+int ext_probe(const char *path);
+int ext_reload(struct ext_fs *fs);
+void ext_close(struct ext_fs *fs);
+ssize_t ext_pread(struct ext_fs *fs, void *buf, size_t len, uint64_t off);
+const void *ext_block(struct ext_fs *fs, uint64_t blk);
+void ext_put(struct ext_fs *fs, const void *p);
+void ext_cache_stats(struct ext_fs *fs, struct ext_cache_stats *stats);
+uint32_t ext_inode_group(const struct ext_fs *fs, uint32_t ino);
+const struct ext_inode_disk *ext_inode(struct ext_fs *fs, uint32_t ino);
+long ext_read_itable(struct ext_fs *fs, uint32_t group, unsigned char *buf);
+int ext_group_has_super(const struct ext_fs *fs, uint64_t group);
+uint64_t ext_gdt_block(const struct ext_fs *fs, uint32_t n);
+
+static inline int ext_has_compat(const struct ext_fs *fs, uint32_t f)
+{
+	return (le32toh(fs->sb.s_feature_compat) & f) != 0;
+}
+
+static inline int ext_has_incompat(const struct ext_fs *fs, uint32_t f)
+{
+	return (le32toh(fs->sb.s_feature_incompat) & f) != 0;
+}
+
+static inline int ext_has_ro_compat(const struct ext_fs *fs, uint32_t f)
+{
+	return (le32toh(fs->sb.s_feature_ro_compat) & f) != 0;
+}
+
+static inline uint64_t ext_inode_size(const struct ext_inode_disk *inode)
+{
+	return ((uint64_t)le32toh(inode->i_size_high) << 32) |
+		le32toh(inode->i_size_lo);
+}
+
+static inline uint32_t ext_inode_flags(const struct ext_inode_disk *inode)
+{
+	return le32toh(inode->i_flags);
+}
+
+/**
+ * ext_inode_has_blocks() - Check whether i_block holds a block map
+ *
+ * Only regular files, directories and symlinks have data blocks, and
+ * symlinks only if the target does not fit into i_block itself.
+ */
+static inline int ext_inode_has_blocks(const struct ext_inode_disk *inode)
+{
+	uint16_t type = le16toh(inode->i_mode) & EXT_S_IFMT;
+
+	if (ext_inode_flags(inode) & EXT_INLINE_DATA_FL)
+		return 0;
+	if (type == EXT_S_IFLNK)
+		return ext_inode_size(inode) >= sizeof(inode->i_block);
+	return type == EXT_S_IFREG || type == EXT_S_IFDIR;
+}
+
+#endif
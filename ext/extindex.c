@@ -0,0 +1,474 @@
+/*
+ * extindex - Inode index of a whole ext2/3/4 file system
+ *
+ * Written in 2026 by the ext3dump contributors
+ *
+ * To the extent possible under law, the author(s) have dedicated
+ * all copyright and related and neighboring rights to this software
+ * to the public domain worldwide. This software is distributed
+ * without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication
+ * along with this software.
+ * If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "extindex.h"
+#include "extcsum.h"
+
+_Static_assert(sizeof(struct ext_idx_header) == 80, "index header layout");
+_Static_assert(sizeof(struct ext_idx_entry) == 32, "index entry layout");
+_Static_assert(sizeof(struct ext_idx_run) == 16, "index run layout");
+
+// Entries and runs found in one block group
+struct group_result {
+	struct ext_idx_entry *e;
+	size_t ne, alloc_e;
+	struct ext_idx_run *r;
+	size_t nr, alloc_r;
+	int done;
+};
+
+// State shared by the scan threads and the writer
+struct scan {
+	struct ext_fs *fs;
+	struct group_result *res;	// One per group
+	uint32_t next_group;		// Next group to scan, taken atomically
+	pthread_mutex_t lock;
+	pthread_cond_t cond;		// A group is done
+	uint64_t itable_bytes;		// Inode table bytes read
+	uint64_t bad;			// Inodes with an unreadable map
+	int err;
+};
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int add_entry(struct group_result *res, const struct ext_idx_entry *e)
+{
+	struct ext_idx_entry *p;
+
+	if (res->ne == res->alloc_e) {
+		res->alloc_e = res->alloc_e ? res->alloc_e * 2 : 256;
+		p = realloc(res->e, res->alloc_e * sizeof(*p));
+		if (!p)
+			return -1;
+		res->e = p;
+	}
+	res->e[res->ne++] = *e;
+	return 0;
+}
+
+/**
+ * add_runs() - Append the runs of a block map to the group result
+ *
+ * Runs are stored with a 32 bit block count, longer runs are split.
+ */
+static int add_runs(struct group_result *res, const struct block_map *map)
+{
+	struct ext_idx_run *p;
+	uint64_t logical, physical, count, n;
+	size_t i;
+
+	for (i = 0; i < map->n; i++) {
+		logical = map->r[i].logical;
+		physical = map->r[i].physical;
+		for (count = map->r[i].count; count > 0; count -= n) {
+			n = count < UINT32_MAX ? count : UINT32_MAX;
+			if (res->nr == res->alloc_r) {
+				res->alloc_r = res->alloc_r ? res->alloc_r * 2 : 1024;
+				p = realloc(res->r, res->alloc_r * sizeof(*p));
+				if (!p)
+					return -1;
+				res->r = p;
+			}
+			res->r[res->nr].logical = htole32(logical);
+			res->r[res->nr].count = htole32(n);
+			res->r[res->nr].physical = htole64(physical);
+			res->nr++;
+			logical += n;
+			physical += n;
+		}
+	}
+	return 0;
+}
+
+/**
+ * scan_group() - Index all used inodes of a block group
+ *
+ * The used part of the inode table is read with ext_read_itable(), the
+ * inode bitmap decides which inodes are in use. Block maps are built
+ * from the inode copy in buf, indirect and extent blocks are read
+ * through ext_block().
+ *
+ * @buf		: Room for a whole inode table
+ */
+static int scan_group(struct scan *st, uint32_t group, unsigned char *buf,
+		struct group_result *res)
+{
+	struct ext_fs *fs = st->fs;
+	const struct ext_group *gd = &fs->gd[group];
+	const struct ext_inode_disk *inode;
+	const unsigned char *bitmap;
+	struct block_map map = { NULL, 0, 0 };
+	struct ext_idx_entry e;
+	uint32_t i;
+	long n;
+	int ret = 0;
+
+	n = ext_read_itable(fs, group, buf);
+	if (n <= 0)
+		return n;
+	__atomic_fetch_add(&st->itable_bytes, (uint64_t)n * fs->inode_size,
+			__ATOMIC_RELAXED);
+
+	bitmap = ext_block(fs, gd->inode_bitmap);
+	if (!bitmap) {
+		printf("Failed to read inode bitmap of group %u\n", group);
+		return -1;
+	}
+	ext_csum_inode_bitmap(fs, group, bitmap);
+
+	for (i = 0; i < (uint32_t)n && ret == 0; i++) {
+		if (!(bitmap[i / 8] & (1 << (i % 8))))
+			continue;
+		inode = (const struct ext_inode_disk *)(buf + (size_t)i * fs->inode_size);
+		if (inode->i_mode == 0)
+			continue;
+
+		memset(&e, 0x00, sizeof(e));
+		e.ino = htole32((uint64_t)group * fs->inodes_per_group + i + 1);
+		e.mode = inode->i_mode;
+		e.size = htole64(ext_inode_size(inode));
+		e.mtime = inode->i_mtime;
+		e.run = res->nr;
+
+		map.n = 0;
+		if (ext_map_file(fs, le32toh(e.ino), inode, &map) < 0) {
+			e.flags = htole16(EXT_IDX_BAD);
+			__atomic_fetch_add(&st->bad, 1, __ATOMIC_RELAXED);
+			map.n = 0;
+		}
+		if (add_runs(res, &map) < 0) {
+			printf("Failed to allocate memory\n");
+			ret = -1;
+			break;
+		}
+		e.nruns = htole32(res->nr - e.run);
+		if (add_entry(res, &e) < 0) {
+			printf("Failed to allocate memory\n");
+			ret = -1;
+		}
+	}
+	ext_put(fs, bitmap);
+	free(map.r);
+	return ret;
+}
+
+static void *scan_thread(void *arg)
+{
+	struct scan *st = arg;
+	struct group_result res;
+	unsigned char *buf;
+	uint32_t group;
+	int ret = 0;
+
+	buf = malloc((size_t)st->fs->inodes_per_group * st->fs->inode_size);
+	if (!buf) {
+		printf("Failed to allocate memory\n");
+		ret = -1;
+	}
+
+	while (1) {
+		group = __atomic_fetch_add(&st->next_group, 1, __ATOMIC_RELAXED);
+		if (group >= st->fs->groups)
+			break;
+		memset(&res, 0x00, sizeof(res));
+		if (ret == 0 && scan_group(st, group, buf, &res) < 0)
+			ret = -1;
+
+		// Failed groups are still marked done so the writer moves on
+		pthread_mutex_lock(&st->lock);
+		if (ret < 0)
+			st->err = 1;
+		st->res[group] = res;
+		st->res[group].done = 1;
+		pthread_cond_broadcast(&st->cond);
+		pthread_mutex_unlock(&st->lock);
+	}
+	free(buf);
+	return NULL;
+}
+
+/**
+ * ext_idx_scan() - Scan all inode tables and write an index file
+ *
+ * Threads take block groups in turn and index them independently. The
+ * calling thread writes the runs of every group to the index file in
+ * group order as soon as the group is done, so the runs do not pile up
+ * in memory, and keeps only the fixed size entries, which are written
+ * at the end. Entries are in inode number order because groups are.
+ *
+ * @path	: Index file to create
+ * @nthreads	: Number of scan threads
+ */
+int ext_idx_scan(struct ext_fs *fs, const char *path, int nthreads)
+{
+	struct ext_idx_header hdr;
+	struct ext_idx_entry *entries = NULL, *p;
+	struct group_result *res;
+	struct scan st;
+	pthread_t *tids;
+	uint64_t nentries = 0, alloc = 0, nruns = 0;
+	double start = now(), elapsed;
+	uint32_t g;
+	size_t i;
+	FILE *out;
+	int t, started = 0, ret = -1;
+
+	out = fopen(path, "w");
+	if (!out) {
+		printf("Error creating index file %s : %s\n", path, strerror(errno));
+		return -1;
+	}
+	memset(&hdr, 0x00, sizeof(hdr));
+	memset(&st, 0x00, sizeof(st));
+	st.fs = fs;
+	st.res = calloc(fs->groups, sizeof(*st.res));
+	tids = calloc(nthreads, sizeof(*tids));
+	if (!st.res || !tids) {
+		printf("Failed to allocate memory\n");
+		goto out;
+	}
+	pthread_mutex_init(&st.lock, NULL);
+	pthread_cond_init(&st.cond, NULL);
+
+	// Room for the header, written last
+	if (fwrite(&hdr, sizeof(hdr), 1, out) != 1)
+		goto err_write;
+
+	for (t = 0; t < nthreads; t++) {
+		if (pthread_create(&tids[t], NULL, scan_thread, &st)) {
+			printf("Failed to create scan thread\n");
+			break;
+		}
+		started++;
+	}
+	if (started == 0)
+		goto out_sync;
+
+	for (g = 0; g < fs->groups; g++) {
+		pthread_mutex_lock(&st.lock);
+		while (!st.res[g].done)
+			pthread_cond_wait(&st.cond, &st.lock);
+		pthread_mutex_unlock(&st.lock);
+
+		res = &st.res[g];
+		if (res->nr > 0 && fwrite(res->r, sizeof(*res->r), res->nr, out)
+				!= res->nr)
+			goto err_write;
+		if (nentries + res->ne > alloc) {
+			alloc = (nentries + res->ne) * 2;
+			p = realloc(entries, alloc * sizeof(*p));
+			if (!p) {
+				printf("Failed to allocate memory\n");
+				goto out_join;
+			}
+			entries = p;
+		}
+		for (i = 0; i < res->ne; i++) {
+			entries[nentries] = res->e[i];
+			entries[nentries].run = htole64(nruns + res->e[i].run);
+			nentries++;
+		}
+		nruns += res->nr;
+		free(res->e);
+		free(res->r);
+		res->e = NULL;
+		res->r = NULL;
+	}
+	if (st.err)
+		goto out_join;
+
+	if (nentries > 0 && fwrite(entries, sizeof(*entries), nentries, out)
+			!= nentries)
+		goto err_write;
+
+	memcpy(hdr.magic, EXT_IDX_MAGIC, sizeof(hdr.magic));
+	hdr.version = htole32(EXT_IDX_VERSION);
+	hdr.block_size = htole32(fs->block_size);
+	memcpy(hdr.uuid, fs->sb.s_uuid, sizeof(hdr.uuid));
+	hdr.blocks_count = htole64(fs->blocks_count);
+	hdr.runs = htole64(nruns);
+	hdr.runs_off = htole64(sizeof(hdr));
+	hdr.entries = htole64(nentries);
+	hdr.entries_off = htole64(sizeof(hdr) + nruns * sizeof(struct ext_idx_run));
+	if (fseek(out, 0, SEEK_SET) < 0 || fwrite(&hdr, sizeof(hdr), 1, out) != 1)
+		goto err_write;
+
+	elapsed = now() - start;
+	printf("Indexed %llu inodes with %llu runs in %u groups, "
+			"%llu unreadable maps\n", (unsigned long long)nentries,
+			(unsigned long long)nruns, fs->groups,
+			(unsigned long long)st.bad);
+	printf("Read %.1f MB of inode tables in %.2f s (%.1f MB/s) "
+			"with %d threads\n", st.itable_bytes / 1e6, elapsed,
+			st.itable_bytes / 1e6 / (elapsed > 0 ? elapsed : 1), started);
+	ret = 0;
+	goto out_join;
+
+err_write:
+	printf("Error writing index file %s : %s\n", path, strerror(errno));
+out_join:
+	// Let the threads run out of groups before joining them
+	__atomic_store_n(&st.next_group, fs->groups, __ATOMIC_RELAXED);
+	for (t = 0; t < started; t++)
+		pthread_join(tids[t], NULL);
+	for (g = 0; g < fs->groups; g++) {
+		free(st.res[g].e);
+		free(st.res[g].r);
+	}
+out_sync:
+	pthread_cond_destroy(&st.cond);
+	pthread_mutex_destroy(&st.lock);
+out:
+	free(entries);
+	free(st.res);
+	free(tids);
+	if (fclose(out) != 0 && ret == 0) {
+		printf("Error writing index file %s : %s\n", path, strerror(errno));
+		ret = -1;
+	}
+	if (ret < 0)
+		unlink(path);
+	return ret;
+}
+
+/**
+ * ext_idx_open() - Map an index file for lookups
+ *
+ * The index has to belong to the file system, which is checked with the
+ * UUID and the block size.
+ */
+int ext_idx_open(struct ext_idx *idx, const char *path, const struct ext_fs *fs)
+{
+	const struct ext_idx_header *hdr;
+	struct stat st;
+	uint64_t n_entries, n_runs, entries_off, runs_off;
+	void *map;
+	int fd;
+
+	memset(idx, 0x00, sizeof(*idx));
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		printf("Error opening index file %s : %s\n", path, strerror(errno));
+		return -1;
+	}
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(*hdr)) {
+		printf("Invalid index file %s\n", path);
+		close(fd);
+		return -1;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		printf("Failed to map index file %s\n", path);
+		return -1;
+	}
+	idx->map = map;
+	idx->size = st.st_size;
+	hdr = map;
+
+	n_entries = le64toh(hdr->entries);
+	n_runs = le64toh(hdr->runs);
+	entries_off = le64toh(hdr->entries_off);
+	runs_off = le64toh(hdr->runs_off);
+	if (memcmp(hdr->magic, EXT_IDX_MAGIC, sizeof(hdr->magic)) != 0 ||
+			le32toh(hdr->version) != EXT_IDX_VERSION ||
+			runs_off > idx->size || entries_off > idx->size ||
+			n_runs > (idx->size - runs_off) / sizeof(struct ext_idx_run) ||
+			n_entries > (idx->size - entries_off) /
+			sizeof(struct ext_idx_entry)) {
+		printf("Invalid index file %s\n", path);
+		ext_idx_close(idx);
+		return -1;
+	}
+	if (le32toh(hdr->block_size) != fs->block_size ||
+			memcmp(hdr->uuid, fs->sb.s_uuid, sizeof(hdr->uuid)) != 0) {
+		printf("Index file %s is of another file system\n", path);
+		ext_idx_close(idx);
+		return -1;
+	}
+
+	idx->hdr = hdr;
+	idx->entries = (const void *)(idx->map + entries_off);
+	idx->runs = (const void *)(idx->map + runs_off);
+	idx->n_entries = n_entries;
+	idx->n_runs = n_runs;
+	return 0;
+}
+
+void ext_idx_close(struct ext_idx *idx)
+{
+	if (idx->map)
+		munmap((void *)idx->map, idx->size);
+	idx->map = NULL;
+}
+
+// Binary search for the entry of an inode, NULL if it is not in the index
+const struct ext_idx_entry *ext_idx_find(const struct ext_idx *idx, uint32_t ino)
+{
+	uint64_t lo = 0, hi = idx->n_entries, mid;
+	uint32_t cur;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		cur = le32toh(idx->entries[mid].ino);
+		if (cur == ino)
+			return &idx->entries[mid];
+		if (cur < ino)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return NULL;
+}
+
+/**
+ * ext_idx_map() - Build the block map of an inode from its index entry
+ */
+int ext_idx_map(const struct ext_idx *idx, const struct ext_idx_entry *e,
+		struct block_map *map)
+{
+	const struct ext_idx_run *r;
+	uint64_t first = le64toh(e->run), n = le32toh(e->nruns), i;
+
+	if (first > idx->n_runs || n > idx->n_runs - first) {
+		printf("Invalid index entry for inode %u\n", le32toh(e->ino));
+		return -1;
+	}
+	for (i = 0; i < n; i++) {
+		r = &idx->runs[first + i];
+		if (map_add(map, le32toh(r->logical), le64toh(r->physical),
+					le32toh(r->count)) < 0)
+			return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,87 @@
+/*
+ * extindex - Inode index of a whole ext2/3/4 file system
+ *
+ * Written in 2026 by the ext3dump contributors
+ *
+ * To the extent possible under law, the author(s) have dedicated
+ * all copyright and related and neighboring rights to this software
+ * to the public domain worldwide. This software is distributed
+ * without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication
+ * along with this software.
+ * If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+#ifndef EXTINDEX_H
+#define EXTINDEX_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "extimg.h"
+#include "extfile.h"
+
+#define EXT_IDX_MAGIC		"EXTIDX01"
+#define EXT_IDX_VERSION		1
+
+// Entry flags
+#define EXT_IDX_BAD		0x0001	// Block map could not be read
+
+/*
+ * Index file layout, all fields little endian :
+ *
+ *   header | runs of all inodes | entries sorted by inode number
+ *
+ * Entries have a fixed size so that an inode is found with a binary
+ * search, its runs are entries[i].nruns runs from entries[i].run on.
+ */
+
+struct ext_idx_header {
+	char     magic[8];
+	uint32_t version;
+	uint32_t block_size;
+	uint8_t  uuid[16];		// File system the index belongs to
+	uint64_t blocks_count;
+	uint64_t entries;		// Number of entries
+	uint64_t entries_off;		// Byte offset of the first entry
+	uint64_t runs;			// Number of runs
+	uint64_t runs_off;		// Byte offset of the first run
+	uint8_t  reserved[8];
+} __attribute__((packed));
+
+struct ext_idx_entry {
+	uint32_t ino;
+	uint16_t mode;			// i_mode, type and permissions
+	uint16_t flags;			// EXT_IDX_ flags
+	uint64_t size;			// File size in bytes
+	uint64_t run;			// Index of the first run
+	uint32_t nruns;
+	uint32_t mtime;
+} __attribute__((packed));
+
+struct ext_idx_run {
+	uint32_t logical;		// First file block
+	uint32_t count;			// Number of blocks
+	uint64_t physical;		// First device block
+} __attribute__((packed));
+
+// An open index file
+struct ext_idx {
+	const unsigned char *map;
+	size_t size;
+	const struct ext_idx_header *hdr;
+	const struct ext_idx_entry *entries;
+	const struct ext_idx_run *runs;
+	uint64_t n_entries;
+	uint64_t n_runs;
+};
+
+int ext_idx_scan(struct ext_fs *fs, const char *path, int nthreads);
+int ext_idx_open(struct ext_idx *idx, const char *path, const struct ext_fs *fs);
+void ext_idx_close(struct ext_idx *idx);
+const struct ext_idx_entry *ext_idx_find(const struct ext_idx *idx, uint32_t ino);
+int ext_idx_map(const struct ext_idx *idx, const struct ext_idx_entry *e,
+		struct block_map *map);
+
+#endif
@@ -0,0 +1,678 @@
+/*
+ * extjournal - Read ext3/4 images as if their jbd2 journal was replayed
+ *
+ * Written in 2026 by the ext3dump contributors
+ *
+ * To the extent possible under law, the author(s) have dedicated
+ * all copyright and related and neighboring rights to this software
+ * to the public domain worldwide. This software is distributed
+ * without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication
+ * along with this software.
+ * If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "extjournal.h"
+#include "extfile.h"
+#include "extcsum.h"
+
+_Static_assert(sizeof(struct jbd2_super) == 1024, "journal super block layout");
+_Static_assert(offsetof(struct jbd2_super, s_checksum) == 0xfc,
+		"journal super block layout");
+
+// Revoke record, the block is not replayed from transactions up to seq
+struct jrevoke {
+	uint64_t blk;
+	uint32_t seq;
+};
+
+/*
+ * State of the log scan. Sequence numbers are kept relative to the
+ * first transaction, so that they sort in log order across a wrap of
+ * the 32 bit transaction ID.
+ */
+struct jscan {
+	struct ext_fs *fs;
+	struct block_map map;		// Blocks of the journal inode
+	uint32_t first;			// Log area, journal blocks [first, last)
+	uint32_t last;
+	uint32_t incompat;
+	uint32_t seed;			// Checksum seed, crc of the journal UUID
+	int csum;			// Blocks carry csum v2 or v3 checksums
+	unsigned int tag_bytes;
+
+	struct ext_jblock *b;		// Copies, ncommit of them committed
+	size_t n, alloc, ncommit;
+	struct jrevoke *r;		// Revokes, rcommit of them committed
+	size_t nr, ralloc, rcommit;
+	uint64_t bad_csum;
+};
+
+/**
+ * jblock() - Get a block of the journal by its number in the journal
+ *
+ * @phys	: Set to the image block, may be NULL
+ */
+static const unsigned char *jblock(struct jscan *s, uint32_t n, uint64_t *phys)
+{
+	uint64_t blk = ext_map_lookup(&s->map, n);
+
+	if (blk == 0)
+		return NULL;
+	if (phys)
+		*phys = blk;
+	return ext_block(s->fs, blk);
+}
+
+// Next block of the log, the log wraps from its end back to s_first
+static inline uint32_t jnext(const struct jscan *s, uint32_t n)
+{
+	return n + 1 >= s->last ? s->first : n + 1;
+}
+
+/**
+ * jcsum() - Checksum of a journal block with its checksum field as zero
+ *
+ * @off		: Offset of the 32 bit checksum field
+ */
+static uint32_t jcsum(uint32_t seed, const unsigned char *p, size_t len,
+		size_t off)
+{
+	const uint32_t zero = 0;
+	uint32_t crc;
+
+	crc = ext_crc32c(seed, p, off);
+	crc = ext_crc32c(crc, &zero, sizeof(zero));
+	return ext_crc32c(crc, p + off + 4, len - off - 4);
+}
+
+// Check the tail checksum of a descriptor or revoke block
+static int jtail_ok(const struct jscan *s, const unsigned char *p)
+{
+	unsigned int bs = s->fs->block_size;
+	uint32_t v;
+
+	if (!s->csum)
+		return 1;
+	memcpy(&v, p + bs - 4, sizeof(v));
+	return jcsum(s->seed, p, bs, bs - 4) == be32toh(v);
+}
+
+static int add_copy(struct jscan *s, uint64_t blk, uint64_t src,
+		uint32_t seq)
+{
+	struct ext_jblock *b;
+
+	if (s->n == s->alloc) {
+		s->alloc = s->alloc ? s->alloc * 2 : 256;
+		b = realloc(s->b, s->alloc * sizeof(*b));
+		if (!b) {
+			printf("Failed to allocate memory\n");
+			return -1;
+		}
+		s->b = b;
+	}
+	s->b[s->n].blk = blk;
+	s->b[s->n].src = src;
+	s->b[s->n].copy = NULL;
+	s->b[s->n].seq = seq;
+	s->n++;
+	return 0;
+}
+
+static int add_revoke(struct jscan *s, uint64_t blk, uint32_t seq)
+{
+	struct jrevoke *r;
+
+	if (s->nr == s->ralloc) {
+		s->ralloc = s->ralloc ? s->ralloc * 2 : 256;
+		r = realloc(s->r, s->ralloc * sizeof(*r));
+		if (!r) {
+			printf("Failed to allocate memory\n");
+			return -1;
+		}
+		s->r = r;
+	}
+	s->r[s->nr].blk = blk;
+	s->r[s->nr].seq = seq;
+	s->nr++;
+	return 0;
+}
+
+// Forget the copies and revokes of a transaction without a commit block
+static void drop_pending(struct jscan *s)
+{
+	while (s->n > s->ncommit)
+		free(s->b[--s->n].copy);
+	s->nr = s->rcommit;
+}
+
+/**
+ * scan_descriptor() - Record the blocks logged after a descriptor block
+ *
+ * Every tag names the file system block whose copy is in the next block
+ * of the log. A copy that started with the journal magic had it zeroed
+ * when it was logged, it is kept in memory with the magic put back.
+ * With csum v2/v3 a copy that does not match its tag is skipped, like
+ * the kernel does on recovery.
+ *
+ * @pos		: Descriptor block, set to the last block of the copies
+ * @steps	: Blocks of the log walked, counted up for every copy
+ * @seq		: Relative sequence of the transaction
+ * @tid		: Transaction ID, part of the copy checksums
+ */
+static int scan_descriptor(struct jscan *s, const unsigned char *desc,
+		uint32_t *pos, uint32_t *steps, uint32_t seq, uint32_t tid)
+{
+	unsigned int bs = s->fs->block_size;
+	unsigned int end = bs - (s->csum ? 4 : 0), off;
+	const unsigned char *data, *t;
+	uint32_t flags, lo, hi, sum, crc, be_tid = htobe32(tid);
+	uint16_t sum16, flags16;
+	uint64_t blk, src;
+	int ok;
+
+	for (off = sizeof(struct jbd2_header); off + s->tag_bytes <= end; ) {
+		t = desc + off;
+		memcpy(&lo, t, 4);
+		hi = 0;
+		if (s->incompat & JBD2_FEATURE_INCOMPAT_CSUM_V3) {
+			memcpy(&flags, t + 4, 4);
+			flags = be32toh(flags);
+			memcpy(&hi, t + 8, 4);
+			memcpy(&sum, t + 12, 4);
+			sum = be32toh(sum);
+		} else {
+			memcpy(&sum16, t + 4, 2);
+			memcpy(&flags16, t + 6, 2);
+			flags = be16toh(flags16);
+			sum = be16toh(sum16);
+			if (s->incompat & JBD2_FEATURE_INCOMPAT_64BIT)
+				memcpy(&hi, t + 8, 4);
+		}
+		blk = be32toh(lo);
+		if (s->incompat & JBD2_FEATURE_INCOMPAT_64BIT)
+			blk |= (uint64_t)be32toh(hi) << 32;
+
+		if (++*steps >= s->last - s->first) {
+			printf("Journal transaction %u does not end\n", tid);
+			return -1;
+		}
+		*pos = jnext(s, *pos);
+		data = jblock(s, *pos, &src);
+		if (!data) {
+			printf("Failed to read journal block %u\n", *pos);
+			return -1;
+		}
+		ok = blk < s->fs->blocks_count;
+		if (ok && s->csum) {
+			crc = ext_crc32c(s->seed, &be_tid, sizeof(be_tid));
+			crc = ext_crc32c(crc, data, bs);
+			if (!(s->incompat & JBD2_FEATURE_INCOMPAT_CSUM_V3))
+				crc &= 0xffff;
+			ok = crc == sum;
+			if (!ok)
+				s->bad_csum++;
+		}
+		if (ok && add_copy(s, blk, src, seq) < 0) {
+			ext_put(s->fs, data);
+			return -1;
+		}
+		if (ok && (flags & JBD2_FLAG_ESCAPE)) {
+			s->b[s->n - 1].copy = malloc(bs);
+			if (!s->b[s->n - 1].copy) {
+				printf("Failed to allocate memory\n");
+				ext_put(s->fs, data);
+				return -1;
+			}
+			memcpy(s->b[s->n - 1].copy, data, bs);
+			lo = htobe32(JBD2_MAGIC);
+			memcpy(s->b[s->n - 1].copy, &lo, 4);
+		}
+		ext_put(s->fs, data);
+
+		off += s->tag_bytes;
+		if (!(flags & JBD2_FLAG_SAME_UUID))
+			off += 16;
+		if (flags & JBD2_FLAG_LAST_TAG)
+			break;
+	}
+	return 0;
+}
+
+// Record the blocks of a revoke block, 4 or 8 bytes each
+static int scan_revoke(struct jscan *s, const unsigned char *p, uint32_t seq)
+{
+	unsigned int bs = s->fs->block_size;
+	unsigned int size = (s->incompat & JBD2_FEATURE_INCOMPAT_64BIT) ? 8 : 4;
+	unsigned int off, count;
+	uint64_t blk;
+	uint32_t v;
+
+	memcpy(&v, p + sizeof(struct jbd2_header), 4);
+	count = be32toh(v);
+	if (count > bs - (s->csum ? 4 : 0))
+		return -1;
+	for (off = sizeof(struct jbd2_header) + 4; off + size <= count;
+			off += size) {
+		if (size == 8) {
+			memcpy(&blk, p + off, 8);
+			blk = be64toh(blk);
+		} else {
+			memcpy(&v, p + off, 4);
+			blk = be32toh(v);
+		}
+		if (add_revoke(s, blk, seq) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+/**
+ * scan_log() - Walk the log from s_start and collect committed copies
+ *
+ * The log holds transactions with increasing IDs, each a run of
+ * descriptor blocks followed by the copies they describe, revoke blocks
+ * and a commit block. It ends at the first block that is not a journal
+ * block of the next expected transaction, or whose checksum is wrong.
+ * Only transactions with a commit block count, the rest is dropped.
+ *
+ * @ret		: Number of transactions committed, -1 on error
+ */
+static long scan_log(struct jscan *s, uint32_t pos, uint32_t tid)
+{
+	const struct jbd2_header *h;
+	const unsigned char *p;
+	uint32_t start_tid = tid, seq = 0, v, steps;
+	int type, err = 0, end = 0;
+
+	for (steps = 0; !end && !err && steps < s->last - s->first; steps++) {
+		p = jblock(s, pos, NULL);
+		if (!p) {
+			printf("Failed to read journal block %u\n", pos);
+			err = -1;
+			break;
+		}
+		h = (const struct jbd2_header *)p;
+		if (be32toh(h->h_magic) != JBD2_MAGIC ||
+				be32toh(h->h_sequence) != tid) {
+			ext_put(s->fs, p);
+			break;
+		}
+		type = be32toh(h->h_blocktype);
+		switch (type) {
+		case JBD2_DESCRIPTOR_BLOCK:
+			if (!jtail_ok(s, p)) {
+				printf("Journal descriptor block %u has a wrong "
+						"checksum\n", pos);
+				end = 1;
+				break;
+			}
+			err = scan_descriptor(s, p, &pos, &steps, seq, tid);
+			break;
+		case JBD2_COMMIT_BLOCK:
+			memcpy(&v, p + offsetof(struct jbd2_commit, h_chksum), 4);
+			if (s->csum && jcsum(s->seed, p, s->fs->block_size,
+					offsetof(struct jbd2_commit, h_chksum)) !=
+					be32toh(v)) {
+				printf("Journal commit block %u has a wrong "
+						"checksum\n", pos);
+				end = 1;
+				break;
+			}
+			s->ncommit = s->n;
+			s->rcommit = s->nr;
+			seq++;
+			tid++;
+			break;
+		case JBD2_REVOKE_BLOCK:
+			if (!jtail_ok(s, p) || scan_revoke(s, p, seq) < 0) {
+				printf("Journal revoke block %u is invalid\n", pos);
+				end = 1;
+			}
+			break;
+		default:
+			end = 1;
+			break;
+		}
+		ext_put(s->fs, p);
+		pos = jnext(s, pos);
+	}
+	drop_pending(s);
+	return err ? -1 : (long)(tid - start_tid);
+}
+
+static int cmp_jblock(const void *a, const void *b)
+{
+	const struct ext_jblock *x = a, *y = b;
+
+	if (x->blk != y->blk)
+		return x->blk < y->blk ? -1 : 1;
+	if (x->seq != y->seq)
+		return x->seq < y->seq ? -1 : 1;
+	return 0;
+}
+
+static int cmp_revoke(const void *a, const void *b)
+{
+	const struct jrevoke *x = a, *y = b;
+
+	if (x->blk != y->blk)
+		return x->blk < y->blk ? -1 : 1;
+	if (x->seq != y->seq)
+		return x->seq < y->seq ? -1 : 1;
+	return 0;
+}
+
+/**
+ * build_overlay() - Keep the latest copy of every block that is not revoked
+ *
+ * A revoke record in a transaction cancels the copies of its block in
+ * that and all earlier transactions. Since a later copy only comes from
+ * a later transaction, a block is either replaced by its latest copy or
+ * not at all.
+ */
+static void build_overlay(struct jscan *s, struct ext_journal *j)
+{
+	size_t i, k, r = 0;
+
+	qsort(s->b, s->n, sizeof(*s->b), cmp_jblock);
+	qsort(s->r, s->nr, sizeof(*s->r), cmp_revoke);
+
+	for (i = 0, k = 0; i < s->n; i++) {
+		if (i + 1 < s->n && s->b[i + 1].blk == s->b[i].blk) {
+			free(s->b[i].copy);
+			continue;
+		}
+		// Latest revoke of the block, if any
+		while (r < s->nr && s->r[r].blk < s->b[i].blk)
+			r++;
+		while (r + 1 < s->nr && s->r[r + 1].blk == s->b[i].blk)
+			r++;
+		if (r < s->nr && s->r[r].blk == s->b[i].blk &&
+				s->r[r].seq >= s->b[i].seq) {
+			free(s->b[i].copy);
+			j->revoked++;
+			continue;
+		}
+		s->b[k] = s->b[i];
+		s->b[k].seq += j->first_seq;
+		k++;
+	}
+	j->b = s->b;
+	j->n = k;
+	s->b = NULL;
+}
+
+/**
+ * journal_open() - Find the log of the journal inode and its parameters
+ *
+ * @ret		: 1 if the log has transactions to replay, 0 if not, -1 on
+ *		  error
+ */
+static int journal_open(struct jscan *s, struct jbd2_super *jsb)
+{
+	struct ext_fs *fs = s->fs;
+	const struct ext_inode_disk *inode;
+	const unsigned char *p;
+	uint32_t ino = le32toh(fs->sb.s_journal_inum), maxlen, fc;
+	int ret;
+
+	inode = ext_inode(fs, ino);
+	if (!inode) {
+		printf("Failed to read the journal inode %u\n", ino);
+		return -1;
+	}
+	ret = ext_map_file(fs, ino, inode, &s->map);
+	ext_put(fs, inode);
+	if (ret < 0)
+		return -1;
+
+	p = jblock(s, 0, NULL);
+	if (!p) {
+		printf("Failed to read the journal super block\n");
+		return -1;
+	}
+	memcpy(jsb, p, sizeof(*jsb));
+	ext_put(fs, p);
+
+	if (be32toh(jsb->s_header.h_magic) != JBD2_MAGIC ||
+			(be32toh(jsb->s_header.h_blocktype) != JBD2_SUPERBLOCK_V1 &&
+			 be32toh(jsb->s_header.h_blocktype) != JBD2_SUPERBLOCK_V2)) {
+		printf("Invalid journal super block\n");
+		return -1;
+	}
+	if (be32toh(jsb->s_header.h_blocktype) == JBD2_SUPERBLOCK_V2)
+		s->incompat = be32toh(jsb->s_feature_incompat);
+	if (be32toh(jsb->s_blocksize) != fs->block_size) {
+		printf("Journal block size %u differs from the file system\n",
+				be32toh(jsb->s_blocksize));
+		return -1;
+	}
+
+	s->csum = (s->incompat & (JBD2_FEATURE_INCOMPAT_CSUM_V2 |
+				JBD2_FEATURE_INCOMPAT_CSUM_V3)) != 0;
+	if (s->csum) {
+		if (jcsum(~0U, (const void *)jsb, sizeof(*jsb),
+				offsetof(struct jbd2_super, s_checksum)) !=
+				be32toh(jsb->s_checksum)) {
+			printf("Journal super block has a wrong checksum\n");
+			return -1;
+		}
+		s->seed = ext_crc32c(~0U, jsb->s_uuid, sizeof(jsb->s_uuid));
+	}
+	if (s->incompat & JBD2_FEATURE_INCOMPAT_CSUM_V3)
+		s->tag_bytes = 16;
+	else
+		s->tag_bytes = 8 + (s->csum ? 2 : 0) +
+			((s->incompat & JBD2_FEATURE_INCOMPAT_64BIT) ? 4 : 0);
+
+	// The fast commit area at the end is not part of the log
+	maxlen = be32toh(jsb->s_maxlen);
+	if (s->incompat & JBD2_FEATURE_INCOMPAT_FAST_COMMIT) {
+		fc = be32toh(jsb->s_num_fc_blks);
+		if (fc == 0)
+			fc = JBD2_FC_BLOCKS;
+		maxlen = fc < maxlen ? maxlen - fc : 0;
+	}
+	s->first = be32toh(jsb->s_first);
+	s->last = maxlen;
+	if (s->first == 0 || s->first >= s->last) {
+		printf("Invalid journal log area\n");
+		return -1;
+	}
+	if (jsb->s_start == 0)
+		return 0;
+	if (be32toh(jsb->s_start) < s->first ||
+			be32toh(jsb->s_start) >= s->last) {
+		printf("Invalid journal log start\n");
+		return -1;
+	}
+	return 1;
+}
+
+/**
+ * ext_journal_load() - Replay the journal of the file system in memory
+ *
+ * Does nothing unless the file system is marked as needing recovery,
+ * as it is while mounted or after a crash. The log is then scanned once
+ * and the latest committed copy of every block in it is looked up in
+ * place of the block itself by ext_block() and ext_pread(), the image
+ * is never written. Copies are read from the journal when used, only
+ * the few that had to be escaped are held in memory. The super block
+ * and the GDT are read again through the overlay.
+ *
+ * External journals and fast commits are not replayed.
+ *
+ * @ret		: 0 on success, also if nothing was replayed, -1 on error
+ */
+int ext_journal_load(struct ext_fs *fs)
+{
+	struct jscan s;
+	struct jbd2_super jsb;
+	struct ext_journal *j;
+	long n;
+	int ret;
+
+	if (!ext_has_compat(fs, EXT_FEATURE_COMPAT_HAS_JOURNAL) ||
+			!ext_has_incompat(fs, EXT_FEATURE_INCOMPAT_RECOVER))
+		return 0;
+	if (fs->sb.s_journal_inum == 0) {
+		printf("Journal on an external device is not replayed\n");
+		return 0;
+	}
+
+	memset(&s, 0x00, sizeof(s));
+	s.fs = fs;
+	ret = journal_open(&s, &jsb);
+	if (ret <= 0)
+		goto out;
+
+	ret = -1;
+	j = calloc(1, sizeof(*j));
+	if (!j) {
+		printf("Failed to allocate memory\n");
+		goto out;
+	}
+	j->first_seq = be32toh(jsb.s_sequence);
+	n = scan_log(&s, be32toh(jsb.s_start), j->first_seq);
+	if (n < 0) {
+		free(j);
+		goto out;
+	}
+	j->transactions = n;
+	j->last_seq = j->first_seq + n - 1;
+	j->bad_csum = s.bad_csum;
+	build_overlay(&s, j);
+
+	printf("Journal : %llu transactions", (unsigned long long)n);
+	if (n > 0)
+		printf(" (%u to %u)", j->first_seq, j->last_seq);
+	printf(", %zu blocks replaced in memory", j->n);
+	if (j->revoked)
+		printf(", %llu revoked", (unsigned long long)j->revoked);
+	if (j->bad_csum)
+		printf(", %llu with a wrong checksum skipped",
+				(unsigned long long)j->bad_csum);
+	printf("\n");
+
+	if (j->n == 0) {
+		ext_journal_free(j);
+		ret = 0;
+		goto out;
+	}
+	fs->journal = j;
+	ret = ext_reload(fs);
+	if (ret < 0) {
+		fs->journal = NULL;
+		ext_journal_free(j);
+	}
+out:
+	free(s.map.r);
+	free(s.b);
+	free(s.r);
+	return ret;
+}
+
+void ext_journal_free(struct ext_journal *j)
+{
+	size_t i;
+
+	if (!j)
+		return;
+	for (i = 0; i < j->n; i++)
+		free(j->b[i].copy);
+	free(j->b);
+	free(j);
+}
+
+// Index of the first block of the overlay at or after blk
+static size_t find_from(const struct ext_journal *j, uint64_t blk)
+{
+	size_t lo = 0, hi = j->n, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (j->b[mid].blk < blk)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/**
+ * ext_journal_find() - Look up the journal copy of a block
+ *
+ * @ret		: Copy or NULL if the block is read from its own place
+ */
+const struct ext_jblock *ext_journal_find(const struct ext_journal *j,
+		uint64_t blk)
+{
+	size_t i = find_from(j, blk);
+
+	return i < j->n && j->b[i].blk == blk ? &j->b[i] : NULL;
+}
+
+/**
+ * ext_journal_patch() - Put the journal copies into data read from the image
+ *
+ * @buf		: len bytes read from offset off
+ */
+int ext_journal_patch(struct ext_fs *fs, void *buf, size_t len, uint64_t off)
+{
+	const struct ext_journal *j = fs->journal;
+	unsigned int bs = fs->block_size;
+	const unsigned char *p;
+	uint64_t start, from, to;
+	size_t i;
+
+	if (!j || len == 0)
+		return 0;
+	for (i = find_from(j, off / bs); i < j->n &&
+			j->b[i].blk * bs < off + len; i++) {
+		start = j->b[i].blk * bs;
+		from = start > off ? start : off;
+		to = start + bs < off + len ? start + bs : off + len;
+		p = j->b[i].copy ? j->b[i].copy : ext_block(fs, j->b[i].src);
+		if (!p) {
+			errno = EIO;
+			return -1;
+		}
+		memcpy((unsigned char *)buf + (from - off), p + (from - start),
+				to - from);
+		if (!j->b[i].copy)
+			ext_put(fs, p);
+	}
+	return 0;
+}
+
+/**
+ * ext_journal_clean() - Length of a range that no journal copy replaces
+ *
+ * For reads that bypass ext_pread(), like copy_file_range().
+ *
+ * @ret		: Bytes from off on up to the first block with a copy
+ */
+uint64_t ext_journal_clean(const struct ext_fs *fs, uint64_t off, uint64_t len)
+{
+	const struct ext_journal *j = fs->journal;
+	uint64_t start;
+	size_t i;
+
+	if (!j)
+		return len;
+	i = find_from(j, off / fs->block_size);
+	if (i == j->n)
+		return len;
+	start = j->b[i].blk * fs->block_size;
+	if (start <= off)
+		return 0;
+	return start - off < len ? start - off : len;
+}
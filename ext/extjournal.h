@@ -0,0 +1,129 @@
+/*
+ * extjournal - Read ext3/4 images as if their jbd2 journal was replayed
+ *
+ * Written in 2026 by the ext3dump contributors
+ *
+ * To the extent possible under law, the author(s) have dedicated
+ * all copyright and related and neighboring rights to this software
+ * to the public domain worldwide. This software is distributed
+ * without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication
+ * along with this software.
+ * If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+#ifndef EXTJOURNAL_H
+#define EXTJOURNAL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "extimg.h"
+
+#define EXT_FEATURE_COMPAT_HAS_JOURNAL		0x0004
+#define EXT_FEATURE_INCOMPAT_RECOVER		0x0004	// Journal needs replay
+#define EXT_FEATURE_INCOMPAT_JOURNAL_DEV	0x0008
+
+#define JBD2_MAGIC		0xC03B3998
+#define JBD2_FC_BLOCKS		256	// Default size of the fast commit area
+
+// Journal block types
+#define JBD2_DESCRIPTOR_BLOCK	1
+#define JBD2_COMMIT_BLOCK	2
+#define JBD2_SUPERBLOCK_V1	3
+#define JBD2_SUPERBLOCK_V2	4
+#define JBD2_REVOKE_BLOCK	5
+
+// Journal incompatible features
+#define JBD2_FEATURE_INCOMPAT_REVOKE		0x0001
+#define JBD2_FEATURE_INCOMPAT_64BIT		0x0002
+#define JBD2_FEATURE_INCOMPAT_ASYNC_COMMIT	0x0004
+#define JBD2_FEATURE_INCOMPAT_CSUM_V2		0x0008
+#define JBD2_FEATURE_INCOMPAT_CSUM_V3		0x0010
+#define JBD2_FEATURE_INCOMPAT_FAST_COMMIT	0x0020
+
+// Flags of a descriptor block tag
+#define JBD2_FLAG_ESCAPE	0x0001	// Data started with JBD2_MAGIC
+#define JBD2_FLAG_SAME_UUID	0x0002	// No UUID follows the tag
+#define JBD2_FLAG_LAST_TAG	0x0008
+
+/*
+ * On-disk journal structures. Unlike the file system they are big
+ * endian, use be32toh() on them.
+ */
+
+struct jbd2_header {
+	uint32_t h_magic;
+	uint32_t h_blocktype;
+	uint32_t h_sequence;		// Transaction the block belongs to
+} __attribute__((packed));
+
+struct jbd2_super {
+	struct jbd2_header s_header;
+	uint32_t s_blocksize;
+	uint32_t s_maxlen;		// Blocks in the journal
+	uint32_t s_first;		// First block of the log
+	uint32_t s_sequence;		// First transaction expected in the log
+	uint32_t s_start;		// Start of the log, 0 if it is empty
+	uint32_t s_errno;
+	// Only valid in a V2 super block
+	uint32_t s_feature_compat;
+	uint32_t s_feature_incompat;
+	uint32_t s_feature_ro_compat;
+	uint8_t  s_uuid[16];
+	uint32_t s_nr_users;
+	uint32_t s_dynsuper;
+	uint32_t s_max_transaction;
+	uint32_t s_max_trans_data;
+	uint8_t  s_checksum_type;
+	uint8_t  s_padding2[3];
+	uint32_t s_num_fc_blks;		// Fast commit blocks at the end
+	uint32_t s_head;
+	uint32_t s_padding[40];
+	uint32_t s_checksum;
+	uint8_t  s_users[16 * 48];
+} __attribute__((packed));
+
+// Commit block, h_chksum[0] holds the block checksum with csum v2/v3
+struct jbd2_commit {
+	struct jbd2_header h;
+	uint8_t  h_chksum_type;
+	uint8_t  h_chksum_size;
+	uint8_t  h_padding[2];
+	uint32_t h_chksum[8];
+	uint64_t h_commit_sec;
+	uint32_t h_commit_nsec;
+} __attribute__((packed));
+
+// A file system block whose latest committed copy is in the journal
+struct ext_jblock {
+	uint64_t blk;			// File system block replaced
+	uint64_t src;			// Image block holding the copy
+	unsigned char *copy;		// Unescaped copy, NULL to read src
+	uint32_t seq;			// Transaction that wrote it
+};
+
+/*
+ * Overlay of the committed transactions of a journal that needs
+ * recovery. Built once by ext_journal_load() and never changed after,
+ * so it is read by all threads without a lock.
+ */
+struct ext_journal {
+	struct ext_jblock *b;		// Sorted by blk
+	size_t n;
+	uint32_t first_seq;		// First and last transaction replayed
+	uint32_t last_seq;
+	uint64_t transactions;
+	uint64_t revoked;		// Copies dropped by a revoke record
+	uint64_t bad_csum;		// Copies dropped for a checksum mismatch
+};
+
+int ext_journal_load(struct ext_fs *fs);
+void ext_journal_free(struct ext_journal *j);
+const struct ext_jblock *ext_journal_find(const struct ext_journal *j,
+		uint64_t blk);
+int ext_journal_patch(struct ext_fs *fs, void *buf, size_t len, uint64_t off);
+uint64_t ext_journal_clean(const struct ext_fs *fs, uint64_t off, uint64_t len);
+
+#endif
@@ -0,0 +1,854 @@
+/*
+ * extstore - Content addressed block store for ext2/3/4 images
+ *
+ * Written in 2026 by the ext3dump contributors
+ *
+ * To the extent possible under law, the author(s) have dedicated
+ * all copyright and related and neighboring rights to this software
+ * to the public domain worldwide. This software is distributed
+ * without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication
+ * along with this software.
+ * If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+#include "extstore.h"
+#include "extimg.h"
+#include "../fileops/blockhash.h"
+
+_Static_assert(sizeof(struct ext_store_header) == 64, "store header layout");
+_Static_assert(sizeof(struct ext_snap_header) == 64, "snapshot header layout");
+
+// Part of the image read by the reader thread
+struct cap_buf {
+	unsigned char *data;
+	size_t len;			// Bytes read, 0 at the end of the image
+	int full;			// Waiting to be hashed
+	int err;			// errno of the reader, 0 if none
+};
+
+// State of a capture
+struct capture {
+	struct ext_fs *fs;
+	struct ext_store *st;
+	struct cap_buf bufs[EXT_STORE_BUFFERS];
+	pthread_mutex_t lock;
+	pthread_cond_t cond;		// A buffer was filled or emptied
+	int stop;
+
+	// Digests of all stored blocks and a hash table over them
+	struct bh_digest *digests;	// Digest of block id i at i - 1
+	uint64_t count, alloc;
+	uint32_t *table;		// Block ids by digest, 0 if empty
+	uint64_t mask;
+
+	// New blocks not written to their pack yet
+	unsigned char *wbuf;
+	uint64_t wfirst;		// Id of the first one
+	size_t wn, wmax;
+	unsigned char *cbuf;		// A stored block read back to compare
+
+	FILE *dfile;			// digests
+	uint64_t zero, dup, added, collisions;
+};
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int store_read_header(struct ext_store *st, int fd)
+{
+	struct ext_store_header hdr;
+
+	if (pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+			memcmp(hdr.magic, EXT_STORE_MAGIC, sizeof(hdr.magic)) != 0 ||
+			le32toh(hdr.version) != EXT_STORE_VERSION ||
+			le32toh(hdr.block_size) == 0 || le32toh(hdr.pack_blocks) == 0) {
+		printf("Invalid store header\n");
+		return -1;
+	}
+	st->block_size = le32toh(hdr.block_size);
+	st->pack_blocks = le32toh(hdr.pack_blocks);
+	return 0;
+}
+
+/**
+ * store_open_dir() - Open a store directory
+ *
+ * @block_size	: Create the store with this block size if it does not
+ *		  exist yet, 0 to open an existing store only
+ * @lockfd	: If not NULL the store is locked for writing and the
+ *		  descriptor holding the lock is returned here
+ */
+static struct ext_store *store_open_dir(const char *dir, uint32_t block_size,
+		int *lockfd)
+{
+	struct ext_store_header hdr;
+	struct ext_store *st;
+	int fd;
+
+	st = calloc(1, sizeof(*st));
+	if (!st) {
+		printf("Failed to allocate memory\n");
+		return NULL;
+	}
+	pthread_mutex_init(&st->lock, NULL);
+	if (block_size && mkdir(dir, 0755) < 0 && errno != EEXIST) {
+		printf("Error creating store %s : %s\n", dir, strerror(errno));
+		goto err;
+	}
+	st->dirfd = open(dir, O_RDONLY | O_DIRECTORY);
+	if (st->dirfd < 0) {
+		printf("Error opening store %s : %s\n", dir, strerror(errno));
+		goto err;
+	}
+
+	fd = openat(st->dirfd, "store", block_size ? O_RDWR | O_CREAT : O_RDONLY,
+			0644);
+	if (fd < 0) {
+		printf("Error opening store %s : %s\n", dir, strerror(errno));
+		goto err_dir;
+	}
+	if (lockfd && flock(fd, LOCK_EX | LOCK_NB) < 0) {
+		printf("Store %s is in use\n", dir);
+		goto err_fd;
+	}
+	// A new store gets its header
+	if (block_size && lseek(fd, 0, SEEK_END) == 0) {
+		memset(&hdr, 0x00, sizeof(hdr));
+		memcpy(hdr.magic, EXT_STORE_MAGIC, sizeof(hdr.magic));
+		hdr.version = htole32(EXT_STORE_VERSION);
+		hdr.block_size = htole32(block_size);
+		hdr.pack_blocks = htole32(EXT_STORE_PACK_BLOCKS);
+		if (pwrite(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+				fsync(fd) < 0) {
+			printf("Error writing store header : %s\n", strerror(errno));
+			goto err_fd;
+		}
+	}
+	if (store_read_header(st, fd) < 0)
+		goto err_fd;
+	if (block_size && block_size != st->block_size) {
+		printf("Store %s has %u byte blocks, the image %u\n", dir,
+				st->block_size, block_size);
+		goto err_fd;
+	}
+	if (lockfd)
+		*lockfd = fd;
+	else
+		close(fd);
+	return st;
+
+err_fd:
+	close(fd);
+err_dir:
+	close(st->dirfd);
+err:
+	pthread_mutex_destroy(&st->lock);
+	free(st);
+	return NULL;
+}
+
+/**
+ * pack_fd() - Get the file of a pack, opening it on first use
+ *
+ * @create	: Open for writing and create it if needed
+ */
+static int pack_fd(struct ext_store *st, uint32_t pack, int create)
+{
+	char name[32];
+	int *p, fd, i;
+
+	pthread_mutex_lock(&st->lock);
+	if (pack >= st->npacks) {
+		p = realloc(st->packs, (pack + 1) * sizeof(*p));
+		if (!p) {
+			pthread_mutex_unlock(&st->lock);
+			printf("Failed to allocate memory\n");
+			return -1;
+		}
+		for (i = st->npacks; i <= (int)pack; i++)
+			p[i] = -1;
+		st->packs = p;
+		st->npacks = pack + 1;
+	}
+	if (st->packs[pack] < 0) {
+		snprintf(name, sizeof(name), "pack-%06u", pack);
+		st->packs[pack] = openat(st->dirfd, name,
+				create ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+		if (st->packs[pack] < 0)
+			printf("Error opening %s of the store : %s\n", name,
+					strerror(errno));
+	}
+	fd = st->packs[pack];
+	pthread_mutex_unlock(&st->lock);
+	return fd;
+}
+
+static int is_zero(const unsigned char *p, size_t len)
+{
+	return p[0] == 0 && memcmp(p, p + 1, len - 1) == 0;
+}
+
+static int table_grow(struct capture *cap)
+{
+	uint64_t size = (cap->mask + 1) * 2, i, h;
+	uint32_t *t;
+
+	t = calloc(size, sizeof(*t));
+	if (!t) {
+		printf("Failed to allocate memory\n");
+		return -1;
+	}
+	for (i = 1; i <= cap->count; i++) {
+		for (h = cap->digests[i - 1].lo & (size - 1); t[h];
+				h = (h + 1) & (size - 1))
+			;
+		t[h] = i;
+	}
+	free(cap->table);
+	cap->table = t;
+	cap->mask = size - 1;
+	return 0;
+}
+
+/**
+ * table_find() - Look up a digest
+ *
+ * @slot	: Set to the slot of the digest or the empty slot for it
+ *
+ * Return: Block id or 0 if the digest is not in the store
+ */
+static uint32_t table_find(const struct capture *cap, const struct bh_digest *d,
+		uint64_t *slot)
+{
+	const struct bh_digest *e;
+	uint64_t h;
+
+	for (h = d->lo & cap->mask; cap->table[h]; h = (h + 1) & cap->mask) {
+		e = &cap->digests[cap->table[h] - 1];
+		if (e->lo == d->lo && e->hi == d->hi)
+			break;
+	}
+	*slot = h;
+	return cap->table[h];
+}
+
+/**
+ * load_digests() - Read the digests of all blocks already in the store
+ *
+ * Digests of blocks whose data did not make it into the pack before a
+ * crash are dropped, those blocks will be stored again.
+ */
+static int load_digests(struct capture *cap)
+{
+	struct ext_store *st = cap->st;
+	struct stat sb;
+	uint64_t count, have, pack, i;
+	int fd, pfd;
+
+	fd = openat(st->dirfd, "digests", O_RDWR | O_CREAT, 0644);
+	if (fd < 0 || fstat(fd, &sb) < 0) {
+		printf("Error opening digests of the store : %s\n", strerror(errno));
+		goto err;
+	}
+	count = sb.st_size / sizeof(struct bh_digest);
+	if (count > UINT32_MAX - 1) {
+		printf("Store is full\n");
+		goto err;
+	}
+	if (count > 0) {
+		pack = (count - 1) / st->pack_blocks;
+		pfd = pack_fd(st, pack, 1);
+		if (pfd < 0 || fstat(pfd, &sb) < 0)
+			goto err;
+		have = pack * st->pack_blocks + sb.st_size / st->block_size;
+		if (have < count)
+			count = have;
+	}
+
+	cap->alloc = count > 1024 ? count * 2 : 2048;
+	cap->digests = malloc(cap->alloc * sizeof(*cap->digests));
+	if (!cap->digests) {
+		printf("Failed to allocate memory\n");
+		goto err;
+	}
+	for (i = 0; i < count; i += have) {
+		have = pread(fd, cap->digests + i, (count - i) *
+				sizeof(*cap->digests), i * sizeof(*cap->digests));
+		if ((ssize_t)have <= 0) {
+			printf("Error reading digests of the store\n");
+			goto err;
+		}
+		have /= sizeof(*cap->digests);
+	}
+	for (i = 0; i < count; i++) {
+		cap->digests[i].lo = le64toh(cap->digests[i].lo);
+		cap->digests[i].hi = le64toh(cap->digests[i].hi);
+	}
+	cap->count = count;
+	cap->mask = 1023;
+	while (cap->mask + 1 < cap->alloc)
+		cap->mask = cap->mask * 2 + 1;
+	cap->mask >>= 1;
+	if (table_grow(cap) < 0)
+		goto err;
+
+	if (ftruncate(fd, count * sizeof(*cap->digests)) < 0 ||
+			lseek(fd, 0, SEEK_END) < 0) {
+		printf("Error writing digests of the store : %s\n", strerror(errno));
+		goto err;
+	}
+	cap->dfile = fdopen(fd, "a");
+	if (!cap->dfile)
+		goto err;
+	return 0;
+
+err:
+	if (fd >= 0)
+		close(fd);
+	return -1;
+}
+
+/**
+ * flush_blocks() - Write the pending new blocks and then their digests
+ */
+static int flush_blocks(struct capture *cap)
+{
+	struct ext_store *st = cap->st;
+	struct bh_digest d;
+	uint64_t slot = (cap->wfirst - 1) % st->pack_blocks, i;
+	size_t len = cap->wn * st->block_size, done;
+	ssize_t n;
+	int fd;
+
+	if (cap->wn == 0)
+		return 0;
+	fd = pack_fd(st, (cap->wfirst - 1) / st->pack_blocks, 1);
+	if (fd < 0)
+		return -1;
+	for (done = 0; done < len; done += n) {
+		n = pwrite(fd, cap->wbuf + done, len - done,
+				slot * st->block_size + done);
+		if (n <= 0) {
+			printf("Error writing pack of the store : %s\n",
+					strerror(errno));
+			return -1;
+		}
+	}
+	for (i = cap->wfirst; i < cap->wfirst + cap->wn; i++) {
+		d.lo = htole64(cap->digests[i - 1].lo);
+		d.hi = htole64(cap->digests[i - 1].hi);
+		if (fwrite(&d, sizeof(d), 1, cap->dfile) != 1) {
+			printf("Error writing digests of the store : %s\n",
+					strerror(errno));
+			return -1;
+		}
+	}
+	cap->wn = 0;
+	return 0;
+}
+
+/**
+ * same_block() - Compare a block with a stored one of the same digest
+ *
+ * The stored block is still in the write buffer or read back from its
+ * pack.
+ *
+ * Return: 1 if the bytes are equal, 0 if not, -1 on error
+ */
+static int same_block(struct capture *cap, uint64_t id, const unsigned char *p)
+{
+	struct ext_store *st = cap->st;
+	size_t done;
+	ssize_t n;
+	int fd;
+
+	if (cap->wn > 0 && id >= cap->wfirst && id < cap->wfirst + cap->wn)
+		return memcmp(cap->wbuf + (id - cap->wfirst) * st->block_size, p,
+				st->block_size) == 0;
+	fd = pack_fd(st, (id - 1) / st->pack_blocks, 1);
+	if (fd < 0)
+		return -1;
+	for (done = 0; done < st->block_size; done += n) {
+		n = pread(fd, cap->cbuf + done, st->block_size - done,
+				((id - 1) % st->pack_blocks) * st->block_size + done);
+		if (n <= 0) {
+			printf("Error reading pack of the store : %s\n",
+					n < 0 ? strerror(errno) : "short read");
+			return -1;
+		}
+	}
+	return memcmp(cap->cbuf, p, st->block_size) == 0;
+}
+
+/**
+ * add_block() - Find a block in the store or add it
+ *
+ * A block whose digest is already in the store is compared byte by
+ * byte with the stored one. If they differ, the digests collide and the
+ * block is stored as a new one. It is left out of the table, so later
+ * copies of it are stored again too.
+ *
+ * Return: Block id, 0 on error
+ */
+static uint32_t add_block(struct capture *cap, const unsigned char *p)
+{
+	struct ext_store *st = cap->st;
+	struct bh_digest d, *nd;
+	uint64_t slot, id;
+	int same = 0;
+
+	blockhash(p, st->block_size, &d);
+	id = table_find(cap, &d, &slot);
+	if (id) {
+		same = same_block(cap, id, p);
+		if (same < 0)
+			return 0;
+		if (same) {
+			cap->dup++;
+			return id;
+		}
+		cap->collisions++;
+	}
+	if (cap->count >= UINT32_MAX - 1) {
+		printf("Store is full\n");
+		return 0;
+	}
+	if (cap->count == cap->alloc) {
+		nd = realloc(cap->digests, cap->alloc * 2 * sizeof(*nd));
+		if (!nd) {
+			printf("Failed to allocate memory\n");
+			return 0;
+		}
+		cap->digests = nd;
+		cap->alloc *= 2;
+	}
+	id = ++cap->count;
+	cap->digests[id - 1] = d;
+	if (cap->table[slot] == 0)
+		cap->table[slot] = id;
+	if (cap->count * 2 > cap->mask + 1 && table_grow(cap) < 0)
+		return 0;
+
+	// New blocks of one pack are written together
+	if (cap->wn > 0 && (cap->wn == cap->wmax ||
+			(id - 1) / st->pack_blocks !=
+			(cap->wfirst - 1) / st->pack_blocks) &&
+			flush_blocks(cap) < 0)
+		return 0;
+	if (cap->wn == 0)
+		cap->wfirst = id;
+	memcpy(cap->wbuf + cap->wn * st->block_size, p, st->block_size);
+	cap->wn++;
+	cap->added++;
+	return id;
+}
+
+/**
+ * reader() - Read the image in large chunks ahead of the hashing
+ *
+ * The buffers are filled in turn, an empty buffer marks the end.
+ */
+static void *reader(void *arg)
+{
+	struct capture *cap = arg;
+	struct cap_buf *b;
+	uint64_t off = 0;
+	size_t len, done;
+	ssize_t n;
+	int i = 0, last = 0;
+
+	while (!last) {
+		b = &cap->bufs[i];
+		pthread_mutex_lock(&cap->lock);
+		while (b->full && !cap->stop)
+			pthread_cond_wait(&cap->cond, &cap->lock);
+		pthread_mutex_unlock(&cap->lock);
+		if (cap->stop)
+			break;
+
+		len = cap->fs->size - off < EXT_STORE_CHUNK ?
+			cap->fs->size - off : EXT_STORE_CHUNK;
+		b->err = 0;
+		for (done = 0; done < len; done += n) {
+			n = ext_pread(cap->fs, b->data + done, len - done,
+					off + done);
+			if (n <= 0) {
+				b->err = n < 0 ? errno : EIO;
+				break;
+			}
+		}
+		b->len = len;
+		off += len;
+		last = len == 0 || b->err;
+
+		pthread_mutex_lock(&cap->lock);
+		b->full = 1;
+		pthread_cond_broadcast(&cap->cond);
+		pthread_mutex_unlock(&cap->lock);
+		i = (i + 1) % EXT_STORE_BUFFERS;
+	}
+	return NULL;
+}
+
+/**
+ * capture_blocks() - Hash the chunks from the reader and write the map
+ */
+static int capture_blocks(struct capture *cap, FILE *map)
+{
+	struct ext_store *st = cap->st;
+	struct cap_buf *b;
+	uint32_t ids[EXT_STORE_CHUNK / 512], id;
+	size_t k, n;
+	int i = 0, ret = -1;
+
+	while (1) {
+		b = &cap->bufs[i];
+		pthread_mutex_lock(&cap->lock);
+		while (!b->full)
+			pthread_cond_wait(&cap->cond, &cap->lock);
+		pthread_mutex_unlock(&cap->lock);
+		if (b->err) {
+			printf("Error reading the image : %s\n", strerror(b->err));
+			break;
+		}
+		if (b->len == 0) {
+			ret = 0;
+			break;
+		}
+
+		// A partial last block is stored padded with zeros
+		n = (b->len + st->block_size - 1) / st->block_size;
+		memset(b->data + b->len, 0x00, n * st->block_size - b->len);
+		for (k = 0; k < n; k++) {
+			if (is_zero(b->data + k * st->block_size, st->block_size)) {
+				cap->zero++;
+				id = 0;
+			} else {
+				id = add_block(cap, b->data + k * st->block_size);
+				if (id == 0)
+					goto out;
+			}
+			ids[k] = htole32(id);
+		}
+		if (fwrite(ids, sizeof(*ids), n, map) != n) {
+			printf("Error writing snapshot : %s\n", strerror(errno));
+			break;
+		}
+
+		pthread_mutex_lock(&cap->lock);
+		b->full = 0;
+		pthread_cond_broadcast(&cap->cond);
+		pthread_mutex_unlock(&cap->lock);
+		i = (i + 1) % EXT_STORE_BUFFERS;
+	}
+out:
+	if (ret == 0)
+		ret = flush_blocks(cap);
+	return ret;
+}
+
+// Flush and sync everything a snapshot refers to
+static int sync_store(struct capture *cap)
+{
+	struct ext_store *st = cap->st;
+	uint32_t i;
+
+	for (i = 0; i < st->npacks; i++)
+		if (st->packs[i] >= 0 && fdatasync(st->packs[i]) < 0)
+			return -1;
+	if (fflush(cap->dfile) != 0 || fdatasync(fileno(cap->dfile)) < 0)
+		return -1;
+	return 0;
+}
+
+/**
+ * ext_store_capture() - Capture an image into a store as a snapshot
+ *
+ * The image is read in EXT_STORE_CHUNK pieces by a reader thread, the
+ * calling thread hashes every block with blockhash() and looks it up in
+ * a table of all digests in the store. Blocks of zeros are not stored,
+ * blocks already in the store are only referenced by the snapshot, new
+ * ones are appended to the current pack. A block with the digest of a
+ * stored one is compared with it byte by byte and stored as new if the
+ * digests collide, so a block never takes the bytes of another.
+ *
+ * @fs		: Open file system, gives the block size and UUID
+ * @dir		: Store directory, created if it does not exist
+ * @name	: Snapshot name, an existing snapshot of that name is replaced
+ */
+int ext_store_capture(struct ext_fs *fs, const char *dir, const char *name)
+{
+	struct ext_snap_header hdr;
+	struct capture cap;
+	pthread_t tid;
+	char path[300], tmp[310];
+	double start = now(), elapsed;
+	uint64_t blocks;
+	FILE *map = NULL;
+	int lockfd = -1, fd, i, started = 0, ret = -1;
+
+	if (!*name || strchr(name, '/') || strlen(name) > 250) {
+		printf("Invalid snapshot name %s\n", name);
+		return -1;
+	}
+	snprintf(path, sizeof(path), "%s.snap", name);
+	snprintf(tmp, sizeof(tmp), "%s.snap.tmp", name);
+
+	memset(&cap, 0x00, sizeof(cap));
+	cap.fs = fs;
+	cap.st = store_open_dir(dir, fs->block_size, &lockfd);
+	if (!cap.st)
+		return -1;
+	pthread_mutex_init(&cap.lock, NULL);
+	pthread_cond_init(&cap.cond, NULL);
+	if (load_digests(&cap) < 0)
+		goto out;
+
+	cap.wmax = EXT_STORE_CHUNK / fs->block_size;
+	cap.wbuf = malloc(EXT_STORE_CHUNK);
+	cap.cbuf = malloc(fs->block_size);
+	for (i = 0; i < EXT_STORE_BUFFERS; i++) {
+		cap.bufs[i].data = malloc(EXT_STORE_CHUNK);
+		if (!cap.bufs[i].data)
+			break;
+	}
+	if (!cap.wbuf || !cap.cbuf || i < EXT_STORE_BUFFERS) {
+		printf("Failed to allocate memory\n");
+		goto out;
+	}
+
+	fd = openat(cap.st->dirfd, tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	map = fd < 0 ? NULL : fdopen(fd, "w");
+	if (!map) {
+		printf("Error creating snapshot %s : %s\n", name, strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		goto out;
+	}
+	// Room for the header, written last
+	memset(&hdr, 0x00, sizeof(hdr));
+	if (fwrite(&hdr, sizeof(hdr), 1, map) != 1)
+		goto err_write;
+
+	if (pthread_create(&tid, NULL, reader, &cap)) {
+		printf("Failed to create reader thread\n");
+		goto out;
+	}
+	started = 1;
+	if (capture_blocks(&cap, map) < 0)
+		goto out;
+	if (sync_store(&cap) < 0)
+		goto err_write;
+
+	blocks = (fs->size + fs->block_size - 1) / fs->block_size;
+	memcpy(hdr.magic, EXT_SNAP_MAGIC, sizeof(hdr.magic));
+	hdr.version = htole32(EXT_STORE_VERSION);
+	hdr.block_size = htole32(fs->block_size);
+	hdr.blocks = htole64(blocks);
+	hdr.size = htole64(fs->size);
+	hdr.created = htole64(time(NULL));
+	memcpy(hdr.uuid, fs->sb.s_uuid, sizeof(hdr.uuid));
+	if (fseek(map, 0, SEEK_SET) < 0 || fwrite(&hdr, sizeof(hdr), 1, map) != 1 ||
+			fflush(map) != 0 || fdatasync(fileno(map)) < 0)
+		goto err_write;
+	if (renameat(cap.st->dirfd, tmp, cap.st->dirfd, path) < 0 ||
+			fsync(cap.st->dirfd) < 0)
+		goto err_write;
+
+	elapsed = now() - start;
+	printf("Captured %llu blocks (%.1f MB) in %.2f s (%.1f MB/s)\n",
+			(unsigned long long)blocks, fs->size / 1e6, elapsed,
+			fs->size / 1e6 / (elapsed > 0 ? elapsed : 1));
+	printf("New blocks : %llu (%.1f MB), already stored : %llu, zero : %llu\n",
+			(unsigned long long)cap.added,
+			cap.added * (double)fs->block_size / 1e6,
+			(unsigned long long)cap.dup, (unsigned long long)cap.zero);
+	if (cap.collisions)
+		printf("Digest collisions : %llu blocks stored again\n",
+				(unsigned long long)cap.collisions);
+	printf("Store %s holds %llu blocks (%.1f MB) in %llu packs\n", dir,
+			(unsigned long long)cap.count,
+			cap.count * (double)fs->block_size / 1e6,
+			(unsigned long long)((cap.count + cap.st->pack_blocks - 1) /
+				cap.st->pack_blocks));
+	ret = 0;
+	goto out;
+
+err_write:
+	printf("Error writing snapshot %s : %s\n", name, strerror(errno));
+out:
+	if (started) {
+		pthread_mutex_lock(&cap.lock);
+		cap.stop = 1;
+		pthread_cond_broadcast(&cap.cond);
+		pthread_mutex_unlock(&cap.lock);
+		pthread_join(tid, NULL);
+	}
+	if (map && fclose(map) != 0 && ret == 0) {
+		printf("Error writing snapshot %s : %s\n", name, strerror(errno));
+		ret = -1;
+	}
+	if (ret < 0)
+		unlinkat(cap.st->dirfd, tmp, 0);
+	if (cap.dfile)
+		fclose(cap.dfile);
+	for (i = 0; i < EXT_STORE_BUFFERS; i++)
+		free(cap.bufs[i].data);
+	free(cap.wbuf);
+	free(cap.cbuf);
+	free(cap.digests);
+	free(cap.table);
+	pthread_cond_destroy(&cap.cond);
+	pthread_mutex_destroy(&cap.lock);
+	ext_store_close(cap.st);
+	close(lockfd);
+	return ret;
+}
+
+/**
+ * ext_store_open() - Open a snapshot of a store for reading
+ */
+struct ext_store *ext_store_open(const char *dir, const char *name)
+{
+	const struct ext_snap_header *hdr;
+	struct ext_store *st;
+	struct stat sb;
+	char path[300];
+	void *p;
+	int fd;
+
+	if (!*name || strchr(name, '/') || strlen(name) > 250) {
+		printf("Invalid snapshot name %s\n", name);
+		return NULL;
+	}
+	st = store_open_dir(dir, 0, NULL);
+	if (!st)
+		return NULL;
+	snprintf(path, sizeof(path), "%s.snap", name);
+	fd = openat(st->dirfd, path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &sb) < 0 || (size_t)sb.st_size < sizeof(*hdr)) {
+		printf("Error opening snapshot %s : %s\n", name,
+				fd < 0 ? strerror(errno) : "too short");
+		goto err;
+	}
+	p = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	fd = -1;
+	if (p == MAP_FAILED) {
+		printf("Failed to map snapshot %s\n", name);
+		goto err;
+	}
+	st->snap = hdr = p;
+	st->snap_len = sb.st_size;
+	st->blocks = le64toh(hdr->blocks);
+	st->size = le64toh(hdr->size);
+	if (memcmp(hdr->magic, EXT_SNAP_MAGIC, sizeof(hdr->magic)) != 0 ||
+			le32toh(hdr->version) != EXT_STORE_VERSION ||
+			le32toh(hdr->block_size) != st->block_size ||
+			st->blocks > (st->snap_len - sizeof(*hdr)) / sizeof(uint32_t) ||
+			st->size > st->blocks * st->block_size) {
+		printf("Invalid snapshot %s\n", name);
+		goto err;
+	}
+	st->map = (const uint32_t *)(hdr + 1);
+	return st;
+
+err:
+	if (fd >= 0)
+		close(fd);
+	ext_store_close(st);
+	return NULL;
+}
+
+/**
+ * ext_store_read() - Read from the image of a snapshot
+ *
+ * Works like pread() on the captured image. Blocks that follow each
+ * other in the image and in a pack are read with a single pread().
+ */
+ssize_t ext_store_read(struct ext_store *st, void *buf, size_t len,
+		uint64_t off)
+{
+	unsigned char *p = buf;
+	uint64_t blk, id, pack, in, run;
+	size_t n, done = 0;
+	ssize_t r;
+	int fd;
+
+	if (off >= st->size)
+		return 0;
+	if (len > st->size - off)
+		len = st->size - off;
+
+	while (done < len) {
+		blk = (off + done) / st->block_size;
+		in = (off + done) % st->block_size;
+		id = le32toh(st->map[blk]);
+		if (id == 0) {
+			n = st->block_size - in < len - done ?
+				st->block_size - in : len - done;
+			memset(p + done, 0x00, n);
+			done += n;
+			continue;
+		}
+
+		pack = (id - 1) / st->pack_blocks;
+		for (run = 1; blk + run < st->blocks &&
+				run * st->block_size < in + (len - done) &&
+				le32toh(st->map[blk + run]) == id + run &&
+				(id + run - 1) / st->pack_blocks == pack; run++)
+			;
+		n = run * st->block_size - in < len - done ?
+			run * st->block_size - in : len - done;
+		fd = pack_fd(st, pack, 0);
+		if (fd < 0)
+			return -1;
+		r = pread(fd, p + done, n, ((id - 1) % st->pack_blocks) *
+				st->block_size + in);
+		if (r < (ssize_t)n) {
+			printf("Block %llu of the snapshot is missing from the "
+					"store\n", (unsigned long long)blk);
+			errno = EIO;
+			return -1;
+		}
+		done += n;
+	}
+	return done;
+}
+
+void ext_store_close(struct ext_store *st)
+{
+	uint32_t i;
+
+	if (!st)
+		return;
+	for (i = 0; i < st->npacks; i++)
+		if (st->packs[i] >= 0)
+			close(st->packs[i]);
+	free(st->packs);
+	if (st->snap)
+		munmap((void *)st->snap, st->snap_len);
+	close(st->dirfd);
+	pthread_mutex_destroy(&st->lock);
+	free(st);
+}
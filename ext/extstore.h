@@ -0,0 +1,91 @@
+/*
+ * extstore - Content addressed block store for ext2/3/4 images
+ *
+ * Written in 2026 by the ext3dump contributors
+ *
+ * To the extent possible under law, the author(s) have dedicated
+ * all copyright and related and neighboring rights to this software
+ * to the public domain worldwide. This software is distributed
+ * without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication
+ * along with this software.
+ * If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+#ifndef EXTSTORE_H
+#define EXTSTORE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <pthread.h>
+
+#define EXT_STORE_MAGIC		"EXTSTOR1"
+#define EXT_SNAP_MAGIC		"EXTSNAP1"
+#define EXT_STORE_VERSION	1
+#define EXT_STORE_PACK_BLOCKS	(256 * 1024)	// Blocks per pack file
+#define EXT_STORE_CHUNK		(4 * 1024 * 1024)	// Capture read size
+#define EXT_STORE_BUFFERS	4	// Capture reads in flight
+
+/*
+ * A store is a directory :
+ *
+ *   store	ext_store_header
+ *   digests	16 byte blockhash digest of every stored block, in id order
+ *   pack-N	raw block data, block id i is in pack (i - 1) / pack_blocks
+ *		at slot (i - 1) % pack_blocks
+ *   NAME.snap	ext_snap_header and a little endian 32 bit block id for
+ *		every block of the image, 0 for a block of zeros
+ *
+ * Pack and digest files are only appended to, a block is written to its
+ * pack before its digest, and a snapshot is renamed into place after
+ * both are synced, so a crash loses at most the capture in progress.
+ */
+
+struct ext_store_header {
+	char     magic[8];
+	uint32_t version;
+	uint32_t block_size;
+	uint32_t pack_blocks;
+	uint8_t  reserved[44];
+} __attribute__((packed));
+
+struct ext_snap_header {
+	char     magic[8];
+	uint32_t version;
+	uint32_t block_size;
+	uint64_t blocks;		// Entries in the map
+	uint64_t size;			// Image size in bytes
+	uint64_t created;		// Capture time, seconds since the epoch
+	uint8_t  uuid[16];		// File system UUID
+	uint8_t  reserved[8];
+} __attribute__((packed));
+
+// An open store, with the map of one snapshot when reading
+struct ext_store {
+	int dirfd;
+	uint32_t block_size;
+	uint32_t pack_blocks;
+
+	pthread_mutex_t lock;		// Protects packs
+	int *packs;			// Pack files opened so far, -1 if not
+	uint32_t npacks;
+
+	// Snapshot being read
+	const uint32_t *map;
+	const struct ext_snap_header *snap;
+	size_t snap_len;
+	uint64_t blocks;
+	uint64_t size;
+};
+
+struct ext_fs;
+
+int ext_store_capture(struct ext_fs *fs, const char *dir, const char *name);
+struct ext_store *ext_store_open(const char *dir, const char *name);
+ssize_t ext_store_read(struct ext_store *st, void *buf, size_t len,
+		uint64_t off);
+void ext_store_close(struct ext_store *st);
+
+#endif
@@ -0,0 +1,1501 @@
+/*
+ * extsynth - Write synthetic ext2/3/4 images with known content
+ *
+ * Written in 2026 by the ext3dump contributors
+ *
+ * To the extent possible under law, the author(s) have dedicated
+ * all copyright and related and neighboring rights to this software
+ * to the public domain worldwide. This software is distributed
+ * without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication
+ * along with this software.
+ * If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "extsynth.h"
+#include "extimg.h"
+#include "extdir.h"
+#include "extcsum.h"
+#include "extjournal.h"
+
+#define GOLDEN			0x9E3779B97F4A7C15ULL
+#define WRITE_MAX		(1024 * 1024)	// Largest data write
+#define EXT_EXTENT_MAX_LEN	32768	// Longest initialized extent
+
+#define EXT_FEATURE_RO_COMPAT_LARGE_FILE	0x0002
+#define EXT_FEATURE_RO_COMPAT_HUGE_FILE		0x0008
+#define EXT_FEATURE_RO_COMPAT_DIR_NLINK		0x0020
+#define EXT_FEATURE_RO_COMPAT_EXTRA_ISIZE	0x0040
+#define JBD2_CRC32C_CHKSUM			4
+
+// Directory entry file types
+#define FT_REG			1
+#define FT_DIR			2
+#define FT_SYMLINK		7
+
+/*
+ * Plan, the tree and its content
+ */
+
+static inline uint64_t mix64(uint64_t x)
+{
+	x ^= x >> 30;
+	x *= 0xBF58476D1CE4E5B9ULL;
+	x ^= x >> 27;
+	x *= 0x94D049BB133111EBULL;
+	return x ^ (x >> 31);
+}
+
+static inline uint64_t rnd(uint64_t *state)
+{
+	*state += GOLDEN;
+	return mix64(*state);
+}
+
+static int add_node(struct ext_synth *s, uint32_t parent, const char *name,
+		int kind, uint64_t size)
+{
+	struct ext_synth_node *n;
+	const char *ppath = s->count ? s->n[parent].path : "";
+	size_t len;
+
+	if (s->count == s->alloc) {
+		s->alloc = s->alloc ? s->alloc * 2 : 1024;
+		n = realloc(s->n, s->alloc * sizeof(*n));
+		if (!n) {
+			printf("Failed to allocate memory\n");
+			return -1;
+		}
+		s->n = n;
+	}
+	n = &s->n[s->count];
+	memset(n, 0x00, sizeof(*n));
+	len = strlen(ppath) + 1 + strlen(name) + 1;
+	n->path = malloc(len);
+	if (!n->path) {
+		printf("Failed to allocate memory\n");
+		return -1;
+	}
+	snprintf(n->path, len, "%s%s%s", ppath, *ppath ? "/" : "", name);
+	n->name = n->path + strlen(n->path) - strlen(name);
+	n->parent = parent;
+	n->kind = kind;
+	n->size = size;
+	n->seed = mix64(s->opts.seed ^ (s->count * GOLDEN));
+	if (kind != EXT_SYNTH_DIR && kind != EXT_SYNTH_SYMLINK)
+		s->data_bytes += size;
+
+	// Root is 2 and lost+found 11, the first 11 inodes are reserved
+	if (s->count == 0)
+		n->ino = 2;
+	else if (s->count == 1)
+		n->ino = 11;
+	else
+		n->ino = s->count + 10;
+	s->last_ino = n->ino > s->last_ino ? n->ino : s->last_ino;
+	s->count++;
+	return 0;
+}
+
+/**
+ * add_children() - Add all entries of a directory one after the other
+ *
+ * Which entries a directory gets follows from its path, and the nodes
+ * are expanded in order, so the tree comes out breadth first.
+ */
+static int add_children(struct ext_synth *s, uint32_t dir, uint64_t *rng)
+{
+	const struct ext_synth_opts *o = &s->opts;
+	static const char chars[] = "abcdefghijklmnopqrstuvwxyz0123456789_-";
+	char name[64];
+	const char *path = s->n[dir].path;
+	uint32_t i, first, ndirs, k, len;
+	uint64_t size, cap = (o->block_size - 12) / 12;
+	int ret = 0;
+
+	s->n[dir].first_child = s->count;
+	if (dir == 0) {
+		ret |= add_node(s, 0, "lost+found", EXT_SYNTH_DIR, 0);
+		ret |= add_node(s, 0, "files", EXT_SYNTH_DIR, 0);
+		ret |= add_node(s, 0, "frag", EXT_SYNTH_DIR, 0);
+		ret |= add_node(s, 0, "huge", EXT_SYNTH_DIR, 0);
+		// Enough one block extents for a two level tree
+		ret |= add_node(s, 0, "deep", EXT_SYNTH_DEEP,
+				(4 * cap + 1) * o->block_size - o->block_size / 2);
+		ret |= add_node(s, 0, "sparse", EXT_SYNTH_SPARSE,
+				16 * EXT_SYNTH_HOLE_RUN * (uint64_t)o->block_size - 100);
+		ret |= add_node(s, 0, "link", EXT_SYNTH_SYMLINK, 0);
+		if (ret == 0) {
+			s->n[s->count - 1].target = "files/d000/f00000";
+			s->n[s->count - 1].size = strlen("files/d000/f00000");
+		}
+	} else if (strcmp(path, "files") == 0) {
+		ndirs = (o->files + EXT_SYNTH_PER_DIR - 1) / EXT_SYNTH_PER_DIR;
+		for (i = 0; i < ndirs && ret == 0; i++) {
+			snprintf(name, sizeof(name), "d%03u", i);
+			ret = add_node(s, dir, name, EXT_SYNTH_DIR, 0);
+		}
+	} else if (strncmp(path, "files/", 6) == 0) {
+		first = atoi(s->n[dir].name + 1) * EXT_SYNTH_PER_DIR;
+		for (i = first; i < o->files && i < first + EXT_SYNTH_PER_DIR &&
+				ret == 0; i++) {
+			// Mostly small files, a few up to max_file
+			size = rnd(rng) % ((o->max_file >> (rnd(rng) % 10)) + 1);
+			if (rnd(rng) % 16 == 0)
+				size = 0;
+			snprintf(name, sizeof(name), "f%05u", i);
+			ret = add_node(s, dir, name, EXT_SYNTH_FILE, size);
+		}
+	} else if (strcmp(path, "frag") == 0) {
+		for (i = 0; i < o->frag_files && ret == 0; i++) {
+			snprintf(name, sizeof(name), "frag%02u", i);
+			ret = add_node(s, dir, name, EXT_SYNTH_FRAG, o->frag_size);
+		}
+	} else if (strcmp(path, "huge") == 0) {
+		for (i = 0; i < o->entries && ret == 0; i++) {
+			len = snprintf(name, sizeof(name), "entry_%u_", i);
+			for (k = rnd(rng) % 24; k > 0; k--)
+				name[len++] = chars[rnd(rng) % (sizeof(chars) - 1)];
+			name[len] = '\0';
+			ret = add_node(s, dir, name, EXT_SYNTH_FILE, 0);
+		}
+	}
+	s->n[dir].nchild = s->count - s->n[dir].first_child;
+	return ret;
+}
+
+/**
+ * ext_synth_plan() - Lay out the tree of a synthetic image
+ *
+ * Everything, names, sizes and content, follows from the options and
+ * the seed, so the same options always give the same tree:
+ *
+ *   /files/dNNN/fNNNNN	files of random sizes, 100 per directory
+ *   /frag/fragNN	files written block by block in turns
+ *   /huge		a directory of many empty files
+ *   /deep		one block extents with a gap, a two level tree
+ *   /sparse		every other run of EXT_SYNTH_HOLE_RUN blocks a hole
+ *   /link		a fast symlink to the first file
+ *
+ * 64bit, flex_bg and metadata_csum are dropped unless the type is 4.
+ */
+int ext_synth_plan(struct ext_synth *s, const struct ext_synth_opts *opts)
+{
+	uint64_t rng = opts->seed;
+	uint32_t i;
+
+	memset(s, 0x00, sizeof(*s));
+	s->opts = *opts;
+	if (opts->type < 4) {
+		s->opts.bit64 = 0;
+		s->opts.flex_bg = 0;
+		s->opts.csum = 0;
+	}
+	if (add_node(s, 0, "", EXT_SYNTH_DIR, 0) < 0)
+		goto err;
+	for (i = 0; i < s->count; i++) {
+		if (s->n[i].kind == EXT_SYNTH_DIR && add_children(s, i, &rng) < 0)
+			goto err;
+	}
+	return 0;
+
+err:
+	ext_synth_free(s);
+	return -1;
+}
+
+void ext_synth_free(struct ext_synth *s)
+{
+	uint32_t i;
+
+	for (i = 0; i < s->count; i++)
+		free(s->n[i].path);
+	free(s->n);
+	s->n = NULL;
+	s->count = 0;
+}
+
+/**
+ * ext_synth_hole() - Check whether a block of a file is a hole
+ *
+ * Only /sparse has holes, its last block is always data.
+ */
+int ext_synth_hole(const struct ext_synth *s, const struct ext_synth_node *n,
+		uint64_t lblk)
+{
+	uint64_t last = (n->size + s->opts.block_size - 1) / s->opts.block_size;
+
+	return n->kind == EXT_SYNTH_SPARSE && lblk + 1 < last &&
+		(lblk / EXT_SYNTH_HOLE_RUN) % 2 == 0;
+}
+
+/**
+ * ext_synth_data() - Content of a file
+ *
+ * Every 8 bytes are a hash of the file seed and their offset, so any
+ * part can be made without the rest. Holes read as zeros.
+ *
+ * @off		: Offset in the file
+ */
+void ext_synth_data(const struct ext_synth *s, const struct ext_synth_node *n,
+		uint64_t off, unsigned char *buf, size_t len)
+{
+	unsigned int bs = s->opts.block_size;
+	uint64_t word, pos;
+	size_t i;
+
+	for (i = 0; i < len; ) {
+		pos = off + i;
+		if (ext_synth_hole(s, n, pos / bs)) {
+			word = bs - pos % bs < len - i ? bs - pos % bs : len - i;
+			memset(buf + i, 0x00, word);
+			i += word;
+			continue;
+		}
+		word = mix64(n->seed + (pos / 8) * GOLDEN);
+		if (pos % 8 == 0 && len - i >= 8) {
+			word = htole64(word);
+			memcpy(buf + i, &word, 8);
+			i += 8;
+		} else {
+			buf[i++] = word >> (8 * (pos % 8));
+		}
+	}
+}
+
+/*
+ * Image writer
+ */
+
+struct wgroup {
+	uint64_t start;			// First block
+	uint64_t end;			// Past the last block
+	uint64_t block_bitmap;
+	uint64_t inode_bitmap;
+	uint64_t inode_table;
+	uint32_t used_dirs;
+};
+
+// Entry of an extent tree level, len 0 for index entries
+struct wextent {
+	uint32_t lblk;
+	uint64_t pblk;
+	uint16_t len;
+};
+
+struct wdirent {
+	const char *name;
+	uint32_t len;
+	uint32_t ino;
+	uint8_t type;
+	uint32_t hash;
+};
+
+struct writer {
+	const struct ext_synth *s;
+	const struct ext_synth_opts *o;
+	struct ext_fs fs;		// Super block and geometry
+	int fd;
+	unsigned int bs;
+	uint64_t blocks;
+	uint32_t groups;
+	uint32_t itb;			// Inode table blocks per group
+	uint32_t per_flex;
+	struct wgroup *g;
+	unsigned char *bmap;		// Block bitmap of the whole image
+	uint64_t cursor;		// Where the allocator looks next
+	int extents;
+	int htree;
+	unsigned char *inode;		// inode_size bytes
+	unsigned char *buf;		// WRITE_MAX bytes
+};
+
+static inline int bit_test(const unsigned char *map, uint64_t bit)
+{
+	return (map[bit / 8] >> (bit % 8)) & 1;
+}
+
+static inline void bit_set(unsigned char *map, uint64_t bit)
+{
+	map[bit / 8] |= 1 << (bit % 8);
+}
+
+static int wr(struct writer *w, const void *buf, size_t len, uint64_t off)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = pwrite(w->fd, buf, len, off);
+		if (n <= 0) {
+			printf("Error writing image : %s\n", strerror(errno));
+			return -1;
+		}
+		buf = (const char *)buf + n;
+		len -= n;
+		off += n;
+	}
+	return 0;
+}
+
+/**
+ * alloc_block() - Take the first free block from the cursor on
+ *
+ * Blocks are handed out in order, so what is allocated one after the
+ * other is contiguous unless metadata is in the way.
+ *
+ * @ret		: Block, 0 if the image is full
+ */
+static uint64_t alloc_block(struct writer *w)
+{
+	uint64_t b, n;
+
+	for (n = 0; n < w->blocks; n++) {
+		b = w->cursor++;
+		if (w->cursor >= w->blocks)
+			w->cursor = w->fs.first_data_block;
+		if (!bit_test(w->bmap, b)) {
+			bit_set(w->bmap, b);
+			return b;
+		}
+	}
+	printf("Image too small for the files\n");
+	return 0;
+}
+
+static int fits(struct writer *w)
+{
+	uint32_t g, f, n, has;
+
+	for (g = 0; g < w->groups; g += w->per_flex) {
+		n = w->groups - g < w->per_flex ? w->groups - g : w->per_flex;
+		f = (uint32_t)(w->g[g].end - w->g[g].start);
+		has = ext_group_has_super(&w->fs, g) ? 1 + w->fs.gdt_blocks : 0;
+		if (has + (uint64_t)n * (2 + w->itb) + 1 > f)
+			return 0;
+	}
+	return 1;
+}
+
+/**
+ * geometry() - Size the groups and place the metadata of each
+ *
+ * There are enough inodes for the tree, at least one per
+ * EXT_SYNTH_INODE_RATIO bytes. A last group too small for its own
+ * metadata is dropped. With flex_bg the bitmaps and inode tables of
+ * up to 16 groups are packed into the first of them, fewer if they do
+ * not fit there.
+ */
+static int geometry(struct writer *w)
+{
+	struct ext_fs *fs = &w->fs;
+	const struct ext_synth_opts *o = w->o;
+	uint64_t total, start;
+	uint32_t g, f, n, mult, gdt_max;
+
+	w->bs = o->block_size;
+	fs->block_size = w->bs;
+	fs->inode_size = o->inode_size;
+	fs->first_data_block = w->bs == 1024;
+	fs->blocks_per_group = 8 * w->bs;
+	fs->desc_size = o->bit64 ? EXT_GDT_ENTRY_SIZE_64 : EXT_GDT_ENTRY_SIZE;
+	w->blocks = o->size / w->bs;
+	if (w->blocks <= fs->first_data_block + 64) {
+		printf("Image too small\n");
+		return -1;
+	}
+
+	for (;;) {
+		w->groups = (w->blocks - fs->first_data_block +
+				fs->blocks_per_group - 1) / fs->blocks_per_group;
+		gdt_max = w->bs / fs->desc_size;
+		fs->gdt_blocks = (w->groups + gdt_max - 1) / gdt_max;
+
+		total = o->size / EXT_SYNTH_INODE_RATIO;
+		if (total < (uint64_t)w->s->last_ino + 16)
+			total = w->s->last_ino + 16;
+		mult = w->bs / o->inode_size > 8 ? w->bs / o->inode_size : 8;
+		fs->inodes_per_group = (total + w->groups - 1) / w->groups;
+		fs->inodes_per_group = (fs->inodes_per_group + mult - 1) / mult * mult;
+		if (fs->inodes_per_group > 8 * w->bs) {
+			printf("Image too small for %u inodes\n", w->s->last_ino);
+			return -1;
+		}
+		w->itb = (uint64_t)fs->inodes_per_group * o->inode_size / w->bs;
+
+		// Drop a last group that has no room for its metadata
+		start = fs->first_data_block +
+			(uint64_t)(w->groups - 1) * fs->blocks_per_group;
+		if (w->groups > 1 && w->blocks - start < (uint64_t)fs->gdt_blocks +
+				3 + w->itb + 64) {
+			w->blocks = start;
+			continue;
+		}
+		break;
+	}
+	fs->blocks_count = w->blocks;
+	fs->groups = w->groups;
+	fs->inodes_count = fs->inodes_per_group * w->groups;
+
+	w->g = calloc(w->groups, sizeof(*w->g));
+	w->bmap = calloc(w->blocks / 8 + 1, 1);
+	if (!w->g || !w->bmap) {
+		printf("Failed to allocate memory\n");
+		return -1;
+	}
+	for (g = 0; g < w->groups; g++) {
+		w->g[g].start = fs->first_data_block +
+			(uint64_t)g * fs->blocks_per_group;
+		w->g[g].end = w->g[g].start + fs->blocks_per_group;
+		if (w->g[g].end > w->blocks)
+			w->g[g].end = w->blocks;
+	}
+
+	w->per_flex = o->flex_bg ? 16 : 1;
+	while (!fits(w) && w->per_flex > 1)
+		w->per_flex /= 2;
+	if (!fits(w)) {
+		printf("Image too small for the inode tables\n");
+		return -1;
+	}
+
+	for (g = 0; g < w->groups; g++) {
+		f = g / w->per_flex * w->per_flex;
+		n = w->groups - f < w->per_flex ? w->groups - f : w->per_flex;
+		start = w->g[f].start + (ext_group_has_super(fs, f) ?
+				1 + fs->gdt_blocks : 0);
+		w->g[g].block_bitmap = start + (g - f);
+		w->g[g].inode_bitmap = start + n + (g - f);
+		w->g[g].inode_table = start + 2 * n + (uint64_t)(g - f) * w->itb;
+	}
+
+	// Everything in use by metadata, and block 0 of 1k block images
+	for (g = 0; g < w->groups; g++) {
+		if (ext_group_has_super(fs, g)) {
+			for (start = 0; start <= fs->gdt_blocks; start++)
+				bit_set(w->bmap, w->g[g].start + start);
+		}
+		bit_set(w->bmap, w->g[g].block_bitmap);
+		bit_set(w->bmap, w->g[g].inode_bitmap);
+		for (start = 0; start < w->itb; start++)
+			bit_set(w->bmap, w->g[g].inode_table + start);
+	}
+	bit_set(w->bmap, 0);
+	w->cursor = fs->first_data_block;
+	return 0;
+}
+
+/**
+ * set_features() - Pick the features of the image type
+ *
+ * ext2 has no journal and no directory index, ext3 adds both and ext4
+ * extents, huge files and optionally 64bit, flex_bg and metadata_csum.
+ * The geometry depends on them, sparse_super in particular.
+ */
+static void set_features(struct writer *w)
+{
+	struct ext_super_disk *sb = &w->fs.sb;
+	const struct ext_synth_opts *o = w->o;
+	uint32_t compat = 0, incompat = EXT_FEATURE_INCOMPAT_FILETYPE;
+	uint32_t ro = EXT_FEATURE_RO_COMPAT_SPARSE_SUPER |
+		EXT_FEATURE_RO_COMPAT_LARGE_FILE;
+
+	if (o->type >= 3)
+		compat |= EXT_FEATURE_COMPAT_HAS_JOURNAL | EXT_FEATURE_COMPAT_DIR_INDEX;
+	if (o->type >= 4) {
+		incompat |= EXT_FEATURE_INCOMPAT_EXTENTS;
+		ro |= EXT_FEATURE_RO_COMPAT_HUGE_FILE | EXT_FEATURE_RO_COMPAT_DIR_NLINK;
+		if (o->inode_size > 128)
+			ro |= EXT_FEATURE_RO_COMPAT_EXTRA_ISIZE;
+		if (o->bit64)
+			incompat |= EXT_FEATURE_INCOMPAT_64BIT;
+		if (o->flex_bg)
+			incompat |= EXT_FEATURE_INCOMPAT_FLEX_BG;
+		if (o->csum)
+			ro |= EXT_FEATURE_RO_COMPAT_METADATA_CSUM;
+	}
+	memset(sb, 0x00, sizeof(*sb));
+	sb->s_feature_compat = htole32(compat);
+	sb->s_feature_incompat = htole32(incompat);
+	sb->s_feature_ro_compat = htole32(ro);
+}
+
+/**
+ * fill_super() - Set up the rest of the super block, except for the
+ * free counts
+ */
+static void fill_super(struct writer *w)
+{
+	struct ext_fs *fs = &w->fs;
+	struct ext_super_disk *sb = &fs->sb;
+	const struct ext_synth_opts *o = w->o;
+	uint64_t r = mix64(o->seed);
+	int i;
+
+	sb->s_inodes_count = htole32(fs->inodes_count);
+	sb->s_blocks_count_lo = htole32((uint32_t)w->blocks);
+	sb->s_blocks_count_hi = htole32((uint32_t)(w->blocks >> 32));
+	sb->s_first_data_block = htole32(fs->first_data_block);
+	sb->s_log_block_size = htole32(__builtin_ctz(w->bs) - 10);
+	sb->s_log_cluster_size = sb->s_log_block_size;
+	sb->s_blocks_per_group = htole32(fs->blocks_per_group);
+	sb->s_clusters_per_group = htole32(fs->blocks_per_group);
+	sb->s_inodes_per_group = htole32(fs->inodes_per_group);
+	sb->s_wtime = htole32(EXT_SYNTH_TIME);
+	sb->s_max_mnt_count = htole16(0xffff);
+	sb->s_magic = htole16(EXT_SUPER_MAGIC);
+	sb->s_state = htole16(1);
+	sb->s_errors = htole16(1);
+	sb->s_lastcheck = htole32(EXT_SYNTH_TIME);
+	sb->s_rev_level = htole32(1);
+	sb->s_first_ino = htole32(11);
+	sb->s_inode_size = htole16(o->inode_size);
+	for (i = 0; i < 16; i++)
+		sb->s_uuid[i] = rnd(&r);
+	sb->s_uuid[6] = (sb->s_uuid[6] & 0x0f) | 0x40;
+	sb->s_uuid[8] = (sb->s_uuid[8] & 0x3f) | 0x80;
+	memcpy(sb->s_volume_name, "synth", 5);
+	for (i = 0; i < 4; i++)
+		sb->s_hash_seed[i] = htole32((uint32_t)rnd(&r));
+	sb->s_def_hash_version = EXT_HASH_HALF_MD4;
+	sb->s_flags = htole32(EXT_FLAGS_SIGNED_HASH);
+	if (o->bit64)
+		sb->s_desc_size = htole16(fs->desc_size);
+	sb->s_mkfs_time = htole32(EXT_SYNTH_TIME);
+	if (o->inode_size > 128) {
+		sb->s_min_extra_isize = htole16(32);
+		sb->s_want_extra_isize = htole16(32);
+	}
+	if (o->flex_bg)
+		sb->s_log_groups_per_flex = __builtin_ctz(w->per_flex);
+	if (o->csum) {
+		sb->s_checksum_type = EXT_CSUM_CRC32C;
+		fs->csum = 1;
+		fs->csum_seed = ext_crc32c(~0U, sb->s_uuid, sizeof(sb->s_uuid));
+	}
+	w->extents = o->type >= 4;
+	w->htree = o->type >= 3;
+}
+
+/**
+ * put_inode() - Write an inode into its table, with its checksum
+ */
+static int put_inode(struct writer *w, uint32_t ino)
+{
+	struct ext_inode_disk *inode = (void *)w->inode;
+	uint32_t group = (ino - 1) / w->fs.inodes_per_group, crc;
+	const size_t hi = offsetof(struct ext_inode_disk, i_checksum_hi);
+
+	if (w->fs.csum) {
+		inode->i_checksum_lo = 0;
+		if (w->o->inode_size > 128)
+			inode->i_checksum_hi = 0;
+		crc = ext_csum_inode_seed(&w->fs, ino, inode);
+		crc = ext_crc32c(crc, w->inode, w->o->inode_size);
+		inode->i_checksum_lo = htole16(crc & 0xffff);
+		if (w->o->inode_size > 128 &&
+				128 + (size_t)le16toh(inode->i_extra_isize) >= hi + 2)
+			inode->i_checksum_hi = htole16(crc >> 16);
+	}
+	return wr(w, w->inode, w->o->inode_size,
+			w->g[group].inode_table * w->bs +
+			(uint64_t)((ino - 1) % w->fs.inodes_per_group) *
+			w->o->inode_size);
+}
+
+// Start a new inode, with the times and size every inode has
+static struct ext_inode_disk *new_inode(struct writer *w, uint16_t mode,
+		uint64_t size, uint16_t links)
+{
+	struct ext_inode_disk *inode = (void *)w->inode;
+
+	memset(w->inode, 0x00, w->o->inode_size);
+	inode->i_mode = htole16(mode);
+	inode->i_size_lo = htole32((uint32_t)size);
+	inode->i_size_high = htole32((uint32_t)(size >> 32));
+	inode->i_atime = htole32(EXT_SYNTH_TIME);
+	inode->i_ctime = htole32(EXT_SYNTH_TIME);
+	inode->i_mtime = htole32(EXT_SYNTH_TIME);
+	inode->i_links_count = htole16(links);
+	if (w->o->inode_size > 128) {
+		inode->i_extra_isize = htole16(32);
+		inode->i_crtime = htole32(EXT_SYNTH_TIME);
+	}
+	return inode;
+}
+
+static void set_blocks(struct ext_inode_disk *inode, uint64_t blocks,
+		unsigned int bs)
+{
+	uint64_t sectors = blocks * (bs / 512);
+
+	inode->i_blocks_lo = htole32((uint32_t)sectors);
+	inode->i_blocks_high = htole16((uint16_t)(sectors >> 32));
+}
+
+/**
+ * write_tree_level() - Write one level of an extent tree into new blocks
+ *
+ * The entries are replaced by the index entries of the blocks written,
+ * each block full up to eh_max entries with the checksum after them.
+ *
+ * @ret		: Number of blocks written, -1 on error
+ */
+static long write_tree_level(struct writer *w, uint32_t seed,
+		struct wextent *e, size_t n, int depth)
+{
+	struct ext_extent_header *eh = (void *)w->buf;
+	struct ext_extent *ex;
+	struct ext_extent_idx *ix;
+	size_t cap = (w->bs - sizeof(*eh)) / sizeof(*ex), i, k, nb = 0;
+	uint64_t blk;
+	uint32_t crc;
+
+	for (i = 0; i < n; i += cap, nb++) {
+		blk = alloc_block(w);
+		if (blk == 0)
+			return -1;
+		memset(w->buf, 0x00, w->bs);
+		eh->eh_magic = htole16(EXT_EXT_MAGIC);
+		eh->eh_entries = htole16(n - i < cap ? n - i : cap);
+		eh->eh_max = htole16(cap);
+		eh->eh_depth = htole16(depth);
+		for (k = 0; k < cap && i + k < n; k++) {
+			if (depth == 0) {
+				ex = (void *)(w->buf + sizeof(*eh) + k * sizeof(*ex));
+				ex->ee_block = htole32(e[i + k].lblk);
+				ex->ee_len = htole16(e[i + k].len);
+				ex->ee_start_lo = htole32((uint32_t)e[i + k].pblk);
+				ex->ee_start_hi = htole16((uint16_t)(e[i + k].pblk >> 32));
+			} else {
+				ix = (void *)(w->buf + sizeof(*eh) + k * sizeof(*ix));
+				ix->ei_block = htole32(e[i + k].lblk);
+				ix->ei_leaf_lo = htole32((uint32_t)e[i + k].pblk);
+				ix->ei_leaf_hi = htole16((uint16_t)(e[i + k].pblk >> 32));
+			}
+		}
+		if (w->fs.csum) {
+			crc = htole32(ext_crc32c(seed, w->buf, sizeof(*eh) +
+						cap * sizeof(*ex)));
+			memcpy(w->buf + sizeof(*eh) + cap * sizeof(*ex), &crc, 4);
+		}
+		if (wr(w, w->buf, w->bs, blk * w->bs) < 0)
+			return -1;
+		e[nb].lblk = e[i].lblk;
+		e[nb].pblk = blk;
+		e[nb].len = 0;
+	}
+	return nb;
+}
+
+/**
+ * map_extents() - Build the extent tree of a file
+ *
+ * Up to four extents fit into i_block, more get levels of full tree
+ * blocks until the top level fits.
+ *
+ * @pblk	: Device block of every file block, 0 for a hole
+ *
+ * Return: Tree blocks written, -1 on error
+ */
+static long map_extents(struct writer *w, uint32_t ino,
+		struct ext_inode_disk *inode, const uint64_t *pblk, uint64_t n)
+{
+	struct ext_extent_header *eh = (void *)inode->i_block;
+	struct ext_extent *ex;
+	struct ext_extent_idx *ix;
+	struct wextent *e;
+	uint32_t seed;
+	uint64_t i, ne = 0, meta = 0;
+	long nb;
+	int depth = 0;
+
+	e = malloc((n + 1) * sizeof(*e));
+	if (!e) {
+		printf("Failed to allocate memory\n");
+		return -1;
+	}
+	for (i = 0; i < n; i++) {
+		if (pblk[i] == 0)
+			continue;
+		if (ne > 0 && e[ne - 1].lblk + e[ne - 1].len == i &&
+				e[ne - 1].pblk + e[ne - 1].len == pblk[i] &&
+				e[ne - 1].len < EXT_EXTENT_MAX_LEN) {
+			e[ne - 1].len++;
+			continue;
+		}
+		e[ne].lblk = i;
+		e[ne].pblk = pblk[i];
+		e[ne].len = 1;
+		ne++;
+	}
+
+	inode->i_flags |= htole32(EXT_EXTENTS_FL);
+	seed = ext_csum_inode_seed(&w->fs, ino, inode);
+	while (ne > 4) {
+		nb = write_tree_level(w, seed, e, ne, depth);
+		if (nb < 0) {
+			free(e);
+			return -1;
+		}
+		meta += nb;
+		ne = nb;
+		depth++;
+	}
+
+	eh->eh_magic = htole16(EXT_EXT_MAGIC);
+	eh->eh_entries = htole16(ne);
+	eh->eh_max = htole16(4);
+	eh->eh_depth = htole16(depth);
+	for (i = 0; i < ne; i++) {
+		if (depth == 0) {
+			ex = (struct ext_extent *)(eh + 1) + i;
+			ex->ee_block = htole32(e[i].lblk);
+			ex->ee_len = htole16(e[i].len);
+			ex->ee_start_lo = htole32((uint32_t)e[i].pblk);
+			ex->ee_start_hi = htole16((uint16_t)(e[i].pblk >> 32));
+		} else {
+			ix = (struct ext_extent_idx *)(eh + 1) + i;
+			ix->ei_block = htole32(e[i].lblk);
+			ix->ei_leaf_lo = htole32((uint32_t)e[i].pblk);
+			ix->ei_leaf_hi = htole16((uint16_t)(e[i].pblk >> 32));
+		}
+	}
+	free(e);
+	return meta;
+}
+
+/**
+ * write_indirect() - Write an indirect block and the ones below it
+ *
+ * @level	: 1 for a block of data block pointers
+ * @first	: First file block the indirect block covers
+ * @blk		: Set to the indirect block, 0 if the range is all holes
+ *
+ * Return: Indirect blocks written, -1 on error
+ */
+static long write_indirect(struct writer *w, int level, uint64_t first,
+		const uint64_t *pblk, uint64_t n, uint32_t *blk)
+{
+	uint32_t ppb = w->bs / 4, *ptr, child;
+	uint64_t span = 1, i, b;
+	long meta = 0, r;
+	int l;
+
+	*blk = 0;
+	for (l = 1; l < level; l++)
+		span *= ppb;
+	for (i = first; i < n && i < first + span * ppb; i++)
+		if (pblk[i])
+			break;
+	if (i == n || i >= first + span * ppb)
+		return 0;
+
+	ptr = calloc(ppb, sizeof(*ptr));
+	if (!ptr) {
+		printf("Failed to allocate memory\n");
+		return -1;
+	}
+	for (i = 0; i < ppb && first + i * span < n; i++) {
+		if (level == 1) {
+			ptr[i] = htole32((uint32_t)pblk[first + i]);
+			continue;
+		}
+		r = write_indirect(w, level - 1, first + i * span, pblk, n, &child);
+		if (r < 0) {
+			free(ptr);
+			return -1;
+		}
+		meta += r;
+		ptr[i] = htole32(child);
+	}
+	b = alloc_block(w);
+	if (b == 0 || wr(w, ptr, w->bs, b * w->bs) < 0) {
+		free(ptr);
+		return -1;
+	}
+	free(ptr);
+	*blk = b;
+	return meta + 1;
+}
+
+/**
+ * map_blocks() - Fill the block pointers of an ext2/3 file
+ *
+ * Return: Indirect blocks written, -1 on error
+ */
+static long map_blocks(struct writer *w, struct ext_inode_disk *inode,
+		const uint64_t *pblk, uint64_t n)
+{
+	uint64_t ppb = w->bs / 4, first = EXT_NDIR_BLOCKS, span = ppb;
+	uint32_t blk;
+	long meta = 0, r;
+	int level;
+
+	for (first = 0; first < EXT_NDIR_BLOCKS && first < n; first++)
+		inode->i_block[first] = htole32((uint32_t)pblk[first]);
+	first = EXT_NDIR_BLOCKS;
+	for (level = 1; level <= 3 && first < n; level++) {
+		r = write_indirect(w, level, first, pblk, n, &blk);
+		if (r < 0)
+			return -1;
+		meta += r;
+		inode->i_block[EXT_NDIR_BLOCKS + level - 1] = htole32(blk);
+		first += span;
+		span *= ppb;
+	}
+	return meta;
+}
+
+static long map_file(struct writer *w, uint32_t ino,
+		struct ext_inode_disk *inode, const uint64_t *pblk, uint64_t n)
+{
+	if (w->extents)
+		return map_extents(w, ino, inode, pblk, n);
+	return map_blocks(w, inode, pblk, n);
+}
+
+/**
+ * write_data() - Write the content of a file into its blocks
+ *
+ * Physically contiguous blocks are written together, up to WRITE_MAX
+ * bytes at a time.
+ */
+static int write_data(struct writer *w, const struct ext_synth_node *n,
+		const uint64_t *pblk, uint64_t nb)
+{
+	uint64_t i, k, off, len;
+
+	for (i = 0; i < nb; i = k) {
+		if (pblk[i] == 0) {
+			k = i + 1;
+			continue;
+		}
+		for (k = i + 1; k < nb && pblk[k] == pblk[k - 1] + 1 &&
+				(k - i) * w->bs < WRITE_MAX; k++)
+			;
+		off = i * w->bs;
+		len = (k - i) * w->bs;
+		memset(w->buf, 0x00, len);
+		ext_synth_data(w->s, n, off, w->buf,
+				off + len > n->size ? n->size - off : len);
+		if (wr(w, w->buf, len, pblk[i] * w->bs) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+/**
+ * write_file() - Write a file, its block map and its inode
+ *
+ * @pblk	: Blocks already allocated, or NULL to allocate them by kind
+ */
+static int write_file(struct writer *w, const struct ext_synth_node *n,
+		uint64_t *pblk)
+{
+	struct ext_inode_disk *inode;
+	uint64_t nb = (n->size + w->bs - 1) / w->bs, i, *own = NULL;
+	long meta;
+	int ret = -1;
+
+	if (n->kind == EXT_SYNTH_SYMLINK) {
+		inode = new_inode(w, 0120777, n->size, 1);
+		memcpy(inode->i_block, n->target, n->size);
+		return put_inode(w, n->ino);
+	}
+
+	if (!pblk && nb > 0) {
+		pblk = own = calloc(nb, sizeof(*pblk));
+		if (!pblk) {
+			printf("Failed to allocate memory\n");
+			return -1;
+		}
+		for (i = 0; i < nb; i++) {
+			if (ext_synth_hole(w->s, n, i))
+				continue;
+			pblk[i] = alloc_block(w);
+			if (pblk[i] == 0)
+				goto out;
+			// Leave the next block free, every block is an extent
+			if (n->kind == EXT_SYNTH_DEEP && pblk[i] + 2 < w->blocks)
+				w->cursor = pblk[i] + 2;
+		}
+	}
+	if (write_data(w, n, pblk, nb) < 0)
+		goto out;
+
+	inode = new_inode(w, 0100644, n->size, 1);
+	meta = map_file(w, n->ino, inode, pblk, nb);
+	if (meta < 0)
+		goto out;
+	for (i = 0; i < nb; i++)
+		meta += pblk[i] != 0;
+	set_blocks(inode, meta, w->bs);
+	ret = put_inode(w, n->ino);
+out:
+	free(own);
+	return ret;
+}
+
+// Write the fragmented files, which take turns block by block
+static int write_frag(struct writer *w, uint32_t first, uint32_t count)
+{
+	const struct ext_synth_node *n = &w->s->n[first];
+	uint64_t nb = (n->size + w->bs - 1) / w->bs, i, *pblk;
+	uint32_t f;
+	int ret = 0;
+
+	pblk = calloc(nb * count + 1, sizeof(*pblk));
+	if (!pblk) {
+		printf("Failed to allocate memory\n");
+		return -1;
+	}
+	for (i = 0; i < nb; i++) {
+		for (f = 0; f < count; f++) {
+			pblk[f * nb + i] = alloc_block(w);
+			if (pblk[f * nb + i] == 0) {
+				free(pblk);
+				return -1;
+			}
+		}
+	}
+	for (f = 0; f < count && ret == 0; f++)
+		ret = write_file(w, &w->s->n[first + f], pblk + f * nb);
+	free(pblk);
+	return ret;
+}
+
+static inline unsigned int rec_len(unsigned int name_len)
+{
+	return (8 + name_len + 3) & ~3U;
+}
+
+static void put_dirent(unsigned char *p, uint32_t ino, unsigned int len,
+		const char *name, unsigned int name_len, uint8_t type)
+{
+	struct ext_dir_entry_disk *de = (void *)p;
+
+	de->inode = htole32(ino);
+	de->rec_len = htole16(len);
+	de->name_len = name_len;
+	de->file_type = type;
+	memcpy(de->name, name, name_len);
+}
+
+/**
+ * fill_leaves() - Pack directory entries into leaf blocks
+ *
+ * The last entry of every block covers the rest of it, up to the
+ * checksum tail with metadata_csum.
+ *
+ * @out		: Room for the blocks, NULL to only count them
+ * @firsts	: Set to the first entry of every block, may be NULL
+ *
+ * Return: Number of blocks
+ */
+static size_t fill_leaves(struct writer *w, uint32_t dir,
+		const struct wdirent *e, size_t n, unsigned char *out,
+		size_t *firsts)
+{
+	unsigned int space = w->bs - (w->fs.csum ? 12 : 0), off = 0, prev = 0;
+	size_t i, nb = 0;
+	unsigned char *blk = NULL;
+	uint32_t seed = 0, crc;
+
+	for (i = 0; i < n; i++) {
+		if (i == 0 || off + rec_len(e[i].len) > space) {
+			if (blk)
+				((struct ext_dir_entry_disk *)(blk + prev))->rec_len =
+					htole16(space - prev);
+			if (firsts)
+				firsts[nb] = i;
+			blk = out ? out + nb * w->bs : NULL;
+			nb++;
+			off = 0;
+		}
+		if (blk)
+			put_dirent(blk + off, e[i].ino, rec_len(e[i].len), e[i].name,
+					e[i].len, e[i].type);
+		prev = off;
+		off += rec_len(e[i].len);
+	}
+	if (blk)
+		((struct ext_dir_entry_disk *)(blk + prev))->rec_len =
+			htole16(space - prev);
+
+	if (out && w->fs.csum) {
+		memset(w->inode, 0x00, sizeof(struct ext_inode_disk));
+		seed = ext_csum_inode_seed(&w->fs, dir, (void *)w->inode);
+		for (i = 0; i < nb; i++) {
+			blk = out + i * w->bs;
+			put_dirent(blk + space, 0, 12, "", 0, 0xDE);
+			crc = htole32(ext_crc32c(seed, blk, space));
+			memcpy(blk + space + 8, &crc, 4);
+		}
+	}
+	return nb;
+}
+
+static int cmp_hash(const void *a, const void *b)
+{
+	const struct wdirent *x = a, *y = b;
+
+	if (x->hash != y->hash)
+		return x->hash < y->hash ? -1 : 1;
+	return 0;
+}
+
+// Checksum tail of an htree node after its limit entries
+static void dx_csum(struct writer *w, uint32_t seed, unsigned char *blk,
+		unsigned int off)
+{
+	uint16_t limit, count;
+	uint32_t crc, zero = 0;
+
+	if (!w->fs.csum)
+		return;
+	memcpy(&limit, blk + off, 2);
+	memcpy(&count, blk + off + 2, 2);
+	crc = ext_crc32c(seed, blk, off + le16toh(count) * 8);
+	crc = ext_crc32c(crc, blk + off + le16toh(limit) * 8, 4);
+	crc = htole32(ext_crc32c(crc, &zero, 4));
+	memcpy(blk + off + le16toh(limit) * 8 + 4, &crc, 4);
+}
+
+// Set the count, limit and entries of an htree node
+static void dx_entries(unsigned char *p, unsigned int limit,
+		const uint32_t *hash, const uint32_t *block, size_t n)
+{
+	struct ext_dx_countlimit cl = { htole16(limit), htole16(n) };
+	struct ext_dx_entry de;
+	size_t i;
+
+	memcpy(p, &cl, sizeof(cl));
+	memcpy(p + 4, &(uint32_t){ htole32(block[0]) }, 4);
+	for (i = 1; i < n; i++) {
+		de.hash = htole32(hash[i]);
+		de.block = htole32(block[i]);
+		memcpy(p + i * 8, &de, sizeof(de));
+	}
+}
+
+/**
+ * build_htree() - Lay out an indexed directory
+ *
+ * The entries are sorted by hash and packed into leaves, which the
+ * root indexes directly or through one level of index nodes. Block 0 is
+ * the root, the index nodes follow and then the leaves. A leaf that
+ * starts with the hash the one before it ends with is marked as a
+ * collision in its index entry.
+ *
+ * Return: Size of the directory in blocks, 0 on error
+ */
+static size_t build_htree(struct writer *w, const struct ext_synth_node *dn,
+		struct wdirent *e, size_t n, unsigned char **outp)
+{
+	unsigned int tail = w->fs.csum ? 8 : 0;
+	unsigned int root_limit = (w->bs - 32 - tail) / 8;
+	unsigned int node_limit = (w->bs - 8 - tail) / 8;
+	struct ext_dx_root_info info = { 0, EXT_HASH_HALF_MD4, 8, 0, 0 };
+	size_t nleaves, nodes = 0, i, k, cnt, total = 0;
+	size_t *firsts = NULL;
+	uint32_t *hash = NULL, *block = NULL, seed = 0;
+	unsigned char *out = NULL, *p;
+
+	for (i = 0; i < n; i++)
+		e[i].hash = ext_dir_hash(&w->fs, EXT_HASH_HALF_MD4, e[i].name,
+				e[i].len);
+	qsort(e, n, sizeof(*e), cmp_hash);
+
+	nleaves = fill_leaves(w, dn->ino, e, n, NULL, NULL);
+	if (nleaves > root_limit)
+		nodes = (nleaves + node_limit - 1) / node_limit;
+	if (nodes > root_limit) {
+		printf("Directory %s too large for a two level htree\n", dn->path);
+		return 0;
+	}
+	total = 1 + nodes + nleaves;
+	out = calloc(total, w->bs);
+	firsts = calloc(nleaves, sizeof(*firsts));
+	hash = calloc(nleaves, sizeof(*hash));
+	block = calloc(nleaves, sizeof(*block));
+	if (!out || !firsts || !hash || !block) {
+		printf("Failed to allocate memory\n");
+		total = 0;
+		goto out;
+	}
+	fill_leaves(w, dn->ino, e, n, out + (1 + nodes) * w->bs, firsts);
+	for (i = 0; i < nleaves; i++) {
+		hash[i] = e[firsts[i]].hash;
+		if (i > 0 && e[firsts[i] - 1].hash == hash[i])
+			hash[i] |= 1;
+		block[i] = 1 + nodes + i;
+	}
+	if (w->fs.csum) {
+		memset(w->inode, 0x00, sizeof(struct ext_inode_disk));
+		seed = ext_csum_inode_seed(&w->fs, dn->ino, (void *)w->inode);
+	}
+
+	// Index nodes look like one empty entry covering the block
+	for (k = 0; k < nodes; k++) {
+		p = out + (1 + k) * w->bs;
+		put_dirent(p, 0, w->bs, "", 0, 0);
+		cnt = nleaves - k * node_limit < node_limit ?
+			nleaves - k * node_limit : node_limit;
+		dx_entries(p + 8, node_limit, hash + k * node_limit,
+				block + k * node_limit, cnt);
+		dx_csum(w, seed, p, 8);
+	}
+	if (nodes) {
+		for (k = 0; k < nodes; k++) {
+			hash[k] = hash[k * node_limit];
+			block[k] = 1 + k;
+		}
+		info.indirect_levels = 1;
+	}
+
+	p = out;
+	put_dirent(p, dn->ino, 12, ".", 1, FT_DIR);
+	put_dirent(p + 12, w->s->n[dn->parent].ino, w->bs - 12, "..", 2, FT_DIR);
+	memcpy(p + 24, &info, sizeof(info));
+	dx_entries(p + 32, root_limit, hash, block, nodes ? nodes : nleaves);
+	dx_csum(w, seed, p, 32);
+out:
+	free(firsts);
+	free(hash);
+	free(block);
+	if (total == 0)
+		free(out);
+	*outp = out;
+	return total;
+}
+
+/**
+ * write_dir() - Write a directory, its blocks and its inode
+ *
+ * A directory that needs more than one block gets an htree when the
+ * file system has dir_index, otherwise it is a plain list.
+ */
+static int write_dir(struct writer *w, const struct ext_synth_node *dn)
+{
+	const struct ext_synth *s = w->s;
+	const struct ext_synth_node *c;
+	struct ext_inode_disk *inode;
+	struct wdirent *e;
+	unsigned char *out = NULL;
+	uint64_t *pblk = NULL;
+	size_t n = dn->nchild + 2, nb, i;
+	uint32_t subdirs = 0, group;
+	long meta;
+	int ret = -1;
+
+	e = calloc(n, sizeof(*e));
+	if (!e) {
+		printf("Failed to allocate memory\n");
+		return -1;
+	}
+	e[0] = (struct wdirent){ ".", 1, dn->ino, FT_DIR, 0 };
+	e[1] = (struct wdirent){ "..", 2, s->n[dn->parent].ino, FT_DIR, 0 };
+	for (i = 0; i < dn->nchild; i++) {
+		c = &s->n[dn->first_child + i];
+		e[i + 2].name = c->name;
+		e[i + 2].len = strlen(c->name);
+		e[i + 2].ino = c->ino;
+		e[i + 2].type = c->kind == EXT_SYNTH_DIR ? FT_DIR :
+			c->kind == EXT_SYNTH_SYMLINK ? FT_SYMLINK : FT_REG;
+		subdirs += c->kind == EXT_SYNTH_DIR;
+	}
+
+	nb = fill_leaves(w, dn->ino, e, n, NULL, NULL);
+	if (nb > 1 && w->htree) {
+		nb = build_htree(w, dn, e + 2, n - 2, &out);
+		if (nb == 0)
+			goto out;
+	} else {
+		out = calloc(nb, w->bs);
+		if (!out) {
+			printf("Failed to allocate memory\n");
+			goto out;
+		}
+		fill_leaves(w, dn->ino, e, n, out, NULL);
+	}
+
+	pblk = calloc(nb, sizeof(*pblk));
+	if (!pblk) {
+		printf("Failed to allocate memory\n");
+		goto out;
+	}
+	for (i = 0; i < nb; i++) {
+		pblk[i] = alloc_block(w);
+		if (pblk[i] == 0 || wr(w, out + i * w->bs, w->bs,
+					pblk[i] * w->bs) < 0)
+			goto out;
+	}
+
+	inode = new_inode(w, 040755, nb * w->bs, 2 + subdirs);
+	if (nb > 1 && w->htree)
+		inode->i_flags |= htole32(EXT_INDEX_FL);
+	meta = map_file(w, dn->ino, inode, pblk, nb);
+	if (meta < 0)
+		goto out;
+	set_blocks(inode, nb + meta, w->bs);
+	ret = put_inode(w, dn->ino);
+	group = (dn->ino - 1) / w->fs.inodes_per_group;
+	w->g[group].used_dirs++;
+out:
+	free(pblk);
+	free(out);
+	free(e);
+	return ret;
+}
+
+/**
+ * write_journal() - Write an empty jbd2 journal as inode 8
+ *
+ * The journal is clean, s_start is 0. Its block map is backed up in
+ * the super block, as mke2fs does.
+ */
+static int write_journal(struct writer *w)
+{
+	struct jbd2_super *jsb = (void *)w->buf;
+	struct ext_inode_disk *inode;
+	uint64_t pblk[EXT_SYNTH_JOURNAL], i;
+	uint32_t incompat = JBD2_FEATURE_INCOMPAT_REVOKE;
+	long meta;
+
+	for (i = 0; i < EXT_SYNTH_JOURNAL; i++) {
+		pblk[i] = alloc_block(w);
+		if (pblk[i] == 0)
+			return -1;
+	}
+	if (w->o->bit64)
+		incompat |= JBD2_FEATURE_INCOMPAT_64BIT;
+	if (w->fs.csum)
+		incompat |= JBD2_FEATURE_INCOMPAT_CSUM_V3;
+
+	memset(w->buf, 0x00, w->bs);
+	jsb->s_header.h_magic = htobe32(JBD2_MAGIC);
+	jsb->s_header.h_blocktype = htobe32(JBD2_SUPERBLOCK_V2);
+	jsb->s_blocksize = htobe32(w->bs);
+	jsb->s_maxlen = htobe32(EXT_SYNTH_JOURNAL);
+	jsb->s_first = htobe32(1);
+	jsb->s_sequence = htobe32(1);
+	jsb->s_feature_incompat = htobe32(incompat);
+	memcpy(jsb->s_uuid, w->fs.sb.s_uuid, sizeof(jsb->s_uuid));
+	jsb->s_nr_users = htobe32(1);
+	if (w->fs.csum) {
+		jsb->s_checksum_type = JBD2_CRC32C_CHKSUM;
+		jsb->s_checksum = htobe32(ext_crc32c(~0U, jsb, sizeof(*jsb)));
+	}
+	if (wr(w, w->buf, w->bs, pblk[0] * w->bs) < 0)
+		return -1;
+
+	inode = new_inode(w, 0100600, (uint64_t)EXT_SYNTH_JOURNAL * w->bs, 1);
+	meta = map_file(w, 8, inode, pblk, EXT_SYNTH_JOURNAL);
+	if (meta < 0)
+		return -1;
+	set_blocks(inode, EXT_SYNTH_JOURNAL + meta, w->bs);
+
+	w->fs.sb.s_journal_inum = htole32(8);
+	w->fs.sb.s_jnl_backup_type = 1;
+	memcpy(w->fs.sb.s_jnl_blocks, inode->i_block, sizeof(inode->i_block));
+	w->fs.sb.s_jnl_blocks[15] = inode->i_size_high;
+	w->fs.sb.s_jnl_blocks[16] = inode->i_size_lo;
+	return put_inode(w, 8);
+}
+
+/**
+ * write_groups() - Write the bitmaps, the GDT and the super blocks
+ *
+ * Free counts come from the block bitmap kept while allocating and from
+ * the inodes handed out, 1 to last_ino. Bits past the end of the last
+ * group and past the inodes of a group are set, as mke2fs does. The
+ * super block and the GDT are copied into every group that holds a
+ * backup.
+ */
+static int write_groups(struct writer *w)
+{
+	struct ext_fs *fs = &w->fs;
+	struct ext_super_disk sb;
+	struct ext_group_desc_disk *d;
+	unsigned char *gdt, *bb = w->buf, *ib = w->buf + w->bs;
+	uint64_t b, free_blocks = 0, free_inodes = 0, used, first_ino;
+	uint32_t g, i, fb, fi, crc, bbc, ibc, le;
+	const size_t off = offsetof(struct ext_group_desc_disk, bg_checksum);
+	const uint16_t zero = 0;
+	int ret = -1;
+
+	gdt = calloc(fs->gdt_blocks, w->bs);
+	if (!gdt) {
+		printf("Failed to allocate memory\n");
+		return -1;
+	}
+	for (g = 0; g < w->groups; g++) {
+		memset(bb, 0x00, w->bs);
+		memset(ib, 0xff, w->bs);
+		for (b = 0, fb = 0; b < fs->blocks_per_group; b++) {
+			if (w->g[g].start + b >= w->g[g].end ||
+					bit_test(w->bmap, w->g[g].start + b))
+				bit_set(bb, b);
+			else
+				fb++;
+		}
+		memset(ib, 0x00, fs->inodes_per_group / 8);
+		first_ino = (uint64_t)g * fs->inodes_per_group + 1;
+		used = w->s->last_ino >= first_ino ? w->s->last_ino - first_ino + 1 : 0;
+		if (used > fs->inodes_per_group)
+			used = fs->inodes_per_group;
+		for (i = 0; i < used; i++)
+			bit_set(ib, i);
+		fi = fs->inodes_per_group - used;
+		free_blocks += fb;
+		free_inodes += fi;
+		if (wr(w, bb, w->bs, w->g[g].block_bitmap * w->bs) < 0 ||
+				wr(w, ib, w->bs, w->g[g].inode_bitmap * w->bs) < 0)
+			goto out;
+
+		bbc = fs->csum ? ext_crc32c(fs->csum_seed, bb,
+				fs->blocks_per_group / 8) : 0;
+		ibc = fs->csum ? ext_crc32c(fs->csum_seed, ib,
+				fs->inodes_per_group / 8) : 0;
+		d = (void *)(gdt + (size_t)g * fs->desc_size);
+		d->bg_block_bitmap_lo = htole32((uint32_t)w->g[g].block_bitmap);
+		d->bg_inode_bitmap_lo = htole32((uint32_t)w->g[g].inode_bitmap);
+		d->bg_inode_table_lo = htole32((uint32_t)w->g[g].inode_table);
+		d->bg_free_blocks_count_lo = htole16(fb & 0xffff);
+		d->bg_free_inodes_count_lo = htole16(fi & 0xffff);
+		d->bg_used_dirs_count_lo = htole16(w->g[g].used_dirs & 0xffff);
+		d->bg_block_bitmap_csum_lo = htole16(bbc & 0xffff);
+		d->bg_inode_bitmap_csum_lo = htole16(ibc & 0xffff);
+		if (fs->desc_size >= EXT_GDT_ENTRY_SIZE_64) {
+			d->bg_block_bitmap_hi = htole32(w->g[g].block_bitmap >> 32);
+			d->bg_inode_bitmap_hi = htole32(w->g[g].inode_bitmap >> 32);
+			d->bg_inode_table_hi = htole32(w->g[g].inode_table >> 32);
+			d->bg_free_blocks_count_hi = htole16(fb >> 16);
+			d->bg_free_inodes_count_hi = htole16(fi >> 16);
+			d->bg_used_dirs_count_hi = htole16(w->g[g].used_dirs >> 16);
+			d->bg_block_bitmap_csum_hi = htole16(bbc >> 16);
+			d->bg_inode_bitmap_csum_hi = htole16(ibc >> 16);
+		}
+		if (fs->csum) {
+			le = htole32(g);
+			crc = ext_crc32c(fs->csum_seed, &le, sizeof(le));
+			crc = ext_crc32c(crc, d, off);
+			crc = ext_crc32c(crc, &zero, sizeof(zero));
+			crc = ext_crc32c(crc, (unsigned char *)d + off + 2,
+					fs->desc_size - off - 2);
+			d->bg_checksum = htole16(crc & 0xffff);
+		}
+	}
+
+	fs->sb.s_free_blocks_count_lo = htole32((uint32_t)free_blocks);
+	fs->sb.s_free_blocks_count_hi = htole32((uint32_t)(free_blocks >> 32));
+	fs->sb.s_free_inodes_count = htole32((uint32_t)free_inodes);
+	for (g = 0; g < w->groups; g++) {
+		if (!ext_group_has_super(fs, g))
+			continue;
+		sb = fs->sb;
+		sb.s_block_group_nr = htole16(g);
+		if (fs->csum)
+			sb.s_checksum = htole32(ext_crc32c(~0U, &sb,
+						offsetof(struct ext_super_disk, s_checksum)));
+		if (wr(w, &sb, sizeof(sb), g ? w->g[g].start * w->bs :
+					EXT_SUPER_OFFSET) < 0 ||
+				wr(w, gdt, (size_t)fs->gdt_blocks * w->bs,
+					(w->g[g].start + 1) * w->bs) < 0)
+			goto out;
+	}
+	ret = 0;
+out:
+	free(gdt);
+	return ret;
+}
+
+/**
+ * ext_synth_write() - Write the image of a planned tree
+ *
+ * The image is a sparse file of opts.size bytes, only metadata and
+ * file data are written. Blocks are allocated in tree order, after the
+ * journal, so a directory comes before its entries.
+ *
+ * @path	: Image file, replaced if it exists
+ */
+int ext_synth_write(const struct ext_synth *s, const char *path)
+{
+	struct writer w;
+	const struct ext_synth_node *n;
+	uint32_t i, k;
+	int ret = -1;
+
+	memset(&w, 0x00, sizeof(w));
+	w.s = s;
+	w.o = &s->opts;
+	w.fd = -1;
+	if (w.o->type < 2 || w.o->type > 4 || (w.o->block_size != 1024 &&
+			w.o->block_size != 2048 && w.o->block_size != 4096) ||
+			(w.o->inode_size != 128 && w.o->inode_size != 256)) {
+		printf("Invalid image options\n");
+		return -1;
+	}
+	set_features(&w);
+	if (geometry(&w) < 0)
+		goto out;
+	fill_super(&w);
+
+	// Large enough for every field even with 128 byte inodes
+	w.inode = calloc(1, w.o->inode_size > sizeof(struct ext_inode_disk) ?
+			w.o->inode_size : sizeof(struct ext_inode_disk));
+	w.buf = malloc(WRITE_MAX > 2 * w.bs ? WRITE_MAX : 2 * w.bs);
+	if (!w.inode || !w.buf) {
+		printf("Failed to allocate memory\n");
+		goto out;
+	}
+	w.fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (w.fd < 0 || ftruncate(w.fd, w.blocks * w.bs) < 0) {
+		printf("Error creating image %s : %s\n", path, strerror(errno));
+		goto out;
+	}
+
+	if (w.o->type >= 3 && write_journal(&w) < 0)
+		goto out;
+	for (i = 0; i < s->count; i++) {
+		n = &s->n[i];
+		if (n->kind == EXT_SYNTH_DIR) {
+			if (write_dir(&w, n) < 0)
+				goto out;
+		} else if (n->kind == EXT_SYNTH_FRAG) {
+			for (k = i; k < s->count && s->n[k].kind == EXT_SYNTH_FRAG; k++)
+				;
+			if (write_frag(&w, i, k - i) < 0)
+				goto out;
+			i = k - 1;
+		} else if (write_file(&w, n, NULL) < 0) {
+			goto out;
+		}
+	}
+	if (write_groups(&w) < 0)
+		goto out;
+	if (fsync(w.fd) < 0) {
+		printf("Error writing image : %s\n", strerror(errno));
+		goto out;
+	}
+	ret = 0;
+out:
+	if (w.fd >= 0 && close(w.fd) < 0 && ret == 0) {
+		printf("Error writing image : %s\n", strerror(errno));
+		ret = -1;
+	}
+	free(w.inode);
+	free(w.buf);
+	free(w.g);
+	free(w.bmap);
+	return ret;
+}
@@ -0,0 +1,89 @@
+/*
+ * extsynth - Write synthetic ext2/3/4 images with known content
+ *
+ * Written in 2026 by the ext3dump contributors
+ *
+ * To the extent possible under law, the author(s) have dedicated
+ * all copyright and related and neighboring rights to this software
+ * to the public domain worldwide. This software is distributed
+ * without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication
+ * along with this software.
+ * If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+#ifndef EXTSYNTH_H
+#define EXTSYNTH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define EXT_SYNTH_TIME		1350000000	// Time stamp of every inode
+#define EXT_SYNTH_JOURNAL	1024	// Journal blocks of ext3 and ext4
+#define EXT_SYNTH_INODE_RATIO	16384	// Bytes of image per inode
+#define EXT_SYNTH_PER_DIR	100	// Files per directory below /files
+#define EXT_SYNTH_HOLE_RUN	4	// Blocks per data or hole run, /sparse
+
+// What a node of the tree is and how its blocks are laid out
+enum ext_synth_kind {
+	EXT_SYNTH_DIR,
+	EXT_SYNTH_FILE,			// Contiguous
+	EXT_SYNTH_FRAG,			// Interleaved block by block with the others
+	EXT_SYNTH_DEEP,			// A free block after every block
+	EXT_SYNTH_SPARSE,		// Every other run of blocks is a hole
+	EXT_SYNTH_SYMLINK,
+};
+
+struct ext_synth_opts {
+	int type;			// 2, 3 or 4
+	uint64_t size;			// Image size in bytes
+	unsigned int block_size;
+	unsigned int inode_size;	// 128 or 256
+	int bit64;			// ext4 only
+	int flex_bg;			// ext4 only
+	int csum;			// metadata_csum, ext4 only
+	uint32_t seed;			// Of the sizes, names and content
+	uint32_t files;			// Files below /files
+	uint64_t max_file;		// Largest of them
+	uint32_t frag_files;		// Files in /frag
+	uint64_t frag_size;		// Size of each of them
+	uint32_t entries;		// Empty files in the directory /huge
+};
+
+/*
+ * A file, directory or symlink. The children of a directory are the
+ * nchild nodes from first_child on.
+ */
+struct ext_synth_node {
+	char *path;			// Below the root, without a leading /
+	const char *name;		// Last part of path
+	uint32_t parent;		// Index of the parent directory
+	uint32_t first_child;
+	uint32_t nchild;
+	uint32_t ino;
+	int kind;
+	uint64_t size;
+	uint64_t seed;			// Of the content
+	const char *target;		// Of a symlink
+};
+
+// The whole tree, node 0 is the root directory
+struct ext_synth {
+	struct ext_synth_opts opts;
+	struct ext_synth_node *n;
+	uint32_t count;
+	uint32_t alloc;
+	uint32_t last_ino;
+	uint64_t data_bytes;		// Sum of all file sizes
+};
+
+int ext_synth_plan(struct ext_synth *s, const struct ext_synth_opts *opts);
+void ext_synth_free(struct ext_synth *s);
+int ext_synth_hole(const struct ext_synth *s, const struct ext_synth_node *n,
+		uint64_t lblk);
+void ext_synth_data(const struct ext_synth *s, const struct ext_synth_node *n,
+		uint64_t off, unsigned char *buf, size_t len);
+int ext_synth_write(const struct ext_synth *s, const char *path);
+
+#endif
@@ -0,0 +1,742 @@
+/*
+ * exttree - Extract whole directory trees from ext2/3/4 images
+ *
+ * Written in 2026 by the ext3dump contributors
+ *
+ * To the extent possible under law, the author(s) have dedicated
+ * all copyright and related and neighboring rights to this software
+ * to the public domain worldwide. This software is distributed
+ * without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication
+ * along with this software.
+ * If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#include "exttree.h"
+#include "extfile.h"
+#include "extdir.h"
+
+// A file, directory or other inode of the tree
+struct tree_node {
+	char *path;			// Output path
+	uint32_t ino;
+	uint16_t mode;
+	uint32_t uid, gid;
+	struct timespec times[2];	// atime, mtime
+	uint64_t size;
+	uint32_t pending;		// Reads not written yet
+	int linked;			// Hard link to an earlier node
+	int restored;			// Mode and times are set
+};
+
+// Part of a file to copy, at most EXT_TREE_READ_MAX
+struct read_job {
+	uint64_t physical;		// First device block
+	uint64_t logical;		// First file block
+	uint32_t count;			// Number of blocks
+	uint32_t node;
+};
+
+// Data of one or more consecutive jobs, passed from a reader to a writer
+struct read_buf {
+	unsigned char *data;		// NULL if the read failed
+	uint64_t physical;		// Device block at data
+	size_t first, n;		// Jobs covered
+};
+
+struct tree {
+	struct ext_fs *fs;
+	const struct ext_tree_opts *opts;
+
+	struct tree_node *nodes;
+	size_t nnodes, alloc_nodes;
+	struct read_job *jobs;
+	size_t njobs, alloc_jobs;
+	size_t parent;			// Directory being walked
+
+	// Inodes with more than one link, ino to node, open addressing
+	uint32_t *link_ino;
+	size_t *link_node;
+	size_t link_size, link_n;
+
+	// Readers take jobs in order from next_job
+	pthread_mutex_t job_lock;
+	size_t next_job;
+
+	// Bounded queue from the readers to the writers
+	pthread_mutex_t q_lock;
+	pthread_cond_t q_not_empty, q_not_full;
+	struct read_buf **queue;
+	size_t q_size, q_head, q_count;
+	int readers_left;
+
+	uint64_t bytes_read, reads, bytes_written;
+	unsigned long files, dirs, links, symlinks, others, errors;
+};
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Seconds and nanoseconds of an inode time, with the extra field if present
+static struct timespec inode_time(const struct ext_fs *fs,
+		const struct ext_inode_disk *inode, uint32_t sec, size_t extra_off,
+		uint32_t extra)
+{
+	struct timespec ts;
+
+	ts.tv_sec = (int32_t)le32toh(sec);
+	ts.tv_nsec = 0;
+	if (fs->inode_size > 128 && (size_t)128 + le16toh(inode->i_extra_isize) >=
+			extra_off + sizeof(uint32_t)) {
+		extra = le32toh(extra);
+		ts.tv_sec += (int64_t)(extra & 3) << 32;
+		ts.tv_nsec = extra >> 2;
+	}
+	return ts;
+}
+
+static int add_job(struct tree *t, uint64_t physical, uint64_t logical,
+		uint32_t count, uint32_t node)
+{
+	struct read_job *p;
+
+	if (t->njobs == t->alloc_jobs) {
+		t->alloc_jobs = t->alloc_jobs ? t->alloc_jobs * 2 : 1024;
+		p = realloc(t->jobs, t->alloc_jobs * sizeof(*p));
+		if (!p)
+			return -1;
+		t->jobs = p;
+	}
+	t->jobs[t->njobs].physical = physical;
+	t->jobs[t->njobs].logical = logical;
+	t->jobs[t->njobs].count = count;
+	t->jobs[t->njobs].node = node;
+	t->njobs++;
+	return 0;
+}
+
+/**
+ * add_file_jobs() - Queue the reads of a regular file
+ *
+ * Every run of the block map becomes one or more jobs of at most
+ * EXT_TREE_READ_MAX bytes. Holes need no job, the output file was
+ * already extended to its size.
+ */
+static int add_file_jobs(struct tree *t, const struct ext_inode_disk *inode,
+		size_t node)
+{
+	struct block_map map = { NULL, 0, 0 };
+	uint64_t max = EXT_TREE_READ_MAX / t->fs->block_size, off, n;
+	size_t i;
+	int ret = 0;
+
+	if (ext_map_file(t->fs, t->nodes[node].ino, inode, &map) < 0) {
+		free(map.r);
+		return -1;
+	}
+	for (i = 0; i < map.n && ret == 0; i++) {
+		for (off = 0; off < map.r[i].count && ret == 0; off += n) {
+			n = map.r[i].count - off < max ? map.r[i].count - off : max;
+			ret = add_job(t, map.r[i].physical + off,
+					map.r[i].logical + off, n, node);
+			t->nodes[node].pending++;
+		}
+	}
+	free(map.r);
+	if (ret < 0)
+		printf("Failed to allocate memory\n");
+	return ret;
+}
+
+// Earlier node of an inode with several links, or -1
+static ssize_t link_find(struct tree *t, uint32_t ino)
+{
+	size_t i;
+
+	if (t->link_size == 0)
+		return -1;
+	for (i = ino % t->link_size; t->link_ino[i] != 0; i = (i + 1) % t->link_size) {
+		if (t->link_ino[i] == ino)
+			return t->link_node[i];
+	}
+	return -1;
+}
+
+static int link_add(struct tree *t, uint32_t ino, size_t node)
+{
+	uint32_t *old_ino = t->link_ino;
+	size_t *old_node = t->link_node, old_size = t->link_size, i;
+
+	// Keep the table at most half full
+	if ((t->link_n + 1) * 2 > t->link_size) {
+		t->link_size = old_size ? old_size * 2 : 1024;
+		t->link_ino = calloc(t->link_size, sizeof(*t->link_ino));
+		t->link_node = calloc(t->link_size, sizeof(*t->link_node));
+		if (!t->link_ino || !t->link_node)
+			return -1;
+		t->link_n = 0;
+		for (i = 0; i < old_size; i++) {
+			if (old_ino[i] != 0)
+				link_add(t, old_ino[i], old_node[i]);
+		}
+		free(old_ino);
+		free(old_node);
+	}
+	for (i = ino % t->link_size; t->link_ino[i] != 0; i = (i + 1) % t->link_size)
+		;
+	t->link_ino[i] = ino;
+	t->link_node[i] = node;
+	t->link_n++;
+	return 0;
+}
+
+/**
+ * create_special() - Create a symlink, device, fifo or socket
+ */
+static int create_special(struct tree *t, uint32_t ino,
+		const struct ext_inode_disk *inode, const char *path)
+{
+	struct block_map map = { NULL, 0, 0 };
+	uint16_t mode = le16toh(inode->i_mode);
+	uint64_t size = ext_inode_size(inode);
+	uint32_t old_dev, new_dev;
+	const unsigned char *blk;
+	char target[EXT_MAX_SYMLINK + 1];
+	dev_t dev;
+	int ret;
+
+	if ((mode & EXT_S_IFMT) != EXT_S_IFLNK) {
+		// Old device numbers are in i_block[0], new ones in i_block[1]
+		old_dev = le32toh(inode->i_block[0]);
+		new_dev = le32toh(inode->i_block[1]);
+		if (old_dev)
+			dev = makedev((old_dev >> 8) & 0xff, old_dev & 0xff);
+		else
+			dev = makedev((new_dev & 0xfff00) >> 8,
+					(new_dev & 0xff) | ((new_dev >> 12) & 0xfff00));
+		t->others++;
+		return mknod(path, (mode & EXT_S_IFMT) | 0600, dev);
+	}
+
+	if (size > EXT_MAX_SYMLINK || size > t->fs->block_size) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	if (!ext_inode_has_blocks(inode)) {
+		// Fast symlink, the target is in i_block
+		memcpy(target, inode->i_block, size);
+	} else {
+		if (ext_map_file(t->fs, ino, inode, &map) < 0 || map.n == 0 ||
+				map.r[0].logical != 0) {
+			free(map.r);
+			errno = EIO;
+			return -1;
+		}
+		blk = ext_block(t->fs, map.r[0].physical);
+		free(map.r);
+		if (!blk) {
+			errno = EIO;
+			return -1;
+		}
+		memcpy(target, blk, size);
+		ext_put(t->fs, blk);
+	}
+	target[size] = '\0';
+	ret = symlink(target, path);
+	if (ret == 0)
+		t->symlinks++;
+	return ret;
+}
+
+/**
+ * add_entry() - Create a directory entry in the output and queue its data
+ *
+ * Called for every entry of the directory being walked. Directories are
+ * created right away and walked later, regular files are created with
+ * their final size and their reads are queued. A further link to an
+ * inode that was already extracted becomes a hard link.
+ */
+static int add_entry(uint32_t ino, const char *name, size_t len,
+		uint8_t file_type, void *arg)
+{
+	struct tree *t = arg;
+	const struct ext_inode_disk *inode;
+	struct tree_node *n, *p;
+	const char *parent = t->nodes[t->parent].path;
+	ssize_t first;
+	size_t node;
+	uint16_t type;
+	char *path;
+	int fd, err = 0;
+
+	(void)file_type;
+	if ((len == 1 && name[0] == '.') ||
+			(len == 2 && name[0] == '.' && name[1] == '.'))
+		return 0;
+	if (memchr(name, '/', len) || memchr(name, '\0', len)) {
+		printf("Skipping invalid name in directory %u\n",
+				t->nodes[t->parent].ino);
+		t->errors++;
+		return 0;
+	}
+
+	if (t->nnodes == t->alloc_nodes) {
+		t->alloc_nodes *= 2;
+		n = realloc(t->nodes, t->alloc_nodes * sizeof(*n));
+		if (!n)
+			goto err_mem;
+		t->nodes = n;
+		parent = t->nodes[t->parent].path;
+	}
+	if (asprintf(&path, "%s/%.*s", parent, (int)len, name) < 0)
+		goto err_mem;
+
+	inode = ext_inode(t->fs, ino);
+	if (!inode) {
+		printf("Skipping %s\n", path);
+		free(path);
+		t->errors++;
+		return 0;
+	}
+
+	node = t->nnodes++;
+	n = &t->nodes[node];
+	memset(n, 0x00, sizeof(*n));
+	n->path = path;
+	n->ino = ino;
+	n->mode = le16toh(inode->i_mode);
+	n->uid = le16toh(inode->i_uid) | (uint32_t)le16toh(inode->i_uid_high) << 16;
+	n->gid = le16toh(inode->i_gid) | (uint32_t)le16toh(inode->i_gid_high) << 16;
+	n->size = ext_inode_size(inode);
+	n->times[0] = inode_time(t->fs, inode, inode->i_atime,
+			offsetof(struct ext_inode_disk, i_atime_extra),
+			inode->i_atime_extra);
+	n->times[1] = inode_time(t->fs, inode, inode->i_mtime,
+			offsetof(struct ext_inode_disk, i_mtime_extra),
+			inode->i_mtime_extra);
+	type = n->mode & EXT_S_IFMT;
+
+	if (type != EXT_S_IFDIR && le16toh(inode->i_links_count) > 1) {
+		first = link_find(t, ino);
+		if (first >= 0) {
+			n->linked = 1;
+			ext_put(t->fs, inode);
+			if (link(t->nodes[first].path, path) < 0)
+				goto err_create;
+			t->links++;
+			return 0;
+		}
+		if (link_add(t, ino, node) < 0) {
+			ext_put(t->fs, inode);
+			goto err_mem;
+		}
+	}
+
+	switch (type) {
+	case EXT_S_IFDIR:
+		if (mkdir(path, 0700) < 0 && errno != EEXIST)
+			err = -1;
+		t->dirs++;
+		break;
+	case EXT_S_IFREG:
+		fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+		if (fd < 0 || ftruncate(fd, n->size) < 0) {
+			err = -1;
+		} else if (add_file_jobs(t, inode, node) < 0) {
+			// The file stays, with zeros where data was not found
+			t->errors++;
+		}
+		if (fd >= 0)
+			close(fd);
+		t->files++;
+		break;
+	default:
+		err = create_special(t, ino, inode, path);
+		break;
+	}
+	ext_put(t->fs, inode);
+	if (err < 0)
+		goto err_create;
+	return 0;
+
+err_create:
+	p = &t->nodes[node];
+	printf("Error creating %s : %s\n", p->path, strerror(errno));
+	p->linked = 1;
+	t->errors++;
+	return 0;
+
+err_mem:
+	printf("Failed to allocate memory\n");
+	return -1;
+}
+
+/**
+ * restore_node() - Set owner, mode and times of an extracted inode
+ *
+ * Owners are only set when running as root. Called after the last write
+ * to a file, and for directories after everything below them.
+ */
+static void restore_node(struct tree *t, struct tree_node *n)
+{
+	if (geteuid() == 0 && lchown(n->path, n->uid, n->gid) < 0)
+		printf("Error setting owner of %s : %s\n", n->path, strerror(errno));
+	if ((n->mode & EXT_S_IFMT) != EXT_S_IFLNK &&
+			chmod(n->path, n->mode & 07777) < 0) {
+		printf("Error setting mode of %s : %s\n", n->path, strerror(errno));
+		__atomic_fetch_add(&t->errors, 1, __ATOMIC_RELAXED);
+	}
+	if (utimensat(AT_FDCWD, n->path, n->times, AT_SYMLINK_NOFOLLOW) < 0) {
+		printf("Error setting times of %s : %s\n", n->path, strerror(errno));
+		__atomic_fetch_add(&t->errors, 1, __ATOMIC_RELAXED);
+	}
+	n->restored = 1;
+}
+
+static int cmp_job(const void *a, const void *b)
+{
+	const struct read_job *x = a, *y = b;
+
+	if (x->physical != y->physical)
+		return x->physical < y->physical ? -1 : 1;
+	return 0;
+}
+
+/**
+ * reader() - Read thread, turns jobs into buffers for the writers
+ *
+ * Jobs are taken in order, so with sorted jobs the readers sweep across
+ * the device once. Jobs that follow each other on the device, with gaps
+ * of at most EXT_TREE_GAP_MAX blocks, are merged into one read of up to
+ * EXT_TREE_READ_MAX bytes, even across files.
+ */
+static void *reader(void *arg)
+{
+	struct tree *t = arg;
+	struct read_buf *rb;
+	const struct read_job *j;
+	uint64_t bs = t->fs->block_size, start, end;
+	size_t len, done;
+	ssize_t r;
+
+	while (1) {
+		pthread_mutex_lock(&t->job_lock);
+		if (t->next_job >= t->njobs) {
+			pthread_mutex_unlock(&t->job_lock);
+			break;
+		}
+		rb = calloc(1, sizeof(*rb));
+		if (!rb) {
+			pthread_mutex_unlock(&t->job_lock);
+			printf("Failed to allocate memory\n");
+			break;
+		}
+		rb->first = t->next_job;
+		start = t->jobs[rb->first].physical;
+		end = start + t->jobs[rb->first].count;
+		for (rb->n = 1; rb->first + rb->n < t->njobs; rb->n++) {
+			j = &t->jobs[rb->first + rb->n];
+			if (j->physical < end || j->physical > end + EXT_TREE_GAP_MAX ||
+					(j->physical + j->count - start) * bs >
+					EXT_TREE_READ_MAX)
+				break;
+			end = j->physical + j->count;
+		}
+		t->next_job += rb->n;
+		pthread_mutex_unlock(&t->job_lock);
+
+		rb->physical = start;
+		len = (end - start) * bs;
+		rb->data = malloc(len);
+		for (done = 0; rb->data && done < len; done += r) {
+			r = ext_pread(t->fs, rb->data + done, len - done,
+					start * bs + done);
+			if (r <= 0) {
+				printf("Failed to read blocks %llu-%llu\n",
+						(unsigned long long)start,
+						(unsigned long long)end - 1);
+				free(rb->data);
+				rb->data = NULL;
+			}
+		}
+		if (rb->data) {
+			__atomic_fetch_add(&t->bytes_read, len, __ATOMIC_RELAXED);
+			__atomic_fetch_add(&t->reads, 1, __ATOMIC_RELAXED);
+		}
+
+		pthread_mutex_lock(&t->q_lock);
+		while (t->q_count == t->q_size)
+			pthread_cond_wait(&t->q_not_full, &t->q_lock);
+		t->queue[(t->q_head + t->q_count) % t->q_size] = rb;
+		t->q_count++;
+		pthread_cond_signal(&t->q_not_empty);
+		pthread_mutex_unlock(&t->q_lock);
+	}
+
+	pthread_mutex_lock(&t->q_lock);
+	t->readers_left--;
+	pthread_cond_broadcast(&t->q_not_empty);
+	pthread_mutex_unlock(&t->q_lock);
+	return NULL;
+}
+
+/**
+ * writer() - Write thread, writes buffers into the output files
+ *
+ * The file of consecutive jobs stays open. After the last job of a file
+ * its mode and times are restored.
+ */
+static void *writer(void *arg)
+{
+	struct tree *t = arg;
+	struct read_buf *rb;
+	const struct read_job *j;
+	struct tree_node *n;
+	uint64_t bs = t->fs->block_size, off, len, done;
+	uint32_t open_node = UINT32_MAX;
+	ssize_t w;
+	size_t k;
+	int fd = -1, err;
+
+	while (1) {
+		pthread_mutex_lock(&t->q_lock);
+		while (t->q_count == 0 && t->readers_left > 0)
+			pthread_cond_wait(&t->q_not_empty, &t->q_lock);
+		if (t->q_count == 0) {
+			pthread_mutex_unlock(&t->q_lock);
+			break;
+		}
+		rb = t->queue[t->q_head];
+		t->q_head = (t->q_head + 1) % t->q_size;
+		t->q_count--;
+		pthread_cond_signal(&t->q_not_full);
+		pthread_mutex_unlock(&t->q_lock);
+
+		for (k = rb->first; k < rb->first + rb->n; k++) {
+			j = &t->jobs[k];
+			n = &t->nodes[j->node];
+			err = !rb->data;
+			if (!err && open_node != j->node) {
+				if (fd >= 0)
+					close(fd);
+				fd = open(n->path, O_WRONLY);
+				open_node = fd < 0 ? UINT32_MAX : j->node;
+				err = fd < 0;
+			}
+
+			// The last block is cut at the file size
+			off = j->logical * bs;
+			len = off < n->size ? n->size - off : 0;
+			if (len > j->count * bs)
+				len = j->count * bs;
+			for (done = 0; !err && done < len; done += w) {
+				w = pwrite(fd, rb->data + (j->physical - rb->physical) * bs +
+						done, len - done, off + done);
+				if (w <= 0)
+					err = 1;
+			}
+			if (err) {
+				printf("Error writing %s\n", n->path);
+				__atomic_fetch_add(&t->errors, 1, __ATOMIC_RELAXED);
+			} else {
+				__atomic_fetch_add(&t->bytes_written, len, __ATOMIC_RELAXED);
+			}
+
+			if (__atomic_sub_fetch(&n->pending, 1, __ATOMIC_ACQ_REL) == 0) {
+				if (open_node == j->node) {
+					close(fd);
+					fd = -1;
+					open_node = UINT32_MAX;
+				}
+				restore_node(t, n);
+			}
+		}
+		free(rb->data);
+		free(rb);
+	}
+	if (fd >= 0)
+		close(fd);
+	return NULL;
+}
+
+/**
+ * copy_data() - Run the readers and writers over all jobs
+ */
+static int copy_data(struct tree *t)
+{
+	pthread_t *tids;
+	int nthreads = t->opts->readers + t->opts->writers, i, started = 0;
+
+	t->q_size = t->opts->readers * 2 + t->opts->writers;
+	t->queue = calloc(t->q_size, sizeof(*t->queue));
+	tids = calloc(nthreads, sizeof(*tids));
+	if (!t->queue || !tids) {
+		printf("Failed to allocate memory\n");
+		free(tids);
+		return -1;
+	}
+	pthread_mutex_init(&t->job_lock, NULL);
+	pthread_mutex_init(&t->q_lock, NULL);
+	pthread_cond_init(&t->q_not_empty, NULL);
+	pthread_cond_init(&t->q_not_full, NULL);
+	t->readers_left = t->opts->readers;
+
+	// Writers first, readers block once the queue is full
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&tids[i], NULL, i < t->opts->writers ?
+					writer : reader, t)) {
+			printf("Failed to create thread\n");
+			break;
+		}
+		started++;
+	}
+	if (started < nthreads) {
+		// Stop the readers that run, and let the writers finish
+		pthread_mutex_lock(&t->job_lock);
+		t->next_job = t->njobs;
+		pthread_mutex_unlock(&t->job_lock);
+		pthread_mutex_lock(&t->q_lock);
+		t->readers_left -= nthreads - (started > t->opts->writers ?
+				started : t->opts->writers);
+		pthread_cond_broadcast(&t->q_not_empty);
+		pthread_mutex_unlock(&t->q_lock);
+	}
+	for (i = 0; i < started; i++)
+		pthread_join(tids[i], NULL);
+
+	pthread_cond_destroy(&t->q_not_full);
+	pthread_cond_destroy(&t->q_not_empty);
+	pthread_mutex_destroy(&t->q_lock);
+	pthread_mutex_destroy(&t->job_lock);
+	free(tids);
+	return started == nthreads ? 0 : -1;
+}
+
+/**
+ * ext_extract_tree() - Extract a directory and everything below it
+ *
+ * First the whole tree is walked, creating directories, empty files of
+ * the right size, symlinks and special files in the output and queueing
+ * a read job for every run of file data. The jobs are then sorted by
+ * device block, so the device is read in a single sweep instead of
+ * seeking from file to file, and copied by a pool of readers feeding a
+ * pool of writers. Directory modes and times are restored last, deepest
+ * first, so that creating entries does not change them again.
+ *
+ * @root	: Inode of the directory to extract
+ * @outdir	: Output directory, created if missing
+ */
+int ext_extract_tree(struct ext_fs *fs, uint32_t root, const char *outdir,
+		const struct ext_tree_opts *opts)
+{
+	const struct ext_inode_disk *inode;
+	struct tree t;
+	struct tree_node *n;
+	double start = now(), walked, copied;
+	size_t i;
+	int ret = -1;
+
+	memset(&t, 0x00, sizeof(t));
+	t.fs = fs;
+	t.opts = opts;
+
+	inode = ext_inode(fs, root);
+	if (!inode)
+		return -1;
+	if ((le16toh(inode->i_mode) & EXT_S_IFMT) != EXT_S_IFDIR) {
+		printf("Inode %u is not a directory\n", root);
+		ext_put(fs, inode);
+		return -1;
+	}
+	if (mkdir(outdir, 0700) < 0 && errno != EEXIST) {
+		printf("Error creating %s : %s\n", outdir, strerror(errno));
+		ext_put(fs, inode);
+		return -1;
+	}
+
+	t.alloc_nodes = 1024;
+	t.nodes = calloc(t.alloc_nodes, sizeof(*t.nodes));
+	if (!t.nodes || !(t.nodes[0].path = strdup(outdir))) {
+		printf("Failed to allocate memory\n");
+		ext_put(fs, inode);
+		goto out;
+	}
+	n = &t.nodes[0];
+	n->ino = root;
+	n->mode = le16toh(inode->i_mode);
+	n->uid = le16toh(inode->i_uid) | (uint32_t)le16toh(inode->i_uid_high) << 16;
+	n->gid = le16toh(inode->i_gid) | (uint32_t)le16toh(inode->i_gid_high) << 16;
+	n->times[0] = inode_time(fs, inode, inode->i_atime,
+			offsetof(struct ext_inode_disk, i_atime_extra),
+			inode->i_atime_extra);
+	n->times[1] = inode_time(fs, inode, inode->i_mtime,
+			offsetof(struct ext_inode_disk, i_mtime_extra),
+			inode->i_mtime_extra);
+	ext_put(fs, inode);
+	t.nnodes = 1;
+	t.dirs = 1;
+
+	// Breadth first, nodes is the queue of directories to walk
+	for (i = 0; i < t.nnodes; i++) {
+		if ((t.nodes[i].mode & EXT_S_IFMT) != EXT_S_IFDIR || t.nodes[i].linked)
+			continue;
+		t.parent = i;
+		if (ext_dir_iterate(fs, t.nodes[i].ino, add_entry, &t) < 0) {
+			printf("Error reading directory %s\n", t.nodes[i].path);
+			t.errors++;
+		}
+	}
+	walked = now();
+	printf("Walked %lu directories, %lu files, %lu symlinks, %lu hard links "
+			"and %lu others in %.2f s, %lu reads queued\n", t.dirs,
+			t.files, t.symlinks, t.links, t.others, walked - start,
+			(unsigned long)t.njobs);
+
+	if (!opts->unsorted)
+		qsort(t.jobs, t.njobs, sizeof(*t.jobs), cmp_job);
+	if (copy_data(&t) < 0)
+		goto out;
+	copied = now();
+
+	// Files without data, then directories deepest first
+	for (i = t.nnodes; i-- > 0; ) {
+		n = &t.nodes[i];
+		if (!n->linked && !n->restored && n->pending == 0)
+			restore_node(&t, n);
+	}
+
+	printf("Copied %.1f MB in %llu reads with %d readers and %d writers "
+			"in %.2f s (%.1f MB/s), %lu errors\n", t.bytes_written / 1e6,
+			(unsigned long long)t.reads, opts->readers, opts->writers,
+			copied - walked, t.bytes_written / 1e6 /
+			(copied > walked ? copied - walked : 1), t.errors);
+	ret = t.errors ? -1 : 0;
+
+out:
+	for (i = 0; i < t.nnodes; i++)
+		free(t.nodes[i].path);
+	free(t.nodes);
+	free(t.jobs);
+	free(t.queue);
+	free(t.link_ino);
+	free(t.link_node);
+	return ret;
+}
@@ -0,0 +1,36 @@
+/*
+ * exttree - Extract whole directory trees from ext2/3/4 images
+ *
+ * Written in 2026 by the ext3dump contributors
+ *
+ * To the extent possible under law, the author(s) have dedicated
+ * all copyright and related and neighboring rights to this software
+ * to the public domain worldwide. This software is distributed
+ * without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication
+ * along with this software.
+ * If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+#ifndef EXTTREE_H
+#define EXTTREE_H
+
+#include <stdint.h>
+
+#include "extimg.h"
+
+#define EXT_TREE_READ_MAX	(8 * 1024 * 1024)	// Largest single read
+#define EXT_TREE_GAP_MAX	16	// Blocks read over to merge two reads
+#define EXT_MAX_SYMLINK		4095	// Longest symlink target
+
+struct ext_tree_opts {
+	int readers;			// Parallel reader threads
+	int writers;			// Parallel writer threads
+	int unsorted;			// Read in tree order, for comparison
+};
+
+int ext_extract_tree(struct ext_fs *fs, uint32_t root, const char *outdir,
+		const struct ext_tree_opts *opts);
+
+#endif
@@ -19,6 +19,7 @@ package main
 
 import (
 	_ "../../server/src/db"
+	"container/list"
 	"database/sql"
 	"fmt"
 	"os"
@@ -35,6 +36,11 @@ const (
 	RootInode = 2 // Inode number of root '/' directory
 )
 
+const ( // Block cache
+	CacheBlocks    = 4096 // Blocks kept in the cache
+	CacheReadAhead = 16   // Blocks read at once on a sequential miss
+)
+
 const ( // Type of inode - file, directory, device, etc
 	FileT = 1
 	DirT  = 2
@@ -175,6 +181,23 @@ var dumpFile *os.File
 
 var DataSrc string
 
+// Metadata blocks read by ReadBlock, least recently used ones are dropped
+type BlockCache struct {
+	blocks    map[uint64]*list.Element
+	lru       *list.List // Front is the most recently used block
+	lastBlock uint64     // Last block read from the source
+	Hits      uint64
+	Misses    uint64
+	ReadAhead uint64 // Blocks read ahead of a miss
+}
+
+type cachedBlock struct {
+	blockNo uint64
+	data    []byte
+}
+
+var cache = BlockCache{blocks: make(map[uint64]*list.Element), lru: list.New()}
+
 func main() {
 	var err error
 
@@ -250,6 +273,8 @@ func main() {
 		}
 	}
 
+	fmt.Printf("Block cache : %d hits, %d misses, %d blocks read ahead\n",
+		cache.Hits, cache.Misses, cache.ReadAhead)
 }
 
 // Read superblock
@@ -744,8 +769,102 @@ func ParseFileBlock(bdata []byte, size uint64) {
 	}
 }
 
-// Read a block of data
+// Get a block from the cache, nil if it is not cached
+func (c *BlockCache) Get(blockNo uint64) []byte {
+	e, ok := c.blocks[blockNo]
+	if !ok {
+		return nil
+	}
+	c.lru.MoveToFront(e)
+	return e.Value.(*cachedBlock).data
+}
+
+// Add a copy of a block to the cache, reusing the least recently used
+// entry when the cache is full
+func (c *BlockCache) Put(blockNo uint64, data []byte) {
+	var b *cachedBlock
+
+	if e, ok := c.blocks[blockNo]; ok {
+		c.lru.MoveToFront(e)
+		copy(e.Value.(*cachedBlock).data, data)
+		return
+	}
+	if c.lru.Len() >= CacheBlocks {
+		e := c.lru.Back()
+		b = e.Value.(*cachedBlock)
+		delete(c.blocks, b.blockNo)
+		c.lru.Remove(e)
+	} else {
+		b = &cachedBlock{data: make([]byte, len(data))}
+	}
+	b.blockNo = blockNo
+	copy(b.data, data)
+	c.blocks[blockNo] = c.lru.PushFront(b)
+}
+
+// Read a block of data through the block cache. A miss on the block
+// after the last one read reads CacheReadAhead blocks at once, directory
+// and inode table blocks are mostly read in order.
 func ReadBlock(blockNo uint64, n *Nucdp) bool {
+	// The super block is read before the block size is known
+	if fs.BlockSize == 0 {
+		return ReadBlockSrc(blockNo, n)
+	}
+	if uint64(len(n.Data)) != fs.BlockSize {
+		n.Data = make([]byte, fs.BlockSize)
+	}
+	if data := cache.Get(blockNo); data != nil {
+		cache.Hits++
+		copy(n.Data, data)
+		return true
+	}
+	cache.Misses++
+
+	count := uint64(1)
+	if DataSrc == "file" && blockNo == cache.lastBlock+1 &&
+		blockNo < fs.TotalBlocks {
+		count = CacheReadAhead
+		if blockNo+count > fs.TotalBlocks {
+			count = fs.TotalBlocks - blockNo
+		}
+	}
+	if count <= 1 {
+		if !ReadBlockSrc(blockNo, n) {
+			return false
+		}
+		cache.Put(blockNo, n.Data)
+		cache.lastBlock = blockNo
+		return true
+	}
+
+	fmt.Println("ReadBlock : BlockNo =", blockNo, " Count =", count)
+	buf := make([]byte, count*fs.BlockSize)
+	r, err := devFile.ReadAt(buf, int64(blockNo*fs.BlockSize))
+	got := uint64(r) / fs.BlockSize
+	if got == 0 {
+		fmt.Println("Error reading block", err)
+		return false
+	}
+	for c := uint64(0); c < got; c++ {
+		cache.Put(blockNo+c, buf[c*fs.BlockSize:(c+1)*fs.BlockSize])
+	}
+	cache.ReadAhead += got - 1
+	cache.lastBlock = blockNo + got - 1
+	copy(n.Data, buf[:fs.BlockSize])
+	return true
+}
+
+// Read a block of an inode, file data is read once and bypasses the
+// cache so that it does not push out metadata
+func ReadInodeBlock(blockNo uint64, n *Nucdp, inodeType uint32) bool {
+	if inodeType == FileT {
+		return ReadBlockSrc(blockNo, n)
+	}
+	return ReadBlock(blockNo, n)
+}
+
+// Read a block of data from the disk or database
+func ReadBlockSrc(blockNo uint64, n *Nucdp) bool {
 	var offset uint64
 	offset = blockNo * fs.BlockSize
 
@@ -871,7 +990,7 @@ func ParseInodeBlockPointers(i *Inode, inodeType uint32) bool {
 			return true
 		}
 		// fmt.Println(i.Direct[c], i.DataSize)
-		if !ReadBlock(i.Direct[c], &n) {
+		if !ReadInodeBlock(i.Direct[c], &n, inodeType) {
 			fmt.Println("Error reading direct block")
 			return false
 		}
@@ -900,7 +1019,7 @@ func ParseInodeBlockPointers(i *Inode, inodeType uint32) bool {
 		blockPtr = uint64(ToInt(n.Data[c : c+4]))
 		// fmt.Println(blockPtr)
 		// Final data blocks
-		if !ReadBlock(blockPtr, &n1) {
+		if !ReadInodeBlock(blockPtr, &n1, inodeType) {
 			fmt.Println("Error reading single indirect level 1 block")
 			return false
 		}
@@ -940,7 +1059,7 @@ func ParseInodeBlockPointers(i *Inode, inodeType uint32) bool {
 			blockPtr = uint64(ToInt(n1.Data[c1 : c1+4]))
 			// fmt.Println(blockPtr)
 			// Final data blocks
-			if !ReadBlock(blockPtr, &n2) {
+			if !ReadInodeBlock(blockPtr, &n2, inodeType) {
 				fmt.Println("Error reading double indirect level 2 block")
 				return false
 			}
@@ -992,7 +1111,7 @@ func ParseInodeBlockPointers(i *Inode, inodeType uint32) bool {
 				blockPtr = uint64(ToInt(n2.Data[c2 : c2+4]))
 				// fmt.Println(blockPtr)
 				// Final data blocks
-				if !ReadBlock(blockPtr, &n3) {
+				if !ReadInodeBlock(blockPtr, &n3, inodeType) {
 					fmt.Println("Error reading triple indirect level 3 block")
 					return false
 				}
@@ -1098,7 +1217,7 @@ func ParseExtent(data []byte, inodeType uint32, size *uint64) bool {
 
 	if inodeType == FileT { // File
 		for c := uint64(0); c < uint64(ee.Len); c++ {
-			if !ReadBlock(ee.Block+c, &n) {
+			if !ReadInodeBlock(ee.Block+c, &n, inodeType) {
 				fmt.Println("Error reading FileBlock")
 				return false
 			}
@@ -13,113 +13,2392 @@
  * If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <endian.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
 #include <fcntl.h>
-#include <linux/fs.h>
+#include <sys/stat.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
-#define BUF_SIZE	4096	/* Block size */
+#include "blockhash.h"
+#include "blockio.h"
+
+#define BUF_SIZE	4096	/* Default block size */
+#define READ_SIZE	(1024 * 1024)		/* Initial bytes read per request */
+#define MAX_READ_SIZE	(16 * 1024 * 1024)	/* Largest auto tuned read */
+#define TUNE_WINDOW	(64 * 1024 * 1024)	/* Bytes read per tuning step */
+#define PROGRESS_SECS	10	/* Default progress report interval */
+
+#define SYNC_SIZE	(8 * 1024 * 1024)	/* Bytes copied per request */
+
+// Exit status, as cmp(1) : 0 all blocks match, 1 some differ, 2 error
+#define EXIT_DIFFER	1
+#define EXIT_ERROR	2
+
+// Fingerprint manifest
+#define MANIFEST_MAGIC		"BLKCMPMF"
+#define MANIFEST_VERSION	2
+#define MANIFEST_HDR_SIZE	48
+#define MANIFEST_V1_HDR_SIZE	40	/* Version 1 has no hash tree */
+#define MANIFEST_HASH		1	/* blockhash */
+
+// Hash tree over the block fingerprints
+#define TREE_FANOUT		64	/* Children per interior node */
+#define TREE_MAX_LEVELS		16
+#define TREE_BATCH		256	/* Interior nodes rebuilt per request */
+
+/*
+ * Manifest file layout : header, then one level of the hash tree after
+ * the other starting with the leaves. Level 0 holds one fingerprint per
+ * block, every node of level k is the hash of up to TREE_FANOUT
+ * consecutive fingerprints of level k - 1 and the last level is the root.
+ */
+struct manifest_hdr {
+	uint32_t version;
+	uint32_t block_size;
+	uint64_t blocks;		// Number of digests in the manifest
+	uint64_t dev_size;		// Device size in bytes
+	uint32_t hash_type;
+	uint32_t digest_size;		// 8 or 16 bytes per block
+	uint32_t fanout;		// Children per interior node
+	uint32_t levels;		// Tree levels including the leaves
+
+	// Derived from the fields above
+	uint32_t hdr_size;
+	uint64_t level_nodes[TREE_MAX_LEVELS];
+	uint64_t level_off[TREE_MAX_LEVELS];
+};
+
+// Range of blocks
+struct range {
+	uint64_t start;
+	uint64_t count;
+};
+
+// Growing list of differing extents
+struct extent_list {
+	struct range *r;
+	size_t n;
+	size_t alloc;
+};
+
+// Counters of a device compare
+struct compare_stats {
+	unsigned long differ;		// Differing blocks
+	unsigned long skipped;		// Blocks skipped as holes on both sides
+	unsigned long read;		// Blocks read from at least one side
+};
+
+// Sampling quick verify
+struct sample_opts {
+	double divergence;		// Smallest divergence to detect, 0..1
+	double confidence;		// Probability to detect it, 0..1
+	uint64_t seed;			// Random generator seed
+	int stratified;			// One sample per stratum
+	int escalate;			// Compare strata of differing samples
+};
+
+// Opened block device or image file
+struct dev {
+	struct blkio io;		// Size, I/O sizes and read statistics
+	uint64_t blocks;		// Size in number of blocks
+	uint64_t next;			// Block after the last read, for prefetch
+	struct range *unmapped;		// Unmapped ranges hint, sorted
+	size_t nunmapped;
+	uint64_t map_start;		// Cached data or hole region
+	uint64_t map_end;
+	int map_data;
+};
+
+// Periodic progress report and final summary
+struct progress {
+	uint64_t total;			// Blocks to process
+	uint64_t done;			// Blocks processed, read or skipped
+	unsigned long differ;
+	double start;
+	double last;			// Time of the last report
+	uint64_t last_done;
+	double interval;		// Seconds between reports, 0 disables
+	struct dev *dev[2];
+	int ndev;
+};
+
+// Read size tuning from measured throughput
+struct read_tuner {
+	size_t size;			// Current read size in bytes
+	size_t best_size;
+	double best_rate;
+	uint64_t bytes;			// Bytes and time of the current step
+	double time;
+	int done;
+};
+
+static unsigned int block_size = BUF_SIZE;	// Compare granularity
+static struct progress progress = { .interval = PROGRESS_SECS };
+static struct read_tuner tuner = { .size = READ_SIZE, .done = 1 };
+static const char *summary_file;		// JSON summary, NULL for none
+static int direct_io;				// Read devices with O_DIRECT
+
+// Function prototypes
+int compare_devices(const char *dev1, const char *dev2, const char *hint1,
+		const char *hint2, const char *report, int do_sync);
+int sample_devices(const char *dev1, const char *dev2, const char *hint1,
+		const char *hint2, const char *report,
+		const struct sample_opts *so);
+int write_manifest(const char *manifest, const char *dev, const char *hint,
+		int digest_size);
+int check_manifest(const char *manifest, const char *dev, const char *hint);
+int diff_manifests(const char *manifest1, const char *manifest2);
+int refresh_manifest(const char *manifest, const char *dev,
+		const char *range_file);
+static ssize_t read_ranges(const char *file, uint64_t max_blocks,
+		struct range **ranges);
+static size_t merge_ranges(struct range *r, size_t n);
+static int parse_sample(const char *arg, struct sample_opts *so);
+
+static void usage(void)
+{
+	fprintf(stderr, "\nUsage : blockcompare [-o <report>] [-s] [-z <ranges>] [-Z <ranges>]\n"
+			"                     <device1> <device2>\n"
+			"        blockcompare -w <manifest> [-H 64|128] [-z <ranges>] <device>\n"
+			"        blockcompare -S <divergence>[,<confidence>] [-e <seed>] [-R] [-x]\n"
+			"                     [-o <report>] <device1> <device2>\n"
+			"        blockcompare -c <manifest> [-z <ranges>] <device>\n"
+			"        blockcompare -d <manifest1> <manifest2>\n"
+			"        blockcompare -u <manifest> -r <changed list> <device>\n"
+			"All modes also take [-b <block size>] [-P <seconds>] [-j <summary>] [-D]\n\n"
+			"  -o  Write differing extents to report file\n"
+			"  -s  Sync, copy differing extents from device1 to device2\n"
+			"  -w  Write per block fingerprint manifest of device\n"
+			"  -c  Compare device against a saved manifest\n"
+			"  -d  Compare two manifests through their hash trees\n"
+			"  -u  Refresh manifest for the blocks listed with -r\n"
+			"  -r  Changed block list, one \"<block> [<count>]\" per line\n"
+			"  -z  Unmapped block ranges of the (first) device\n"
+			"  -Z  Unmapped block ranges of the second device\n"
+			"  -H  Fingerprint size in bits (default 128)\n"
+			"  -S  Sample enough blocks to detect divergence %% with\n"
+			"      confidence %% (default 99.9)\n"
+			"  -e  Seed of the sample (default current time)\n"
+			"  -R  Simple random instead of stratified sample\n"
+			"  -x  Compare the full stratum around differing samples\n"
+			"  -b  Block size in bytes (default 4096, -c and -u use the\n"
+			"      manifest block size)\n"
+			"  -P  Seconds between progress reports on stderr (default 10,\n"
+			"      0 disables)\n"
+			"  -j  Write a JSON summary of the run, - for stdout\n"
+			"  -D  Read with O_DIRECT, bypassing the page cache\n\n");
+}
 
 int main(int argc, char *argv[])
 {
-	int fd1 = 0, fd2 = 0;
+	const char *write_file = NULL;
+	const char *check_file = NULL;
+	const char *diff_file = NULL;
+	const char *update_file = NULL;
+	const char *range_file = NULL;
+	const char *report = NULL;
+	const char *hint1 = NULL;
+	const char *hint2 = NULL;
+	struct sample_opts so = { 0.0, 0.999, 0, 1, 0 };
+	int do_sync = 0;
+	int sample = 0;
+	int bits = 128;
+	int modes;
+	int opt;
+
+	so.seed = time(NULL);
+
+	while ((opt = getopt(argc, argv, "w:c:d:u:r:o:sz:Z:H:S:e:Rxb:P:j:D")) != -1) {
+		switch (opt) {
+		case 'w':
+			write_file = optarg;
+			break;
+		case 'c':
+			check_file = optarg;
+			break;
+		case 'd':
+			diff_file = optarg;
+			break;
+		case 'u':
+			update_file = optarg;
+			break;
+		case 'r':
+			range_file = optarg;
+			break;
+		case 'o':
+			report = optarg;
+			break;
+		case 's':
+			do_sync = 1;
+			break;
+		case 'z':
+			hint1 = optarg;
+			break;
+		case 'Z':
+			hint2 = optarg;
+			break;
+		case 'H':
+			bits = atoi(optarg);
+			if (bits != 64 && bits != 128) {
+				fprintf(stderr, "Fingerprint size must be 64 or 128.\n");
+				return EXIT_ERROR;
+			}
+			break;
+		case 'S':
+			sample = 1;
+			if (parse_sample(optarg, &so) < 0)
+				return EXIT_ERROR;
+			break;
+		case 'e':
+			so.seed = strtoull(optarg, NULL, 0);
+			break;
+		case 'R':
+			so.stratified = 0;
+			break;
+		case 'x':
+			so.escalate = 1;
+			break;
+		case 'b':
+			block_size = atoi(optarg);
+			if (block_size < 512 || block_size % 512 != 0 ||
+					block_size > MAX_READ_SIZE) {
+				fprintf(stderr, "Block size must be a multiple of 512.\n");
+				return EXIT_ERROR;
+			}
+			break;
+		case 'P':
+			progress.interval = atof(optarg);
+			break;
+		case 'j':
+			summary_file = optarg;
+			break;
+		case 'D':
+			direct_io = 1;
+			break;
+		default:
+			usage();
+			return EXIT_ERROR;
+		}
+	}
+
+	modes = !!write_file + !!check_file + !!diff_file + !!update_file;
+	if (modes > 1) {
+		fprintf(stderr, "Options -w, -c, -d and -u are exclusive.\n");
+		return EXIT_ERROR;
+	}
+	if (update_file && !range_file) {
+		fprintf(stderr, "Option -u needs a changed block list (-r).\n");
+		return EXIT_ERROR;
+	}
+
+	if (modes == 1 && (report || do_sync || hint2 || sample)) {
+		fprintf(stderr, "Options -o, -s, -S and -Z need two devices.\n");
+		return EXIT_ERROR;
+	}
+	if (sample && do_sync) {
+		fprintf(stderr, "Options -S and -s are exclusive.\n");
+		return EXIT_ERROR;
+	}
+
+	if (modes == 1) {
+		if (argc - optind != 1) {
+			fprintf(stderr, "Invalid number of parameters.\n");
+			usage();
+			return EXIT_ERROR;
+		}
+		if (write_file)
+			return write_manifest(write_file, argv[optind], hint1,
+					bits / 8);
+		if (check_file)
+			return check_manifest(check_file, argv[optind], hint1);
+		if (diff_file)
+			return diff_manifests(diff_file, argv[optind]);
+		return refresh_manifest(update_file, argv[optind], range_file);
+	}
+
+	if (argc - optind != 2) {
+		fprintf(stderr, "Invalid number of parameters.\n");
+		usage();
+		return EXIT_ERROR;
+	}
+	if (sample)
+		return sample_devices(argv[optind], argv[optind + 1], hint1,
+				hint2, report, &so);
+	return compare_devices(argv[optind], argv[optind + 1], hint1, hint2,
+			report, do_sync);
+}
+
+/**
+ * parse_sample() - Parse "<divergence>[,<confidence>]" in percent
+ */
+static int parse_sample(const char *arg, struct sample_opts *so)
+{
+	double div, conf = 100.0 * so->confidence;
+	int n;
+
+	n = sscanf(arg, "%lf,%lf", &div, &conf);
+	if (n < 1 || div <= 0.0 || div >= 100.0 ||
+			conf <= 0.0 || conf >= 100.0) {
+		fprintf(stderr, "Invalid sampling target %s.\n", arg);
+		return -1;
+	}
+	so->divergence = div / 100.0;
+	so->confidence = conf / 100.0;
+	return 0;
+}
+
+static void put_le32(unsigned char *p, uint32_t v)
+{
+	v = htole32(v);
+	memcpy(p, &v, sizeof(v));
+}
+
+static void put_le64(unsigned char *p, uint64_t v)
+{
+	v = htole64(v);
+	memcpy(p, &v, sizeof(v));
+}
+
+static uint32_t get_le32(const unsigned char *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return le32toh(v);
+}
+
+static uint64_t get_le64(const unsigned char *p)
+{
+	uint64_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return le64toh(v);
+}
+
+
+/**
+ * encode_digest() - Store the fingerprint of a buffer in manifest format
+ *
+ * @p		: Destination, digest_size bytes
+ * @buf		: Block data or child fingerprints of a tree node
+ * @len		: Length of buf in bytes
+ */
+static void encode_digest(unsigned char *p, const unsigned char *buf,
+		size_t len, int digest_size)
+{
+	struct bh_digest d;
+
+	if (digest_size == 8) {
+		put_le64(p, blockhash64(buf, len));
+		return;
+	}
+	blockhash(buf, len, &d);
+	put_le64(p, d.lo);
+	put_le64(p + 8, d.hi);
+}
+
+/**
+ * add_extent() - Extend the last extent by block or start a new one
+ */
+static int add_extent(struct extent_list *el, uint64_t block)
+{
+	struct range *tmp;
+
+	if (el->n && el->r[el->n - 1].start + el->r[el->n - 1].count == block) {
+		el->r[el->n - 1].count++;
+		return 0;
+	}
+	if (el->n == el->alloc) {
+		el->alloc = el->alloc ? el->alloc * 2 : 1024;
+		tmp = realloc(el->r, el->alloc * sizeof(*el->r));
+		if (!tmp) {
+			fprintf(stderr, "Failed to allocate memory.\n");
+			return -1;
+		}
+		el->r = tmp;
+	}
+	el->r[el->n].start = block;
+	el->r[el->n].count = 1;
+	el->n++;
+	return 0;
+}
+
+/**
+ * write_report() - Write the differing extents to a file
+ *
+ * The report uses the changed block list format, one "<first block>
+ * <count>" per line, so it can be fed back into -u and -r.
+ */
+static int write_report(const char *report, const struct extent_list *el)
+{
+	FILE *out;
+	size_t i;
+
+	out = fopen(report, "w");
+	if (!out) {
+		fprintf(stderr, "Failed to create extent report.\n");
+		return -1;
+	}
+	fprintf(out, "# blockcompare extents, block size %u\n", block_size);
+	for (i = 0; i < el->n; i++) {
+		fprintf(out, "%llu %llu\n",
+				(unsigned long long)el->r[i].start,
+				(unsigned long long)el->r[i].count);
+	}
+	if (fclose(out) != 0) {
+		fprintf(stderr, "Failed to write extent report.\n");
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * copy_extents() - Copy extents from source to target device
+ *
+ * copy_file_range() is tried first so that regular files on the same
+ * file system are copied inside the kernel (or reflinked). When it is
+ * not supported, e.g. between block devices, the extents are copied with
+ * large aligned pread() / pwrite() requests.
+ *
+ * @ret		: number of bytes copied, -1 on error
+ */
+static int64_t copy_extents(struct dev *src, struct dev *dst,
+		const struct extent_list *el)
+{
+	unsigned char *buf = NULL;
+	int use_cfr = 1;
+	int64_t copied = 0;
+	uint64_t off, len, n;
+	loff_t in, out;
+	ssize_t res;
+	size_t i;
+
+	buf = blkio_alloc(block_size, SYNC_SIZE);
+	if (!buf) {
+		fprintf(stderr, "Failed to allocate memory.\n");
+		return -1;
+	}
+
+	for (i = 0; i < el->n; i++) {
+		off = el->r[i].start * block_size;
+		len = el->r[i].count * block_size;
+
+		while (len > 0) {
+			n = len < SYNC_SIZE ? len : SYNC_SIZE;
+
+			if (use_cfr) {
+				in = off;
+				out = off;
+				res = copy_file_range(src->io.fd, &in, dst->io.fd,
+						&out, n, 0);
+				if (res > 0) {
+					off += res;
+					len -= res;
+					copied += res;
+					continue;
+				}
+				if (res < 0 && errno == EINTR)
+					continue;
+				if (res == 0 || (errno != EINVAL &&
+						errno != EXDEV &&
+						errno != ENOSYS &&
+						errno != EOPNOTSUPP)) {
+					fprintf(stderr, "Failed to copy block number : %llu\n",
+							(unsigned long long)(off / block_size));
+					goto err;
+				}
+				use_cfr = 0;
+			}
+
+			if (blkio_pread(&src->io, buf, n, off) != (ssize_t)n) {
+				fprintf(stderr, "Failed to read source at block number : %llu\n",
+						(unsigned long long)(off / block_size));
+				goto err;
+			}
+			if (blkio_pwrite(&dst->io, buf, n, off) < 0) {
+				fprintf(stderr, "Failed to write target at block number : %llu\n",
+						(unsigned long long)(off / block_size));
+				goto err;
+			}
+			off += n;
+			len -= n;
+			copied += n;
+		}
+	}
+
+	free(buf);
+	return copied;
+
+err:
+	free(buf);
+	return -1;
+}
+
+/**
+ * dev_open() - Open a block device or a regular image file
+ *
+ * @d		: Device to initialize
+ * @path	: Block device or image filename
+ * @flags	: open() flags, with -D reads bypass the page cache
+ * @hint	: Optional list of unmapped (discarded) block ranges that
+ *		  read as zeros, see read_ranges()
+ */
+static int dev_open(struct dev *d, const char *path, int flags,
+		const char *hint)
+{
+	ssize_t n;
+
+	memset(d, 0x00, sizeof(*d));
+	if (blkio_open(&d->io, path, flags) < 0) {
+		if (errno == ENOTBLK)
+			fprintf(stderr, "%s is not a block device or image file.\n",
+					path);
+		else
+			fprintf(stderr, "Failed to open %s : %s.\n", path,
+					strerror(errno));
+		return -1;
+	}
+	if (block_size % d->io.sector_size != 0) {
+		fprintf(stderr, "Block size %u is not a multiple of the %u byte "
+				"sectors of %s.\n", block_size, d->io.sector_size, path);
+		goto err;
+	}
+	if (direct_io && blkio_set_direct(&d->io, 1) < 0)
+		fprintf(stderr, "No O_DIRECT on %s, reading through the page "
+				"cache.\n", path);
+	d->blocks = d->io.size / block_size;
+
+	if (hint) {
+		n = read_ranges(hint, d->blocks, &d->unmapped);
+		if (n < 0)
+			goto err;
+		d->nunmapped = n;
+	}
+	return 0;
+
+err:
+	blkio_close(&d->io);
+	return -1;
+}
+
+static void dev_close(struct dev *d)
+{
+	free(d->unmapped);
+	d->unmapped = NULL;
+	blkio_close(&d->io);
+}
+
+/**
+ * dev_lookup() - Find the data or hole region containing block
+ *
+ * Image files are queried with SEEK_DATA / SEEK_HOLE, block devices are
+ * all data. A block that is only partly allocated counts as data.
+ */
+static void dev_lookup(struct dev *d, uint64_t block)
+{
+	off_t off = block * block_size;
+	off_t data, hole;
+
+	d->map_start = block;
+	d->map_end = d->blocks;
+	d->map_data = 1;
+
+	if (!d->io.is_reg)
+		return;
+
+	data = lseek(d->io.fd, off, SEEK_DATA);
+	if (data < 0) {
+		// ENXIO means only a hole is left till the end of the file
+		if (errno == ENXIO)
+			d->map_data = 0;
+		return;
+	}
+	if (data >= off + block_size) {
+		d->map_data = 0;
+		d->map_end = data / block_size;
+	} else {
+		hole = lseek(d->io.fd, off, SEEK_HOLE);
+		if (hole > off)
+			d->map_end = (hole + block_size - 1) / block_size;
+	}
+	if (d->map_end > d->blocks)
+		d->map_end = d->blocks;
+}
+
+/**
+ * dev_map() - Check whether block holds data or is known to read as zeros
+ *
+ * @count	: Number of blocks from block onwards in the same state
+ * @ret		: 1 if data has to be read, 0 for holes and unmapped ranges
+ */
+static int dev_map(struct dev *d, uint64_t block, uint64_t *count)
+{
+	uint64_t end;
+	size_t lo, hi, mid;
+	int data;
+
+	if (block < d->map_start || block >= d->map_end)
+		dev_lookup(d, block);
+	data = d->map_data;
+	end = d->map_end;
+
+	// Binary search for the first unmapped range ending after block
+	lo = 0;
+	hi = d->nunmapped;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (d->unmapped[mid].start + d->unmapped[mid].count <= block)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo < d->nunmapped) {
+		if (d->unmapped[lo].start <= block) {
+			data = 0;
+			end = d->unmapped[lo].start + d->unmapped[lo].count;
+		} else if (data && d->unmapped[lo].start < end) {
+			end = d->unmapped[lo].start;
+		}
+	}
+
+	*count = end - block;
+	return data;
+}
+
+static int is_zero_scalar(const unsigned char *buf, size_t len)
+{
+	uint64_t acc = 0, v;
+	size_t i;
+
+	for (i = 0; i < len; i += 8) {
+		memcpy(&v, buf + i, sizeof(v));
+		acc |= v;
+	}
+	return acc == 0;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+static int is_zero_avx2(const unsigned char *buf, size_t len)
+{
+	__m256i acc = _mm256_setzero_si256();
+	size_t i;
+
+	for (i = 0; i < len; i += 128) {
+		acc = _mm256_or_si256(acc, _mm256_or_si256(
+				_mm256_loadu_si256((const __m256i *)(buf + i)),
+				_mm256_loadu_si256((const __m256i *)(buf + i + 32))));
+		acc = _mm256_or_si256(acc, _mm256_or_si256(
+				_mm256_loadu_si256((const __m256i *)(buf + i + 64)),
+				_mm256_loadu_si256((const __m256i *)(buf + i + 96))));
+	}
+	return _mm256_testz_si256(acc, acc);
+}
+#endif
+
+/**
+ * is_zero() - Check whether a block contains only zeros
+ *
+ * Used instead of memcmp() when the other side is a hole, which then
+ * does not have to be read at all.
+ */
+static int is_zero(const unsigned char *buf)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	static int avx2 = -1;
+
+	if (avx2 < 0)
+		avx2 = __builtin_cpu_supports("avx2");
+	if (avx2)
+		return is_zero_avx2(buf, block_size);
+#endif
+	return is_zero_scalar(buf, block_size);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * tuner_init() - Pick the initial read size for the devices
+ *
+ * Starts at the larger of READ_SIZE and the optimal or minimum I/O size
+ * reported by the devices, rounded up to whole blocks. With auto_tune
+ * the size is then doubled while the measured throughput improves.
+ */
+static void tuner_init(struct dev **devs, int ndev, int auto_tune)
+{
+	size_t size = READ_SIZE;
+	int i;
+
+	for (i = 0; i < ndev; i++) {
+		if (devs[i]->io.io_opt > size)
+			size = devs[i]->io.io_opt;
+		if (devs[i]->io.io_min > size)
+			size = devs[i]->io.io_min;
+	}
+	size = (size + block_size - 1) / block_size * block_size;
+	if (size > MAX_READ_SIZE)
+		size = MAX_READ_SIZE / block_size * block_size;
+
+	memset(&tuner, 0x00, sizeof(tuner));
+	tuner.size = size;
+	tuner.best_size = size;
+	tuner.done = !auto_tune;
+}
+
+static void tuner_account(size_t len, double t)
+{
+	double rate;
+
+	if (tuner.done)
+		return;
+	tuner.bytes += len;
+	tuner.time += t;
+	if (tuner.bytes < TUNE_WINDOW || tuner.time <= 0.0)
+		return;
+
+	rate = tuner.bytes / tuner.time;
+	if (rate > tuner.best_rate * 1.05) {
+		tuner.best_rate = rate;
+		tuner.best_size = tuner.size;
+		if (tuner.size * 2 <= MAX_READ_SIZE)
+			tuner.size *= 2;
+		else
+			tuner.done = 1;
+	} else {
+		// No longer improving, settle on the best size seen
+		tuner.size = tuner.best_size;
+		tuner.done = 1;
+	}
+	tuner.bytes = 0;
+	tuner.time = 0.0;
+}
+
+// Blocks per read request
+static uint64_t read_blocks(void)
+{
+	uint64_t n = tuner.size / block_size;
+
+	return n ? n : 1;
+}
+
+// Blocks that fit in a buffer of MAX_READ_SIZE
+static uint64_t max_read_blocks(void)
+{
+	return MAX_READ_SIZE / block_size;
+}
+
+/**
+ * dev_read() - Timed read of blocks from a device
+ *
+ * The latency of every request goes into the device statistics and the
+ * read size tuner. A read that continues the previous one starts the
+ * next one of the same size in the background, so the device is busy
+ * while the blocks just read are compared or hashed.
+ */
+static ssize_t dev_read(struct dev *d, void *buf, uint64_t block,
+		uint64_t count)
+{
+	double t = now();
+	uint64_t ahead;
+	ssize_t res;
+
+	res = blkio_pread(&d->io, buf, count * block_size, block * block_size);
+	t = now() - t;
+	if (res > 0)
+		tuner_account(res, t);
+
+	if (block == d->next && block + count < d->blocks) {
+		ahead = d->blocks - block - count;
+		if (ahead > count)
+			ahead = count;
+		blkio_prefetch(&d->io, (block + count) * block_size,
+				ahead * block_size);
+	}
+	d->next = block + count;
+	return res;
+}
+
+/**
+ * progress_start() - Start tracking progress of a run
+ *
+ * @total	: Number of blocks that will be processed
+ * @d1, d2	: Devices whose read latency is reported, d2 may be NULL
+ */
+static void progress_start(uint64_t total, struct dev *d1, struct dev *d2)
+{
+	progress.total = total;
+	progress.done = 0;
+	progress.differ = 0;
+	progress.start = now();
+	progress.last = progress.start;
+	progress.last_done = 0;
+	progress.dev[0] = d1;
+	progress.dev[1] = d2;
+	progress.ndev = d2 ? 2 : 1;
+}
+
+static void progress_print(double t)
+{
+	double mb = (double)block_size / (1024 * 1024);
+	double rate, avg, eta;
+	int i;
+
+	rate = (progress.done - progress.last_done) * mb / (t - progress.last);
+	avg = progress.done * mb / (t - progress.start);
+	eta = avg > 0.0 ? (progress.total - progress.done) * mb / avg : 0.0;
+
+	fprintf(stderr, "Progress : %5.1f%% %llu MB at %.1f MB/s, ETA %d:%02d:%02d, "
+			"%lu differ, read latency p50/p99/p999",
+			progress.total ? 100.0 * progress.done / progress.total : 100.0,
+			(unsigned long long)(progress.done * mb), rate,
+			(int)eta / 3600, (int)eta / 60 % 60, (int)eta % 60,
+			progress.differ);
+	for (i = 0; i < progress.ndev; i++) {
+		fprintf(stderr, "%s %.2f/%.2f/%.2f ms", i ? "," : "",
+				blkio_lat_percentile(&progress.dev[i]->io.stats.lat, 0.50) / 1e6,
+				blkio_lat_percentile(&progress.dev[i]->io.stats.lat, 0.99) / 1e6,
+				blkio_lat_percentile(&progress.dev[i]->io.stats.lat, 0.999) / 1e6);
+	}
+	fprintf(stderr, ", read size %zu KB\n", tuner.size / 1024);
+}
+
+/**
+ * progress_update() - Account processed blocks and report periodically
+ */
+static void progress_update(uint64_t blocks, unsigned long differ)
+{
+	double t;
+
+	progress.done += blocks;
+	progress.differ += differ;
+	if (progress.interval <= 0.0)
+		return;
+
+	t = now();
+	if (t - progress.last < progress.interval)
+		return;
+	progress_print(t);
+	progress.last = t;
+	progress.last_done = progress.done;
+}
+
+static void json_string(FILE *out, const char *str)
+{
+	fputc('"', out);
+	for (; *str; str++) {
+		if (*str == '"' || *str == '\\')
+			fprintf(out, "\\%c", *str);
+		else if ((unsigned char)*str < 0x20)
+			fprintf(out, "\\u%04x", *str);
+		else
+			fputc(*str, out);
+	}
+	fputc('"', out);
+}
+
+/**
+ * progress_summary() - Print throughput and write the JSON summary
+ *
+ * @json	: Optional summary filename, "-" for standard output
+ * @mode	: Name of the run mode
+ * @extents	: Number of differing extents
+ */
+static int progress_summary(const char *json, const char *mode,
+		unsigned long extents)
+{
+	double elapsed = now() - progress.start;
+	uint64_t bytes = 0;
+	struct dev *d;
+	FILE *out;
+	int i;
+
+	for (i = 0; i < progress.ndev; i++)
+		bytes += progress.dev[i]->io.stats.bytes;
+	fprintf(stdout, "Read %.1f MB in %.2f seconds (%.1f MB/s), read size %zu KB.\n",
+			bytes / 1048576.0, elapsed,
+			elapsed > 0.0 ? bytes / 1048576.0 / elapsed : 0.0,
+			tuner.size / 1024);
+
+	if (!json)
+		return 0;
+	if (strcmp(json, "-") == 0)
+		out = stdout;
+	else
+		out = fopen(json, "w");
+	if (!out) {
+		fprintf(stderr, "Failed to create JSON summary.\n");
+		return -1;
+	}
+
+	fprintf(out, "{\n  \"mode\": \"%s\",\n", mode);
+	fprintf(out, "  \"block_size\": %u,\n", block_size);
+	fprintf(out, "  \"read_size\": %zu,\n", tuner.size);
+	fprintf(out, "  \"blocks\": %llu,\n", (unsigned long long)progress.total);
+	fprintf(out, "  \"blocks_done\": %llu,\n", (unsigned long long)progress.done);
+	fprintf(out, "  \"blocks_differ\": %lu,\n", progress.differ);
+	fprintf(out, "  \"extents\": %lu,\n", extents);
+	fprintf(out, "  \"elapsed_seconds\": %.3f,\n", elapsed);
+	fprintf(out, "  \"read_mb_per_second\": %.1f,\n",
+			elapsed > 0.0 ? bytes / 1048576.0 / elapsed : 0.0);
+	fprintf(out, "  \"devices\": [\n");
+	for (i = 0; i < progress.ndev; i++) {
+		d = progress.dev[i];
+		fprintf(out, "    {\n      \"path\": ");
+		json_string(out, d->io.path);
+		fprintf(out, ",\n      \"size_bytes\": %llu,\n",
+				(unsigned long long)d->blocks * block_size);
+		fprintf(out, "      \"sector_size\": %u,\n", d->io.sector_size);
+		fprintf(out, "      \"io_min\": %u,\n", d->io.io_min);
+		fprintf(out, "      \"io_opt\": %u,\n", d->io.io_opt);
+		fprintf(out, "      \"direct\": %s,\n", d->io.direct ? "true" : "false");
+		fprintf(out, "      \"bytes_read\": %llu,\n",
+				(unsigned long long)d->io.stats.bytes);
+		fprintf(out, "      \"reads\": %llu,\n",
+				(unsigned long long)d->io.stats.reads);
+		fprintf(out, "      \"short_reads\": %llu,\n",
+				(unsigned long long)d->io.stats.short_reads);
+		fprintf(out, "      \"latency_us\": { \"p50\": %.1f, \"p90\": %.1f, "
+				"\"p99\": %.1f, \"p999\": %.1f, \"max\": %.1f }\n",
+				blkio_lat_percentile(&d->io.stats.lat, 0.50) / 1e3,
+				blkio_lat_percentile(&d->io.stats.lat, 0.90) / 1e3,
+				blkio_lat_percentile(&d->io.stats.lat, 0.99) / 1e3,
+				blkio_lat_percentile(&d->io.stats.lat, 0.999) / 1e3,
+				d->io.stats.lat.max_ns / 1e3);
+		fprintf(out, "    }%s\n", i + 1 < progress.ndev ? "," : "");
+	}
+	fprintf(out, "  ]\n}\n");
+
+	if (out != stdout && fclose(out) != 0) {
+		fprintf(stderr, "Failed to write JSON summary.\n");
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * compare_range() - Compare a range of blocks of two devices
+ *
+ * Differing blocks are added to el. Ranges that are holes or unmapped on
+ * both sides are skipped without reading them, against a hole the other
+ * side is only checked for zeros.
+ *
+ * @buf1, buf2	: Buffers of MAX_READ_SIZE bytes
+ * @print	: Print every differing block
+ * @ret		: 0 on success, -1 on error. The range is within both
+ *		  devices, so a short read is an error too.
+ */
+static int compare_range(struct dev *d1, struct dev *d2, uint64_t start,
+		uint64_t count, unsigned char *buf1, unsigned char *buf2,
+		struct extent_list *el, int print, struct compare_stats *cs)
+{
+	uint64_t c, n, n1, n2, i, end = start + count;
+	unsigned long differ;
+	int data1, data2, same;
+
+	for (c = start; c < end; c += n) {
+		data1 = dev_map(d1, c, &n1);
+		data2 = dev_map(d2, c, &n2);
+		n = end - c;
+		if (n > read_blocks())
+			n = read_blocks();
+		if (n > n1)
+			n = n1;
+		if (n > n2)
+			n = n2;
+
+		/* Holes on both sides are equal */
+		if (!data1 && !data2) {
+			cs->skipped += n;
+			progress_update(n, 0);
+			continue;
+		}
+
+		/* Read a run of blocks from the devices holding data */
+		if (data1 && dev_read(d1, buf1, c, n)
+				< (ssize_t)(n * block_size)) {
+			fprintf(stderr, "Failed to read first block device at "
+					"block number : %llu\n", (unsigned long long)c);
+			return -1;
+		}
+		if (data2 && dev_read(d2, buf2, c, n)
+				< (ssize_t)(n * block_size)) {
+			fprintf(stderr, "Failed to read second block device at "
+					"block number : %llu\n", (unsigned long long)c);
+			return -1;
+		}
+		cs->read += n;
+
+		/* Most runs are identical, compare block by block only if not */
+		if (data1 && data2 && memcmp(buf1, buf2, n * block_size) == 0) {
+			progress_update(n, 0);
+			continue;
+		}
+
+		for (i = 0, differ = 0; i < n; i++) {
+			if (data1 && data2)
+				same = memcmp(buf1 + i * block_size,
+						buf2 + i * block_size, block_size) == 0;
+			else
+				same = is_zero((data1 ? buf1 : buf2) + i * block_size);
+			if (same)
+				continue;
+			if (print)
+				fprintf(stdout, "Block differ at block number : %llu\n",
+						(unsigned long long)(c + i));
+			if (add_extent(el, c + i) < 0)
+				return -1;
+			differ++;
+		}
+		cs->differ += differ;
+		progress_update(n, differ);
+	}
+	return 0;
+}
+
+/**
+ * compare_devices() - Compare two devices block by block
+ *
+ * Differing blocks are coalesced into extents. With do_sync set the extents
+ * are then copied from the first (source) to the second (target) device.
+ *
+ * @hint1	: Optional unmapped ranges of dev1
+ * @hint2	: Optional unmapped ranges of dev2
+ * @report	: Optional file to write the differing extents to
+ * @do_sync	: Copy differing extents from dev1 to dev2
+ */
+int compare_devices(const char *dev1, const char *dev2, const char *hint1,
+		const char *hint2, const char *report, int do_sync)
+{
+	struct dev d1 = { .io.fd = -1 }, d2 = { .io.fd = -1 };
+	unsigned char *buf1 = NULL;
+	unsigned char *buf2 = NULL;
+	struct extent_list el = { NULL, 0, 0 };
+	struct compare_stats cs = { 0, 0, 0 };
+	struct dev *devs[2] = { &d1, &d2 };
+	uint64_t min;
+	int64_t copied;
+
+	/* Opening block devices */
+	if (dev_open(&d1, dev1, O_RDONLY, hint1) < 0)
+		goto err;
+	if (dev_open(&d2, dev2, do_sync ? O_RDWR : O_RDONLY, hint2) < 0)
+		goto err;
+
+	fprintf(stdout, "First block device size: %llu\n",
+			(unsigned long long)d1.blocks * (block_size / 512));
+	fprintf(stdout, "Second block device size: %llu\n",
+			(unsigned long long)d2.blocks * (block_size / 512));
+
+	/* Partition with minimum size */
+	min = d1.blocks;
+	if (d2.blocks < min) {
+		min = d2.blocks;
+	}
+
+	/* Allocating buffers */
+	buf1 = blkio_alloc(BLKIO_ALIGN, MAX_READ_SIZE);
+	if (!buf1) {
+		fprintf(stderr, "Failed to allocate memory.\n");
+		goto err;
+	}
+	buf2 = blkio_alloc(BLKIO_ALIGN, MAX_READ_SIZE);
+	if (!buf2) {
+		fprintf(stderr, "Failed to allocate memory.\n");
+		goto err;
+	}
+
+	tuner_init(devs, 2, 1);
+	fprintf(stdout, "Block size %u, read size %zu KB\n",
+			block_size, tuner.size / 1024);
+	fprintf(stdout, "Reading %llu blocks...\n", (unsigned long long)min);
+
+	progress_start(min, &d1, &d2);
+	if (compare_range(&d1, &d2, 0, min, buf1, buf2, &el, !do_sync, &cs) < 0)
+		goto err;
+
+	fprintf(stdout, "%lu blocks differ in %lu extents, %lu hole blocks skipped.\n",
+			cs.differ, (unsigned long)el.n, cs.skipped);
+
+	if (progress_summary(summary_file, do_sync ? "sync" : "compare",
+				el.n) < 0)
+		goto err;
+
+	if (report && write_report(report, &el) < 0)
+		goto err;
+
+	if (do_sync && el.n > 0) {
+		fprintf(stdout, "Copying %lu extents...\n", (unsigned long)el.n);
+		copied = copy_extents(&d1, &d2, &el);
+		if (copied < 0)
+			goto err;
+		if (fsync(d2.io.fd) != 0) {
+			fprintf(stderr, "Failed to flush second block device.\n");
+			goto err;
+		}
+		fprintf(stdout, "Copied %lld bytes.\n", (long long)copied);
+	}
+
+	free(el.r);
+	free(buf1);
+	free(buf2);
+	dev_close(&d1);
+	dev_close(&d2);
+
+	// After a sync the devices match
+	return cs.differ && !do_sync ? EXIT_DIFFER : EXIT_SUCCESS;
+
+err:
+	free(el.r);
+	free(buf1);
+	free(buf2);
+	dev_close(&d1);
+	dev_close(&d2);
+
+	return EXIT_ERROR;
+}
+
+/**
+ * rand64() - splitmix64 pseudo random generator
+ *
+ * Used instead of rand() so that a seed selects the same sample on every
+ * machine and C library.
+ */
+static uint64_t rand64(uint64_t *state)
+{
+	uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+// Uniform random number in [0, n)
+static uint64_t rand_below(uint64_t *state, uint64_t n)
+{
+	return (uint64_t)(((__uint128_t)rand64(state) * n) >> 64);
+}
+
+/**
+ * binom_cdf() - P(X <= k) for X ~ Binomial(n, p)
+ *
+ * Summed in log space so that large n does not underflow.
+ */
+static double binom_cdf(uint64_t k, uint64_t n, double p)
+{
+	double lp, acc, m;
+	uint64_t i;
+
+	if (k >= n || p <= 0.0)
+		return 1.0;
+	if (p >= 1.0)
+		return 0.0;
+
+	lp = n * log1p(-p);
+	acc = lp;
+	for (i = 0; i < k; i++) {
+		lp += log((double)(n - i) / (i + 1)) + log(p / (1.0 - p));
+		m = acc > lp ? acc : lp;
+		acc = m + log(exp(acc - m) + exp(lp - m));
+	}
+	return acc >= 0.0 ? 1.0 : exp(acc);
+}
+
+/**
+ * binom_bounds() - Clopper-Pearson confidence interval of k / n
+ *
+ * @conf	: Confidence level, e.g. 0.999
+ */
+static void binom_bounds(uint64_t k, uint64_t n, double conf,
+		double *lower, double *upper)
+{
+	double alpha = (1.0 - conf) / 2.0;
+	double lo, hi, mid;
+	int i;
+
+	// Largest p for which seeing at most k differences is still likely
+	*upper = 1.0;
+	if (k < n) {
+		for (lo = 0.0, hi = 1.0, i = 0; i < 64; i++) {
+			mid = (lo + hi) / 2.0;
+			if (binom_cdf(k, n, mid) > alpha)
+				lo = mid;
+			else
+				hi = mid;
+		}
+		*upper = hi;
+	}
+
+	// Smallest p for which seeing at least k differences is still likely
+	*lower = 0.0;
+	if (k > 0) {
+		for (lo = 0.0, hi = 1.0, i = 0; i < 64; i++) {
+			mid = (lo + hi) / 2.0;
+			if (1.0 - binom_cdf(k - 1, n, mid) < alpha)
+				lo = mid;
+			else
+				hi = mid;
+		}
+		*lower = lo;
+	}
+}
+
+static int u64_cmp(const void *a, const void *b)
+{
+	const uint64_t *ua = a, *ub = b;
+
+	return *ua < *ub ? -1 : *ua > *ub;
+}
+
+/**
+ * sample_distinct() - Draw n distinct block numbers below max, sorted
+ *
+ * Floyd's algorithm, so exactly n blocks are compared however close n
+ * is to max. The numbers drawn are kept in an open addressing set.
+ */
+static int sample_distinct(uint64_t *state, uint64_t n, uint64_t max,
+		uint64_t *out)
+{
+	uint64_t *set, size = 2, j, t, h;
+	int bits = 1;
+
+	while (size < 2 * n) {
+		size <<= 1;
+		bits++;
+	}
+	set = (uint64_t *)malloc(size * sizeof(*set));
+	if (!set) {
+		fprintf(stderr, "Failed to allocate memory.\n");
+		return -1;
+	}
+	memset(set, 0xff, size * sizeof(*set));
+
+	for (j = max - n; j < max; j++) {
+		t = rand_below(state, j + 1);
+		for (h = (t * 0x9E3779B97F4A7C15ULL) >> (64 - bits);
+				set[h] != UINT64_MAX && set[h] != t;
+				h = (h + 1) & (size - 1))
+			;
+		// Taken already, j itself cannot be
+		if (set[h] == t) {
+			t = j;
+			for (h = (t * 0x9E3779B97F4A7C15ULL) >> (64 - bits);
+					set[h] != UINT64_MAX; h = (h + 1) & (size - 1))
+				;
+		}
+		set[h] = t;
+		out[j - (max - n)] = t;
+	}
+	free(set);
+	qsort(out, n, sizeof(*out), u64_cmp);
+	return 0;
+}
+
+// First block of stratum k, the device split into nsamples strata
+static inline uint64_t stratum_start(uint64_t k, uint64_t min,
+		uint64_t nsamples)
+{
+	return (uint64_t)((__uint128_t)k * min / nsamples);
+}
+
+static uint64_t stratum_of(uint64_t block, uint64_t min, uint64_t nsamples)
+{
+	uint64_t k = (uint64_t)((__uint128_t)block * nsamples / min);
+
+	while (k + 1 < nsamples && stratum_start(k + 1, min, nsamples) <= block)
+		k++;
+	while (k > 0 && stratum_start(k, min, nsamples) > block)
+		k--;
+	return k;
+}
+
+// Strata compared in full around the differing samples
+struct escalation {
+	struct dev *d1, *d2;
+	unsigned char *buf1, *buf2;
+	struct extent_list *el;
+	struct compare_stats *cs;
+	uint64_t min, nsamples;
+	unsigned char *done;		// Bit per stratum compared
+};
+
+/**
+ * compare_stratum() - Compare a whole stratum
+ *
+ * @first, last	: Set if its first or last block differs, so a differing
+ *		  run may go on in the stratum next to it
+ */
+static int compare_stratum(struct escalation *e, uint64_t k, int *first,
+		int *last)
+{
+	uint64_t start = stratum_start(k, e->min, e->nsamples);
+	uint64_t end = stratum_start(k + 1, e->min, e->nsamples);
+	size_t i, n0 = e->el->n;
+	int res;
+
+	e->done[k / 8] |= 1 << (k % 8);
+	progress.total += end - start;
+	res = compare_range(e->d1, e->d2, start, end - start, e->buf1, e->buf2,
+			e->el, 1, e->cs);
+	if (res < 0)
+		return -1;
+
+	// The extent with start may have been extended from the one before
+	*first = 0;
+	for (i = n0 ? n0 - 1 : 0; i < e->el->n; i++) {
+		if (e->el->r[i].start <= start &&
+				e->el->r[i].start + e->el->r[i].count > start)
+			*first = 1;
+	}
+	*last = e->el->n > 0 &&
+		e->el->r[e->el->n - 1].start + e->el->r[e->el->n - 1].count == end;
+	return 0;
+}
+
+static inline int stratum_done(const struct escalation *e, uint64_t k)
+{
+	return e->done[k / 8] & (1 << (k % 8));
+}
+
+/**
+ * escalate() - Compare the stratum of a differing sample in full
+ *
+ * Strata next to it are compared too as long as a differing run
+ * reaches the edge, so the whole run is found.
+ */
+static int escalate(struct escalation *e, uint64_t block)
+{
+	uint64_t k = stratum_of(block, e->min, e->nsamples), f;
+	int lo, hi, unused;
+
+	if (stratum_done(e, k))
+		return 0;
+	if (compare_stratum(e, k, &lo, &hi) < 0)
+		return -1;
+	for (f = k + 1; hi && f < e->nsamples && !stratum_done(e, f); f++)
+		if (compare_stratum(e, f, &unused, &hi) < 0)
+			return -1;
+	for (f = k; lo && f > 0 && !stratum_done(e, f - 1); f--)
+		if (compare_stratum(e, f - 1, &lo, &unused) < 0)
+			return -1;
+	return 0;
+}
+
+/**
+ * sample_devices() - Compare a random sample of blocks of two devices
+ *
+ * The number of samples is chosen so that a divergence of at least
+ * so->divergence is detected with probability so->confidence. With
+ * stratified sampling the device is split into as many equal strata as
+ * there are samples and one random block is compared in each of them.
+ * Random sampling draws as many distinct blocks. The sampled divergence
+ * is reported with its confidence interval and with so->escalate the
+ * stratum around every differing sample is compared in full, and the
+ * strata next to it for as long as a differing run goes on.
+ *
+ * @report	: Optional file to write the differing extents to
+ */
+int sample_devices(const char *dev1, const char *dev2, const char *hint1,
+		const char *hint2, const char *report,
+		const struct sample_opts *so)
+{
+	struct dev d1 = { .io.fd = -1 }, d2 = { .io.fd = -1 };
 	unsigned char *buf1 = NULL;
 	unsigned char *buf2 = NULL;
-	unsigned long c = 0, min = 0;
-	int res = 0;
+	uint64_t *samples = NULL;
+	struct extent_list hits = { NULL, 0, 0 };
+	struct extent_list el = { NULL, 0, 0 };
+	struct compare_stats cs = { 0, 0, 0 };
+	struct compare_stats ecs = { 0, 0, 0 };
+	struct dev *devs[2] = { &d1, &d2 };
+	struct escalation esc;
+	unsigned char *done = NULL;
+	uint64_t min, nsamples, strata, state, i, b, first;
+	double lower, upper;
+	size_t j;
+	int res;
 
-	if (argc != 3) {
-		fprintf(stderr, "Invalid number of parameters.\n");
-		return EXIT_FAILURE;
+	if (dev_open(&d1, dev1, O_RDONLY, hint1) < 0)
+		goto err;
+	if (dev_open(&d2, dev2, O_RDONLY, hint2) < 0)
+		goto err;
+
+	// Samples are scattered, read ahead around them is wasted
+	blkio_advise(&d1.io, BLKIO_RA_RANDOM);
+	blkio_advise(&d2.io, BLKIO_RA_RANDOM);
+
+	min = d1.blocks;
+	if (d2.blocks < min)
+		min = d2.blocks;
+
+	nsamples = ceil(log(1.0 - so->confidence) / log1p(-so->divergence));
+	if (nsamples > min)
+		nsamples = min;
+	if (nsamples == 0) {
+		fprintf(stdout, "Nothing to sample.\n");
+		goto out;
 	}
 
-	/* Opening block devices */
-	fd1 = open(argv[1], O_RDONLY);
-	if (fd1 < 0) {
-		fprintf(stderr, "Failed to open first block device.\n");
+	buf1 = blkio_alloc(BLKIO_ALIGN, MAX_READ_SIZE);
+	buf2 = blkio_alloc(BLKIO_ALIGN, MAX_READ_SIZE);
+	samples = (uint64_t *)malloc(nsamples * sizeof(*samples));
+	if (!buf1 || !buf2 || !samples) {
+		fprintf(stderr, "Failed to allocate memory.\n");
 		goto err;
 	}
-	fd2 = open(argv[2], O_RDONLY);
-	if (fd2 < 0) {
-		fprintf(stderr, "Failed to open second block device.\n");
+
+	// Sample positions in ascending order
+	state = so->seed;
+	if (so->stratified) {
+		for (i = 0; i < nsamples; i++) {
+			first = stratum_start(i, min, nsamples);
+			samples[i] = first + rand_below(&state,
+					stratum_start(i + 1, min, nsamples) - first);
+		}
+	} else if (sample_distinct(&state, nsamples, min, samples) < 0) {
 		goto err;
 	}
+	strata = nsamples;
 
-	/* Calculating size of block devices in sector size */
-	ioctl(fd1, BLKGETSIZE, &c);
-	fprintf(stdout, "First block device size: %lu\n", c);
-	min = c;
-	ioctl(fd2, BLKGETSIZE, &c);
-	fprintf(stdout, "Second block device size: %lu\n", c);
+	tuner_init(devs, 2, 0);
+	progress_start(nsamples, &d1, &d2);
 
-	/* Partition with minimum size */
-	if (c < min) {
-		min = c;
+	fprintf(stdout, "Sampling %llu of %llu blocks (%s, seed %llu)...\n",
+			(unsigned long long)nsamples, (unsigned long long)min,
+			so->stratified ? "stratified" : "random",
+			(unsigned long long)so->seed);
+
+	for (i = 0; i < nsamples; i++) {
+		res = compare_range(&d1, &d2, samples[i], 1, buf1, buf2, &hits,
+				1, &cs);
+		if (res < 0)
+			goto err;
 	}
 
-	/* Converting size to number of blocks */
-	min = min / 8;
+	binom_bounds(cs.differ, nsamples, so->confidence, &lower, &upper);
+	fprintf(stdout, "Sampled %llu blocks, %lu differ.\n",
+			(unsigned long long)nsamples, cs.differ);
+	fprintf(stdout, "Estimated divergence : %.4f%% (%.1f%% confidence "
+			"interval %.4f%% - %.4f%%)\n",
+			nsamples ? 100.0 * cs.differ / nsamples : 0.0,
+			100.0 * so->confidence, 100.0 * lower, 100.0 * upper);
 
-	/* Allocating buffers */
-	buf1 = (unsigned char *)malloc(BUF_SIZE);
-	if (!buf1) {
+	if (so->escalate && hits.n > 0) {
+		fprintf(stdout, "Escalating to full compare of the strata of %lu "
+				"differing samples...\n", cs.differ);
+
+		// Strata are the ones of the sampler, whatever the mode
+		done = (unsigned char *)calloc((strata + 7) / 8, 1);
+		if (!done) {
+			fprintf(stderr, "Failed to allocate memory.\n");
+			goto err;
+		}
+		esc = (struct escalation){ &d1, &d2, buf1, buf2, &el, &ecs,
+			min, strata, done };
+		tuner_init(devs, 2, 1);
+		for (j = 0; j < hits.n; j++) {
+			for (b = hits.r[j].start; b < hits.r[j].start +
+					hits.r[j].count; b++) {
+				if (escalate(&esc, b) < 0)
+					goto err;
+			}
+		}
+		el.n = merge_ranges(el.r, el.n);
+		fprintf(stdout, "%lu blocks differ in %lu extents in escalated ranges.\n",
+				ecs.differ, (unsigned long)el.n);
+		if (report && write_report(report, &el) < 0)
+			goto err;
+	} else if (report && write_report(report, &hits) < 0) {
+		goto err;
+	}
+
+	if (progress_summary(summary_file, "sample",
+				so->escalate ? el.n : hits.n) < 0)
+		goto err;
+
+out:
+	free(done);
+	free(samples);
+	free(hits.r);
+	free(el.r);
+	free(buf1);
+	free(buf2);
+	dev_close(&d1);
+	dev_close(&d2);
+	return cs.differ ? EXIT_DIFFER : EXIT_SUCCESS;
+
+err:
+	free(done);
+	free(samples);
+	free(hits.r);
+	free(el.r);
+	free(buf1);
+	free(buf2);
+	dev_close(&d1);
+	dev_close(&d2);
+	return EXIT_ERROR;
+}
+
+/**
+ * tree_layout() - Compute number of nodes and file offset of each level
+ *
+ * @ret		: number of levels, -1 if the tree is too deep
+ */
+static int tree_layout(struct manifest_hdr *mh)
+{
+	uint64_t n = mh->blocks;
+	uint64_t off = mh->hdr_size;
+	int k = 0;
+
+	for (;;) {
+		if (k == TREE_MAX_LEVELS)
+			return -1;
+		mh->level_nodes[k] = n;
+		mh->level_off[k] = off;
+		off += n * mh->digest_size;
+		k++;
+
+		// Version 1 manifests only have the leaves
+		if (n <= 1 || mh->fanout == 0)
+			break;
+		n = (n + mh->fanout - 1) / mh->fanout;
+	}
+	return k;
+}
+
+/**
+ * write_manifest_hdr() - Write the manifest header for mh
+ */
+static int write_manifest_hdr(int fd, const struct manifest_hdr *mh)
+{
+	unsigned char hdr[MANIFEST_HDR_SIZE];
+
+	memset(hdr, 0x00, sizeof(hdr));
+	memcpy(hdr, MANIFEST_MAGIC, 8);
+	put_le32(hdr + 8, mh->version);
+	put_le32(hdr + 12, mh->block_size);
+	put_le64(hdr + 16, mh->blocks);
+	put_le64(hdr + 24, mh->dev_size);
+	put_le32(hdr + 32, mh->hash_type);
+	put_le32(hdr + 36, mh->digest_size);
+	put_le32(hdr + 40, mh->fanout);
+	put_le32(hdr + 44, mh->levels);
+
+	return blkio_pwrite_full(fd, hdr, sizeof(hdr), 0);
+}
+
+/**
+ * read_manifest_hdr() - Read and validate the manifest header
+ */
+static int read_manifest_hdr(int fd, struct manifest_hdr *mh)
+{
+	unsigned char hdr[MANIFEST_HDR_SIZE];
+	ssize_t res;
+
+	memset(mh, 0x00, sizeof(*mh));
+	res = blkio_pread_full(fd, hdr, sizeof(hdr), 0);
+	if (res < MANIFEST_V1_HDR_SIZE) {
+		fprintf(stderr, "Failed to read manifest header.\n");
+		return -1;
+	}
+	if (memcmp(hdr, MANIFEST_MAGIC, 8) != 0) {
+		fprintf(stderr, "Not a blockcompare manifest.\n");
+		return -1;
+	}
+
+	mh->version = get_le32(hdr + 8);
+	mh->block_size = get_le32(hdr + 12);
+	mh->blocks = get_le64(hdr + 16);
+	mh->dev_size = get_le64(hdr + 24);
+	mh->hash_type = get_le32(hdr + 32);
+	mh->digest_size = get_le32(hdr + 36);
+
+	if (mh->version == 1) {
+		mh->hdr_size = MANIFEST_V1_HDR_SIZE;
+	} else if (mh->version == MANIFEST_VERSION &&
+			res == MANIFEST_HDR_SIZE) {
+		mh->hdr_size = MANIFEST_HDR_SIZE;
+		mh->fanout = get_le32(hdr + 40);
+		mh->levels = get_le32(hdr + 44);
+	} else {
+		fprintf(stderr, "Unsupported manifest version %u.\n",
+				mh->version);
+		return -1;
+	}
+
+	if (mh->hash_type != MANIFEST_HASH ||
+			(mh->digest_size != 8 && mh->digest_size != 16)) {
+		fprintf(stderr, "Unsupported manifest fingerprint.\n");
+		return -1;
+	}
+	if (mh->block_size == 0 || mh->block_size % 512 != 0 ||
+			mh->block_size > MAX_READ_SIZE) {
+		fprintf(stderr, "Invalid manifest block size %u.\n",
+				mh->block_size);
+		return -1;
+	}
+	if (mh->version == 1) {
+		mh->levels = tree_layout(mh);
+	} else if (mh->fanout < 2 || mh->fanout > TREE_FANOUT ||
+			tree_layout(mh) != (int)mh->levels) {
+		fprintf(stderr, "Corrupt manifest hash tree.\n");
+		return -1;
+	}
+	return 0;
+}
+
+static int range_cmp(const void *a, const void *b)
+{
+	const struct range *ra = a, *rb = b;
+
+	if (ra->start != rb->start)
+		return ra->start < rb->start ? -1 : 1;
+	return 0;
+}
+
+/**
+ * merge_ranges() - Sort ranges and merge overlapping or adjacent ones
+ *
+ * @ret		: number of ranges left
+ */
+static size_t merge_ranges(struct range *r, size_t n)
+{
+	size_t i, out = 0;
+
+	if (n == 0)
+		return 0;
+
+	qsort(r, n, sizeof(*r), range_cmp);
+	for (i = 1; i < n; i++) {
+		if (r[i].start <= r[out].start + r[out].count) {
+			if (r[i].start + r[i].count > r[out].start + r[out].count)
+				r[out].count = r[i].start + r[i].count
+					- r[out].start;
+		} else {
+			r[++out] = r[i];
+		}
+	}
+	return out + 1;
+}
+
+/**
+ * read_ranges() - Read a changed block list
+ *
+ * Each line holds the first block number of a range and optionally the
+ * number of blocks in the range (default 1). Empty lines and lines
+ * starting with '#' are ignored. The ranges are returned sorted and
+ * merged and clipped to max_blocks.
+ *
+ * @file	: Filename, "-" for standard input
+ * @ranges	: Returned array, to be freed by the caller
+ * @ret		: number of ranges, -1 on error
+ */
+static ssize_t read_ranges(const char *file, uint64_t max_blocks,
+		struct range **ranges)
+{
+	FILE *in;
+	char line[256];
+	struct range *r = NULL, *tmp;
+	size_t n = 0, alloc = 0, i, out;
+	unsigned long long start, count;
+	unsigned long lineno = 0;
+	int res;
+
+	if (strcmp(file, "-") == 0)
+		in = stdin;
+	else
+		in = fopen(file, "r");
+	if (!in) {
+		fprintf(stderr, "Failed to open changed block list.\n");
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), in)) {
+		lineno++;
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+		count = 1;
+		res = sscanf(line, "%llu %llu", &start, &count);
+		if (res < 1 || count == 0) {
+			fprintf(stderr, "Invalid range at line %lu.\n", lineno);
+			goto err;
+		}
+		if (n == alloc) {
+			alloc = alloc ? alloc * 2 : 1024;
+			tmp = realloc(r, alloc * sizeof(*r));
+			if (!tmp) {
+				fprintf(stderr, "Failed to allocate memory.\n");
+				goto err;
+			}
+			r = tmp;
+		}
+		r[n].start = start;
+		r[n].count = count;
+		n++;
+	}
+
+	if (in != stdin)
+		fclose(in);
+
+	n = merge_ranges(r, n);
+
+	// Drop ranges past the end of the device
+	for (i = 0, out = 0; i < n; i++) {
+		if (r[i].start >= max_blocks)
+			continue;
+		if (r[i].start + r[i].count > max_blocks)
+			r[i].count = max_blocks - r[i].start;
+		r[out++] = r[i];
+	}
+
+	*ranges = r;
+	return out;
+
+err:
+	free(r);
+	if (in != stdin)
+		fclose(in);
+	return -1;
+}
+
+/**
+ * update_tree() - Rebuild the interior tree nodes above changed leaves
+ *
+ * Only the parents of the given leaf ranges are recomputed, level by
+ * level up to the root, so the cost is proportional to the number of
+ * changed blocks and not to the size of the device.
+ *
+ * @fd		: Manifest opened read write
+ * @r		: Changed leaf ranges, sorted and merged, modified in place
+ * @n		: Number of ranges
+ * @ret		: number of interior nodes written, -1 on error
+ */
+static long update_tree(int fd, const struct manifest_hdr *mh,
+		struct range *r, size_t n)
+{
+	unsigned char *children = NULL;
+	unsigned char *nodes = NULL;
+	const uint32_t ds = mh->digest_size;
+	const uint32_t f = mh->fanout;
+	uint64_t p, batch, first, nchild, j;
+	long written = 0;
+	uint32_t k;
+	size_t i;
+
+	children = malloc((size_t)TREE_BATCH * f * ds);
+	nodes = malloc((size_t)TREE_BATCH * ds);
+	if (!children || !nodes) {
 		fprintf(stderr, "Failed to allocate memory.\n");
 		goto err;
 	}
-	memset(buf1, 0x00, BUF_SIZE);
-	buf2 = (unsigned char *)malloc(BUF_SIZE);
-	if (!buf2) {
+
+	for (k = 1; k < mh->levels; k++) {
+		// Parents of the changed nodes of level k - 1
+		for (i = 0; i < n; i++) {
+			first = r[i].start / f;
+			r[i].count = (r[i].start + r[i].count - 1) / f - first + 1;
+			r[i].start = first;
+		}
+		n = merge_ranges(r, n);
+
+		for (i = 0; i < n; i++) {
+			for (p = r[i].start; p < r[i].start + r[i].count;
+					p += batch) {
+				batch = r[i].start + r[i].count - p;
+				if (batch > TREE_BATCH)
+					batch = TREE_BATCH;
+
+				first = p * f;
+				nchild = mh->level_nodes[k - 1] - first;
+				if (nchild > batch * f)
+					nchild = batch * f;
+
+				if (blkio_pread_full(fd, children, nchild * ds,
+						mh->level_off[k - 1] + first * ds)
+						!= (ssize_t)(nchild * ds)) {
+					fprintf(stderr, "Manifest is truncated.\n");
+					goto err;
+				}
+				for (j = 0; j < batch; j++) {
+					uint64_t c = nchild - j * f;
+
+					if (c > f)
+						c = f;
+					encode_digest(nodes + j * ds,
+							children + j * f * ds,
+							c * ds, ds);
+				}
+				if (blkio_pwrite_full(fd, nodes, batch * ds,
+						mh->level_off[k] + p * ds) < 0) {
+					fprintf(stderr, "Failed to write manifest.\n");
+					goto err;
+				}
+				written += batch;
+			}
+		}
+	}
+
+	free(children);
+	free(nodes);
+	return written;
+
+err:
+	free(children);
+	free(nodes);
+	return -1;
+}
+
+/**
+ * zero_digest() - Fingerprint of a block of zeros, used for holes
+ */
+static int zero_digest(unsigned char *p, int digest_size)
+{
+	unsigned char *zero;
+
+	zero = (unsigned char *)calloc(1, block_size);
+	if (!zero) {
+		fprintf(stderr, "Failed to allocate memory.\n");
+		return -1;
+	}
+	encode_digest(p, zero, block_size, digest_size);
+	free(zero);
+	return 0;
+}
+
+/**
+ * write_manifest() - Write per block fingerprints of a device to a file
+ *
+ * The manifest is a 48 byte little endian header followed by one
+ * fingerprint of digest_size bytes for every block of the device and
+ * the interior levels of the hash tree built over them. Holes and
+ * unmapped ranges are not read, they get the fingerprint of zeros.
+ *
+ * @manifest	: Output manifest filename
+ * @dev		: Device to fingerprint
+ * @hint	: Optional unmapped ranges of dev
+ * @digest_size	: 8 or 16 bytes per block
+ */
+int write_manifest(const char *manifest, const char *dev, const char *hint,
+		int digest_size)
+{
+	struct dev d = { .io.fd = -1 };
+	struct dev *devs[1] = { &d };
+	int mfd = -1;
+	unsigned char *buf = NULL;
+	unsigned char *digests = NULL;
+	unsigned char zero[BH_DIGEST_SIZE];
+	struct manifest_hdr mh;
+	struct range all;
+	uint64_t c, n, i;
+
+	if (dev_open(&d, dev, O_RDONLY, hint) < 0)
+		goto err;
+	fprintf(stdout, "Block device size: %llu\n",
+			(unsigned long long)d.blocks * (block_size / 512));
+
+	mfd = open(manifest, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (mfd < 0) {
+		fprintf(stderr, "Failed to create manifest file.\n");
+		goto err;
+	}
+
+	buf = blkio_alloc(BLKIO_ALIGN, MAX_READ_SIZE);
+	digests = (unsigned char *)malloc(BH_DIGEST_SIZE * max_read_blocks());
+	if (!buf || !digests) {
 		fprintf(stderr, "Failed to allocate memory.\n");
 		goto err;
 	}
-	memset(buf2, 0x00, BUF_SIZE);
+	if (zero_digest(zero, digest_size) < 0)
+		goto err;
 
-	fprintf(stdout, "Reading %lu blocks...\n", min);
+	memset(&mh, 0x00, sizeof(mh));
+	mh.version = MANIFEST_VERSION;
+	mh.block_size = block_size;
+	mh.blocks = d.blocks;
+	mh.dev_size = d.blocks * block_size;
+	mh.hash_type = MANIFEST_HASH;
+	mh.digest_size = digest_size;
+	mh.fanout = TREE_FANOUT;
+	mh.hdr_size = MANIFEST_HDR_SIZE;
+	mh.levels = tree_layout(&mh);
+	if (write_manifest_hdr(mfd, &mh) < 0) {
+		fprintf(stderr, "Failed to write manifest header.\n");
+		goto err;
+	}
 
-	for (c = 0; c < min; c++) {
-		memset(buf1, 0x00, BUF_SIZE);
-		memset(buf2, 0x00, BUF_SIZE);
+	tuner_init(devs, 1, 1);
+	fprintf(stdout, "Hashing %llu blocks (%s)...\n",
+			(unsigned long long)d.blocks, blockhash_impl());
+	progress_start(d.blocks, &d, NULL);
 
-		/* Read one block of data from both devices */
-		res = read(fd1, buf1, BUF_SIZE);
-		if (res < BUF_SIZE) {
-			fprintf(stdout, "End of first block device.\n");
-			break;
+	for (c = 0; c < d.blocks; c += n) {
+		if (dev_map(&d, c, &n)) {
+			if (n > read_blocks())
+				n = read_blocks();
+			if (dev_read(&d, buf, c, n)
+					< (ssize_t)(n * block_size)) {
+				fprintf(stderr, "Failed to read block device at "
+						"block number : %llu\n",
+						(unsigned long long)c);
+				goto err;
+			}
+			for (i = 0; i < n; i++) {
+				encode_digest(digests + i * digest_size,
+						buf + i * block_size, block_size,
+						digest_size);
+			}
+		} else {
+			if (n > read_blocks())
+				n = read_blocks();
+			for (i = 0; i < n; i++)
+				memcpy(digests + i * digest_size, zero,
+						digest_size);
 		}
-		res = read(fd2, buf2, BUF_SIZE);
-		if (res < BUF_SIZE) {
-			fprintf(stdout, "End of first block device.\n");
-			break;
+		if (blkio_pwrite_full(mfd, digests, n * digest_size,
+				mh.level_off[0] + c * digest_size) < 0) {
+			fprintf(stderr, "Failed to write manifest.\n");
+			goto err;
+		}
+		progress_update(n, 0);
+	}
+
+	// Build all interior levels of the hash tree
+	if (d.blocks > 0) {
+		all.start = 0;
+		all.count = d.blocks;
+		if (update_tree(mfd, &mh, &all, 1) < 0)
+			goto err;
+	}
+
+	if (close(mfd) != 0) {
+		mfd = -1;
+		fprintf(stderr, "Failed to write manifest.\n");
+		goto err;
+	}
+	fprintf(stdout, "Manifest written for %llu blocks (%u tree levels).\n",
+			(unsigned long long)d.blocks, mh.levels);
+	if (progress_summary(summary_file, "write", 0) < 0)
+		goto err;
+
+	free(buf);
+	free(digests);
+	dev_close(&d);
+	return EXIT_SUCCESS;
+
+err:
+	free(buf);
+	free(digests);
+	if (mfd >= 0)
+		close(mfd);
+	dev_close(&d);
+	return EXIT_ERROR;
+}
+
+/**
+ * check_manifest() - Compare a device against a saved manifest
+ *
+ * Only the device is read, each block is hashed and compared against
+ * the fingerprint recorded in the manifest. Holes and unmapped ranges
+ * are compared against the fingerprint of zeros without reading them.
+ *
+ * @manifest	: Manifest written by write_manifest()
+ * @dev		: Device to verify
+ * @hint	: Optional unmapped ranges of dev
+ */
+int check_manifest(const char *manifest, const char *dev, const char *hint)
+{
+	struct dev d = { .io.fd = -1 };
+	struct dev *devs[1] = { &d };
+	int mfd = -1;
+	struct manifest_hdr mh;
+	unsigned char *buf = NULL;
+	unsigned char *expected = NULL;
+	unsigned char digest[BH_DIGEST_SIZE];
+	unsigned char zero[BH_DIGEST_SIZE];
+	unsigned long differ = 0, chunk_differ;
+	uint64_t min, c, n, i;
+	int data;
+
+	mfd = open(manifest, O_RDONLY);
+	if (mfd < 0) {
+		fprintf(stderr, "Failed to open manifest file.\n");
+		goto err;
+	}
+	if (read_manifest_hdr(mfd, &mh) < 0)
+		goto err;
+	block_size = mh.block_size;
+
+	if (dev_open(&d, dev, O_RDONLY, hint) < 0)
+		goto err;
+	fprintf(stdout, "Manifest device size: %llu\n",
+			(unsigned long long)mh.blocks * (block_size / 512));
+	fprintf(stdout, "Block device size: %llu\n",
+			(unsigned long long)d.blocks * (block_size / 512));
+
+	min = d.blocks;
+	if (mh.blocks < min)
+		min = mh.blocks;
+
+	buf = blkio_alloc(BLKIO_ALIGN, MAX_READ_SIZE);
+	expected = (unsigned char *)malloc(BH_DIGEST_SIZE * max_read_blocks());
+	if (!buf || !expected) {
+		fprintf(stderr, "Failed to allocate memory.\n");
+		goto err;
+	}
+	if (zero_digest(zero, mh.digest_size) < 0)
+		goto err;
+
+	tuner_init(devs, 1, 1);
+	fprintf(stdout, "Reading %llu blocks (%s)...\n",
+			(unsigned long long)min, blockhash_impl());
+	progress_start(min, &d, NULL);
+
+	for (c = 0; c < min; c += n) {
+		data = dev_map(&d, c, &n);
+		if (n > min - c)
+			n = min - c;
+		if (n > read_blocks())
+			n = read_blocks();
+
+		if (blkio_pread_full(mfd, expected, n * mh.digest_size,
+				mh.level_off[0] + c * mh.digest_size)
+				!= (ssize_t)(n * mh.digest_size)) {
+			fprintf(stderr, "Manifest is truncated.\n");
+			goto err;
+		}
+		if (data && dev_read(&d, buf, c, n)
+				< (ssize_t)(n * block_size)) {
+			fprintf(stderr, "Failed to read block device at "
+					"block number : %llu\n",
+					(unsigned long long)c);
+			goto err;
+		}
+
+		for (i = 0, chunk_differ = 0; i < n; i++) {
+			if (data)
+				encode_digest(digest, buf + i * block_size,
+						block_size, mh.digest_size);
+			else
+				memcpy(digest, zero, mh.digest_size);
+			if (memcmp(digest, expected + i * mh.digest_size,
+						mh.digest_size) != 0) {
+				fprintf(stdout, "Block differ at block number : %llu\n",
+						(unsigned long long)(c + i));
+				chunk_differ++;
+			}
+		}
+		differ += chunk_differ;
+		progress_update(n, chunk_differ);
+	}
+
+	fprintf(stdout, "%lu blocks differ.\n", differ);
+	if (progress_summary(summary_file, "check", 0) < 0)
+		goto err;
+
+	free(buf);
+	free(expected);
+	close(mfd);
+	dev_close(&d);
+	return differ ? EXIT_DIFFER : EXIT_SUCCESS;
+
+err:
+	free(buf);
+	free(expected);
+	if (mfd >= 0)
+		close(mfd);
+	dev_close(&d);
+	return EXIT_ERROR;
+}
+
+// State of a top down comparison of two hash trees
+struct tree_diff {
+	int fd1, fd2;
+	const struct manifest_hdr *mh;
+	unsigned long nodes_read;	// Tree nodes read from each manifest
+	unsigned long differ;		// Number of differing blocks
+	uint64_t run_start;		// Current run of differing blocks
+	uint64_t run_count;
+};
+
+static void flush_run(struct tree_diff *td)
+{
+	if (td->run_count == 0)
+		return;
+	fprintf(stdout, "Blocks differ : %llu - %llu (%llu blocks)\n",
+			(unsigned long long)td->run_start,
+			(unsigned long long)(td->run_start + td->run_count - 1),
+			(unsigned long long)td->run_count);
+	td->run_count = 0;
+}
+
+static void add_differ(struct tree_diff *td, uint64_t block)
+{
+	if (td->run_count && td->run_start + td->run_count == block) {
+		td->run_count++;
+	} else {
+		flush_run(td);
+		td->run_start = block;
+		td->run_count = 1;
+	}
+	td->differ++;
+}
+
+/**
+ * diff_children() - Compare the children of a differing tree node
+ *
+ * Recurses only into children whose fingerprints differ, so identical
+ * subtrees are never read.
+ *
+ * @level	: Level of the differing node, > 0
+ * @index	: Index of the node inside its level
+ */
+static int diff_children(struct tree_diff *td, uint32_t level, uint64_t index)
+{
+	const struct manifest_hdr *mh = td->mh;
+	const uint32_t ds = mh->digest_size;
+	unsigned char c1[TREE_FANOUT * BH_DIGEST_SIZE];
+	unsigned char c2[TREE_FANOUT * BH_DIGEST_SIZE];
+	uint64_t first = index * mh->fanout;
+	uint64_t n = mh->level_nodes[level - 1] - first;
+	off_t off = mh->level_off[level - 1] + first * ds;
+	uint64_t i;
+
+	if (n > mh->fanout)
+		n = mh->fanout;
+
+	if (blkio_pread_full(td->fd1, c1, n * ds, off) != (ssize_t)(n * ds) ||
+			blkio_pread_full(td->fd2, c2, n * ds, off) != (ssize_t)(n * ds)) {
+		fprintf(stderr, "Manifest is truncated.\n");
+		return -1;
+	}
+	td->nodes_read += n;
+
+	for (i = 0; i < n; i++) {
+		if (memcmp(c1 + i * ds, c2 + i * ds, ds) == 0)
+			continue;
+		if (level == 1) {
+			add_differ(td, first + i);
+		} else if (diff_children(td, level - 1, first + i) < 0) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * diff_manifests() - Compare two manifests through their hash trees
+ *
+ * Starting at the roots only the subtrees with differing fingerprints are
+ * descended, finding the differing block ranges in O(differences * log N)
+ * manifest reads without touching either device.
+ */
+int diff_manifests(const char *manifest1, const char *manifest2)
+{
+	struct manifest_hdr mh1, mh2;
+	struct tree_diff td;
+	unsigned char r1[BH_DIGEST_SIZE], r2[BH_DIGEST_SIZE];
+	uint32_t top;
+
+	memset(&td, 0x00, sizeof(td));
+	td.fd2 = -1;
+	td.fd1 = open(manifest1, O_RDONLY);
+	if (td.fd1 < 0) {
+		fprintf(stderr, "Failed to open first manifest file.\n");
+		goto err;
+	}
+	td.fd2 = open(manifest2, O_RDONLY);
+	if (td.fd2 < 0) {
+		fprintf(stderr, "Failed to open second manifest file.\n");
+		goto err;
+	}
+	if (read_manifest_hdr(td.fd1, &mh1) < 0 ||
+			read_manifest_hdr(td.fd2, &mh2) < 0)
+		goto err;
+
+	if (mh1.version < 2 || mh2.version < 2) {
+		fprintf(stderr, "Manifest has no hash tree, rewrite it with -w.\n");
+		goto err;
+	}
+	if (mh1.blocks != mh2.blocks || mh1.block_size != mh2.block_size ||
+			mh1.hash_type != mh2.hash_type ||
+			mh1.digest_size != mh2.digest_size ||
+			mh1.fanout != mh2.fanout) {
+		fprintf(stderr, "Manifests differ in size, block size, hash or "
+				"tree geometry.\n");
+		goto err;
+	}
+	td.mh = &mh1;
+
+	fprintf(stdout, "Comparing %llu blocks (%u tree levels)...\n",
+			(unsigned long long)mh1.blocks, mh1.levels);
+
+	top = mh1.levels - 1;
+	if (mh1.blocks > 0) {
+		if (blkio_pread_full(td.fd1, r1, mh1.digest_size, mh1.level_off[top])
+				!= (ssize_t)mh1.digest_size ||
+				blkio_pread_full(td.fd2, r2, mh1.digest_size,
+					mh1.level_off[top])
+				!= (ssize_t)mh1.digest_size) {
+			fprintf(stderr, "Manifest is truncated.\n");
+			goto err;
 		}
+		td.nodes_read = 1;
+
+		if (memcmp(r1, r2, mh1.digest_size) != 0) {
+			if (top == 0)
+				add_differ(&td, 0);
+			else if (diff_children(&td, top, 0) < 0)
+				goto err;
+		}
+	}
+	flush_run(&td);
+
+	fprintf(stdout, "%lu blocks differ (%lu tree nodes read).\n",
+			td.differ, td.nodes_read);
 
-		/* Compare blocks */
-		res = memcmp(buf1, buf2, BUF_SIZE);
-		if (res != 0) {
-			fprintf(stdout, "Block differ at block number : %lu\n", c);
+	close(td.fd1);
+	close(td.fd2);
+	return td.differ ? EXIT_DIFFER : EXIT_SUCCESS;
+
+err:
+	if (td.fd1 >= 0)
+		close(td.fd1);
+	if (td.fd2 >= 0)
+		close(td.fd2);
+	return EXIT_ERROR;
+}
+
+/**
+ * refresh_manifest() - Rehash changed blocks and update the hash tree
+ *
+ * Only the blocks listed in the changed block list are read from the
+ * device, their leaves and all interior nodes above them are rewritten
+ * in place.
+ *
+ * @manifest	: Manifest with a hash tree, updated in place
+ * @dev		: Device the manifest was written for
+ * @range_file	: Changed block list, see read_ranges()
+ */
+int refresh_manifest(const char *manifest, const char *dev,
+		const char *range_file)
+{
+	struct dev d = { .io.fd = -1 };
+	struct dev *devs[1] = { &d };
+	int mfd = -1;
+	struct manifest_hdr mh;
+	struct range *r = NULL;
+	unsigned char *buf = NULL;
+	unsigned char *digests = NULL;
+	unsigned long refreshed = 0;
+	uint64_t c, n, i;
+	ssize_t nr, j;
+	long nodes;
+
+	mfd = open(manifest, O_RDWR);
+	if (mfd < 0) {
+		fprintf(stderr, "Failed to open manifest file.\n");
+		goto err;
+	}
+	if (read_manifest_hdr(mfd, &mh) < 0)
+		goto err;
+	if (mh.version < 2) {
+		fprintf(stderr, "Manifest has no hash tree, rewrite it with -w.\n");
+		goto err;
+	}
+	block_size = mh.block_size;
+
+	if (dev_open(&d, dev, O_RDONLY, NULL) < 0)
+		goto err;
+	if (d.blocks != mh.blocks) {
+		fprintf(stderr, "Device size changed, rewrite the manifest with -w.\n");
+		goto err;
+	}
+
+	nr = read_ranges(range_file, mh.blocks, &r);
+	if (nr < 0)
+		goto err;
+
+	buf = blkio_alloc(BLKIO_ALIGN, MAX_READ_SIZE);
+	digests = (unsigned char *)malloc(BH_DIGEST_SIZE * max_read_blocks());
+	if (!buf || !digests) {
+		fprintf(stderr, "Failed to allocate memory.\n");
+		goto err;
+	}
+
+	tuner_init(devs, 1, 1);
+	progress_start(0, &d, NULL);
+	for (j = 0; j < nr; j++)
+		progress.total += r[j].count;
+
+	for (j = 0; j < nr; j++) {
+		for (c = r[j].start; c < r[j].start + r[j].count; c += n) {
+			n = r[j].start + r[j].count - c;
+			if (n > read_blocks())
+				n = read_blocks();
+
+			if (dev_read(&d, buf, c, n)
+					< (ssize_t)(n * block_size)) {
+				fprintf(stderr, "Failed to read block device at "
+						"block number : %llu\n",
+						(unsigned long long)c);
+				goto err;
+			}
+			for (i = 0; i < n; i++) {
+				encode_digest(digests + i * mh.digest_size,
+						buf + i * block_size, block_size,
+						mh.digest_size);
+			}
+			if (blkio_pwrite_full(mfd, digests, n * mh.digest_size,
+					mh.level_off[0] + c * mh.digest_size) < 0) {
+				fprintf(stderr, "Failed to write manifest.\n");
+				goto err;
+			}
+			refreshed += n;
+			progress_update(n, 0);
 		}
 	}
 
-	if (buf1)
-		free(buf1);
-	if (buf2)
-		free(buf2);
-	if (fd1 > 0)
-		close(fd1);
-	if (fd2 > 0)
-		close(fd2);
+	nodes = update_tree(mfd, &mh, r, nr);
+	if (nodes < 0)
+		goto err;
+
+	if (close(mfd) != 0) {
+		mfd = -1;
+		fprintf(stderr, "Failed to write manifest.\n");
+		goto err;
+	}
+	fprintf(stdout, "Refreshed %lu blocks and %ld tree nodes.\n",
+			refreshed, nodes);
+	if (progress_summary(summary_file, "refresh", 0) < 0)
+		goto err;
 
+	free(r);
+	free(buf);
+	free(digests);
+	dev_close(&d);
 	return EXIT_SUCCESS;
 
 err:
-	if (buf1)
-		free(buf1);
-	if (buf2)
-		free(buf2);
-	if (fd1 > 0)
-		close(fd1);
-	if (fd2 > 0)
-		close(fd2);
-
-	return EXIT_FAILURE;
+	free(r);
+	free(buf);
+	free(digests);
+	if (mfd >= 0)
+		close(mfd);
+	dev_close(&d);
+	return EXIT_ERROR;
 }
@@ -0,0 +1,282 @@
+/*
+ * blockhash - Fast non-cryptographic block fingerprints
+ *
+ * Written in 2026 by the blockcompare contributors
+ *
+ * To the extent possible under law, the author(s) have dedicated
+ * all copyright and related and neighboring rights to this software
+ * to the public domain worldwide. This software is distributed
+ * without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication
+ * along with this software.
+ * If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+/*
+ * The hash follows the layout of the xxHash3 long input loop: the block
+ * is consumed in 64 byte stripes by 8 independent 64 bit accumulators
+ * using only 32x32->64 multiplies, so the same arithmetic maps directly
+ * on to AVX2 lanes. The accumulators are scrambled every 16 stripes and
+ * folded into two independent 64 bit halves at the end. The scalar and
+ * the AVX2 code produce bit identical results, so manifests written on
+ * one machine can be checked on any other.
+ */
+
+#include <string.h>
+#include <endian.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BH_HAVE_AVX2	1
+#endif
+
+#include "blockhash.h"
+
+#define BH_STRIPE_LEN		64	/* Bytes consumed per accumulate step */
+#define BH_STRIPES_PER_ROUND	16	/* Stripes between two scrambles */
+#define BH_LANES		8	/* Number of 64 bit accumulators */
+
+#define PRIME32_1	0x9E3779B1U
+#define PRIME32_2	0x85EBCA77U
+#define PRIME32_3	0xC2B2AE3DU
+#define PRIME64_1	0x9E3779B185EBCA87ULL
+#define PRIME64_2	0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3	0x165667B19E3779F9ULL
+#define PRIME64_4	0x85EBCA77C2B2AE63ULL
+#define PRIME64_5	0x27D4EB2F165667C5ULL
+
+// Per stripe keys, stripe n uses bh_key[n % 16 .. n % 16 + 7]
+static const uint64_t bh_key[24] = {
+	0xb3315ad89407e6c3ULL, 0xa977c1a57d89ce24ULL, 0xe6b33c3aa102a941ULL,
+	0xa63e4075a580e514ULL, 0x74d5a45e3827fb3fULL, 0x1d1525d2570e60d6ULL,
+	0x2bbbf1318a79a0a9ULL, 0xbe1e4ffcb39ac6fbULL, 0x5b33921e2cde1b9cULL,
+	0xc0aacef72266371dULL, 0xf51ac6a2d3808a1aULL, 0x12e2ddf4742c2c37ULL,
+	0x51030812d526028bULL, 0x2dfafb9f3fdc4794ULL, 0x5994d00d234e15d9ULL,
+	0xfd11614d55d6273eULL, 0xd79f0744a3bc1bebULL, 0xd41c726a6c337c57ULL,
+	0x2a92d9b75eebad4cULL, 0x34a8a35a3ba9c8b2ULL, 0xb9295e1d72d94761ULL,
+	0x9340a26f076832aeULL, 0x0ebf27f82eda6af6ULL, 0xd89f0a74b74e82fbULL,
+};
+
+typedef void (*accumulate_fn)(uint64_t *acc, const unsigned char *p,
+		size_t nstripes);
+
+static accumulate_fn accumulate;
+static const char *accumulate_name;
+
+static inline uint64_t read_le64(const unsigned char *p)
+{
+	uint64_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return le64toh(v);
+}
+
+/**
+ * accumulate_stripe() - Mix one 64 byte stripe into the accumulators
+ *
+ * @acc		: Accumulators
+ * @p		: Stripe data
+ * @s		: Stripe index inside the current round
+ */
+static inline void accumulate_stripe(uint64_t *acc, const unsigned char *p,
+		unsigned int s)
+{
+	uint64_t d, dk;
+	int i;
+
+	for (i = 0; i < BH_LANES; i++) {
+		d = read_le64(p + 8 * i);
+		dk = d ^ bh_key[s + i];
+		acc[i ^ 1] += d;
+		acc[i] += (dk & 0xFFFFFFFFULL) * (dk >> 32);
+	}
+}
+
+static inline void scramble(uint64_t *acc)
+{
+	int i;
+
+	for (i = 0; i < BH_LANES; i++) {
+		acc[i] ^= acc[i] >> 47;
+		acc[i] ^= bh_key[BH_STRIPES_PER_ROUND + i];
+		acc[i] *= PRIME32_1;
+	}
+}
+
+static void accumulate_scalar(uint64_t *acc, const unsigned char *p,
+		size_t nstripes)
+{
+	size_t n;
+	unsigned int s;
+
+	for (n = 0; n < nstripes; n++, p += BH_STRIPE_LEN) {
+		s = n % BH_STRIPES_PER_ROUND;
+		accumulate_stripe(acc, p, s);
+		if (s == BH_STRIPES_PER_ROUND - 1)
+			scramble(acc);
+	}
+}
+
+#ifdef BH_HAVE_AVX2
+__attribute__((target("avx2")))
+static void accumulate_avx2(uint64_t *acc, const unsigned char *p,
+		size_t nstripes)
+{
+	__m256i a0, a1, d0, d1, k0, k1, m0, m1;
+	const __m256i prime = _mm256_set1_epi32(PRIME32_1);
+	const __m256i sk0 = _mm256_loadu_si256((const __m256i *)
+			(bh_key + BH_STRIPES_PER_ROUND));
+	const __m256i sk1 = _mm256_loadu_si256((const __m256i *)
+			(bh_key + BH_STRIPES_PER_ROUND + 4));
+	size_t n;
+	unsigned int s;
+
+	a0 = _mm256_loadu_si256((const __m256i *)acc);
+	a1 = _mm256_loadu_si256((const __m256i *)(acc + 4));
+
+	for (n = 0; n < nstripes; n++, p += BH_STRIPE_LEN) {
+		s = n % BH_STRIPES_PER_ROUND;
+
+		d0 = _mm256_loadu_si256((const __m256i *)p);
+		d1 = _mm256_loadu_si256((const __m256i *)(p + 32));
+		k0 = _mm256_xor_si256(d0, _mm256_loadu_si256(
+					(const __m256i *)(bh_key + s)));
+		k1 = _mm256_xor_si256(d1, _mm256_loadu_si256(
+					(const __m256i *)(bh_key + s + 4)));
+
+		// acc[i] += lo32(dk) * hi32(dk)
+		m0 = _mm256_mul_epu32(k0, _mm256_srli_epi64(k0, 32));
+		m1 = _mm256_mul_epu32(k1, _mm256_srli_epi64(k1, 32));
+
+		// acc[i ^ 1] += d, swapping 64 bit neighbours
+		d0 = _mm256_shuffle_epi32(d0, _MM_SHUFFLE(1, 0, 3, 2));
+		d1 = _mm256_shuffle_epi32(d1, _MM_SHUFFLE(1, 0, 3, 2));
+		a0 = _mm256_add_epi64(a0, _mm256_add_epi64(d0, m0));
+		a1 = _mm256_add_epi64(a1, _mm256_add_epi64(d1, m1));
+
+		if (s != BH_STRIPES_PER_ROUND - 1)
+			continue;
+
+		a0 = _mm256_xor_si256(a0, _mm256_srli_epi64(a0, 47));
+		a1 = _mm256_xor_si256(a1, _mm256_srli_epi64(a1, 47));
+		a0 = _mm256_xor_si256(a0, sk0);
+		a1 = _mm256_xor_si256(a1, sk1);
+
+		// 64 bit multiply by a 32 bit constant from two 32x32 products
+		a0 = _mm256_add_epi64(_mm256_mul_epu32(a0, prime),
+				_mm256_slli_epi64(_mm256_mul_epu32(
+					_mm256_srli_epi64(a0, 32), prime), 32));
+		a1 = _mm256_add_epi64(_mm256_mul_epu32(a1, prime),
+				_mm256_slli_epi64(_mm256_mul_epu32(
+					_mm256_srli_epi64(a1, 32), prime), 32));
+	}
+
+	_mm256_storeu_si256((__m256i *)acc, a0);
+	_mm256_storeu_si256((__m256i *)(acc + 4), a1);
+}
+#endif
+
+__attribute__((constructor))
+static void blockhash_init(void)
+{
+	accumulate = accumulate_scalar;
+	accumulate_name = "scalar";
+#ifdef BH_HAVE_AVX2
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		accumulate = accumulate_avx2;
+		accumulate_name = "avx2";
+	}
+#endif
+}
+
+static inline uint64_t mul128_fold64(uint64_t a, uint64_t b)
+{
+	__uint128_t r = (__uint128_t)a * b;
+
+	return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+static inline uint64_t avalanche(uint64_t h)
+{
+	h ^= h >> 37;
+	h *= 0x165667919E3779F9ULL;
+	h ^= h >> 32;
+	return h;
+}
+
+static uint64_t merge(const uint64_t *acc, int key_offset, uint64_t start)
+{
+	uint64_t r = start;
+	int i;
+
+	for (i = 0; i < BH_LANES; i += 2) {
+		r += mul128_fold64(acc[i] ^ bh_key[key_offset + i],
+				acc[i + 1] ^ bh_key[key_offset + i + 1]);
+	}
+	return avalanche(r);
+}
+
+static void hash_long(const void *buf, size_t len, uint64_t *acc)
+{
+	const unsigned char *p = buf;
+	unsigned char last[BH_STRIPE_LEN];
+	size_t nstripes = len / BH_STRIPE_LEN;
+	size_t tail = len % BH_STRIPE_LEN;
+
+	acc[0] = PRIME32_3;
+	acc[1] = PRIME64_1;
+	acc[2] = PRIME64_2;
+	acc[3] = PRIME64_3;
+	acc[4] = PRIME64_4;
+	acc[5] = PRIME32_2;
+	acc[6] = PRIME64_5;
+	acc[7] = PRIME32_1;
+
+	accumulate(acc, p, nstripes);
+
+	// Zero pad the partial stripe, the length is mixed in by merge()
+	if (tail) {
+		memset(last, 0x00, sizeof(last));
+		memcpy(last, p + nstripes * BH_STRIPE_LEN, tail);
+		accumulate_stripe(acc, last, nstripes % BH_STRIPES_PER_ROUND);
+	}
+}
+
+/**
+ * blockhash() - Compute the 128 bit fingerprint of a buffer
+ *
+ * @buf		: Data to hash
+ * @len		: Length of data in bytes
+ * @digest	: Resulting fingerprint
+ */
+void blockhash(const void *buf, size_t len, struct bh_digest *digest)
+{
+	uint64_t acc[BH_LANES];
+
+	hash_long(buf, len, acc);
+	digest->lo = merge(acc, 0, len * PRIME64_1);
+	digest->hi = merge(acc, BH_LANES, ~(len * PRIME64_2));
+}
+
+/**
+ * blockhash64() - Compute the 64 bit fingerprint of a buffer
+ *
+ * The result is equal to the low half of the blockhash() digest.
+ */
+uint64_t blockhash64(const void *buf, size_t len)
+{
+	uint64_t acc[BH_LANES];
+
+	hash_long(buf, len, acc);
+	return merge(acc, 0, len * PRIME64_1);
+}
+
+/**
+ * blockhash_impl() - Name of the accumulate loop selected for this CPU
+ */
+const char *blockhash_impl(void)
+{
+	return accumulate_name;
+}
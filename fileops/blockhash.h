@@ -0,0 +1,34 @@
+/*
+ * blockhash - Fast non-cryptographic block fingerprints
+ *
+ * Written in 2026 by the blockcompare contributors
+ *
+ * To the extent possible under law, the author(s) have dedicated
+ * all copyright and related and neighboring rights to this software
+ * to the public domain worldwide. This software is distributed
+ * without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication
+ * along with this software.
+ * If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+#ifndef BLOCKHASH_H
+#define BLOCKHASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define BH_DIGEST_SIZE	16	/* Size of a full digest in bytes */
+
+// 128 bit block fingerprint, the low half is the 64 bit fingerprint
+struct bh_digest {
+	uint64_t lo;
+	uint64_t hi;
+};
+
+void blockhash(const void *buf, size_t len, struct bh_digest *digest);
+uint64_t blockhash64(const void *buf, size_t len);
+const char *blockhash_impl(void);
+
+#endif // BLOCKHASH_H
@@ -0,0 +1,537 @@
+/*
+ * blockio - Block device and image file I/O shared by the tools
+ *
+ * Written in 2026 by the blockcompare contributors
+ *
+ * To the extent possible under law, the author(s) have dedicated
+ * all copyright and related and neighboring rights to this software
+ * to the public domain worldwide. This software is distributed
+ * without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication
+ * along with this software.
+ * If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+/*
+ * Every read of a device goes through blkio_pread() or blkio_preadv(),
+ * which retry short and interrupted reads until the buffer is full or
+ * the end of the device is reached, and account the request in the
+ * statistics of the handle. The functions do not print anything, they
+ * return -1 with errno set and leave the message to the tool.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+
+#include "blockio.h"
+
+#define BLKIO_IOV_MAX		64	/* Largest vector read with preadv() */
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * blkio_open() - Open a block device or a regular image file
+ *
+ * The size comes from BLKGETSIZE64 for block devices and from fstat()
+ * for image files, together with the sector and I/O sizes the device
+ * reports. Other kinds of files fail with ENOTBLK.
+ *
+ * @flags	: open() flags, O_DIRECT is set with blkio_set_direct()
+ *
+ * Return: 0 on success, -1 on error
+ */
+int blkio_open(struct blkio *b, const char *path, int flags)
+{
+	struct stat st;
+	int err;
+
+	memset(b, 0x00, sizeof(*b));
+	b->path = path;
+	b->fd = open(path, flags & ~O_DIRECT);
+	if (b->fd < 0)
+		return -1;
+	if (fstat(b->fd, &st) < 0)
+		goto err;
+
+	if (S_ISBLK(st.st_mode)) {
+		if (ioctl(b->fd, BLKGETSIZE64, &b->size) < 0)
+			goto err;
+		ioctl(b->fd, BLKSSZGET, &b->sector_size);
+		ioctl(b->fd, BLKIOMIN, &b->io_min);
+		ioctl(b->fd, BLKIOOPT, &b->io_opt);
+	} else if (S_ISREG(st.st_mode)) {
+		b->size = st.st_size;
+		b->is_reg = 1;
+		b->io_min = st.st_blksize;
+	} else {
+		errno = ENOTBLK;
+		goto err;
+	}
+	if (b->sector_size == 0)
+		b->sector_size = 512;
+	b->align = b->is_reg ? BLKIO_ALIGN : b->sector_size;
+	return 0;
+
+err:
+	err = errno;
+	close(b->fd);
+	b->fd = -1;
+	errno = err;
+	return -1;
+}
+
+void blkio_close(struct blkio *b)
+{
+	if (b->fd >= 0)
+		close(b->fd);
+	b->fd = -1;
+}
+
+/**
+ * blkio_set_direct() - Turn O_DIRECT on or off
+ *
+ * Unaligned reads still work with O_DIRECT, they go through an aligned
+ * bounce buffer. Fails with EINVAL on file systems without O_DIRECT.
+ */
+int blkio_set_direct(struct blkio *b, int on)
+{
+	int fl;
+
+	fl = fcntl(b->fd, F_GETFL);
+	if (fl < 0)
+		return -1;
+	fl = on ? fl | O_DIRECT : fl & ~O_DIRECT;
+	if (fcntl(b->fd, F_SETFL, fl) < 0)
+		return -1;
+	b->direct = on;
+	return 0;
+}
+
+/**
+ * blkio_advise() - Set the read ahead policy of the kernel for the handle
+ *
+ * Sequential doubles the read ahead window of the page cache, random
+ * turns it off for tools that do their own read ahead.
+ */
+int blkio_advise(struct blkio *b, enum blkio_policy policy)
+{
+	static const int advice[] = {
+		[BLKIO_RA_NORMAL] = POSIX_FADV_NORMAL,
+		[BLKIO_RA_SEQUENTIAL] = POSIX_FADV_SEQUENTIAL,
+		[BLKIO_RA_RANDOM] = POSIX_FADV_RANDOM,
+	};
+	int err;
+
+	err = posix_fadvise(b->fd, 0, 0, advice[policy]);
+	if (err) {
+		errno = err;
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * blkio_prefetch() - Start reading a range into the page cache
+ *
+ * Returns at once, a later blkio_pread() of the range then finds it in
+ * memory. Does nothing with O_DIRECT.
+ */
+void blkio_prefetch(struct blkio *b, uint64_t off, uint64_t len)
+{
+	if (!b->direct && len > 0)
+		posix_fadvise(b->fd, off, len, POSIX_FADV_WILLNEED);
+}
+
+/**
+ * read_loop() - Read until the buffer is full or end of device
+ *
+ * @s		: Statistics that count retries, or NULL
+ * @calls	: Number of pread() calls that returned data
+ *
+ * Return: Number of bytes read, -1 on error
+ */
+static ssize_t read_loop(int fd, void *buf, size_t len, off_t off,
+		struct blkio_stats *s, unsigned int *calls)
+{
+	size_t done = 0;
+	ssize_t res;
+
+	*calls = 0;
+	while (done < len) {
+		res = pread(fd, (unsigned char *)buf + done, len - done,
+				off + done);
+		if (res < 0) {
+			if (errno != EINTR)
+				return -1;
+			if (s)
+				__atomic_fetch_add(&s->retries, 1, __ATOMIC_RELAXED);
+			continue;
+		}
+		if (res == 0)
+			break;
+		done += res;
+		(*calls)++;
+	}
+	return done;
+}
+
+// Add a finished request to the statistics
+static void account(struct blkio *b, ssize_t res, unsigned int calls,
+		uint64_t ns)
+{
+	struct blkio_stats *s = &b->stats;
+
+	__atomic_fetch_add(&s->reads, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&s->ns, ns, __ATOMIC_RELAXED);
+	if (res < 0)
+		__atomic_fetch_add(&s->errors, 1, __ATOMIC_RELAXED);
+	else
+		__atomic_fetch_add(&s->bytes, res, __ATOMIC_RELAXED);
+	if (calls > 1)
+		__atomic_fetch_add(&s->short_reads, 1, __ATOMIC_RELAXED);
+	blkio_lat_add(&s->lat, ns);
+}
+
+static inline int is_aligned(const struct blkio *b, const void *buf,
+		size_t len, uint64_t off)
+{
+	return (((uintptr_t)buf | len | off) & (b->align - 1)) == 0;
+}
+
+/**
+ * bounce_read() - Unaligned read with O_DIRECT
+ *
+ * The range is widened to whole sectors and read into an aligned buffer,
+ * the part asked for is copied out.
+ */
+static ssize_t bounce_read(struct blkio *b, void *buf, size_t len,
+		uint64_t off, unsigned int *calls)
+{
+	uint64_t start = off & ~(uint64_t)(b->align - 1);
+	uint64_t end = (off + len + b->align - 1) & ~(uint64_t)(b->align - 1);
+	unsigned char *tmp;
+	ssize_t res;
+
+	*calls = 0;
+	tmp = blkio_alloc(b->align, end - start);
+	if (!tmp)
+		return -1;
+	res = read_loop(b->fd, tmp, end - start, start, &b->stats, calls);
+	if (res >= 0) {
+		res = (uint64_t)res > off - start ? res - (off - start) : 0;
+		if ((size_t)res > len)
+			res = len;
+		memcpy(buf, tmp + (off - start), res);
+	}
+	free(tmp);
+	__atomic_fetch_add(&b->stats.bounced, 1, __ATOMIC_RELAXED);
+	return res;
+}
+
+/**
+ * blkio_pread() - Read from the device, retrying short reads
+ *
+ * Return: Number of bytes read, less than len only at the end of the
+ *	   device, -1 on error
+ */
+ssize_t blkio_pread(struct blkio *b, void *buf, size_t len, uint64_t off)
+{
+	uint64_t t = now_ns();
+	unsigned int calls;
+	ssize_t res;
+
+	if (b->direct && !is_aligned(b, buf, len, off))
+		res = bounce_read(b, buf, len, off, &calls);
+	else
+		res = read_loop(b->fd, buf, len, off, &b->stats, &calls);
+	account(b, res, calls, now_ns() - t);
+	return res;
+}
+
+/**
+ * blkio_preadv() - Read into several buffers, retrying short reads
+ *
+ * After a short read the vector is advanced past the bytes read and the
+ * rest is asked for again. Vectors longer than BLKIO_IOV_MAX, and
+ * unaligned ones with O_DIRECT, are read one buffer at a time.
+ *
+ * Return: Number of bytes read, -1 on error
+ */
+ssize_t blkio_preadv(struct blkio *b, const struct iovec *iov, int iovcnt,
+		uint64_t off)
+{
+	struct iovec v[BLKIO_IOV_MAX];
+	uint64_t t;
+	size_t done = 0, total = 0;
+	unsigned int calls = 0;
+	ssize_t res;
+	int i, aligned = 1;
+
+	for (i = 0; i < iovcnt; i++) {
+		total += iov[i].iov_len;
+		if (b->direct && !is_aligned(b, iov[i].iov_base,
+					iov[i].iov_len, off))
+			aligned = 0;
+	}
+	if (iovcnt > BLKIO_IOV_MAX || !aligned) {
+		for (i = 0; i < iovcnt; i++) {
+			res = blkio_pread(b, iov[i].iov_base, iov[i].iov_len,
+					off + done);
+			if (res < 0)
+				return -1;
+			done += res;
+			if ((size_t)res < iov[i].iov_len)
+				break;
+		}
+		return done;
+	}
+
+	t = now_ns();
+	memcpy(v, iov, iovcnt * sizeof(*iov));
+	i = 0;
+	while (done < total) {
+		res = preadv(b->fd, v + i, iovcnt - i, off + done);
+		if (res < 0) {
+			if (errno == EINTR) {
+				__atomic_fetch_add(&b->stats.retries, 1,
+						__ATOMIC_RELAXED);
+				continue;
+			}
+			account(b, -1, calls, now_ns() - t);
+			return -1;
+		}
+		if (res == 0)
+			break;
+		done += res;
+		calls++;
+		while (i < iovcnt && (size_t)res >= v[i].iov_len)
+			res -= v[i++].iov_len;
+		if (i < iovcnt) {
+			v[i].iov_base = (unsigned char *)v[i].iov_base + res;
+			v[i].iov_len -= res;
+		}
+	}
+	account(b, done, calls, now_ns() - t);
+	return done;
+}
+
+int blkio_pwrite(struct blkio *b, const void *buf, size_t len, uint64_t off)
+{
+	return blkio_pwrite_full(b->fd, buf, len, off);
+}
+
+/**
+ * blkio_pread_full() - Read from any file until the buffer is full or
+ * end of file, for files that have no handle, e.g. manifests
+ *
+ * Return: Number of bytes read, -1 on error
+ */
+ssize_t blkio_pread_full(int fd, void *buf, size_t len, off_t off)
+{
+	unsigned int calls;
+
+	return read_loop(fd, buf, len, off, NULL, &calls);
+}
+
+/**
+ * blkio_pwrite_full() - Write the whole buffer at offset
+ *
+ * Return: 0 on success, -1 on error
+ */
+int blkio_pwrite_full(int fd, const void *buf, size_t len, off_t off)
+{
+	size_t done = 0;
+	ssize_t res;
+
+	while (done < len) {
+		res = pwrite(fd, (const unsigned char *)buf + done, len - done,
+				off + done);
+		if (res < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (res == 0) {
+			errno = EIO;
+			return -1;
+		}
+		done += res;
+	}
+	return 0;
+}
+
+/**
+ * blkio_alloc() - Allocate an aligned buffer, to be freed with free()
+ *
+ * @align	: Power of two, e.g. blkio.align, BLKIO_ALIGN is always enough
+ */
+void *blkio_alloc(size_t align, size_t len)
+{
+	void *p;
+
+	if (align < sizeof(void *))
+		align = sizeof(void *);
+	if (posix_memalign(&p, align, len ? len : 1) != 0) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	return p;
+}
+
+/**
+ * blkio_pool_init() - Allocate count buffers of size bytes
+ *
+ * All buffers are carved out of one aligned allocation, the size is
+ * rounded up to the alignment so every buffer is aligned.
+ */
+int blkio_pool_init(struct blkio_pool *p, size_t size, unsigned int count,
+		size_t align)
+{
+	unsigned int i;
+
+	memset(p, 0x00, sizeof(*p));
+	if (align < sizeof(void *))
+		align = sizeof(void *);
+	p->size = (size + align - 1) / align * align;
+	p->count = count;
+	p->mem = blkio_alloc(align, p->size * count);
+	p->free = calloc(count ? count : 1, sizeof(*p->free));
+	if (!p->mem || !p->free) {
+		free(p->mem);
+		free(p->free);
+		errno = ENOMEM;
+		return -1;
+	}
+	for (i = 0; i < count; i++)
+		p->free[i] = p->mem + (size_t)i * p->size;
+	p->nfree = count;
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_cond_init(&p->cond, NULL);
+	return 0;
+}
+
+// Take a buffer, waiting for one to be put back if none is free
+void *blkio_pool_get(struct blkio_pool *p)
+{
+	void *buf;
+
+	pthread_mutex_lock(&p->lock);
+	while (p->nfree == 0)
+		pthread_cond_wait(&p->cond, &p->lock);
+	buf = p->free[--p->nfree];
+	pthread_mutex_unlock(&p->lock);
+	return buf;
+}
+
+void blkio_pool_put(struct blkio_pool *p, void *buf)
+{
+	pthread_mutex_lock(&p->lock);
+	p->free[p->nfree++] = buf;
+	pthread_cond_signal(&p->cond);
+	pthread_mutex_unlock(&p->lock);
+}
+
+void blkio_pool_destroy(struct blkio_pool *p)
+{
+	if (!p->mem)
+		return;
+	pthread_mutex_destroy(&p->lock);
+	pthread_cond_destroy(&p->cond);
+	free(p->mem);
+	free(p->free);
+	p->mem = NULL;
+	p->free = NULL;
+}
+
+/**
+ * blkio_lat_add() - Add one latency sample to the histogram
+ *
+ * Buckets are exact below 8 ns, above that each power of two is split
+ * into 8 buckets, which keeps percentiles within 12.5%.
+ */
+void blkio_lat_add(struct blkio_lat *h, uint64_t ns)
+{
+	uint64_t max;
+	int msb, idx;
+
+	if (ns < (1 << BLKIO_LAT_SUB_BITS)) {
+		idx = ns;
+	} else {
+		msb = 63 - __builtin_clzll(ns);
+		idx = ((msb - BLKIO_LAT_SUB_BITS + 1) << BLKIO_LAT_SUB_BITS) +
+			((ns >> (msb - BLKIO_LAT_SUB_BITS)) &
+			 ((1 << BLKIO_LAT_SUB_BITS) - 1));
+	}
+	__atomic_fetch_add(&h->count[idx], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->n, 1, __ATOMIC_RELAXED);
+	max = __atomic_load_n(&h->max_ns, __ATOMIC_RELAXED);
+	while (ns > max && !__atomic_compare_exchange_n(&h->max_ns, &max, ns,
+				1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+/**
+ * blkio_lat_percentile() - Latency in nanoseconds below which p of the
+ * samples are
+ *
+ * @p		: Fraction, e.g. 0.99
+ */
+double blkio_lat_percentile(const struct blkio_lat *h, double p)
+{
+	uint64_t want, seen = 0, v;
+	int idx, msb;
+
+	if (h->n == 0)
+		return 0.0;
+	want = p * h->n;
+	if (want < p * h->n)
+		want++;
+	for (idx = 0; idx < BLKIO_LAT_BUCKETS; idx++) {
+		seen += h->count[idx];
+		if (seen >= want)
+			break;
+	}
+	if (idx < (1 << BLKIO_LAT_SUB_BITS))
+		return idx;
+
+	// Upper end of the bucket, but never above the largest sample
+	msb = (idx >> BLKIO_LAT_SUB_BITS) + BLKIO_LAT_SUB_BITS - 1;
+	v = ((uint64_t)(idx & ((1 << BLKIO_LAT_SUB_BITS) - 1)) +
+			(1 << BLKIO_LAT_SUB_BITS) + 1) << (msb - BLKIO_LAT_SUB_BITS);
+	return v < h->max_ns ? v : h->max_ns;
+}
+
+// Copy the statistics of a handle that other threads may be updating
+void blkio_stats_get(const struct blkio *b, struct blkio_stats *s)
+{
+	const struct blkio_stats *src = &b->stats;
+	int i;
+
+	s->reads = __atomic_load_n(&src->reads, __ATOMIC_RELAXED);
+	s->bytes = __atomic_load_n(&src->bytes, __ATOMIC_RELAXED);
+	s->ns = __atomic_load_n(&src->ns, __ATOMIC_RELAXED);
+	s->short_reads = __atomic_load_n(&src->short_reads, __ATOMIC_RELAXED);
+	s->retries = __atomic_load_n(&src->retries, __ATOMIC_RELAXED);
+	s->bounced = __atomic_load_n(&src->bounced, __ATOMIC_RELAXED);
+	s->errors = __atomic_load_n(&src->errors, __ATOMIC_RELAXED);
+	for (i = 0; i < BLKIO_LAT_BUCKETS; i++)
+		s->lat.count[i] = __atomic_load_n(&src->lat.count[i],
+				__ATOMIC_RELAXED);
+	s->lat.n = __atomic_load_n(&src->lat.n, __ATOMIC_RELAXED);
+	s->lat.max_ns = __atomic_load_n(&src->lat.max_ns, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,110 @@
+/*
+ * blockio - Block device and image file I/O shared by the tools
+ *
+ * Written in 2026 by the blockcompare contributors
+ *
+ * To the extent possible under law, the author(s) have dedicated
+ * all copyright and related and neighboring rights to this software
+ * to the public domain worldwide. This software is distributed
+ * without any warranty.
+ *
+ * You should have received a copy of the CC0 Public Domain Dedication
+ * along with this software.
+ * If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+ */
+
+#ifndef BLOCKIO_H
+#define BLOCKIO_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#define BLKIO_ALIGN		4096	/* Buffer alignment of image files */
+
+// Read latency histogram, log linear buckets of nanoseconds
+#define BLKIO_LAT_SUB_BITS	3
+#define BLKIO_LAT_BUCKETS	(64 << BLKIO_LAT_SUB_BITS)
+
+// Read ahead policy, see blkio_advise()
+enum blkio_policy {
+	BLKIO_RA_NORMAL,		// Kernel default
+	BLKIO_RA_SEQUENTIAL,		// Large read ahead window
+	BLKIO_RA_RANDOM,		// No read ahead
+};
+
+struct blkio_lat {
+	uint64_t count[BLKIO_LAT_BUCKETS];
+	uint64_t n;
+	uint64_t max_ns;
+};
+
+/*
+ * Counters of a handle. They are updated atomically, so one handle can
+ * be read by several threads at once.
+ */
+struct blkio_stats {
+	uint64_t reads;			// Requests
+	uint64_t bytes;			// Bytes read
+	uint64_t ns;			// Time spent in requests
+	uint64_t short_reads;		// Requests that took more than one call
+	uint64_t retries;		// Calls interrupted by a signal
+	uint64_t bounced;		// Unaligned O_DIRECT reads copied
+	uint64_t errors;
+	struct blkio_lat lat;
+};
+
+// Opened block device or image file
+struct blkio {
+	const char *path;
+	int fd;
+	int is_reg;			// Image file, not a block device
+	int direct;			// Reads bypass the page cache (O_DIRECT)
+	uint64_t size;			// Size in bytes
+	unsigned int sector_size;	// Logical sector size (BLKSSZGET)
+	unsigned int io_min;		// Minimum I/O size (BLKIOMIN)
+	unsigned int io_opt;		// Optimal I/O size (BLKIOOPT)
+	unsigned int align;		// Alignment O_DIRECT needs
+	struct blkio_stats stats;
+};
+
+/*
+ * Fixed set of equally sized, aligned buffers. blkio_pool_get() waits
+ * until a buffer is free, so the pool also limits the data in flight.
+ */
+struct blkio_pool {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	unsigned char *mem;
+	void **free;			// Stack of free buffers
+	unsigned int nfree;
+	unsigned int count;
+	size_t size;
+};
+
+int blkio_open(struct blkio *b, const char *path, int flags);
+void blkio_close(struct blkio *b);
+int blkio_set_direct(struct blkio *b, int on);
+int blkio_advise(struct blkio *b, enum blkio_policy policy);
+void blkio_prefetch(struct blkio *b, uint64_t off, uint64_t len);
+ssize_t blkio_pread(struct blkio *b, void *buf, size_t len, uint64_t off);
+ssize_t blkio_preadv(struct blkio *b, const struct iovec *iov, int iovcnt,
+		uint64_t off);
+int blkio_pwrite(struct blkio *b, const void *buf, size_t len, uint64_t off);
+ssize_t blkio_pread_full(int fd, void *buf, size_t len, off_t off);
+int blkio_pwrite_full(int fd, const void *buf, size_t len, off_t off);
+
+void *blkio_alloc(size_t align, size_t len);
+int blkio_pool_init(struct blkio_pool *p, size_t size, unsigned int count,
+		size_t align);
+void *blkio_pool_get(struct blkio_pool *p);
+void blkio_pool_put(struct blkio_pool *p, void *buf);
+void blkio_pool_destroy(struct blkio_pool *p);
+
+void blkio_lat_add(struct blkio_lat *h, uint64_t ns);
+double blkio_lat_percentile(const struct blkio_lat *h, double p);
+void blkio_stats_get(const struct blkio *b, struct blkio_stats *s);
+
+#endif // BLOCKIO_H
@@ -1,6 +1,6 @@
 /*
- * filecreation - Program to create many empty files for testing
- * file system performance
+ * filecreation - Program to benchmark file system metadata operations
+ * on many small files
  *
  * Written in 2012 by Prashant P Shah <pshah.mumbai@gmail.com>
  *
@@ -14,42 +14,1664 @@
  * If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <time.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <math.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
 
-#define MAX_COUNT 100000
+#define MAX_COUNT	100000	/* Default number of files */
+#define NAME_LEN	15	/* File name length */
+#define MAX_THREADS	1024
+#define MAX_DEPTH	8	/* Maximum directory tree depth */
+#define MAX_RUNS	64	/* Runs of all phases in one invocation */
+#define MAX_MODES	16	/* Write modes to compare */
+#define WRITE_CHUNK	(1024 * 1024)	/* Largest write() call */
+#define DIRECT_ALIGN	4096	/* Alignment of O_DIRECT writes */
+#define MAX_FILE_SIZE	(1ULL << 30)
+#define URING_BATCH	32	/* Operations per io_uring_enter() */
+#define URING_DEPTH	128	/* Operations in flight per thread */
+#define URING_LAST	(1ULL << 32)	/* Last SQE of an operation */
+
+// Latency histogram, log linear buckets of nanoseconds
+#define LAT_SUB_BITS	3
+#define LAT_BUCKETS	(64 << LAT_SUB_BITS)
+
+enum phase {
+	PH_MKDIR,
+	PH_CREATE,
+	PH_WRITE,
+	PH_STAT,
+	PH_OPEN,
+	PH_RENAME,
+	PH_READDIR,
+	PH_UNLINK,
+	PH_RMDIR,
+	PH_MAX
+};
+
+static const char *phase_names[PH_MAX] = {
+	"mkdir", "create", "write", "stat", "open", "rename", "readdir", "unlink", "rmdir"
+};
+
+enum sync_policy {
+	SYNC_NONE,
+	SYNC_FSYNC,
+	SYNC_FDATASYNC,
+	SYNC_RANGE,
+	SYNC_FS,
+	SYNC_MAX
+};
+
+static const char *sync_names[SYNC_MAX] = {
+	"none", "fsync", "fdatasync", "sync_file_range", "syncfs"
+};
+
+// How the write phase writes every file
+struct write_mode {
+	char name[64];
+	enum sync_policy sync;
+	unsigned int batch;		// Files per syncfs() of every thread
+	int direct;			// O_DIRECT
+	int falloc;			// fallocate() the file size first
+};
+
+enum size_type {
+	SIZE_FIXED,
+	SIZE_UNIFORM,
+	SIZE_LOGNORMAL,
+	SIZE_HIST
+};
+
+// Distribution of the file sizes of the write phase
+struct size_dist {
+	enum size_type type;
+	uint64_t min, max;		// Fixed size or uniform range
+	double mu, sigma;		// Log normal parameters
+	uint64_t *hsize;		// Histogram sizes
+	double *hcum;			// Cumulative histogram weights
+	size_t hn;
+};
+
+// How the metadata phases issue their operations
+enum method {
+	M_SYSCALL,
+	M_STDIO,
+	M_URING,
+	M_MAX
+};
+
+static const char *method_names[M_MAX] = { "syscall", "stdio", "uring" };
+
+// io_uring instance of a thread, with the mapped rings
+struct uring {
+	int fd;
+	unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned int *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sq_ring, *cq_ring;
+	size_t sq_len, cq_len, sqes_len;
+	unsigned int tail;		// Next SQE to fill
+	unsigned int queued;		// SQEs not yet submitted
+	int skip;			// IOSQE_CQE_SKIP_SUCCESS works
+};
+
+// An operation in flight, its index is also its direct descriptor slot
+struct uring_slot {
+	char path[PATH_MAX];
+	char path2[PATH_MAX];
+	struct statx stx;
+	uint64_t start;
+	int failed;
+};
+
+struct lat_hist {
+	uint64_t count[LAT_BUCKETS];
+	uint64_t n;
+	uint64_t max_ns;
+};
+
+// Result of one phase, summed over all threads
+struct phase_result {
+	int run;
+	uint64_t ops;
+	uint64_t errors;
+	uint64_t entries;		// Directory entries seen by readdir
+	uint64_t bytes;			// Data written by the write phase
+	double seconds;			// Wall clock time of the phase
+	struct lat_hist lat;
+};
+
+// One run of all phases with a given number of threads and write mode
+struct run {
+	unsigned int threads;
+	const struct write_mode *wm;
+	enum method method;
+	const struct run *base;		// Same run with the first method
+	char dir[PATH_MAX];
+	struct phase_result results[PH_MAX];
+};
+
+struct worker {
+	pthread_t tid;
+	int id;
+	enum phase ph;
+	int level;			// Directory level for mkdir / rmdir
+	char prefix[16];		// Top directory of the thread's files
+	double start, end;		// Time of the first and last operation
+	unsigned char *buf;		// Data for the write phase
+	unsigned int unsynced;		// Files written since the last syncfs()
+	struct uring ring;
+	struct uring_slot *slots;
+	unsigned int *free_slots;
+	unsigned int nfree;
+	uint64_t ops;
+	uint64_t errors;
+	uint64_t entries;
+	uint64_t bytes;
+	struct lat_hist lat;
+};
+
+// Benchmark configuration
+static unsigned long nfiles = MAX_COUNT;
+static unsigned int fanout;		// Sub directories per directory
+static unsigned int depth;		// Directory levels below the run dir
+static unsigned int nthreads = 1;
+static uint64_t leaves = 1;		// Directories holding files
+static int private_dirs;		// Every thread has its own directory tree
+static int pin_cpus;			// Pin thread i to cpu i
+static int renamed;			// Files carry the renamed suffix
+static const struct write_mode *wmode;	// Write mode of the current run
+static enum method method;		// Method of the current run
+static unsigned int uring_batch = URING_BATCH;
+static unsigned int uring_depth = URING_DEPTH;
+static struct size_dist sizes = { .type = SIZE_FIXED, .min = 4096, .max = 4096 };
+static const char *size_spec = "4k";
 
 const char alphanum[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
 
-void gen_random(char *s, const int len)
+static struct worker workers[MAX_THREADS];
+static pthread_barrier_t start_barrier;
+static struct run runs[MAX_RUNS];
+static int nruns;
+static unsigned int thread_counts[MAX_RUNS];
+static int nthread_counts;
+static struct write_mode wmodes[MAX_MODES];
+static int nwmodes;
+static enum method methods[M_MAX];
+static int nmethods;
+
+static void usage(void)
+{
+	fprintf(stderr, "\nUsage : createfiles [-n <files>] [-f <fanout>] [-d <depth>]\n"
+			"                   [-t <threads>] [-m shared|private] [-c]\n"
+			"                   [-p <phases>] [-s <sizes>] [-w <modes>]\n"
+			"                   [-a <methods>] [-B <batch>] [-Q <depth>]\n"
+			"                   [-r <dir>] [-j <file>]\n\n"
+			"  -n  Number of files (default %d)\n"
+			"  -f  Sub directories per directory (default 0, one directory)\n"
+			"  -d  Levels of sub directories (default 1 with -f)\n"
+			"  -t  Number of threads, or a comma separated list of thread\n"
+			"      counts to run one after the other, eg 1,2,4,8 (default 1)\n"
+			"  -m  All threads share one directory tree, or every thread\n"
+			"      has a private tree (default shared)\n"
+			"  -c  Pin thread i to cpu i\n"
+			"  -p  Comma separated phases out of create or write, stat, open,\n"
+			"      rename, readdir, unlink (default all with create)\n"
+			"  -s  File sizes of the write phase, <size>, uniform:<min>:<max>,\n"
+			"      lognormal:<median>:<sigma> or hist:<file> (default 4k)\n"
+			"  -w  Comma separated write modes to compare, a sync policy out\n"
+			"      of none, fsync, fdatasync, sync_file_range, syncfs[:<files>]\n"
+			"      followed by +direct and / or +falloc (default none)\n"
+			"  -a  Comma separated methods to compare out of syscall, stdio\n"
+			"      and uring (default syscall)\n"
+			"  -B  io_uring operations per submission (default %d)\n"
+			"  -Q  io_uring operations in flight per thread (default %d)\n"
+			"  -r  Directory to run in (default current directory)\n"
+			"  -j  Write JSON results to file, - for stdout\n\n",
+			MAX_COUNT, URING_BATCH, URING_DEPTH);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * lat_add() - Add one latency sample to the histogram
+ *
+ * Buckets are exact below 8 ns, above that each power of two is split
+ * into 8 buckets, which keeps percentiles within 12.5%.
+ */
+static void lat_add(struct lat_hist *h, uint64_t ns)
+{
+	int msb, idx;
+
+	if (ns < (1 << LAT_SUB_BITS)) {
+		idx = ns;
+	} else {
+		msb = 63 - __builtin_clzll(ns);
+		idx = ((msb - LAT_SUB_BITS + 1) << LAT_SUB_BITS) +
+			((ns >> (msb - LAT_SUB_BITS)) & ((1 << LAT_SUB_BITS) - 1));
+	}
+	h->count[idx]++;
+	h->n++;
+	if (ns > h->max_ns)
+		h->max_ns = ns;
+}
+
+static void lat_merge(struct lat_hist *to, const struct lat_hist *from)
 {
 	int i;
-	for (i = 0; i < len; i++) {
-		s[i] = alphanum[rand() % (sizeof(alphanum) - 1)];
+
+	for (i = 0; i < LAT_BUCKETS; i++)
+		to->count[i] += from->count[i];
+	to->n += from->n;
+	if (from->max_ns > to->max_ns)
+		to->max_ns = from->max_ns;
+}
+
+/**
+ * lat_percentile() - Latency in nanoseconds below which p of the samples are
+ *
+ * @p		: Fraction, e.g. 0.99
+ */
+static double lat_percentile(const struct lat_hist *h, double p)
+{
+	uint64_t want, seen = 0, v;
+	int idx, msb;
+
+	if (h->n == 0)
+		return 0.0;
+	want = ceil(p * h->n);
+	for (idx = 0; idx < LAT_BUCKETS; idx++) {
+		seen += h->count[idx];
+		if (seen >= want)
+			break;
+	}
+	if (idx < (1 << LAT_SUB_BITS))
+		return idx;
+
+	// Upper end of the bucket, but never above the largest sample
+	msb = (idx >> LAT_SUB_BITS) + LAT_SUB_BITS - 1;
+	v = ((uint64_t)(idx & ((1 << LAT_SUB_BITS) - 1)) +
+			(1 << LAT_SUB_BITS) + 1) << (msb - LAT_SUB_BITS);
+	return v < h->max_ns ? v : h->max_ns;
+}
+
+static uint64_t splitmix64(uint64_t x)
+{
+	x += 0x9E3779B97F4A7C15ULL;
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+	return x ^ (x >> 31);
+}
+
+/**
+ * gen_name() - Generate the file name of file number i
+ *
+ * The first 7 characters are random looking so that names spread over
+ * directory hash buckets like real workloads, the last 8 characters
+ * encode i so names are unique and can be regenerated by every phase
+ * without keeping them in memory.
+ *
+ * @s		: Buffer of at least NAME_LEN + 3 bytes
+ */
+void gen_name(char *s, uint64_t i)
+{
+	uint64_t r = splitmix64(i);
+	int k;
+
+	for (k = 0; k < NAME_LEN - 8; k++) {
+		s[k] = alphanum[r % (sizeof(alphanum) - 1)];
+		r /= sizeof(alphanum) - 1;
+	}
+	for (k = NAME_LEN - 1; k >= NAME_LEN - 8; k--) {
+		s[k] = alphanum[i % (sizeof(alphanum) - 1)];
+		i /= sizeof(alphanum) - 1;
+	}
+	s[NAME_LEN] = 0;
+}
+
+/**
+ * dir_path() - Relative path of directory number idx at the given level
+ *
+ * Level 0 is the top directory given by prefix, directories of level l
+ * are numbered 0 .. fanout^l - 1 and named after their base fanout digits.
+ */
+static int dir_path(char *s, size_t len, const char *prefix, int level,
+		uint64_t idx)
+{
+	uint64_t digits[MAX_DEPTH];
+	int l, n;
+
+	for (l = 0; l < level; l++) {
+		digits[l] = idx % fanout;
+		idx /= fanout;
+	}
+	n = snprintf(s, len, "%s", prefix);
+	for (l = level - 1; l >= 0; l--) {
+		n += snprintf(s + n, len - n, "/d%02llu",
+				(unsigned long long)digits[l]);
+	}
+	return n;
+}
+
+// Relative path of file number i
+static void file_path(char *s, size_t len, const char *prefix, uint64_t i,
+		int suffix)
+{
+	char name[NAME_LEN + 3];
+	int n;
+
+	gen_name(name, i);
+	n = dir_path(s, len, prefix, depth, i % leaves);
+	snprintf(s + n, len - n, "/%s%s", name, suffix ? ".r" : "");
+}
+
+static uint64_t level_dirs(int level)
+{
+	uint64_t n = 1;
+	int l;
+
+	for (l = 0; l < level; l++)
+		n *= fanout;
+	return n;
+}
+
+/**
+ * parse_size() - Parse a size in bytes with an optional k, m or g suffix
+ */
+static int parse_size(const char *str, uint64_t *size)
+{
+	char *end;
+
+	*size = strtoull(str, &end, 0);
+	switch (*end) {
+	case 'k': case 'K':
+		*size <<= 10;
+		end++;
+		break;
+	case 'm': case 'M':
+		*size <<= 20;
+		end++;
+		break;
+	case 'g': case 'G':
+		*size <<= 30;
+		end++;
+		break;
+	}
+	if (end == str || (*end && *end != ':') || *size > MAX_FILE_SIZE) {
+		fprintf(stderr, "Invalid size %s\n", str);
+		return -1;
 	}
-	s[len] = 0;
+	return 0;
 }
 
-int main()
+/**
+ * read_hist() - Read a file size histogram
+ *
+ * One "<size> <weight>" pair per line, lines starting with # are comments.
+ */
+static int read_hist(const char *file)
 {
+	char line[256], sz[64];
+	double weight, total = 0.0;
+	size_t alloc = 0;
+	FILE *fp;
+	void *p;
+
+	fp = fopen(file, "r");
+	if (!fp) {
+		perror("Error opening size histogram");
+		return -1;
+	}
+	while (fgets(line, sizeof(line), fp)) {
+		if (line[0] == '#' || sscanf(line, "%63s %lf", sz, &weight) != 2)
+			continue;
+		if (sizes.hn == alloc) {
+			alloc = alloc ? alloc * 2 : 64;
+			p = realloc(sizes.hsize, alloc * sizeof(*sizes.hsize));
+			if (!p)
+				goto err;
+			sizes.hsize = p;
+			p = realloc(sizes.hcum, alloc * sizeof(*sizes.hcum));
+			if (!p)
+				goto err;
+			sizes.hcum = p;
+		}
+		if (parse_size(sz, &sizes.hsize[sizes.hn]) < 0 || weight < 0.0)
+			goto err;
+		total += weight;
+		sizes.hcum[sizes.hn++] = total;
+	}
+	fclose(fp);
+	if (total <= 0.0) {
+		fprintf(stderr, "Empty size histogram %s\n", file);
+		return -1;
+	}
+	return 0;
+
+err:
+	fprintf(stderr, "Invalid size histogram %s\n", file);
+	fclose(fp);
+	return -1;
+}
+
+static int parse_sizes(const char *arg)
+{
+	const char *p;
+
+	size_spec = arg;
+	if (strncmp(arg, "uniform:", 8) == 0) {
+		sizes.type = SIZE_UNIFORM;
+		p = strchr(arg + 8, ':');
+		if (!p || parse_size(arg + 8, &sizes.min) < 0 ||
+				parse_size(p + 1, &sizes.max) < 0)
+			return -1;
+		if (sizes.max < sizes.min) {
+			fprintf(stderr, "Invalid size range %s\n", arg);
+			return -1;
+		}
+	} else if (strncmp(arg, "lognormal:", 10) == 0) {
+		sizes.type = SIZE_LOGNORMAL;
+		p = strchr(arg + 10, ':');
+		if (!p || parse_size(arg + 10, &sizes.min) < 0 || sizes.min == 0)
+			return -1;
+		sizes.mu = log(sizes.min);
+		sizes.sigma = atof(p + 1);
+	} else if (strncmp(arg, "hist:", 5) == 0) {
+		sizes.type = SIZE_HIST;
+		return read_hist(arg + 5);
+	} else {
+		sizes.type = SIZE_FIXED;
+		if (strncmp(arg, "fixed:", 6) == 0)
+			arg += 6;
+		if (parse_size(arg, &sizes.min) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+/**
+ * file_size() - Size of file number i in the write phase
+ *
+ * Drawn from the size distribution with a hash of i, so every file gets
+ * the same size in every run whatever the number of threads or the
+ * write mode. O_DIRECT sizes are rounded up to whole DIRECT_ALIGN blocks.
+ */
+static uint64_t file_size(uint64_t i, int direct)
+{
+	uint64_t r = splitmix64(i ^ 0x5DEECE66DULL);
+	double u1, u2, v, *c;
+	uint64_t size;
+	size_t lo, hi;
+
+	switch (sizes.type) {
+	case SIZE_UNIFORM:
+		size = sizes.min + r % (sizes.max - sizes.min + 1);
+		break;
+	case SIZE_LOGNORMAL:
+		// Box-Muller transform of two uniform numbers in (0, 1]
+		u1 = ((r >> 11) + 1) / 9007199254740992.0;
+		u2 = ((splitmix64(r) >> 11) + 1) / 9007199254740992.0;
+		v = exp(sizes.mu + sizes.sigma * sqrt(-2.0 * log(u1)) *
+				cos(2.0 * M_PI * u2));
+		size = v < MAX_FILE_SIZE ? (uint64_t)v : MAX_FILE_SIZE;
+		break;
+	case SIZE_HIST:
+		c = sizes.hcum;
+		v = (r >> 11) / 9007199254740992.0 * c[sizes.hn - 1];
+		lo = 0;
+		hi = sizes.hn - 1;
+		while (lo < hi) {
+			if (c[(lo + hi) / 2] > v)
+				hi = (lo + hi) / 2;
+			else
+				lo = (lo + hi) / 2 + 1;
+		}
+		size = sizes.hsize[lo];
+		break;
+	default:
+		size = sizes.min;
+		break;
+	}
+	if (direct)
+		size = (size + DIRECT_ALIGN - 1) / DIRECT_ALIGN * DIRECT_ALIGN;
+	return size;
+}
+
+/**
+ * parse_modes() - Parse the list of write modes
+ *
+ * Every mode is a sync policy followed by optional +direct and +falloc,
+ * eg fdatasync+falloc or syncfs:100+direct.
+ */
+static int parse_modes(const char *arg)
+{
+	char buf[1024], *tok, *opt, *save = NULL, *save2 = NULL;
+	struct write_mode *wm;
 	int i;
-	FILE *f;
-	char fname[15];
-	time_t start, end;
-
-	time(&start);
-	for (i = 0; i < MAX_COUNT; i++) {
-		gen_random(fname, 15);
-		f = fopen(fname, "w");
-		if (f != NULL) {
-			fclose(f);
-		} else {
-			perror("Error creating file\n");
+
+	snprintf(buf, sizeof(buf), "%s", arg);
+	nwmodes = 0;
+	for (tok = strtok_r(buf, ",", &save); tok;
+			tok = strtok_r(NULL, ",", &save)) {
+		if (nwmodes == MAX_MODES) {
+			fprintf(stderr, "Too many write modes\n");
+			return -1;
+		}
+		wm = &wmodes[nwmodes++];
+		memset(wm, 0x00, sizeof(*wm));
+		snprintf(wm->name, sizeof(wm->name), "%s", tok);
+
+		opt = strtok_r(tok, "+", &save2);
+		wm->batch = 1000;
+		if (strncmp(opt, "syncfs:", 7) == 0) {
+			wm->batch = atoi(opt + 7);
+			opt[6] = 0;
+		}
+		for (i = 0; i < SYNC_MAX; i++) {
+			if (strcmp(opt, sync_names[i]) == 0)
+				break;
+		}
+		if (i == SYNC_MAX || wm->batch < 1) {
+			fprintf(stderr, "Unknown sync policy %s\n", opt);
+			return -1;
+		}
+		wm->sync = i;
+
+		while ((opt = strtok_r(NULL, "+", &save2)) != NULL) {
+			if (strcmp(opt, "direct") == 0) {
+				wm->direct = 1;
+			} else if (strcmp(opt, "falloc") == 0) {
+				wm->falloc = 1;
+			} else {
+				fprintf(stderr, "Unknown write option %s\n", opt);
+				return -1;
+			}
+		}
+	}
+	return nwmodes ? 0 : -1;
+}
+
+/**
+ * write_file() - Create file number i and write its data
+ *
+ * The whole sequence of open, fallocate, write, sync and close is one
+ * operation. With syncfs every thread syncs the file system after every
+ * batch of files and after its last file.
+ *
+ * @last	: This is the last file of the thread
+ */
+static int write_file(struct worker *w, const char *path, uint64_t i, int last)
+{
+	const struct write_mode *wm = wmode;
+	uint64_t size = file_size(i, wm->direct), off;
+	int fd, res = 0, flags = O_WRONLY | O_CREAT | O_EXCL;
+	size_t len;
+	ssize_t n;
+
+	if (wm->direct)
+		flags |= O_DIRECT;
+	fd = open(path, flags, 0644);
+	if (fd < 0)
+		return -1;
+	if (wm->falloc && size > 0 && fallocate(fd, 0, 0, size) < 0)
+		goto err;
+
+	for (off = 0; off < size; off += n) {
+		len = size - off < WRITE_CHUNK ? size - off : WRITE_CHUNK;
+		n = write(fd, w->buf, len);
+		if (n <= 0) {
+			if (n == 0)
+				errno = EIO;
+			goto err;
+		}
+	}
+	w->bytes += size;
+
+	switch (wm->sync) {
+	case SYNC_FSYNC:
+		res = fsync(fd);
+		break;
+	case SYNC_FDATASYNC:
+		res = fdatasync(fd);
+		break;
+	case SYNC_RANGE:
+		res = sync_file_range(fd, 0, 0, SYNC_FILE_RANGE_WAIT_BEFORE |
+				SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+		break;
+	case SYNC_FS:
+		if (++w->unsynced >= wm->batch || last) {
+			res = syncfs(fd);
+			w->unsynced = 0;
+		}
+		break;
+	default:
+		break;
+	}
+	if (res < 0)
+		goto err;
+	return close(fd);
+
+err:
+	res = errno;
+	close(fd);
+	errno = res;
+	return -1;
+}
+
+static void op_error(struct worker *w, const char *op, const char *path)
+{
+	// Report only the first failure of every thread and phase
+	if (w->errors++ == 0)
+		fprintf(stderr, "Thread %d : %s %s : %s\n", w->id, op, path,
+				strerror(errno));
+}
+
+static int uring_phase(enum phase ph)
+{
+	return ph == PH_CREATE || ph == PH_STAT || ph == PH_OPEN ||
+		ph == PH_RENAME || ph == PH_UNLINK;
+}
+
+/**
+ * uring_setup() - Create an io_uring and map its rings
+ *
+ * Also registers a sparse table of depth direct descriptors, so that an
+ * openat and the close of the file can be linked in one submission
+ * without the file descriptor coming back to user space in between.
+ */
+static int uring_setup(struct uring *u, unsigned int depth)
+{
+	struct io_uring_rsrc_register reg;
+	struct io_uring_params p;
+	unsigned int *sq;
+
+	memset(u, 0x00, sizeof(*u));
+	memset(&p, 0x00, sizeof(p));
+	u->fd = syscall(__NR_io_uring_setup, depth * 2, &p);
+	if (u->fd < 0)
+		return -1;
+	u->skip = !!(p.features & IORING_FEAT_CQE_SKIP);
+
+	u->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	u->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (u->cq_len > u->sq_len)
+			u->sq_len = u->cq_len;
+		u->cq_len = 0;
+	}
+	u->sq_ring = mmap(NULL, u->sq_len, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+	if (u->sq_ring == MAP_FAILED)
+		goto err;
+	u->cq_ring = u->sq_ring;
+	if (u->cq_len) {
+		u->cq_ring = mmap(NULL, u->cq_len, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+		if (u->cq_ring == MAP_FAILED)
+			goto err;
+	}
+	u->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	u->sqes = mmap(NULL, u->sqes_len, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+	if (u->sqes == MAP_FAILED)
+		goto err;
+
+	sq = u->sq_ring;
+	u->sq_head = sq + p.sq_off.head / sizeof(*sq);
+	u->sq_tail = sq + p.sq_off.tail / sizeof(*sq);
+	u->sq_mask = sq + p.sq_off.ring_mask / sizeof(*sq);
+	u->sq_array = sq + p.sq_off.array / sizeof(*sq);
+	u->cq_head = (unsigned int *)u->cq_ring + p.cq_off.head / sizeof(*sq);
+	u->cq_tail = (unsigned int *)u->cq_ring + p.cq_off.tail / sizeof(*sq);
+	u->cq_mask = (unsigned int *)u->cq_ring + p.cq_off.ring_mask / sizeof(*sq);
+	u->cqes = (struct io_uring_cqe *)((char *)u->cq_ring + p.cq_off.cqes);
+	u->tail = *u->sq_tail;
+
+	memset(&reg, 0x00, sizeof(reg));
+	reg.nr = depth;
+	reg.flags = IORING_RSRC_REGISTER_SPARSE;
+	if (syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_FILES2,
+				&reg, sizeof(reg)) < 0)
+		goto err;
+	return 0;
+
+err:
+	if (u->sqes && u->sqes != MAP_FAILED)
+		munmap(u->sqes, u->sqes_len);
+	if (u->cq_len && u->cq_ring && u->cq_ring != MAP_FAILED)
+		munmap(u->cq_ring, u->cq_len);
+	if (u->sq_ring && u->sq_ring != MAP_FAILED)
+		munmap(u->sq_ring, u->sq_len);
+	close(u->fd);
+	return -1;
+}
+
+static void uring_exit(struct uring *u)
+{
+	munmap(u->sqes, u->sqes_len);
+	if (u->cq_len)
+		munmap(u->cq_ring, u->cq_len);
+	munmap(u->sq_ring, u->sq_len);
+	close(u->fd);
+}
+
+// The ring has room for two SQEs of every operation in flight
+static struct io_uring_sqe *uring_sqe(struct uring *u)
+{
+	unsigned int idx = u->tail & *u->sq_mask;
+	struct io_uring_sqe *sqe = &u->sqes[idx];
+
+	memset(sqe, 0x00, sizeof(*sqe));
+	u->sq_array[idx] = idx;
+	u->tail++;
+	u->queued++;
+	return sqe;
+}
+
+/**
+ * uring_submit() - Submit the queued SQEs
+ *
+ * @wait	: Also wait for at least one completion
+ */
+static int uring_submit(struct uring *u, int wait)
+{
+	int res;
+
+	__atomic_store_n(u->sq_tail, u->tail, __ATOMIC_RELEASE);
+	do {
+		res = syscall(__NR_io_uring_enter, u->fd, u->queued, wait ? 1 : 0,
+				wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+		if (res > 0)
+			u->queued -= res;
+	} while ((res < 0 && (errno == EINTR || errno == EAGAIN)) ||
+			(res >= 0 && u->queued > 0));
+	return res < 0 ? -1 : 0;
+}
+
+/**
+ * uring_queue() - Queue the operation of a phase on file number i
+ *
+ * Creating and opening a file is an openat into the direct descriptor of
+ * the slot linked to a close of it, the other phases take one SQE.
+ */
+static void uring_queue(struct worker *w, unsigned int s, uint64_t i)
+{
+	struct uring_slot *slot = &w->slots[s];
+	struct uring *u = &w->ring;
+	struct io_uring_sqe *sqe;
+
+	file_path(slot->path, sizeof(slot->path), w->prefix, i, renamed);
+	slot->failed = 0;
+	slot->start = now_ns();
+
+	sqe = uring_sqe(u);
+	sqe->fd = AT_FDCWD;
+	sqe->addr = (uintptr_t)slot->path;
+	sqe->user_data = s | URING_LAST;
+	switch (w->ph) {
+	case PH_CREATE:
+	case PH_OPEN:
+		sqe->opcode = IORING_OP_OPENAT;
+		sqe->open_flags = w->ph == PH_CREATE ?
+			O_WRONLY | O_CREAT | O_EXCL : O_RDONLY;
+		sqe->len = 0644;
+		sqe->file_index = s + 1;
+		sqe->flags = IOSQE_IO_LINK | (u->skip ? IOSQE_CQE_SKIP_SUCCESS : 0);
+		sqe->user_data = s;
+
+		sqe = uring_sqe(u);
+		sqe->opcode = IORING_OP_CLOSE;
+		sqe->file_index = s + 1;
+		sqe->user_data = s | URING_LAST;
+		break;
+	case PH_STAT:
+		sqe->opcode = IORING_OP_STATX;
+		sqe->len = STATX_BASIC_STATS;
+		sqe->off = (uintptr_t)&slot->stx;
+		break;
+	case PH_RENAME:
+		file_path(slot->path2, sizeof(slot->path2), w->prefix, i, 1);
+		sqe->opcode = IORING_OP_RENAMEAT;
+		sqe->len = AT_FDCWD;
+		sqe->off = (uintptr_t)slot->path2;
+		break;
+	case PH_UNLINK:
+		sqe->opcode = IORING_OP_UNLINKAT;
+		break;
+	default:
+		break;
+	}
+}
+
+// Handle all completions, returns the number of finished operations
+static unsigned int uring_reap(struct worker *w)
+{
+	struct uring *u = &w->ring;
+	unsigned int head = *u->cq_head, done = 0;
+	unsigned int tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+	struct io_uring_cqe *cqe;
+	struct uring_slot *slot;
+	unsigned int s;
+
+	for (; head != tail; head++) {
+		cqe = &u->cqes[head & *u->cq_mask];
+		s = cqe->user_data & (URING_LAST - 1);
+		slot = &w->slots[s];
+
+		// A failed openat cancels the linked close
+		if (cqe->res < 0 && !slot->failed) {
+			slot->failed = 1;
+			errno = -cqe->res;
+			op_error(w, phase_names[w->ph], slot->path);
+		}
+		if (!(cqe->user_data & URING_LAST))
+			continue;
+
+		lat_add(&w->lat, now_ns() - slot->start);
+		w->ops++;
+		w->free_slots[w->nfree++] = s;
+		done++;
+	}
+	__atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+	return done;
+}
+
+/**
+ * run_uring() - Run this thread's share of a phase through io_uring
+ *
+ * Keeps up to uring_depth operations in flight and submits them in
+ * batches of uring_batch, the latency of an operation runs from queueing
+ * it till its completion has been seen.
+ */
+static void run_uring(struct worker *w, uint64_t first, uint64_t last)
+{
+	unsigned int inflight = 0, pending = 0;
+	uint64_t i = first;
+
+	while (i < last || inflight > 0) {
+		while (i < last && inflight < uring_depth) {
+			uring_queue(w, w->free_slots[--w->nfree], i++);
+			inflight++;
+			if (++pending >= uring_batch) {
+				if (uring_submit(&w->ring, 0) < 0)
+					goto err;
+				pending = 0;
+			}
+		}
+		if (uring_submit(&w->ring, 1) < 0)
+			goto err;
+		pending = 0;
+		inflight -= uring_reap(w);
+	}
+	return;
+
+err:
+	fprintf(stderr, "Thread %d : io_uring_enter : %s\n", w->id,
+			strerror(errno));
+	exit(1);
+}
+
+static void uring_init(struct worker *w)
+{
+	unsigned int s;
+
+	w->slots = malloc(uring_depth * sizeof(*w->slots));
+	w->free_slots = malloc(uring_depth * sizeof(*w->free_slots));
+	if (!w->slots || !w->free_slots) {
+		fprintf(stderr, "Failed to allocate memory\n");
+		exit(1);
+	}
+	for (s = 0; s < uring_depth; s++)
+		w->free_slots[s] = uring_depth - 1 - s;
+	w->nfree = uring_depth;
+
+	if (uring_setup(&w->ring, uring_depth) < 0) {
+		fprintf(stderr, "Thread %d : io_uring setup : %s\n", w->id,
+				strerror(errno));
+		exit(1);
+	}
+}
+
+static void uring_free(struct worker *w)
+{
+	uring_exit(&w->ring);
+	free(w->slots);
+	free(w->free_slots);
+}
+
+/**
+ * run_ops() - Run this thread's share of a phase
+ *
+ * Files are split into contiguous ranges, one per thread. In the shared
+ * mode the directories are split the same way, in the private mode every
+ * thread works on all directories below its own top directory. Threads
+ * wait at a barrier so that they all start together, every operation is
+ * timed on its own.
+ */
+static void *run_ops(void *arg)
+{
+	struct worker *w = arg;
+	char path[PATH_MAX], path2[PATH_MAX];
+	uint64_t i, first, last, total, t;
+	int dirop = w->ph == PH_MKDIR || w->ph == PH_RMDIR || w->ph == PH_READDIR;
+	int level = w->ph == PH_READDIR ? (int)depth : w->level;
+	struct dirent *de;
+	DIR *dir;
+	int fd, res = 0;
+	struct stat st;
+	cpu_set_t cpus;
+	FILE *fp;
+	int uring = method == M_URING && uring_phase(w->ph);
+
+	if (pin_cpus) {
+		CPU_ZERO(&cpus);
+		CPU_SET(w->id % sysconf(_SC_NPROCESSORS_ONLN), &cpus);
+		if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus))
+			fprintf(stderr, "Thread %d : failed to set cpu affinity\n", w->id);
+	}
+
+	total = dirop ? level_dirs(level) : nfiles;
+	if (dirop && private_dirs) {
+		first = 0;
+		last = total;
+	} else {
+		first = total * w->id / nthreads;
+		last = total * (w->id + 1) / nthreads;
+	}
+
+	if (uring)
+		uring_init(w);
+
+	pthread_barrier_wait(&start_barrier);
+	w->start = now();
+
+	if (uring) {
+		run_uring(w, first, last);
+		last = first;
+	}
+
+	for (i = first; i < last; i++) {
+		if (dirop)
+			dir_path(path, sizeof(path), w->prefix, level, i);
+		else
+			file_path(path, sizeof(path), w->prefix, i, renamed);
+
+		t = now_ns();
+		switch (w->ph) {
+		case PH_MKDIR:
+			res = mkdir(path, 0755);
+			break;
+		case PH_CREATE:
+			if (method == M_STDIO) {
+				fp = fopen(path, "wx");
+				res = fp ? fclose(fp) : -1;
+				break;
+			}
+			fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+			res = fd < 0 ? -1 : close(fd);
+			break;
+		case PH_WRITE:
+			res = write_file(w, path, i, i + 1 == last);
+			break;
+		case PH_STAT:
+			res = stat(path, &st);
+			break;
+		case PH_OPEN:
+			if (method == M_STDIO) {
+				fp = fopen(path, "r");
+				res = fp ? fclose(fp) : -1;
+				break;
+			}
+			fd = open(path, O_RDONLY);
+			res = fd < 0 ? -1 : close(fd);
+			break;
+		case PH_RENAME:
+			file_path(path2, sizeof(path2), w->prefix, i, 1);
+			res = rename(path, path2);
+			break;
+		case PH_READDIR:
+			dir = opendir(path);
+			if (!dir) {
+				res = -1;
+				break;
+			}
+			while ((de = readdir(dir)) != NULL)
+				w->entries++;
+			res = closedir(dir);
+			break;
+		case PH_UNLINK:
+			res = method == M_STDIO ? remove(path) : unlink(path);
+			break;
+		case PH_RMDIR:
+			res = rmdir(path);
+			break;
+		default:
+			break;
+		}
+		lat_add(&w->lat, now_ns() - t);
+		w->ops++;
+		if (res < 0)
+			op_error(w, phase_names[w->ph], path);
+	}
+	w->end = now();
+
+	if (uring)
+		uring_free(w);
+	return NULL;
+}
+
+// Buffer of random data, so that compressing file systems have to write it
+static unsigned char *alloc_data(void)
+{
+	uint64_t *p;
+	size_t i;
+
+	if (posix_memalign((void **)&p, DIRECT_ALIGN, WRITE_CHUNK)) {
+		fprintf(stderr, "Failed to allocate memory\n");
+		exit(1);
+	}
+	for (i = 0; i < WRITE_CHUNK / sizeof(*p); i++)
+		p[i] = splitmix64(i);
+	return (unsigned char *)p;
+}
+
+/**
+ * run_threads() - Run one step of a phase on all threads and wait for them
+ *
+ * The phase is timed from the first thread passing the start barrier till
+ * the last thread is done, thread creation is not part of it.
+ */
+static int run_threads(enum phase ph, int level, struct phase_result *pr)
+{
+	unsigned char *data = NULL;
+	unsigned int i;
+	double start, end;
+
+	if (ph == PH_WRITE)
+		data = alloc_data();
+
+	for (i = 0; i < nthreads; i++) {
+		memset(&workers[i], 0x00, sizeof(workers[i]));
+		workers[i].id = i;
+		workers[i].ph = ph;
+		workers[i].level = level;
+		workers[i].buf = data;
+		if (private_dirs)
+			snprintf(workers[i].prefix, sizeof(workers[i].prefix),
+					"t%03u", i);
+		else
+			strcpy(workers[i].prefix, ".");
+	}
+
+	pthread_barrier_init(&start_barrier, NULL, nthreads + 1);
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&workers[i].tid, NULL, run_ops, &workers[i])) {
+			fprintf(stderr, "Failed to create thread\n");
 			exit(1);
 		}
 	}
-	time(&end);
-	printf("Time taken %f\n", difftime(end, start));
+	pthread_barrier_wait(&start_barrier);
+	for (i = 0; i < nthreads; i++)
+		pthread_join(workers[i].tid, NULL);
+	pthread_barrier_destroy(&start_barrier);
+	free(data);
+
+	start = workers[0].start;
+	end = workers[0].end;
+	for (i = 1; i < nthreads; i++) {
+		if (workers[i].start < start)
+			start = workers[i].start;
+		if (workers[i].end > end)
+			end = workers[i].end;
+	}
+	pr->seconds += end - start;
+
+	pr->run = 1;
+	for (i = 0; i < nthreads; i++) {
+		pr->ops += workers[i].ops;
+		pr->errors += workers[i].errors;
+		pr->entries += workers[i].entries;
+		pr->bytes += workers[i].bytes;
+		lat_merge(&pr->lat, &workers[i].lat);
+	}
+	return pr->errors ? -1 : 0;
+}
+
+/**
+ * run_phase() - Run a benchmark phase
+ *
+ * The directory tree is created top down and removed bottom up, one
+ * level after the other, all other phases run over all files at once.
+ * Level 0 is the run directory in the shared mode, which exists already,
+ * and the per thread top directory in the private mode.
+ */
+static int run_phase(struct run *r, enum phase ph)
+{
+	struct phase_result *pr = &r->results[ph];
+	int top = private_dirs ? 0 : 1;
+	int l, res = 0;
+
+	if (ph == PH_MKDIR) {
+		for (l = top; l <= (int)depth && res == 0; l++)
+			res = run_threads(ph, l, pr);
+	} else if (ph == PH_RMDIR) {
+		for (l = depth; l >= top && res == 0; l--)
+			res = run_threads(ph, l, pr);
+	} else {
+		res = run_threads(ph, 0, pr);
+	}
+	if (ph == PH_RENAME)
+		renamed = 1;
+	return res;
+}
+
+static int parse_phases(const char *arg, int *phases)
+{
+	char buf[256], *tok, *save = NULL;
+	int i;
+
+	snprintf(buf, sizeof(buf), "%s", arg);
+	memset(phases, 0x00, PH_MAX * sizeof(*phases));
+	for (tok = strtok_r(buf, ",", &save); tok;
+			tok = strtok_r(NULL, ",", &save)) {
+		for (i = PH_CREATE; i <= PH_UNLINK; i++) {
+			if (strcmp(tok, phase_names[i]) == 0)
+				break;
+		}
+		if (i > PH_UNLINK) {
+			fprintf(stderr, "Unknown phase %s\n", tok);
+			return -1;
+		}
+		phases[i] = 1;
+	}
+	if (phases[PH_CREATE] == phases[PH_WRITE]) {
+		fprintf(stderr, "Phases must include either create or write\n");
+		return -1;
+	}
 	return 0;
 }
+
+static double ops_per_sec(const struct phase_result *pr)
+{
+	return pr->seconds > 0.0 ? pr->ops / pr->seconds : 0.0;
+}
+
+static double mb_per_sec(const struct phase_result *pr)
+{
+	return pr->seconds > 0.0 ? pr->bytes / 1048576.0 / pr->seconds : 0.0;
+}
+
+static void print_results(const struct run *r)
+{
+	const struct phase_result *pr;
+	int i;
+
+	printf("%-8s %10s %7s %9s %11s %9s %9s %9s %9s %9s\n", "Phase", "Ops",
+			"Errors", "Seconds", "Ops/s", "p50 us", "p90 us",
+			"p99 us", "p999 us", "max us");
+	for (i = 0; i < PH_MAX; i++) {
+		pr = &r->results[i];
+		if (!pr->run)
+			continue;
+		printf("%-8s %10llu %7llu %9.3f %11.1f %9.1f %9.1f %9.1f %9.1f %9.1f\n",
+				phase_names[i], (unsigned long long)pr->ops,
+				(unsigned long long)pr->errors, pr->seconds,
+				ops_per_sec(pr),
+				lat_percentile(&pr->lat, 0.50) / 1e3,
+				lat_percentile(&pr->lat, 0.90) / 1e3,
+				lat_percentile(&pr->lat, 0.99) / 1e3,
+				lat_percentile(&pr->lat, 0.999) / 1e3,
+				pr->lat.max_ns / 1e3);
+	}
+	pr = &r->results[PH_WRITE];
+	if (pr->run)
+		printf("Wrote %.1f MB, %.1f MB/s\n", pr->bytes / 1048576.0,
+				mb_per_sec(pr));
+}
+
+/**
+ * print_scaling() - Show how every phase scales with the number of threads
+ *
+ * Speedup is relative to the first run of the same write mode, efficiency
+ * is the speedup divided by the increase in threads. The thread count with
+ * the highest rate is where contention stops further scaling.
+ *
+ * @first	: First run of the write mode
+ */
+static void print_scaling(const struct run *first)
+{
+	const struct phase_result *pr, *base;
+	double rate, speedup, best;
+	int i, k, peak;
+
+	printf("\nScaling (%s directories%s", private_dirs ? "private" : "shared",
+			pin_cpus ? ", pinned threads" : "");
+	if (first->results[PH_WRITE].run)
+		printf(", write mode %s", first->wm->name);
+	if (nmethods > 1)
+		printf(", %s", method_names[first->method]);
+	printf(") :\n%-8s %8s %11s %8s %10s\n", "Phase", "Threads", "Ops/s",
+			"Speedup", "Efficiency");
+	for (i = PH_CREATE; i <= PH_UNLINK; i++) {
+		base = &first->results[i];
+		if (!base->run || ops_per_sec(base) <= 0.0)
+			continue;
+		best = 0.0;
+		peak = 0;
+		for (k = 0; k < nthread_counts; k++) {
+			pr = &first[k].results[i];
+			rate = ops_per_sec(pr);
+			speedup = rate / ops_per_sec(base);
+			printf("%-8s %8u %11.1f %7.2fx %9.0f%%\n", phase_names[i],
+					first[k].threads, rate, speedup, 100.0 *
+					speedup * first->threads / first[k].threads);
+			if (rate > best) {
+				best = rate;
+				peak = k;
+			}
+		}
+		printf("%-8s peaks at %u threads\n", phase_names[i],
+				first[peak].threads);
+	}
+}
+
+// Compare the write phase of all runs
+static void print_modes(void)
+{
+	const struct phase_result *pr;
+	int k;
+
+	printf("\nWrite modes (sizes %s) :\n", size_spec);
+	printf("%-24s %8s %11s %9s %9s %9s %9s\n", "Mode", "Threads",
+			"Files/s", "MB/s", "p50 us", "p99 us", "p999 us");
+	for (k = 0; k < nruns; k++) {
+		pr = &runs[k].results[PH_WRITE];
+		printf("%-24s %8u %11.1f %9.1f %9.1f %9.1f %9.1f\n",
+				runs[k].wm->name, runs[k].threads,
+				ops_per_sec(pr), mb_per_sec(pr),
+				lat_percentile(&pr->lat, 0.50) / 1e3,
+				lat_percentile(&pr->lat, 0.99) / 1e3,
+				lat_percentile(&pr->lat, 0.999) / 1e3);
+	}
+}
+
+/**
+ * print_methods() - Compare the methods of issuing metadata operations
+ *
+ * Speedup is relative to the same run with the first method.
+ */
+static void print_methods(void)
+{
+	const struct phase_result *pr, *base;
+	int i, k;
+
+	printf("\nMethods :\n%-8s %-8s %8s %11s %8s %9s %9s %9s\n", "Phase",
+			"Method", "Threads", "Ops/s", "Speedup", "p50 us",
+			"p99 us", "p999 us");
+	for (i = PH_CREATE; i <= PH_UNLINK; i++) {
+		if (!uring_phase(i) || !runs[0].results[i].run)
+			continue;
+		for (k = 0; k < nruns; k++) {
+			pr = &runs[k].results[i];
+			base = &runs[k].base->results[i];
+			printf("%-8s %-8s %8u %11.1f %7.2fx %9.1f %9.1f %9.1f\n",
+					phase_names[i], method_names[runs[k].method],
+					runs[k].threads, ops_per_sec(pr),
+					ops_per_sec(base) > 0.0 ?
+					ops_per_sec(pr) / ops_per_sec(base) : 0.0,
+					lat_percentile(&pr->lat, 0.50) / 1e3,
+					lat_percentile(&pr->lat, 0.99) / 1e3,
+					lat_percentile(&pr->lat, 0.999) / 1e3);
+		}
+	}
+}
+
+static void json_phases(FILE *out, const struct run *r)
+{
+	const struct phase_result *pr;
+	int i, first = 1;
+
+	for (i = 0; i < PH_MAX; i++) {
+		pr = &r->results[i];
+		if (!pr->run)
+			continue;
+		fprintf(out, "%s        { \"name\": \"%s\", \"ops\": %llu, \"errors\": %llu, "
+				"\"seconds\": %.6f, \"ops_per_sec\": %.1f,",
+				first ? "" : ",\n", phase_names[i],
+				(unsigned long long)pr->ops,
+				(unsigned long long)pr->errors, pr->seconds,
+				ops_per_sec(pr));
+		if (i == PH_READDIR)
+			fprintf(out, " \"entries\": %llu,",
+					(unsigned long long)pr->entries);
+		if (i == PH_WRITE)
+			fprintf(out, " \"bytes\": %llu, \"mb_per_sec\": %.1f,",
+					(unsigned long long)pr->bytes,
+					mb_per_sec(pr));
+		fprintf(out, "\n          \"latency_us\": { \"p50\": %.2f, \"p90\": %.2f, "
+				"\"p99\": %.2f, \"p999\": %.2f, \"max\": %.2f } }",
+				lat_percentile(&pr->lat, 0.50) / 1e3,
+				lat_percentile(&pr->lat, 0.90) / 1e3,
+				lat_percentile(&pr->lat, 0.99) / 1e3,
+				lat_percentile(&pr->lat, 0.999) / 1e3,
+				pr->lat.max_ns / 1e3);
+		first = 0;
+	}
+}
+
+static int write_json(const char *file, const int *phases)
+{
+	FILE *out;
+	int k;
+
+	if (strcmp(file, "-") == 0)
+		out = stdout;
+	else
+		out = fopen(file, "w");
+	if (!out) {
+		perror("Error creating JSON file");
+		return -1;
+	}
+
+	fprintf(out, "{\n  \"files\": %lu,\n  \"fanout\": %u,\n  \"depth\": %u,\n",
+			nfiles, fanout, depth);
+	fprintf(out, "  \"directories\": \"%s\",\n  \"pinned\": %s,\n",
+			private_dirs ? "private" : "shared",
+			pin_cpus ? "true" : "false");
+	if (phases[PH_WRITE])
+		fprintf(out, "  \"file_sizes\": \"%s\",\n", size_spec);
+	fprintf(out, "  \"uring_batch\": %u,\n  \"uring_depth\": %u,\n",
+			uring_batch, uring_depth);
+	fprintf(out, "  \"runs\": [\n");
+	for (k = 0; k < nruns; k++) {
+		fprintf(out, "    {\n      \"threads\": %u,\n", runs[k].threads);
+		fprintf(out, "      \"method\": \"%s\",\n",
+				method_names[runs[k].method]);
+		if (phases[PH_WRITE])
+			fprintf(out, "      \"write_mode\": \"%s\",\n",
+					runs[k].wm->name);
+		fprintf(out, "      \"directory\": \"%s\",\n      \"phases\": [\n",
+				runs[k].dir);
+		json_phases(out, &runs[k]);
+		fprintf(out, "\n      ]\n    }%s\n", k + 1 < nruns ? "," : "");
+	}
+	fprintf(out, "  ]\n}\n");
+
+	if (out != stdout && fclose(out) != 0) {
+		perror("Error writing JSON file");
+		return -1;
+	}
+	return 0;
+}
+
+static int parse_methods(const char *arg)
+{
+	char buf[256], *tok, *save = NULL;
+	int i;
+
+	snprintf(buf, sizeof(buf), "%s", arg);
+	nmethods = 0;
+	for (tok = strtok_r(buf, ",", &save); tok;
+			tok = strtok_r(NULL, ",", &save)) {
+		for (i = 0; i < M_MAX; i++) {
+			if (strcmp(tok, method_names[i]) == 0)
+				break;
+		}
+		if (i == M_MAX || nmethods == M_MAX) {
+			fprintf(stderr, "Unknown method %s\n", tok);
+			return -1;
+		}
+		methods[nmethods++] = i;
+	}
+	return nmethods ? 0 : -1;
+}
+
+static int parse_threads(const char *arg)
+{
+	char buf[256], *tok, *save = NULL;
+	long n;
+
+	snprintf(buf, sizeof(buf), "%s", arg);
+	nthread_counts = 0;
+	for (tok = strtok_r(buf, ",", &save); tok;
+			tok = strtok_r(NULL, ",", &save)) {
+		n = atol(tok);
+		if (n < 1 || n > MAX_THREADS) {
+			fprintf(stderr, "Number of threads must be 1 to %d\n",
+					MAX_THREADS);
+			return -1;
+		}
+		if (nthread_counts == MAX_RUNS) {
+			fprintf(stderr, "Too many thread counts\n");
+			return -1;
+		}
+		thread_counts[nthread_counts++] = n;
+	}
+	return nthread_counts ? 0 : -1;
+}
+
+/**
+ * run_benchmark() - Run all selected phases in a fresh directory
+ *
+ * Called with the -r directory as working directory and returns to it.
+ */
+static int run_benchmark(struct run *r, const char *root, const int *phases)
+{
+	char dir[64];
+	int i, failed = 0;
+	int tree = depth > 0 || private_dirs;
+
+	nthreads = r->threads;
+	wmode = r->wm;
+	method = r->method;
+	renamed = 0;
+	snprintf(dir, sizeof(dir), "createfiles.%d.%d", (int)getpid(),
+			(int)(r - runs));
+	snprintf(r->dir, sizeof(r->dir), "%s/%s", root, dir);
+	if (mkdir(dir, 0755) < 0 || chdir(dir) < 0) {
+		perror("Error creating run directory");
+		return -1;
+	}
+	printf("\nRunning in %s : %lu files, %llu directories%s, %u threads",
+			r->dir, nfiles, (unsigned long long)leaves,
+			private_dirs ? " per thread" : "", nthreads);
+	if (phases[PH_WRITE])
+		printf(", write mode %s", r->wm->name);
+	if (method == M_URING)
+		printf(", uring batch %u depth %u", uring_batch, uring_depth);
+	else if (method == M_STDIO)
+		printf(", stdio");
+	printf("\n");
+
+	if (tree && run_phase(r, PH_MKDIR) < 0)
+		failed = 1;
+	for (i = PH_CREATE; i <= PH_UNLINK && !failed; i++) {
+		if (!phases[i])
+			continue;
+		if (run_phase(r, i) < 0 && (i == PH_CREATE || i == PH_WRITE))
+			failed = 1;
+	}
+	if (!failed && phases[PH_UNLINK] && tree)
+		run_phase(r, PH_RMDIR);
+
+	if (chdir("..") < 0) {
+		perror("Error leaving run directory");
+		return -1;
+	}
+	if (!failed && phases[PH_UNLINK])
+		rmdir(dir);
+
+	print_results(r);
+	return failed ? -1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int phases[PH_MAX];
+	const char *root = ".";
+	const char *json = NULL;
+	int opt, k, m, a, t, failed = 0;
+	struct uring u;
+
+	parse_phases("create,stat,open,rename,readdir,unlink", phases);
+	parse_threads("1");
+	parse_modes("none");
+	parse_methods("syscall");
+
+	while ((opt = getopt(argc, argv, "n:f:d:t:m:cp:s:w:a:B:Q:r:j:")) != -1) {
+		switch (opt) {
+		case 'n':
+			nfiles = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			fanout = atoi(optarg);
+			break;
+		case 'd':
+			depth = atoi(optarg);
+			break;
+		case 't':
+			if (parse_threads(optarg) < 0)
+				return 1;
+			break;
+		case 'm':
+			if (strcmp(optarg, "shared") == 0) {
+				private_dirs = 0;
+			} else if (strcmp(optarg, "private") == 0) {
+				private_dirs = 1;
+			} else {
+				fprintf(stderr, "Unknown directory mode %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'c':
+			pin_cpus = 1;
+			break;
+		case 'p':
+			if (parse_phases(optarg, phases) < 0)
+				return 1;
+			break;
+		case 's':
+			if (parse_sizes(optarg) < 0)
+				return 1;
+			break;
+		case 'w':
+			if (parse_modes(optarg) < 0)
+				return 1;
+			break;
+		case 'a':
+			if (parse_methods(optarg) < 0)
+				return 1;
+			break;
+		case 'B':
+			uring_batch = atoi(optarg);
+			break;
+		case 'Q':
+			uring_depth = atoi(optarg);
+			break;
+		case 'r':
+			root = optarg;
+			break;
+		case 'j':
+			json = optarg;
+			break;
+		default:
+			usage();
+			return 1;
+		}
+	}
+
+	if (fanout > 0 && depth == 0)
+		depth = 1;
+	if (fanout == 0)
+		depth = 0;
+	if (depth > MAX_DEPTH || (fanout > 100 && depth > 0)) {
+		fprintf(stderr, "Directory tree too large\n");
+		return 1;
+	}
+	leaves = level_dirs(depth);
+
+	// Write modes only matter to the write phase
+	if (!phases[PH_WRITE])
+		nwmodes = 1;
+	if (nwmodes * nmethods * nthread_counts > MAX_RUNS) {
+		fprintf(stderr, "Too many runs, at most %d\n", MAX_RUNS);
+		return 1;
+	}
+	nruns = 0;
+	for (m = 0; m < nwmodes; m++) {
+		for (a = 0; a < nmethods; a++) {
+			for (t = 0; t < nthread_counts; t++) {
+				runs[nruns].threads = thread_counts[t];
+				runs[nruns].wm = &wmodes[m];
+				runs[nruns].method = methods[a];
+				runs[nruns].base = &runs[nruns - a * nthread_counts];
+				nruns++;
+			}
+		}
+	}
+
+	if (uring_batch < 1 || uring_depth < 1 || uring_depth > 4096) {
+		fprintf(stderr, "Invalid io_uring batch or depth\n");
+		return 1;
+	}
+	for (a = 0; a < nmethods; a++) {
+		if (methods[a] != M_URING)
+			continue;
+		if (uring_setup(&u, uring_depth) < 0) {
+			perror("io_uring with direct descriptors not available");
+			return 1;
+		}
+		uring_exit(&u);
+	}
+
+	if (chdir(root) < 0) {
+		perror("Error changing to run directory");
+		return 1;
+	}
+	for (k = 0; k < nruns && !failed; k++) {
+		if (run_benchmark(&runs[k], root, phases) < 0)
+			failed = 1;
+	}
+	nruns = k;
+
+	if (nthread_counts > 1) {
+		for (k = 0; k + nthread_counts <= nruns; k += nthread_counts)
+			print_scaling(&runs[k]);
+	}
+	if (phases[PH_WRITE] && nwmodes > 1)
+		print_modes();
+	if (nmethods > 1)
+		print_methods();
+	if (json && write_json(json, phases) < 0)
+		return 1;
+	return failed ? 1 : 0;
+}